@@ -0,0 +1,54 @@
+-- Benchmark: re-planned vs. prepared catalog queries
+--
+-- pg_ai_schema_version() runs on every request. It issues a catalog query
+-- to locate the extension's fingerprint table and, unless the session
+-- already computed the version, a query reading the fingerprints. This
+-- script times those queries sent as fresh SQL text (parsed and planned on
+-- every call, as the extension used to do) against pg_ai_schema_version()
+-- itself, which executes plans prepared once per backend.
+--
+-- Usage (on a database with the extension installed):
+--   psql -d scratch -f bench/catalog_plan_cache.sql
+
+\set ON_ERROR_STOP on
+\set iterations 20000
+
+SELECT set_config('pg_ai_bench.iterations', :'iterations', false);
+
+-- Before: the same queries, planned on every call.
+DO $$
+DECLARE
+    iterations int := current_setting('pg_ai_bench.iterations')::int;
+    started timestamptz := clock_timestamp();
+    fingerprint_table text;
+    version bigint;
+BEGIN
+    FOR i IN 1..iterations LOOP
+        EXECUTE $q$
+            SELECT pg_catalog.format('%I.pg_ai_schema_fingerprints', n.nspname)
+            FROM pg_catalog.pg_extension e
+            JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace
+            WHERE e.extname = 'pg_ai_query'
+              AND pg_catalog.to_regclass(
+                    pg_catalog.format('%I.pg_ai_schema_fingerprints', n.nspname)) IS NOT NULL
+        $q$ INTO fingerprint_table;
+        EXECUTE 'SELECT count(fingerprint) FROM ' || fingerprint_table INTO version;
+    END LOOP;
+    RAISE NOTICE 'planned per call: % us per call',
+        round(extract(epoch FROM clock_timestamp() - started) * 1000000 / iterations, 2);
+END
+$$;
+
+-- After: prepared plans kept for the backend lifetime.
+DO $$
+DECLARE
+    iterations int := current_setting('pg_ai_bench.iterations')::int;
+    started timestamptz := clock_timestamp();
+BEGIN
+    FOR i IN 1..iterations LOOP
+        PERFORM pg_ai_schema_version();
+    END LOOP;
+    RAISE NOTICE 'prepared: % us per call',
+        round(extract(epoch FROM clock_timestamp() - started) * 1000000 / iterations, 2);
+END
+$$;
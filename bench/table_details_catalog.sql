@@ -0,0 +1,141 @@
+-- Benchmark: information_schema column discovery vs. get_table_details()
+--
+-- Builds a synthetic catalog of 10,000 tables (each with a primary key, a
+-- two-column foreign key, a default and a secondary index), then times the
+-- information_schema query get_table_details() used to run against the
+-- native catalog path it uses now.
+--
+-- Usage (on a scratch database with the extension installed):
+--   psql -d scratch -f bench/table_details_catalog.sql
+--
+-- Set cache_enabled = false in the [schema] section of ~/.pg_ai.config (or
+-- run without shared_preload_libraries) to time the uncached native path;
+-- otherwise every call after the first is served from the schema cache.
+
+\set ON_ERROR_STOP on
+\set tables 10000
+\set iterations 200
+
+SELECT set_config('pg_ai_bench.tables', :'tables', false),
+       set_config('pg_ai_bench.iterations', :'iterations', false);
+
+-- DDL commits in batches to stay within max_locks_per_transaction.
+CREATE OR REPLACE PROCEDURE pg_temp.pg_ai_bench_drop()
+LANGUAGE plpgsql AS $$
+DECLARE
+    rel record;
+    dropped int := 0;
+BEGIN
+    FOR rel IN SELECT c.oid::regclass AS name FROM pg_class c
+               JOIN pg_namespace n ON n.oid = c.relnamespace
+               WHERE n.nspname = 'pg_ai_bench' AND c.relkind = 'r'
+               ORDER BY c.oid DESC LOOP
+        EXECUTE format('DROP TABLE %s CASCADE', rel.name);
+        dropped := dropped + 1;
+        IF dropped % 500 = 0 THEN
+            COMMIT;
+        END IF;
+    END LOOP;
+    COMMIT;
+    DROP SCHEMA IF EXISTS pg_ai_bench CASCADE;
+END
+$$;
+
+CALL pg_temp.pg_ai_bench_drop();
+CREATE SCHEMA pg_ai_bench;
+
+DO $$
+DECLARE
+    n int := current_setting('pg_ai_bench.tables')::int;
+BEGIN
+    FOR i IN 1..n LOOP
+        EXECUTE format(
+            'CREATE TABLE pg_ai_bench.t%s (
+                 id int NOT NULL,
+                 region int NOT NULL,
+                 parent_id int,
+                 parent_region int,
+                 name text NOT NULL,
+                 created_at timestamptz DEFAULT now(),
+                 PRIMARY KEY (id, region))', i);
+        EXECUTE format('CREATE INDEX ON pg_ai_bench.t%s (created_at)', i);
+        IF i > 1 THEN
+            EXECUTE format(
+                'ALTER TABLE pg_ai_bench.t%s ADD FOREIGN KEY (parent_id, parent_region)
+                     REFERENCES pg_ai_bench.t%s (id, region)', i, i - 1);
+        END IF;
+        IF i % 500 = 0 THEN
+            COMMIT;
+        END IF;
+    END LOOP;
+END
+$$;
+
+ANALYZE;
+
+-- Before: the information_schema joins previously issued by
+-- get_table_details() (two queries per call).
+DO $$
+DECLARE
+    n int := current_setting('pg_ai_bench.tables')::int;
+    iterations int := current_setting('pg_ai_bench.iterations')::int;
+    started timestamptz := clock_timestamp();
+    target text;
+BEGIN
+    FOR i IN 1..iterations LOOP
+        target := 't' || (1 + (i * 7919) % n);
+        PERFORM c.column_name, c.data_type, c.is_nullable, c.column_default,
+                pk.column_name IS NOT NULL, fk.column_name IS NOT NULL,
+                fk.foreign_table_name, fk.foreign_column_name
+        FROM information_schema.columns c
+        LEFT JOIN (
+            SELECT kcu.column_name, kcu.table_name, kcu.table_schema
+            FROM information_schema.table_constraints tc
+            JOIN information_schema.key_column_usage kcu
+                ON tc.constraint_name = kcu.constraint_name
+                AND tc.table_schema = kcu.table_schema
+            WHERE tc.constraint_type = 'PRIMARY KEY'
+        ) pk ON c.column_name = pk.column_name
+            AND c.table_name = pk.table_name
+            AND c.table_schema = pk.table_schema
+        LEFT JOIN (
+            SELECT kcu.column_name, kcu.table_name, kcu.table_schema,
+                   ccu.table_name AS foreign_table_name,
+                   ccu.column_name AS foreign_column_name
+            FROM information_schema.table_constraints tc
+            JOIN information_schema.key_column_usage kcu
+                ON tc.constraint_name = kcu.constraint_name
+                AND tc.table_schema = kcu.table_schema
+            JOIN information_schema.constraint_column_usage ccu
+                ON ccu.constraint_name = tc.constraint_name
+                AND ccu.table_schema = tc.table_schema
+            WHERE tc.constraint_type = 'FOREIGN KEY'
+        ) fk ON c.column_name = fk.column_name
+            AND c.table_name = fk.table_name
+            AND c.table_schema = fk.table_schema
+        WHERE c.table_name = target AND c.table_schema = 'pg_ai_bench';
+
+        PERFORM indexname, indexdef FROM pg_indexes
+        WHERE tablename = target AND schemaname = 'pg_ai_bench';
+    END LOOP;
+    RAISE NOTICE 'information_schema: % ms per table',
+        round(extract(epoch FROM clock_timestamp() - started) * 1000 / iterations, 3);
+END
+$$;
+
+-- After: native catalog path.
+DO $$
+DECLARE
+    n int := current_setting('pg_ai_bench.tables')::int;
+    iterations int := current_setting('pg_ai_bench.iterations')::int;
+    started timestamptz := clock_timestamp();
+BEGIN
+    FOR i IN 1..iterations LOOP
+        PERFORM get_table_details('t' || (1 + (i * 7919) % n), 'pg_ai_bench');
+    END LOOP;
+    RAISE NOTICE 'get_table_details: % ms per table',
+        round(extract(epoch FROM clock_timestamp() - started) * 1000 / iterations, 3);
+END
+$$;
+
+CALL pg_temp.pg_ai_bench_drop();
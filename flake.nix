@@ -58,6 +58,7 @@
 
             # Install SQL and control files
             cp ${./sql/pg_ai_query--1.0.sql} $out/share/extension/
+            cp ${./sql/pg_ai_query--1.0--1.1.sql} $out/share/extension/
             cp ${./pg_ai_query.control} $out/share/extension/
           '';
 
@@ -0,0 +1,358 @@
+-- Upgrade pg_ai_query from 1.0 to 1.1
+
+\echo Use "ALTER EXTENSION pg_ai_query UPDATE TO '1.1'" to load this file. \quit
+
+-- generate_query gains use_cache; the old signature would otherwise remain as
+-- an ambiguous overload
+DROP FUNCTION generate_query(text, text, text);
+
+CREATE OR REPLACE FUNCTION generate_query(
+    natural_language_query text,
+    api_key text DEFAULT NULL,
+    provider text DEFAULT 'auto',
+    use_cache boolean DEFAULT true
+)
+RETURNS text
+AS 'MODULE_PATHNAME', 'generate_query'
+LANGUAGE C;
+
+-- Example usage:
+-- SELECT generate_query('Show me all users created in the last 7 days');
+-- SELECT generate_query('Count orders by status');
+-- SELECT generate_query('Show me all users', 'your-api-key-here');
+-- SELECT generate_query('Show me all users', 'your-api-key-here', 'openai');
+-- SELECT generate_query('Show me all users', 'your-api-key-here', 'anthropic');
+-- SELECT generate_query('Count orders by status', use_cache => false);
+
+COMMENT ON FUNCTION generate_query(text, text, text, boolean) IS
+'Generate a PostgreSQL SELECT query from natural language description with automatic database schema discovery. Provider options: openai, anthropic, auto (default). Pass API key as parameter or configure ~/.pg_ai.config. Repeated requests are served from the shared result cache unless use_cache is false.';
+
+-- Stream the model response; the query is raised as a NOTICE as soon as it is complete
+CREATE OR REPLACE FUNCTION generate_query_stream(
+    natural_language_query text,
+    api_key text DEFAULT NULL,
+    provider text DEFAULT 'auto',
+    stop_after_sql boolean DEFAULT false
+)
+RETURNS TABLE (
+    seq integer,
+    kind text,
+    content text
+)
+AS 'MODULE_PATHNAME', 'generate_query_stream'
+LANGUAGE C;
+
+-- Example usage:
+-- SELECT * FROM generate_query_stream('Count orders by status');
+-- SELECT content FROM generate_query_stream('Count orders by status', stop_after_sql => true) WHERE kind = 'sql';
+
+COMMENT ON FUNCTION generate_query_stream(text, text, text, boolean) IS
+'Like generate_query, but streams the response. Returns text chunks in arrival order, the sql field as soon as it is complete (also sent as a NOTICE), and the final formatted result. With stop_after_sql the rest of the response is not read.';
+
+-- Translate many requests at once, with bounded concurrent provider calls
+CREATE OR REPLACE FUNCTION generate_queries(
+    natural_language_queries text[],
+    api_key text DEFAULT NULL,
+    provider text DEFAULT 'auto',
+    use_cache boolean DEFAULT true
+)
+RETURNS TABLE (
+    idx integer,
+    natural_language_query text,
+    generated_query text,
+    error text
+)
+AS 'MODULE_PATHNAME', 'generate_queries'
+LANGUAGE C;
+
+-- Example usage:
+-- SELECT * FROM generate_queries(ARRAY['Count orders by status', 'Top 10 customers by revenue']);
+-- SELECT q.id, g.generated_query, g.error
+--   FROM generate_queries((SELECT array_agg(description ORDER BY id) FROM saved_reports)) g
+--   JOIN (SELECT id, row_number() OVER (ORDER BY id) AS idx FROM saved_reports) q USING (idx);
+
+COMMENT ON FUNCTION generate_queries(text[], text, text, boolean) IS
+'Like generate_query for every element of an array. The schema is read once for the batch and up to batch_concurrency provider calls run at a time. Returns one row per element in input order; failures are reported in the error column without aborting the batch.';
+
+-- Get detailed information about several tables in one catalog pass
+CREATE OR REPLACE FUNCTION get_tables_details(
+    table_names text[]
+)
+RETURNS text
+AS 'MODULE_PATHNAME', 'get_tables_details'
+LANGUAGE C;
+
+-- Example usage:
+-- SELECT get_tables_details(ARRAY['users', 'sales.orders']);
+
+COMMENT ON FUNCTION get_tables_details(text[]) IS
+'Returns a JSON array with the details of several tables (schema-qualified or in public), fetched in a single catalog pass.';
+
+-- explain_query gains mode
+DROP FUNCTION explain_query(text, text, text);
+
+-- Explain query function: Runs EXPLAIN and provides AI-generated explanation.
+-- mode: 'plan' (query not run), 'analyze' (run, then rolled back) or
+-- 'bounded' (analyze, falling back to the plan after [explain] timeout_ms)
+CREATE OR REPLACE FUNCTION explain_query(
+    query_text text,
+    api_key text DEFAULT NULL,
+    provider text DEFAULT 'auto',
+    mode text DEFAULT 'analyze'
+)
+RETURNS text
+AS 'MODULE_PATHNAME', 'explain_query'
+LANGUAGE C
+VOLATILE
+SECURITY DEFINER;
+
+-- Example usage:
+-- SELECT explain_query('SELECT * FROM users WHERE created_at > NOW() - INTERVAL ''7 days''');
+-- SELECT explain_query('SELECT u.name, COUNT(o.id) FROM users u LEFT JOIN orders o ON u.id = o.user_id GROUP BY u.id', 'your-api-key-here');
+-- SELECT explain_query('SELECT * FROM products ORDER BY price DESC LIMIT 10', 'your-api-key-here', 'openai');
+-- SELECT explain_query('SELECT * FROM big_report', mode => 'plan');
+
+COMMENT ON FUNCTION explain_query(text, text, text, text) IS
+'Runs EXPLAIN on a query and returns an AI-generated explanation of the execution plan, performance insights, and optimization suggestions. Modes: plan (estimates only, the query is not run), analyze (default; runs the query and rolls it back), bounded (analyze limited to [explain] timeout_ms, else plan). Provider options: openai, anthropic, auto (default). Pass API key as parameter or configure ~/.pg_ai.config.';
+
+
+-- Rule-based plan analysis: runs EXPLAIN like explain_query() and reports
+-- known problems without calling an AI provider
+CREATE OR REPLACE FUNCTION analyze_plan(
+    query_text text,
+    mode text DEFAULT 'analyze'
+)
+RETURNS TABLE (
+    severity text,
+    rule text,
+    node_path text,
+    node_type text,
+    relation text,
+    message text
+)
+AS 'MODULE_PATHNAME', 'analyze_plan'
+LANGUAGE C
+VOLATILE;
+
+-- Example usage:
+-- SELECT * FROM analyze_plan('SELECT * FROM orders WHERE status = ''late''');
+-- SELECT * FROM analyze_plan('SELECT * FROM monthly_report', 'bounded');
+
+COMMENT ON FUNCTION analyze_plan(text, text) IS
+'Runs EXPLAIN on a query (modes as in explain_query: plan, analyze, bounded; always rolled back) and returns the problems found by rule-based checks: large sequential scans, row misestimates, disk spills, nested loops over large inner sides and index-only scans that visit the heap. Findings are ordered by severity (critical, warning, info). No AI provider is needed.';
+
+
+-- Schema fingerprints: one hash per user relation, maintained by the event
+-- triggers below. The schema version is the XOR of all fingerprints; there is
+-- no shared version row, so concurrent DDL does not queue on one row lock.
+CREATE TABLE pg_ai_schema_fingerprints (
+    relid oid PRIMARY KEY,
+    fingerprint bigint NOT NULL
+);
+
+GRANT SELECT ON pg_ai_schema_fingerprints TO PUBLIC;
+
+CREATE OR REPLACE FUNCTION pg_ai_schema_version()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'pg_ai_schema_version'
+LANGUAGE C
+STABLE;
+
+CREATE OR REPLACE FUNCTION pg_ai_schema_refresh()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'pg_ai_schema_refresh'
+LANGUAGE C
+VOLATILE;
+
+REVOKE EXECUTE ON FUNCTION pg_ai_schema_refresh() FROM PUBLIC;
+
+CREATE OR REPLACE FUNCTION pg_ai_relation_fingerprint(relation regclass)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'pg_ai_relation_fingerprint'
+LANGUAGE C
+STABLE
+STRICT;
+
+-- Run as the extension owner so DDL by any role can update the state tables.
+CREATE OR REPLACE FUNCTION pg_ai_schema_ddl_command_end()
+RETURNS event_trigger
+AS 'MODULE_PATHNAME', 'pg_ai_schema_ddl_command_end'
+LANGUAGE C
+SECURITY DEFINER;
+
+CREATE OR REPLACE FUNCTION pg_ai_schema_sql_drop()
+RETURNS event_trigger
+AS 'MODULE_PATHNAME', 'pg_ai_schema_sql_drop'
+LANGUAGE C
+SECURITY DEFINER;
+
+CREATE EVENT TRIGGER pg_ai_schema_ddl_command_end
+    ON ddl_command_end
+    EXECUTE FUNCTION pg_ai_schema_ddl_command_end();
+
+CREATE EVENT TRIGGER pg_ai_schema_sql_drop
+    ON sql_drop
+    EXECUTE FUNCTION pg_ai_schema_sql_drop();
+
+SELECT pg_ai_schema_refresh();
+
+-- Example usage:
+-- SELECT pg_ai_schema_version();
+-- SELECT pg_ai_relation_fingerprint('public.users');
+-- SELECT pg_ai_schema_refresh();  -- after pg_restore or disabled triggers
+
+COMMENT ON FUNCTION pg_ai_schema_version() IS
+'Returns the schema fingerprint of the database. It changes when any user table, view or index definition changes and returns to the same value when a change is reverted.';
+
+COMMENT ON FUNCTION pg_ai_schema_refresh() IS
+'Recomputes every relation fingerprint from the catalogs and returns the new schema version.';
+
+COMMENT ON FUNCTION pg_ai_relation_fingerprint(regclass) IS
+'Returns the fingerprint of one relation, or NULL if the relation is not tracked (system, temporary or non-table relations).';
+
+-- Set-returning catalog functions: rows instead of one JSON document, so
+-- results can be filtered, joined and paged with plain SQL.
+CREATE OR REPLACE FUNCTION list_tables()
+RETURNS TABLE (
+    schema_name text,
+    table_name text,
+    table_type text,
+    estimated_rows bigint
+)
+AS 'MODULE_PATHNAME', 'list_tables'
+LANGUAGE C
+STABLE;
+
+CREATE OR REPLACE FUNCTION list_table_columns(
+    table_name text,
+    schema_name text DEFAULT 'public'
+)
+RETURNS TABLE (
+    ordinal_position integer,
+    column_name text,
+    data_type text,
+    is_nullable boolean,
+    column_default text,
+    is_primary_key boolean,
+    is_foreign_key boolean,
+    foreign_table text,
+    foreign_column text
+)
+AS 'MODULE_PATHNAME', 'list_table_columns'
+LANGUAGE C
+STABLE;
+
+CREATE OR REPLACE FUNCTION list_table_indexes(
+    table_name text,
+    schema_name text DEFAULT 'public'
+)
+RETURNS TABLE (
+    index_name text,
+    is_unique boolean,
+    is_primary boolean,
+    index_definition text
+)
+AS 'MODULE_PATHNAME', 'list_table_indexes'
+LANGUAGE C
+STABLE;
+
+-- Example usage:
+-- SELECT * FROM list_tables() WHERE table_type = 'BASE TABLE' ORDER BY estimated_rows DESC LIMIT 20;
+-- SELECT column_name, data_type FROM list_table_columns('orders') WHERE is_foreign_key;
+-- SELECT t.table_name, c.column_name FROM list_tables() t, list_table_columns(t.table_name, t.schema_name) c WHERE c.column_name LIKE '%email%';
+-- SELECT * FROM list_table_indexes('users');
+
+COMMENT ON FUNCTION list_tables() IS
+'Returns one row per user table, view, materialized view and foreign table visible to the current user, read directly from pg_class. estimated_rows is pg_class.reltuples.';
+
+COMMENT ON FUNCTION list_table_columns(text, text) IS
+'Returns one row per column of a table with its type, nullability, default, and key information. Columns the current user has no privilege on are left out.';
+
+COMMENT ON FUNCTION list_table_indexes(text, text) IS
+'Returns one row per index of a table with its uniqueness and definition. Returns no rows for tables the current user cannot see.';
+
+CREATE OR REPLACE FUNCTION pg_ai_backend_stats()
+RETURNS TABLE (
+    stat text,
+    value bigint
+)
+AS 'MODULE_PATHNAME', 'pg_ai_backend_stats'
+LANGUAGE C
+VOLATILE;
+
+-- Example usage:
+-- SELECT * FROM pg_ai_backend_stats();
+
+COMMENT ON FUNCTION pg_ai_backend_stats() IS
+'Returns counters of the current backend, such as reuse of pooled AI clients.';
+
+-- Shared cache of generated queries
+CREATE OR REPLACE FUNCTION pg_ai_cache_stats()
+RETURNS TABLE (
+    stat text,
+    value bigint
+)
+AS 'MODULE_PATHNAME', 'pg_ai_cache_stats'
+LANGUAGE C
+VOLATILE;
+
+CREATE OR REPLACE FUNCTION pg_ai_cache_reset()
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'pg_ai_cache_reset'
+LANGUAGE C
+VOLATILE;
+
+-- Only superusers and roles granted it may empty the cache for everyone
+REVOKE ALL ON FUNCTION pg_ai_cache_reset() FROM PUBLIC;
+
+-- Example usage:
+-- SELECT * FROM pg_ai_cache_stats();
+-- SELECT pg_ai_cache_reset();
+
+COMMENT ON FUNCTION pg_ai_cache_stats() IS
+'Returns hits, misses, evictions, entries and bytes of the shared result cache.';
+
+COMMENT ON FUNCTION pg_ai_cache_reset() IS
+'Removes every entry of the shared result cache and zeroes its counters. Returns the number of entries removed.';
+
+-- Prompt token counts
+CREATE OR REPLACE FUNCTION pg_ai_estimate_tokens(
+    input_text text,
+    model text DEFAULT NULL
+)
+RETURNS integer
+AS 'MODULE_PATHNAME', 'pg_ai_estimate_tokens'
+LANGUAGE C
+STABLE
+CALLED ON NULL INPUT;
+
+-- Example usage:
+-- SELECT pg_ai_estimate_tokens('show me all users');
+-- SELECT pg_ai_estimate_tokens(pg_read_file('schema.sql'), 'gpt-4o');
+
+COMMENT ON FUNCTION pg_ai_estimate_tokens(text, text) IS
+'Counts the tokens of a text for a model (the default model when NULL): exact for OpenAI models whose tokenizer vocabulary is installed, an estimate of about four characters per token otherwise.';
+
+-- Provider rate limits shared by all sessions
+CREATE OR REPLACE FUNCTION pg_ai_rate_limits()
+RETURNS TABLE (
+    bucket text,
+    requests_per_minute bigint,
+    tokens_per_minute bigint,
+    requests_available double precision,
+    tokens_available double precision,
+    blocked_ms bigint,
+    admitted bigint,
+    waited bigint,
+    rejected bigint,
+    throttled bigint
+)
+AS 'MODULE_PATHNAME', 'pg_ai_rate_limits'
+LANGUAGE C
+VOLATILE;
+
+-- Example usage:
+-- SELECT * FROM pg_ai_rate_limits();
+
+COMMENT ON FUNCTION pg_ai_rate_limits() IS
+'Returns the rate limit bucket of each provider and API key: its limits, the requests and tokens it could admit now (negative while in debt), how long a 429 answer still blocks it, and counts of admitted, waiting, refused and throttled calls.';
@@ -11,6 +11,68 @@
 
 namespace pg_ai::config {
 
+namespace {
+
+ModelConfig* findModel(ProviderConfig& provider, const std::string& name) {
+  for (auto& model : provider.available_models) {
+    if (model.name == name)
+      return &model;
+  }
+  return nullptr;
+}
+
+// Options shared by the [openai] and [anthropic] sections.
+void setProviderOption(ProviderConfig& provider,
+                       const std::string& key,
+                       const std::string& value) {
+  if (key == "api_key") {
+    provider.api_key = value;
+  } else if (key == "base_url") {
+    provider.base_url = value;
+    while (!provider.base_url.empty() && provider.base_url.back() == '/')
+      provider.base_url.pop_back();
+  } else if (key == "models") {
+    // The models the endpoint serves replace the built-in list; settings
+    // of known models are kept.
+    std::vector<ModelConfig> models;
+    std::istringstream names(value);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      name.erase(0, name.find_first_not_of(" \t"));
+      name.erase(name.find_last_not_of(" \t") + 1);
+      if (name.empty())
+        continue;
+      ModelConfig model;
+      if (const ModelConfig* known = findModel(provider, name))
+        model = *known;
+      model.name = name;
+      models.push_back(model);
+    }
+    if (models.empty())
+      return;
+    provider.available_models = std::move(models);
+    if (!findModel(provider, provider.default_model.name))
+      provider.default_model = provider.available_models.front();
+  } else if (key == "default_model") {
+    // Models outside the list (e.g. served by a local endpoint) are added
+    // with default settings.
+    if (!findModel(provider, value)) {
+      ModelConfig model;
+      model.name = value;
+      provider.available_models.push_back(model);
+    }
+    provider.default_model = *findModel(provider, value);
+  } else if (key == "fast_model") {
+    provider.fast_model = value;
+  } else if (key == "requests_per_minute") {
+    provider.requests_per_minute = std::stoi(value);
+  } else if (key == "tokens_per_minute") {
+    provider.tokens_per_minute = std::stoi(value);
+  }
+}
+
+}  // namespace
+
 Configuration ConfigManager::config_;
 bool ConfigManager::config_loaded_ = false;
 
@@ -20,6 +82,7 @@ Configuration::Configuration() {
   enable_logging = false;      // Default: disable logging
   request_timeout_ms = 30000;  // 30 seconds
   max_retries = 3;
+  batch_concurrency = 4;
 
   // Query generation defaults
   enforce_limit = true;
@@ -31,6 +94,51 @@ Configuration::Configuration() {
   show_suggested_visualization = false;
   use_formatted_response = false;
 
+  // Schema cache defaults
+  schema_cache_enabled = true;
+  schema_cache_size_mb = 64;
+  schema_cache_max_entries = 16384;
+  schema_column_stats = false;
+  schema_column_stats_max_chars = 1500;
+  schema_column_stats_mcv_count = 3;
+  schema_context_token_budget = 2000;
+  schema_context_max_detailed_tables = 5;
+  schema_prewarm_interval_ms = 5000;
+
+  // Result cache defaults
+  result_cache_enabled = true;
+  result_cache_size_mb = 16;
+  result_cache_max_entries = 4096;
+  result_cache_ttl_seconds = 3600;
+  result_cache_similar_enabled = false;
+  result_cache_similarity_threshold = 0.8;
+
+  // Hedging defaults
+  hedging_enabled = false;
+  hedging_percentile = 95.0;
+  hedging_delay_ms = 5000;
+  hedging_max_rate = 0.05;
+
+  // Routing defaults
+  routing_enabled = false;
+  routing_threshold = 2.0;
+
+  // Tokenizer defaults
+  tokenizer_vocab_dir = "";
+
+  // Rate limit defaults
+  rate_limit_policy = RateLimitPolicy::WAIT;
+  rate_limit_max_wait_ms = 30000;
+  rate_limit_burst_seconds = 6.0;
+  rate_limit_throttle_ms = 2000;
+
+  // Single-flight defaults
+  single_flight_enabled = true;
+
+  // Explain defaults
+  explain_timeout_ms = 5000;
+  explain_include_findings = true;
+
   // Set up default OpenAI provider
   default_provider.provider = Provider::OPENAI;
   default_provider.api_key = "";
@@ -41,18 +149,21 @@ Configuration::Configuration() {
   gpt4o.description = "GPT-4 Omni - Latest model";
   gpt4o.max_tokens = 16384;
   gpt4o.temperature = 0.7;
+  gpt4o.context_window = 128000;
 
   ModelConfig gpt4;
   gpt4.name = "gpt-4";
   gpt4.description = "GPT-4 - High quality model";
   gpt4.max_tokens = 8192;
   gpt4.temperature = 0.7;
+  gpt4.context_window = 8192;
 
   ModelConfig gpt35;
   gpt35.name = "gpt-3.5-turbo";
   gpt35.description = "GPT-3.5 Turbo - Fast and efficient";
   gpt35.max_tokens = 4096;
   gpt35.temperature = 0.7;
+  gpt35.context_window = 16385;
 
   default_provider.available_models = {gpt4o, gpt4, gpt35};
   default_provider.default_model = gpt4o;
@@ -131,7 +242,15 @@ void ConfigManager::loadEnvConfig() {
       claude3_5.description = "Claude 3.5 Sonnet - Latest model";
       claude3_5.max_tokens = 8192;
       claude3_5.temperature = 0.7;
+      claude3_5.context_window = 200000;
+      ModelConfig claude3_5_haiku;
+      claude3_5_haiku.name = "claude-3-5-haiku-20241022";
+      claude3_5_haiku.description = "Claude 3.5 Haiku - Fast and efficient";
+      claude3_5_haiku.max_tokens = 8192;
+      claude3_5_haiku.temperature = 0.7;
+      claude3_5_haiku.context_window = 200000;
       new_config.available_models.push_back(claude3_5);
+      new_config.available_models.push_back(claude3_5_haiku);
       new_config.default_model = claude3_5;
 
       config_.providers.push_back(new_config);
@@ -209,6 +328,11 @@ Provider ConfigManager::stringToProvider(const std::string& provider_str) {
   return Provider::UNKNOWN;
 }
 
+void ConfigManager::reset() {
+  config_ = Configuration();
+  config_loaded_ = false;
+}
+
 bool ConfigManager::parseConfig(const std::string& content) {
   std::istringstream stream(content);
   std::string line;
@@ -262,6 +386,8 @@ bool ConfigManager::parseConfig(const std::string& content) {
         config_.request_timeout_ms = std::stoi(value);
       else if (key == "max_retries")
         config_.max_retries = std::stoi(value);
+      else if (key == "batch_concurrency")
+        config_.batch_concurrency = std::stoi(value);
     } else if (current_section == "query") {
       if (key == "enforce_limit")
         config_.enforce_limit = (value == "true");
@@ -277,6 +403,83 @@ bool ConfigManager::parseConfig(const std::string& content) {
       else if (key == "use_formatted_response") {
         config_.use_formatted_response = (value == "true");
       }
+    } else if (current_section == "schema") {
+      if (key == "cache_enabled")
+        config_.schema_cache_enabled = (value == "true");
+      else if (key == "cache_size_mb")
+        config_.schema_cache_size_mb = std::stoi(value);
+      else if (key == "cache_max_entries")
+        config_.schema_cache_max_entries = std::stoi(value);
+      else if (key == "column_stats")
+        config_.schema_column_stats = (value == "true");
+      else if (key == "column_stats_max_chars")
+        config_.schema_column_stats_max_chars = std::stoi(value);
+      else if (key == "column_stats_mcv_count")
+        config_.schema_column_stats_mcv_count = std::stoi(value);
+      else if (key == "context_token_budget")
+        config_.schema_context_token_budget = std::stoi(value);
+      else if (key == "context_max_detailed_tables")
+        config_.schema_context_max_detailed_tables = std::stoi(value);
+      else if (key == "prewarm_databases") {
+        config_.schema_prewarm_databases.clear();
+        std::istringstream names(value);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+          name.erase(0, name.find_first_not_of(" \t"));
+          name.erase(name.find_last_not_of(" \t") + 1);
+          if (!name.empty())
+            config_.schema_prewarm_databases.push_back(name);
+        }
+      } else if (key == "prewarm_interval_ms")
+        config_.schema_prewarm_interval_ms = std::stoi(value);
+    } else if (current_section == "result_cache") {
+      if (key == "enabled")
+        config_.result_cache_enabled = (value == "true");
+      else if (key == "size_mb")
+        config_.result_cache_size_mb = std::stoi(value);
+      else if (key == "max_entries")
+        config_.result_cache_max_entries = std::stoi(value);
+      else if (key == "ttl_seconds")
+        config_.result_cache_ttl_seconds = std::stoi(value);
+      else if (key == "similar_enabled")
+        config_.result_cache_similar_enabled = (value == "true");
+      else if (key == "similarity_threshold")
+        config_.result_cache_similarity_threshold = std::stod(value);
+    } else if (current_section == "hedging") {
+      if (key == "enabled")
+        config_.hedging_enabled = (value == "true");
+      else if (key == "percentile")
+        config_.hedging_percentile = std::stod(value);
+      else if (key == "delay_ms")
+        config_.hedging_delay_ms = std::stoi(value);
+      else if (key == "max_rate")
+        config_.hedging_max_rate = std::stod(value);
+    } else if (current_section == "routing") {
+      if (key == "enabled")
+        config_.routing_enabled = (value == "true");
+      else if (key == "threshold")
+        config_.routing_threshold = std::stod(value);
+    } else if (current_section == "tokenizer") {
+      if (key == "vocab_dir")
+        config_.tokenizer_vocab_dir = value;
+    } else if (current_section == "rate_limit") {
+      if (key == "policy")
+        config_.rate_limit_policy =
+            value == "fail" ? RateLimitPolicy::FAIL : RateLimitPolicy::WAIT;
+      else if (key == "max_wait_ms")
+        config_.rate_limit_max_wait_ms = std::stoi(value);
+      else if (key == "burst_seconds")
+        config_.rate_limit_burst_seconds = std::stod(value);
+      else if (key == "throttle_ms")
+        config_.rate_limit_throttle_ms = std::stoi(value);
+    } else if (current_section == "single_flight") {
+      if (key == "enabled")
+        config_.single_flight_enabled = (value == "true");
+    } else if (current_section == "explain") {
+      if (key == "timeout_ms")
+        config_.explain_timeout_ms = std::stoi(value);
+      else if (key == "include_findings")
+        config_.explain_include_findings = (value == "true");
     } else if (current_section == "openai") {
       auto provider_config = getProviderConfigMutable(Provider::OPENAI);
       if (!provider_config) {
@@ -287,17 +490,7 @@ bool ConfigManager::parseConfig(const std::string& content) {
         provider_config = &config_.providers.back();
       }
 
-      if (key == "api_key")
-        provider_config->api_key = value;
-      else if (key == "default_model") {
-        // Find model in available models
-        for (const auto& model : provider_config->available_models) {
-          if (model.name == value) {
-            provider_config->default_model = model;
-            break;
-          }
-        }
-      }
+      setProviderOption(*provider_config, key, value);
     } else if (current_section == "anthropic") {
       auto provider_config = getProviderConfigMutable(Provider::ANTHROPIC);
       if (!provider_config) {
@@ -310,16 +503,24 @@ bool ConfigManager::parseConfig(const std::string& content) {
         claude3_5.description = "Claude 3.5 Sonnet - Latest model";
         claude3_5.max_tokens = 8192;
         claude3_5.temperature = 0.7;
+        claude3_5.context_window = 200000;
+
+        ModelConfig claude3_5_haiku;
+        claude3_5_haiku.name = "claude-3-5-haiku-20241022";
+        claude3_5_haiku.description = "Claude 3.5 Haiku - Fast and efficient";
+        claude3_5_haiku.max_tokens = 8192;
+        claude3_5_haiku.temperature = 0.7;
+        claude3_5_haiku.context_window = 200000;
 
         new_config.available_models.push_back(claude3_5);
+        new_config.available_models.push_back(claude3_5_haiku);
         new_config.default_model = claude3_5;
 
         config_.providers.push_back(new_config);
         provider_config = &config_.providers.back();
       }
 
-      if (key == "api_key")
-        provider_config->api_key = value;
+      setProviderOption(*provider_config, key, value);
     }
   }
 
@@ -0,0 +1,385 @@
+#include "../include/bpe_tokenizer.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace pg_ai {
+
+namespace {
+
+constexpr uint32_t kNoRank = std::numeric_limits<uint32_t>::max();
+
+bool isLetter(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+bool isUpper(unsigned char c) {
+  return c >= 'A' && c <= 'Z';
+}
+
+bool isLower(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || c >= 0x80;
+}
+
+bool isDigit(unsigned char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool isSpace(unsigned char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+bool isNewline(unsigned char c) {
+  return c == '\r' || c == '\n';
+}
+
+// Neither whitespace, letter nor digit.
+bool isSymbol(unsigned char c) {
+  return !isSpace(c) && !isLetter(c) && !isDigit(c);
+}
+
+// Length of an English contraction ('s, 't, 're, 've, 'm, 'll, 'd) at `i`,
+// case-insensitively, or 0.
+size_t contractionAt(std::string_view text, size_t i) {
+  if (i + 1 >= text.size() || text[i] != '\'')
+    return 0;
+  auto lower = [&](size_t k) -> char {
+    if (k >= text.size())
+      return '\0';
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(text[k])));
+  };
+  char a = lower(i + 1), b = lower(i + 2);
+  if ((a == 'l' && b == 'l') || (a == 'v' && b == 'e') ||
+      (a == 'r' && b == 'e'))
+    return 3;
+  if (a == 's' || a == 'd' || a == 'm' || a == 't')
+    return 2;
+  return 0;
+}
+
+// Whitespace alternatives shared by both patterns: \s*[\r\n], \s+(?!\S), \s+
+size_t whitespaceEnd(std::string_view text, size_t i) {
+  size_t end = i;
+  while (end < text.size() && isSpace(text[end]))
+    end++;
+  for (size_t k = end; k > i; k--) {
+    if (isNewline(text[k - 1]))
+      return k;
+  }
+  if (end < text.size() && end - i >= 2)
+    return end - 1;
+  return end;
+}
+
+// End of the piece starting at `i`, following
+// 's|'t|'re|'ve|'m|'ll|'d|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}|
+// ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]|\s+(?!\S)|\s+
+size_t cl100kEnd(std::string_view text, size_t i) {
+  size_t n = text.size();
+  unsigned char c = text[i];
+
+  if (size_t length = contractionAt(text, i))
+    return i + length;
+
+  size_t start = i;
+  if (!isLetter(c) && !isDigit(c) && !isNewline(c) && i + 1 < n &&
+      isLetter(text[i + 1]))
+    start = i + 1;
+  if (isLetter(text[start])) {
+    size_t end = start;
+    while (end < n && isLetter(text[end]))
+      end++;
+    return end;
+  }
+
+  if (isDigit(c)) {
+    size_t end = i;
+    while (end < n && end - i < 3 && isDigit(text[end]))
+      end++;
+    return end;
+  }
+
+  size_t symbols = c == ' ' ? i + 1 : i;
+  if (symbols < n && isSymbol(text[symbols])) {
+    size_t end = symbols;
+    while (end < n && isSymbol(text[end]))
+      end++;
+    while (end < n && isNewline(text[end]))
+      end++;
+    return end;
+  }
+
+  if (isSpace(c))
+    return whitespaceEnd(text, i);
+  return i + 1;
+}
+
+// End of the piece starting at `i`, following
+// [^\r\n\p{L}\p{N}]?\p{Lu}*\p{Ll}+(contraction)?|
+// [^\r\n\p{L}\p{N}]?\p{Lu}+\p{Ll}*(contraction)?|\p{N}{1,3}|
+// ?[^\s\p{L}\p{N}]+[\r\n/]*|\s*[\r\n]+|\s+(?!\S)|\s+
+size_t o200kEnd(std::string_view text, size_t i) {
+  size_t n = text.size();
+  unsigned char c = text[i];
+
+  size_t start = i;
+  if (!isLetter(c) && !isDigit(c) && !isNewline(c) && i + 1 < n &&
+      isLetter(text[i + 1]))
+    start = i + 1;
+  if (isLetter(text[start])) {
+    // Upper* Lower+, else Upper+ (no lowercase follows)
+    size_t end = start;
+    while (end < n && isUpper(text[end]))
+      end++;
+    while (end < n && isLower(text[end]))
+      end++;
+    return end + contractionAt(text, end);
+  }
+
+  if (isDigit(c)) {
+    size_t end = i;
+    while (end < n && end - i < 3 && isDigit(text[end]))
+      end++;
+    return end;
+  }
+
+  size_t symbols = c == ' ' ? i + 1 : i;
+  if (symbols < n && isSymbol(text[symbols])) {
+    size_t end = symbols;
+    while (end < n && isSymbol(text[end]))
+      end++;
+    while (end < n && (isNewline(text[end]) || text[end] == '/'))
+      end++;
+    return end;
+  }
+
+  if (isSpace(c))
+    return whitespaceEnd(text, i);
+  return i + 1;
+}
+
+int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+bool decodeBase64(std::string_view in, std::string& out) {
+  uint32_t buffer = 0;
+  int bits = 0;
+  for (char c : in) {
+    if (c == '=')
+      break;
+    int value = base64Value(c);
+    if (value < 0)
+      return false;
+    buffer = (buffer << 6) | static_cast<uint32_t>(value);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out.push_back(static_cast<char>((buffer >> bits) & 0xff));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+std::unique_ptr<BpeTokenizer> BpeTokenizer::load(const std::string& path,
+                                                 Pattern pattern) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open tokenizer vocabulary " + path +
+                             ": " + std::strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("Empty tokenizer vocabulary " + path);
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Cannot map tokenizer vocabulary " + path +
+                             ": " + std::strerror(errno));
+  }
+
+  std::unique_ptr<BpeTokenizer> tokenizer(new BpeTokenizer());
+  tokenizer->pattern_ = pattern;
+  // Decoded tokens are shorter than their base64 text, so the buffer never
+  // reallocates and the index can point into it.
+  tokenizer->bytes_.reserve(size);
+
+  struct Entry {
+    size_t offset;
+    size_t length;
+    uint32_t rank;
+  };
+  std::vector<Entry> entries;
+  std::string_view text(static_cast<const char*>(mapped), size);
+  bool valid = true;
+  size_t line_start = 0;
+  while (valid && line_start < text.size()) {
+    size_t line_end = text.find('\n', line_start);
+    if (line_end == std::string_view::npos)
+      line_end = text.size();
+    std::string_view line = text.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (line.empty())
+      continue;
+
+    size_t space = line.find(' ');
+    if (space == std::string_view::npos) {
+      valid = false;
+      break;
+    }
+    size_t offset = tokenizer->bytes_.size();
+    if (!decodeBase64(line.substr(0, space), tokenizer->bytes_)) {
+      valid = false;
+      break;
+    }
+    uint64_t rank = 0;
+    for (char c : line.substr(space + 1)) {
+      if (!isDigit(c)) {
+        valid = false;
+        break;
+      }
+      rank = rank * 10 + static_cast<uint64_t>(c - '0');
+    }
+    if (rank >= kNoRank)
+      valid = false;
+    entries.push_back({offset, tokenizer->bytes_.size() - offset,
+                       static_cast<uint32_t>(rank)});
+  }
+  munmap(mapped, size);
+  if (!valid || entries.empty())
+    throw std::runtime_error("Malformed tokenizer vocabulary " + path);
+
+  tokenizer->ranks_.reserve(entries.size());
+  for (const auto& entry : entries) {
+    tokenizer->ranks_.emplace(
+        std::string_view(tokenizer->bytes_.data() + entry.offset, entry.length),
+        entry.rank);
+  }
+  return tokenizer;
+}
+
+const char* BpeTokenizer::vocabularyFor(const std::string& model) {
+  auto starts_with = [&](const char* prefix) {
+    return model.rfind(prefix, 0) == 0;
+  };
+  if (starts_with("gpt-4o") || starts_with("gpt-4.1") || starts_with("gpt-5") ||
+      starts_with("o1") || starts_with("o3") || starts_with("o4"))
+    return "o200k_base";
+  if (starts_with("gpt-4") || starts_with("gpt-3.5"))
+    return "cl100k_base";
+  return nullptr;
+}
+
+BpeTokenizer::Pattern BpeTokenizer::patternFor(const std::string& vocabulary) {
+  return vocabulary == "o200k_base" ? Pattern::O200K : Pattern::CL100K;
+}
+
+std::vector<std::string_view> BpeTokenizer::split(std::string_view text,
+                                                  Pattern pattern) {
+  std::vector<std::string_view> pieces;
+  size_t i = 0;
+  while (i < text.size()) {
+    size_t end = pattern == Pattern::O200K ? o200kEnd(text, i)
+                                           : cl100kEnd(text, i);
+    pieces.push_back(text.substr(i, end - i));
+    i = end;
+  }
+  return pieces;
+}
+
+size_t BpeTokenizer::mergePiece(std::string_view piece,
+                                std::vector<uint32_t>* out) const {
+  auto whole = ranks_.find(piece);
+  if (whole != ranks_.end()) {
+    if (out)
+      out->push_back(whole->second);
+    return 1;
+  }
+
+  // Token boundaries, each with the rank of merging it with the next token.
+  struct Part {
+    size_t start;
+    uint32_t rank;
+  };
+  std::vector<Part> parts;
+  parts.reserve(piece.size() + 1);
+  for (size_t i = 0; i <= piece.size(); i++)
+    parts.push_back({i, kNoRank});
+
+  auto pairRank = [&](size_t i) {
+    if (i + 2 >= parts.size())
+      return kNoRank;
+    auto it = ranks_.find(
+        piece.substr(parts[i].start, parts[i + 2].start - parts[i].start));
+    return it == ranks_.end() ? kNoRank : it->second;
+  };
+  for (size_t i = 0; i < parts.size(); i++)
+    parts[i].rank = pairRank(i);
+
+  for (;;) {
+    size_t best = 0;
+    uint32_t best_rank = kNoRank;
+    for (size_t i = 0; i + 1 < parts.size(); i++) {
+      if (parts[i].rank < best_rank) {
+        best_rank = parts[i].rank;
+        best = i;
+      }
+    }
+    if (best_rank == kNoRank)
+      break;
+    parts.erase(parts.begin() + static_cast<std::ptrdiff_t>(best) + 1);
+    parts[best].rank = pairRank(best);
+    if (best > 0)
+      parts[best - 1].rank = pairRank(best - 1);
+  }
+
+  if (out) {
+    for (size_t i = 0; i + 1 < parts.size(); i++) {
+      auto it = ranks_.find(
+          piece.substr(parts[i].start, parts[i + 1].start - parts[i].start));
+      out->push_back(it == ranks_.end() ? kNoRank : it->second);
+    }
+  }
+  return parts.size() - 1;
+}
+
+std::vector<uint32_t> BpeTokenizer::encode(std::string_view text) const {
+  std::vector<uint32_t> tokens;
+  for (auto piece : split(text, pattern_))
+    mergePiece(piece, &tokens);
+  return tokens;
+}
+
+size_t BpeTokenizer::count(std::string_view text) const {
+  size_t tokens = 0;
+  for (auto piece : split(text, pattern_))
+    tokens += mergePiece(piece, nullptr);
+  return tokens;
+}
+
+}  // namespace pg_ai
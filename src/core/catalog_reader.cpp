@@ -0,0 +1,623 @@
+#include "../include/catalog_reader.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <access/genam.h>
+#include <access/htup_details.h>
+#include <access/relation.h>
+#include <access/stratnum.h>
+#include <access/table.h>
+#include <catalog/catalog.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_class.h>
+#include <catalog/pg_constraint.h>
+#include <catalog/pg_depend.h>
+#include <catalog/pg_extension.h>
+#include <catalog/pg_index.h>
+#include <catalog/pg_statistic.h>
+#include <commands/extension.h>
+#include <miscadmin.h>
+#include <nodes/nodes.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/fmgroids.h>
+#include <utils/lsyscache.h>
+#include <utils/rel.h>
+#include <utils/relcache.h>
+#include <utils/rls.h>
+#include <utils/ruleutils.h>
+#include <utils/syscache.h>
+}
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace pg_ai {
+
+namespace {
+
+bool hasColumns(char relkind) {
+  return relkind == RELKIND_RELATION || relkind == RELKIND_PARTITIONED_TABLE ||
+         relkind == RELKIND_VIEW || relkind == RELKIND_MATVIEW ||
+         relkind == RELKIND_FOREIGN_TABLE;
+}
+
+std::set<AttrNumber> primaryKeyColumns(Relation rel) {
+  std::set<AttrNumber> columns;
+#if PG_VERSION_NUM >= 170000
+  Oid pk_index = RelationGetPrimaryKeyIndex(rel, false);
+#else
+  Oid pk_index = RelationGetPrimaryKeyIndex(rel);
+#endif
+  if (!OidIsValid(pk_index))
+    return columns;
+
+  HeapTuple tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(pk_index));
+  if (!HeapTupleIsValid(tuple))
+    return columns;
+
+  auto* index = reinterpret_cast<Form_pg_index>(GETSTRUCT(tuple));
+  for (int i = 0; i < index->indnkeyatts; i++) {
+    columns.insert(index->indkey.values[i]);
+  }
+  ReleaseSysCache(tuple);
+  return columns;
+}
+
+// Maps each referencing column to the referenced (table, column). Columns of
+// multi-column keys are paired positionally, conkey[i] -> confkey[i].
+std::map<AttrNumber, std::pair<std::string, std::string>> foreignKeyColumns(
+    Relation rel) {
+  std::map<AttrNumber, std::pair<std::string, std::string>> columns;
+  ListCell* lc;
+  foreach (lc, RelationGetFKeyList(rel)) {
+    auto* fk = static_cast<ForeignKeyCacheInfo*>(lfirst(lc));
+    char* ref_table = get_rel_name(fk->confrelid);
+    if (!ref_table)
+      continue;
+
+    for (int i = 0; i < fk->nkeys; i++) {
+      if (columns.count(fk->conkey[i]))
+        continue;
+      char* ref_column = get_attname(fk->confrelid, fk->confkey[i], true);
+      if (!ref_column)
+        continue;
+      columns[fk->conkey[i]] = {ref_table, ref_column};
+      pfree(ref_column);
+    }
+    pfree(ref_table);
+  }
+  return columns;
+}
+
+std::map<AttrNumber, std::string> columnDefaults(Relation rel) {
+  std::map<AttrNumber, std::string> defaults;
+  TupleConstr* constr = RelationGetDescr(rel)->constr;
+  if (!constr || constr->num_defval == 0)
+    return defaults;
+
+  List* context = deparse_context_for(RelationGetRelationName(rel),
+                                      RelationGetRelid(rel));
+  for (int i = 0; i < constr->num_defval; i++) {
+    const AttrDefault& def = constr->defval[i];
+    char* text = deparse_expression(
+        static_cast<Node*>(stringToNode(def.adbin)), context, false, false);
+    defaults[def.adnum] = text;
+    pfree(text);
+  }
+  return defaults;
+}
+
+std::vector<IndexDetails> indexList(Relation rel) {
+  std::vector<IndexDetails> indexes;
+  List* index_oids = RelationGetIndexList(rel);
+  ListCell* lc;
+  foreach (lc, index_oids) {
+    Oid index_oid = lfirst_oid(lc);
+    IndexDetails index{};
+
+    char* name = get_rel_name(index_oid);
+    if (name) {
+      index.index_name = name;
+      pfree(name);
+    }
+
+    HeapTuple tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(index_oid));
+    if (HeapTupleIsValid(tuple)) {
+      auto* form = reinterpret_cast<Form_pg_index>(GETSTRUCT(tuple));
+      index.is_unique = form->indisunique;
+      index.is_primary = form->indisprimary;
+      ReleaseSysCache(tuple);
+    }
+
+    text* def = DatumGetTextPP(
+        DirectFunctionCall1(pg_get_indexdef, ObjectIdGetDatum(index_oid)));
+    char* def_str = text_to_cstring(def);
+    index.definition = def_str;
+    pfree(def_str);
+
+    indexes.push_back(std::move(index));
+  }
+  list_free(index_oids);
+
+  // Same order pg_indexes would give.
+  std::sort(indexes.begin(), indexes.end(),
+            [](const IndexDetails& a, const IndexDetails& b) {
+              return std::tie(a.index_name, a.definition) <
+                     std::tie(b.index_name, b.definition);
+            });
+  return indexes;
+}
+
+std::vector<std::string> indexDefinitions(Relation rel) {
+  std::vector<std::string> result;
+  for (auto& index : indexList(rel)) {
+    result.push_back(std::move(index.definition));
+  }
+  return result;
+}
+
+std::map<AttrNumber, std::string> leadingIndexes(Relation rel) {
+  std::map<AttrNumber, std::string> leading;
+  List* index_oids = RelationGetIndexList(rel);
+  ListCell* lc;
+  foreach (lc, index_oids) {
+    Oid index_oid = lfirst_oid(lc);
+    HeapTuple tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(index_oid));
+    if (!HeapTupleIsValid(tuple))
+      continue;
+    auto* index = reinterpret_cast<Form_pg_index>(GETSTRUCT(tuple));
+    // Expression indexes have attnum 0 in the first position.
+    AttrNumber first = index->indnatts > 0 ? index->indkey.values[0] : 0;
+    ReleaseSysCache(tuple);
+
+    if (first <= 0 || leading.count(first))
+      continue;
+    char* name = get_rel_name(index_oid);
+    if (name) {
+      leading[first] = name;
+      pfree(name);
+    }
+  }
+  list_free(index_oids);
+  return leading;
+}
+
+// Privileges that make a column visible in information_schema.columns
+constexpr AclMode kColumnPrivileges =
+    ACL_SELECT | ACL_INSERT | ACL_UPDATE | ACL_REFERENCES;
+
+// Same test information_schema.tables applies: any privilege on the table or
+// one of its columns, or membership in the owning role.
+bool canSeeRelation(Oid relid, Oid owner) {
+  Oid user = GetUserId();
+  if (has_privs_of_role(user, owner))
+    return true;
+  AclMode table_privileges = ACL_SELECT | ACL_INSERT | ACL_UPDATE |
+                             ACL_DELETE | ACL_TRUNCATE | ACL_REFERENCES |
+                             ACL_TRIGGER;
+  if (pg_class_aclmask(relid, user, table_privileges, ACLMASK_ANY) != 0)
+    return true;
+  return pg_attribute_aclcheck_all(relid, user, kColumnPrivileges,
+                                   ACLMASK_ANY) == ACLCHECK_OK;
+}
+
+// Owner of a relation, or InvalidOid if it no longer exists
+Oid relationOwner(Oid relid) {
+  HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+  if (!HeapTupleIsValid(tuple))
+    return InvalidOid;
+  Oid owner = reinterpret_cast<Form_pg_class>(GETSTRUCT(tuple))->relowner;
+  ReleaseSysCache(tuple);
+  return owner;
+}
+
+// Owners and holders of a table privilege see every column.
+bool canSeeAllColumns(Oid relid, Oid owner) {
+  Oid user = GetUserId();
+  return has_privs_of_role(user, owner) ||
+         pg_class_aclmask(relid, user, kColumnPrivileges, ACLMASK_ANY) != 0;
+}
+
+bool hasColumnPrivilege(Oid relid,
+                        const std::string& column_name,
+                        AclMode privileges) {
+  AttrNumber attnum = get_attnum(relid, column_name.c_str());
+  return attnum != InvalidAttrNumber &&
+         pg_attribute_aclcheck(relid, attnum, GetUserId(), privileges) ==
+             ACLCHECK_OK;
+}
+
+std::set<Oid> extensionRelations() {
+  std::set<Oid> members;
+  Oid extension = get_extension_oid("pg_ai_query", true);
+  if (!OidIsValid(extension))
+    return members;
+
+  Relation depend = table_open(DependRelationId, AccessShareLock);
+  ScanKeyData keys[2];
+  ScanKeyInit(&keys[0], Anum_pg_depend_refclassid, BTEqualStrategyNumber,
+              F_OIDEQ, ObjectIdGetDatum(ExtensionRelationId));
+  ScanKeyInit(&keys[1], Anum_pg_depend_refobjid, BTEqualStrategyNumber,
+              F_OIDEQ, ObjectIdGetDatum(extension));
+  SysScanDesc scan = systable_beginscan(depend, DependReferenceIndexId, true,
+                                        nullptr, 2, keys);
+  HeapTuple tuple;
+  while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+    auto* form = reinterpret_cast<Form_pg_depend>(GETSTRUCT(tuple));
+    if (form->classid == RelationRelationId &&
+        form->deptype == DEPENDENCY_EXTENSION)
+      members.insert(form->objid);
+  }
+  systable_endscan(scan);
+  table_close(depend, AccessShareLock);
+  return members;
+}
+
+const char* tableType(char relkind) {
+  switch (relkind) {
+    case RELKIND_RELATION:
+    case RELKIND_PARTITIONED_TABLE:
+      return "BASE TABLE";
+    case RELKIND_VIEW:
+      return "VIEW";
+    case RELKIND_MATVIEW:
+      return "MATERIALIZED VIEW";
+    case RELKIND_FOREIGN_TABLE:
+      return "FOREIGN";
+    default:
+      return nullptr;
+  }
+}
+
+constexpr size_t kMaxSampleValueLength = 40;
+
+std::vector<std::string> mostCommonValues(HeapTuple stats_tuple,
+                                          int mcv_count) {
+  std::vector<std::string> values;
+  if (mcv_count <= 0)
+    return values;
+
+  AttStatsSlot slot;
+  if (!get_attstatsslot(&slot, stats_tuple, STATISTIC_KIND_MCV, InvalidOid,
+                        ATTSTATSSLOT_VALUES))
+    return values;
+
+  Oid output_func;
+  bool is_varlena;
+  getTypeOutputInfo(slot.valuetype, &output_func, &is_varlena);
+  for (int i = 0; i < slot.nvalues && i < mcv_count; i++) {
+    char* value = OidOutputFunctionCall(output_func, slot.values[i]);
+    std::string text(value);
+    pfree(value);
+    if (text.size() > kMaxSampleValueLength)
+      text = text.substr(0, kMaxSampleValueLength) + "...";
+    values.push_back(std::move(text));
+  }
+  free_attstatsslot(&slot);
+  return values;
+}
+
+}  // namespace
+
+Oid CatalogReader::resolveTable(const std::string& table_name,
+                                const std::string& schema_name) {
+  Oid namespace_oid = get_namespace_oid(schema_name.c_str(), true);
+  if (!OidIsValid(namespace_oid))
+    return InvalidOid;
+  return get_relname_relid(table_name.c_str(), namespace_oid);
+}
+
+TableDetails CatalogReader::readTableDetails(Oid relid) {
+  TableDetails result = readTableStructure(relid);
+  if (result.success)
+    restrictTableDetailsToUser(relid, result);
+  return result;
+}
+
+TableDetails CatalogReader::readTableStructure(Oid relid) {
+  TableDetails result;
+  result.success = false;
+
+  Relation rel = try_relation_open(relid, AccessShareLock);
+  if (!rel) {
+    result.error_message = "Relation with OID " + std::to_string(relid) +
+                           " does not exist";
+    return result;
+  }
+
+  result.table_name = RelationGetRelationName(rel);
+  char* schema_name = get_namespace_name(RelationGetNamespace(rel));
+  if (schema_name) {
+    result.schema_name = schema_name;
+    pfree(schema_name);
+  }
+
+  if (!hasColumns(rel->rd_rel->relkind)) {
+    relation_close(rel, AccessShareLock);
+    result.error_message = "Relation " + result.schema_name + "." +
+                           result.table_name + " is not a table";
+    return result;
+  }
+
+  auto pk_columns = primaryKeyColumns(rel);
+  auto fk_columns = foreignKeyColumns(rel);
+  auto defaults = columnDefaults(rel);
+
+  TupleDesc desc = RelationGetDescr(rel);
+  for (int i = 0; i < desc->natts; i++) {
+    Form_pg_attribute att = TupleDescAttr(desc, i);
+    if (att->attisdropped)
+      continue;
+
+    ColumnInfo column_info;
+    column_info.column_name = NameStr(att->attname);
+
+    char* type_name = format_type_with_typemod(att->atttypid, att->atttypmod);
+    column_info.data_type = type_name;
+    pfree(type_name);
+
+    column_info.is_nullable = !att->attnotnull;
+
+    // information_schema reports no default for generated columns either.
+    auto def = defaults.find(att->attnum);
+    if (def != defaults.end() && !att->attgenerated)
+      column_info.column_default = def->second;
+
+    column_info.is_primary_key = pk_columns.count(att->attnum) > 0;
+
+    auto fk = fk_columns.find(att->attnum);
+    column_info.is_foreign_key = fk != fk_columns.end();
+    if (column_info.is_foreign_key) {
+      column_info.foreign_table = fk->second.first;
+      column_info.foreign_column = fk->second.second;
+    }
+
+    result.columns.push_back(std::move(column_info));
+  }
+
+  result.indexes = indexDefinitions(rel);
+
+  relation_close(rel, AccessShareLock);
+  result.success = true;
+  return result;
+}
+
+void CatalogReader::forEachTable(
+    const std::function<void(const TableInfo&)>& visit) {
+  auto excluded = extensionRelations();
+  // Schema names, or empty for schemas that are skipped entirely.
+  std::map<Oid, std::string> schemas;
+  auto schemaName = [&](Oid namespace_oid) -> const std::string& {
+    auto found = schemas.find(namespace_oid);
+    if (found != schemas.end())
+      return found->second;
+    std::string name;
+    if (!IsCatalogNamespace(namespace_oid) &&
+        !IsToastNamespace(namespace_oid) &&
+        !isOtherTempNamespace(namespace_oid)) {
+      char* nspname = get_namespace_name(namespace_oid);
+      if (nspname && strcmp(nspname, "information_schema") != 0)
+        name = nspname;
+      if (nspname)
+        pfree(nspname);
+    }
+    return schemas.emplace(namespace_oid, std::move(name)).first->second;
+  };
+
+  Relation classes = table_open(RelationRelationId, AccessShareLock);
+  SysScanDesc scan =
+      systable_beginscan(classes, InvalidOid, false, nullptr, 0, nullptr);
+  HeapTuple tuple;
+  while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+    auto* form = reinterpret_cast<Form_pg_class>(GETSTRUCT(tuple));
+    const char* type = tableType(form->relkind);
+    if (!type || excluded.count(form->oid))
+      continue;
+    const std::string& schema_name = schemaName(form->relnamespace);
+    if (schema_name.empty() || !canSeeRelation(form->oid, form->relowner))
+      continue;
+
+    TableInfo info;
+    info.table_name = NameStr(form->relname);
+    info.schema_name = schema_name;
+    info.table_type = type;
+    // reltuples is -1 until the first VACUUM or ANALYZE.
+    info.estimated_rows =
+        form->reltuples > 0 ? static_cast<int64_t>(form->reltuples) : 0;
+    visit(info);
+  }
+  systable_endscan(scan);
+  table_close(classes, AccessShareLock);
+}
+
+std::vector<ForeignKeyInfo> CatalogReader::readForeignKeys() {
+  // (schema, table) per relation, or empty names for system relations.
+  std::map<Oid, std::pair<std::string, std::string>> names;
+  auto nameOf = [&](Oid relid) -> const std::pair<std::string, std::string>& {
+    auto found = names.find(relid);
+    if (found != names.end())
+      return found->second;
+    std::pair<std::string, std::string> name;
+    Oid namespace_oid = get_rel_namespace(relid);
+    if (OidIsValid(namespace_oid) && !IsCatalogNamespace(namespace_oid) &&
+        !IsToastNamespace(namespace_oid)) {
+      char* nspname = get_namespace_name(namespace_oid);
+      char* relname = get_rel_name(relid);
+      if (nspname && relname && strcmp(nspname, "information_schema") != 0)
+        name = {nspname, relname};
+      if (nspname)
+        pfree(nspname);
+      if (relname)
+        pfree(relname);
+    }
+    return names.emplace(relid, std::move(name)).first->second;
+  };
+
+  std::vector<ForeignKeyInfo> keys;
+  Relation constraints = table_open(ConstraintRelationId, AccessShareLock);
+  SysScanDesc scan =
+      systable_beginscan(constraints, InvalidOid, false, nullptr, 0, nullptr);
+  HeapTuple tuple;
+  while (HeapTupleIsValid(tuple = systable_getnext(scan))) {
+    auto* form = reinterpret_cast<Form_pg_constraint>(GETSTRUCT(tuple));
+    if (form->contype != CONSTRAINT_FOREIGN || OidIsValid(form->conparentid))
+      continue;
+    const auto& from = nameOf(form->conrelid);
+    const auto& to = nameOf(form->confrelid);
+    if (from.first.empty() || to.first.empty())
+      continue;
+    keys.push_back({from.first, from.second, to.first, to.second});
+  }
+  systable_endscan(scan);
+  table_close(constraints, AccessShareLock);
+  return keys;
+}
+
+std::vector<IndexDetails> CatalogReader::readIndexes(Oid relid) {
+  if (!canSeeTable(relid))
+    return {};
+  Relation rel = try_relation_open(relid, AccessShareLock);
+  if (!rel)
+    return {};
+  auto indexes = indexList(rel);
+  relation_close(rel, AccessShareLock);
+  return indexes;
+}
+
+std::vector<ColumnStats> CatalogReader::readColumnStats(Oid relid,
+                                                        int mcv_count) {
+  std::vector<ColumnStats> result;
+
+  Relation rel = try_relation_open(relid, AccessShareLock);
+  if (!rel)
+    return result;
+  if (!hasColumns(rel->rd_rel->relkind)) {
+    relation_close(rel, AccessShareLock);
+    return result;
+  }
+
+  // Partitioned tables only have statistics covering their children.
+  bool inherited = rel->rd_rel->relkind == RELKIND_PARTITIONED_TABLE;
+  auto leading = leadingIndexes(rel);
+
+  TupleDesc desc = RelationGetDescr(rel);
+  for (int i = 0; i < desc->natts; i++) {
+    Form_pg_attribute att = TupleDescAttr(desc, i);
+    if (att->attisdropped)
+      continue;
+
+    ColumnStats stats;
+    stats.column_name = NameStr(att->attname);
+    stats.has_statistics = false;
+    stats.null_frac = 0;
+    stats.n_distinct = 0;
+    stats.has_correlation = false;
+    stats.correlation = 0;
+
+    auto index = leading.find(att->attnum);
+    if (index != leading.end())
+      stats.leading_index = index->second;
+
+    HeapTuple tuple =
+        SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(relid),
+                        Int16GetDatum(att->attnum), BoolGetDatum(inherited));
+    if (HeapTupleIsValid(tuple)) {
+      auto* statistic = reinterpret_cast<Form_pg_statistic>(GETSTRUCT(tuple));
+      stats.has_statistics = true;
+      stats.null_frac = statistic->stanullfrac;
+      stats.n_distinct = statistic->stadistinct;
+      stats.most_common_values = mostCommonValues(tuple, mcv_count);
+
+      AttStatsSlot slot;
+      if (get_attstatsslot(&slot, tuple, STATISTIC_KIND_CORRELATION,
+                           InvalidOid, ATTSTATSSLOT_NUMBERS)) {
+        if (slot.nnumbers > 0) {
+          stats.has_correlation = true;
+          stats.correlation = slot.numbers[0];
+        }
+        free_attstatsslot(&slot);
+      }
+      ReleaseSysCache(tuple);
+    }
+
+    if (stats.has_statistics || !stats.leading_index.empty())
+      result.push_back(std::move(stats));
+  }
+
+  relation_close(rel, AccessShareLock);
+  return result;
+}
+
+bool CatalogReader::canSeeTable(Oid relid) {
+  Oid owner = relationOwner(relid);
+  return OidIsValid(owner) && canSeeRelation(relid, owner);
+}
+
+size_t CatalogReader::restrictTablesToUser(std::vector<TableInfo>& tables) {
+  size_t before = tables.size();
+  tables.erase(std::remove_if(tables.begin(), tables.end(),
+                              [](const TableInfo& table) {
+                                Oid relid = resolveTable(table.table_name,
+                                                         table.schema_name);
+                                return !OidIsValid(relid) ||
+                                       !canSeeTable(relid);
+                              }),
+               tables.end());
+  return before - tables.size();
+}
+
+bool CatalogReader::restrictTableDetailsToUser(Oid relid,
+                                               TableDetails& details) {
+  Oid owner = relationOwner(relid);
+  if (!OidIsValid(owner) || !canSeeRelation(relid, owner)) {
+    // Reported like a missing table, as information_schema would.
+    details.columns.clear();
+    details.indexes.clear();
+    details.column_stats.clear();
+    details.success = false;
+    details.error_message = "Table " + details.schema_name + "." +
+                            details.table_name + " does not exist";
+    return false;
+  }
+  if (canSeeAllColumns(relid, owner))
+    return true;
+
+  auto& columns = details.columns;
+  size_t before = columns.size();
+  columns.erase(std::remove_if(columns.begin(), columns.end(),
+                               [&](const ColumnInfo& column) {
+                                 return !hasColumnPrivilege(
+                                     relid, column.column_name,
+                                     kColumnPrivileges);
+                               }),
+                columns.end());
+  details.restricted = columns.size() < before;
+  return true;
+}
+
+void CatalogReader::restrictColumnStatsToUser(Oid relid,
+                                              std::vector<ColumnStats>& stats) {
+  // Statistics would give away rows the policies hide from this user.
+  if (check_enable_rls(relid, InvalidOid, true) == RLS_ENABLED) {
+    stats.clear();
+    return;
+  }
+  if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) == ACLCHECK_OK)
+    return;
+
+  stats.erase(std::remove_if(stats.begin(), stats.end(),
+                             [&](const ColumnStats& column) {
+                               return !hasColumnPrivilege(
+                                   relid, column.column_name, ACL_SELECT);
+                             }),
+              stats.end());
+}
+
+}  // namespace pg_ai
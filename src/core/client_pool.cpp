@@ -0,0 +1,85 @@
+#include "../include/client_pool.hpp"
+
+#include <functional>
+#include <list>
+#include <tuple>
+
+#include <ai/anthropic.h>
+
+#include "../include/logger.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+constexpr size_t kMaxClients = 8;
+
+struct PooledClient {
+  config::Provider provider;
+  size_t key_hash;
+  std::string base_url;
+  // Kept to rule out hash collisions between keys.
+  std::string api_key;
+  std::shared_ptr<ai::Client> client;
+};
+
+// Most recently used first.
+std::list<PooledClient> clients;
+ClientPool::Stats counters;
+
+ai::Client createClient(config::Provider provider,
+                        const std::string& api_key,
+                        const std::string& base_url) {
+  if (provider == config::Provider::ANTHROPIC) {
+    return base_url.empty() ? ai::anthropic::create_client(api_key)
+                            : ai::anthropic::create_client(api_key, base_url);
+  }
+  return base_url.empty() ? ai::openai::create_client(api_key)
+                          : ai::openai::create_client(api_key, base_url);
+}
+
+}  // namespace
+
+std::shared_ptr<ai::Client> ClientPool::acquire(config::Provider provider,
+                                                const std::string& api_key,
+                                                const std::string& base_url) {
+  size_t key_hash = std::hash<std::string>{}(api_key);
+  for (auto it = clients.begin(); it != clients.end(); ++it) {
+    // Held elsewhere means still in use by an earlier call.
+    if (it->client.use_count() > 1)
+      continue;
+    if (it->provider == provider && it->key_hash == key_hash &&
+        it->base_url == base_url && it->api_key == api_key) {
+      clients.splice(clients.begin(), clients, it);
+      counters.hits++;
+      return clients.front().client;
+    }
+  }
+
+  logger::Logger::info("Creating " +
+                       config::ConfigManager::providerToString(provider) +
+                       " client" +
+                       (base_url.empty() ? "" : " for " + base_url));
+  auto client =
+      std::make_shared<ai::Client>(createClient(provider, api_key, base_url));
+  counters.misses++;
+  if (clients.size() >= kMaxClients) {
+    clients.pop_back();
+    counters.evictions++;
+  }
+  clients.push_front(
+      {provider, key_hash, base_url, api_key, std::move(client)});
+  return clients.front().client;
+}
+
+ClientPool::Stats ClientPool::stats() {
+  Stats result = counters;
+  result.size = clients.size();
+  return result;
+}
+
+void ClientPool::clear() {
+  clients.clear();
+}
+
+}  // namespace pg_ai
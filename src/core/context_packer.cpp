@@ -0,0 +1,435 @@
+#include "../include/context_packer.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <map>
+#include <set>
+#include <sstream>
+#include <unordered_set>
+
+namespace pg_ai {
+
+namespace {
+
+// Whole table name found in the request, e.g. "order items" -> order_items
+constexpr double kFullNameScore = 10.0;
+constexpr double kNameTokenScore = 3.0;
+constexpr double kPrefixScore = 1.0;
+constexpr double kColumnScore = 1.5;
+constexpr double kMaxColumnScore = 6.0;
+// Share of a matched table's score given to tables it has a key to or from
+constexpr double kForeignKeyShare = 0.4;
+constexpr double kRowCountWeight = 0.1;
+// Matches at least this strong are joined to each other through the graph
+constexpr double kJoinSeedScore = kNameTokenScore;
+// Longest join path followed between two matched tables, in foreign keys
+constexpr size_t kMaxJoinHops = 3;
+
+const std::unordered_set<std::string>& stopWords() {
+  static const std::unordered_set<std::string> words = {
+      "a",    "all",  "an",    "and",   "any",   "are",   "as",   "at",
+      "be",   "by",   "can",   "do",    "each",  "every", "find", "first",
+      "for",  "from", "get",   "give",  "have",  "how",   "i",    "in",
+      "is",   "it",   "last",  "list",  "many",  "me",    "most", "much",
+      "my",   "of",   "on",    "or",    "per",   "query", "show", "than",
+      "that", "the",  "their", "them",  "there", "this",  "to",   "top",
+      "was",  "we",   "were",  "what",  "when",  "where", "which", "who",
+      "with", "you"};
+  return words;
+}
+
+std::vector<std::string> nameTokens(const std::string& name) {
+  std::vector<std::string> tokens;
+  std::string current;
+  auto flush = [&]() {
+    if (!current.empty()) {
+      tokens.push_back(ContextPacker::stem(current));
+      current.clear();
+    }
+  };
+  for (char c : name) {
+    if (std::isalnum(static_cast<unsigned char>(c))) {
+      current += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    } else {
+      flush();
+    }
+  }
+  flush();
+  return tokens;
+}
+
+bool sharesPrefix(const std::string& a, const std::string& b) {
+  const std::string& shorter = a.size() < b.size() ? a : b;
+  const std::string& longer = a.size() < b.size() ? b : a;
+  return shorter.size() >= 4 && longer.compare(0, shorter.size(), shorter) == 0;
+}
+
+bool containsSequence(const std::vector<std::string>& haystack,
+                      const std::vector<std::string>& needle) {
+  if (needle.empty() || needle.size() > haystack.size())
+    return false;
+  return std::search(haystack.begin(), haystack.end(), needle.begin(),
+                     needle.end()) != haystack.end();
+}
+
+double nameScore(const std::vector<std::string>& request_tokens,
+                 const std::set<std::string>& request_set,
+                 const std::string& table_name) {
+  auto tokens = nameTokens(table_name);
+  double score = 0;
+  if (containsSequence(request_tokens, tokens))
+    score += kFullNameScore;
+  for (const auto& token : tokens) {
+    if (token.size() < 2)
+      continue;
+    if (request_set.count(token)) {
+      score += kNameTokenScore;
+      continue;
+    }
+    for (const auto& word : request_set) {
+      if (sharesPrefix(word, token)) {
+        score += kPrefixScore;
+        break;
+      }
+    }
+  }
+  return score;
+}
+
+double columnScore(const std::set<std::string>& request_set,
+                   const TableDetails& details) {
+  double score = 0;
+  for (const auto& column : details.columns) {
+    for (const auto& token : nameTokens(column.column_name)) {
+      // "id" and friends match nearly every table.
+      if (token.size() < 3 || !request_set.count(token))
+        continue;
+      score += kColumnScore;
+      break;
+    }
+  }
+  return std::min(score, kMaxColumnScore);
+}
+
+std::string tableLine(const TableInfo& table) {
+  std::ostringstream line;
+  line << "- " << table.schema_name << "." << table.table_name << " ("
+       << table.table_type << ", ~" << table.estimated_rows << " rows)\n";
+  return line.str();
+}
+
+std::pair<std::string, std::string> qualifiedName(const TableInfo& table) {
+  return {table.schema_name, table.table_name};
+}
+
+}  // namespace
+
+std::string ContextPacker::stem(const std::string& word) {
+  auto ends_with = [&](const char* suffix) {
+    size_t n = std::char_traits<char>::length(suffix);
+    return word.size() > n && word.compare(word.size() - n, n, suffix) == 0;
+  };
+
+  if (word.size() <= 3)
+    return word;
+  if (ends_with("ies"))
+    return word.substr(0, word.size() - 3) + "y";
+  if (ends_with("sses") || ends_with("xes") || ends_with("ches") ||
+      ends_with("shes"))
+    return word.substr(0, word.size() - 2);
+  if (ends_with("ss") || ends_with("us") || ends_with("is"))
+    return word;
+  if (ends_with("s"))
+    return word.substr(0, word.size() - 1);
+  if (word.size() > 5 && ends_with("ing"))
+    return word.substr(0, word.size() - 3);
+  if (word.size() > 4 && ends_with("ed"))
+    return word.substr(0, word.size() - 2);
+  return word;
+}
+
+std::vector<std::string> ContextPacker::tokenize(const std::string& text) {
+  std::vector<std::string> tokens;
+  for (auto& token : nameTokens(text)) {
+    if (!stopWords().count(token))
+      tokens.push_back(std::move(token));
+  }
+  return tokens;
+}
+
+size_t ContextPacker::estimateTokens(const std::string& text) {
+  return (text.size() + 3) / 4;
+}
+
+std::vector<ContextPacker::ScoredTable> ContextPacker::rankTables(
+    const std::string& request,
+    const DatabaseSchema& schema) {
+  auto request_tokens = tokenize(request);
+  std::set<std::string> request_set(request_tokens.begin(),
+                                    request_tokens.end());
+
+  std::vector<ScoredTable> ranked;
+  ranked.reserve(schema.tables.size());
+  for (size_t i = 0; i < schema.tables.size(); i++) {
+    ranked.push_back({i, nameScore(request_tokens, request_set,
+                                   schema.tables[i].table_name)});
+  }
+
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [&](const ScoredTable& a, const ScoredTable& b) {
+                     if (a.score != b.score)
+                       return a.score > b.score;
+                     return schema.tables[a.index].estimated_rows >
+                            schema.tables[b.index].estimated_rows;
+                   });
+  return ranked;
+}
+
+ContextPacker::PackedContext ContextPacker::pack(
+    const std::string& request,
+    const DatabaseSchema& schema,
+    const DetailsFetcher& fetch,
+    const DetailsFormatter& format,
+    const Options& options,
+    const FkGraph* graph) {
+  const auto& tables = schema.tables;
+  auto request_tokens = tokenize(request);
+  std::set<std::string> request_set(request_tokens.begin(),
+                                    request_tokens.end());
+
+  std::vector<double> scores(tables.size(), 0);
+  for (const auto& ranked : rankTables(request, schema)) {
+    scores[ranked.index] = ranked.score;
+  }
+
+  std::map<size_t, TableDetails> details;
+  auto fetchDetails = [&](const std::vector<size_t>& indexes) {
+    std::vector<std::pair<std::string, std::string>> names;
+    for (size_t i : indexes) {
+      names.push_back(qualifiedName(tables[i]));
+    }
+    if (names.empty() || !fetch)
+      return;
+    auto fetched = fetch(names);
+    for (size_t k = 0; k < fetched.size() && k < indexes.size(); k++) {
+      if (fetched[k].success)
+        details[indexes[k]] = std::move(fetched[k]);
+    }
+  };
+
+  // Candidates worth a details fetch: the best name matches, with room for
+  // some that column matches may push ahead.
+  auto topMatches = [&](size_t limit) {
+    std::vector<size_t> order(tables.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      if (scores[a] != scores[b])
+        return scores[a] > scores[b];
+      return tables[a].estimated_rows > tables[b].estimated_rows;
+    });
+    std::vector<size_t> top;
+    for (size_t i : order) {
+      if (top.size() >= limit || scores[i] <= 0)
+        break;
+      top.push_back(i);
+    }
+    return top;
+  };
+
+  size_t candidate_limit = options.max_detailed_tables * 2;
+  fetchDetails(topMatches(candidate_limit));
+
+  for (const auto& [i, table_details] : details) {
+    scores[i] += columnScore(request_set, table_details);
+  }
+
+  // Foreign keys only name the referenced table, so match on name and prefer
+  // the referencing table's schema when the name is ambiguous.
+  std::multimap<std::string, size_t> by_name;
+  std::map<FkGraph::TableName, size_t> by_qualified_name;
+  for (size_t i = 0; i < tables.size(); i++) {
+    by_name.emplace(tables[i].table_name, i);
+    by_qualified_name.emplace(qualifiedName(tables[i]), i);
+  }
+  auto resolve = [&](const std::string& name, const std::string& schema_name) {
+    auto range = by_name.equal_range(name);
+    size_t found = tables.size();
+    for (auto it = range.first; it != range.second; ++it) {
+      if (tables[it->second].schema_name == schema_name)
+        return it->second;
+      if (found == tables.size())
+        found = it->second;
+    }
+    return found;
+  };
+  auto indexOf = [&](const FkGraph::TableName& name) {
+    auto found = by_qualified_name.find(name);
+    return found == by_qualified_name.end() ? tables.size() : found->second;
+  };
+
+  // The strongest matches, which join paths are built between.
+  std::set<size_t> seeds;
+  if (graph) {
+    for (size_t i : topMatches(options.max_detailed_tables)) {
+      if (scores[i] >= kJoinSeedScore)
+        seeds.insert(i);
+    }
+  }
+
+  std::vector<double> direct = scores;
+  for (size_t i = 0; i < tables.size(); i++) {
+    std::set<size_t> neighbours;
+    if (graph && direct[i] > 0) {
+      for (const auto& name : graph->neighbours(qualifiedName(tables[i]))) {
+        size_t target = indexOf(name);
+        if (target < tables.size() && target != i)
+          neighbours.insert(target);
+      }
+    } else if (!graph && details.count(i)) {
+      for (const auto& column : details[i].columns) {
+        if (!column.is_foreign_key)
+          continue;
+        size_t target = resolve(column.foreign_table, tables[i].schema_name);
+        if (target < tables.size() && target != i)
+          neighbours.insert(target);
+      }
+    }
+    // The graph is undirected and visits both ends of a key; fetched
+    // details only know the referencing end.
+    for (size_t target : neighbours) {
+      scores[target] += kForeignKeyShare * direct[i];
+      if (!graph)
+        scores[i] += kForeignKeyShare * direct[target];
+    }
+  }
+
+  for (size_t i = 0; i < tables.size(); i++) {
+    if (scores[i] > 0) {
+      scores[i] +=
+          kRowCountWeight *
+          std::log10(1.0 + std::max<int64_t>(tables[i].estimated_rows, 0));
+    }
+  }
+
+  // Tables needed to join the matches rank with the weakest of them.
+  std::set<size_t> join_tables;
+  if (seeds.size() > 1) {
+    std::vector<FkGraph::TableName> seed_names;
+    double weakest = scores[*seeds.begin()];
+    for (size_t i : seeds) {
+      seed_names.push_back(qualifiedName(tables[i]));
+      weakest = std::min(weakest, scores[i]);
+    }
+    auto listed = [&](const FkGraph::TableName& name) {
+      return by_qualified_name.count(name) > 0;
+    };
+    for (const auto& name : graph->connect(seed_names, kMaxJoinHops, listed)) {
+      size_t i = indexOf(name);
+      if (i < tables.size()) {
+        join_tables.insert(i);
+        scores[i] = std::max(scores[i], weakest);
+      }
+    }
+  }
+  auto mayDetail = [&](size_t i) {
+    return seeds.empty() || seeds.count(i) || join_tables.count(i);
+  };
+  size_t detail_limit = options.max_detailed_tables + join_tables.size();
+
+  // Tables promoted by keys may still lack details.
+  std::vector<size_t> missing;
+  for (size_t i : topMatches(detail_limit)) {
+    if (!details.count(i) && mayDetail(i))
+      missing.push_back(i);
+  }
+  fetchDetails(missing);
+
+  std::vector<size_t> order(tables.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if (scores[a] != scores[b])
+      return scores[a] > scores[b];
+    if (tables[a].estimated_rows != tables[b].estimated_rows)
+      return tables[a].estimated_rows > tables[b].estimated_rows;
+    return qualifiedName(tables[a]) < qualifiedName(tables[b]);
+  });
+
+  // Selected tables are written in name order, so requests that select the
+  // same tables share a byte-identical prompt prefix (provider-side caching).
+  const std::string header =
+      "=== DATABASE SCHEMA ===\n"
+      "Tables in this database:\n\n";
+  // Room is kept for the longer footer, which also carries the omitted count.
+  const std::string complete_footer =
+      "\nCRITICAL: If user asks for tables not listed above, return an error "
+      "with available table names.\n"
+      "Do NOT query information_schema or pg_catalog tables.\n";
+  const std::string partial_footer =
+      "\nOnly the tables listed above may be used; other tables in the "
+      "database were left out as unrelated to the request.\n"
+      "Do NOT query information_schema or pg_catalog tables.\n";
+
+  const std::string omitted_line = "- ... 1000000 more tables not shown\n";
+  size_t used = estimateTokens(header) +
+                std::max(estimateTokens(complete_footer),
+                         estimateTokens(omitted_line + partial_footer));
+
+  PackedContext packed;
+  std::map<FkGraph::TableName, std::string> listed;
+  std::map<FkGraph::TableName, std::string> detailed;
+  for (size_t i : order) {
+    std::string line = tableLine(tables[i]);
+    size_t line_tokens = estimateTokens(line);
+
+    auto table_details = details.find(i);
+    if (scores[i] > 0 && packed.detailed_tables < detail_limit &&
+        mayDetail(i) && table_details != details.end()) {
+      std::string block = "\n" + format(table_details->second);
+      size_t block_tokens = estimateTokens(block);
+      if (used + line_tokens + block_tokens <= options.token_budget) {
+        listed.emplace(qualifiedName(tables[i]), line);
+        detailed.emplace(qualifiedName(tables[i]), block);
+        used += line_tokens + block_tokens;
+        packed.detailed_tables++;
+        packed.listed_tables++;
+        continue;
+      }
+    }
+
+    if (used + line_tokens > options.token_budget)
+      break;
+    listed.emplace(qualifiedName(tables[i]), line);
+    used += line_tokens;
+    packed.listed_tables++;
+  }
+  packed.omitted_tables = tables.size() - packed.listed_tables;
+
+  std::string listing;
+  for (const auto& [name, line] : listed)
+    listing += line;
+  std::string detail_blocks;
+  for (const auto& [name, block] : detailed)
+    detail_blocks += block;
+
+  std::ostringstream text;
+  text << header;
+  if (tables.empty())
+    text << "- No user tables found in database\n";
+  text << listing;
+  if (packed.omitted_tables > 0) {
+    text << "- ... " << packed.omitted_tables << " more tables not shown\n";
+    text << partial_footer;
+  } else {
+    text << complete_footer;
+  }
+  text << detail_blocks;
+
+  packed.text = text.str();
+  packed.estimated_tokens = estimateTokens(packed.text);
+  return packed;
+}
+
+}  // namespace pg_ai
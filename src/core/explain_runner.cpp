@@ -0,0 +1,193 @@
+#include "../include/explain_runner.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <access/xact.h>
+#include <executor/spi.h>
+#include <miscadmin.h>
+#include <storage/latch.h>
+#include <utils/memutils.h>
+#include <utils/resowner.h>
+#include <utils/timeout.h>
+}
+
+#include <algorithm>
+#include <cctype>
+#include <csignal>
+
+#include "../include/logger.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+constexpr const char* kAnalyzeOptions =
+    "EXPLAIN (ANALYZE, VERBOSE, COSTS, SETTINGS, BUFFERS, FORMAT JSON) ";
+constexpr const char* kPlanOptions =
+    "EXPLAIN (VERBOSE, COSTS, SETTINGS, FORMAT JSON) ";
+
+// Set by the timeout handler, to tell our cancel from the user's
+volatile sig_atomic_t timed_out = false;
+bool timeout_registered = false;
+TimeoutId timeout_id;
+
+// Runs in the signal handler: raise a query cancel like statement_timeout.
+void onTimeout() {
+  timed_out = true;
+  QueryCancelPending = true;
+  InterruptPending = true;
+  SetLatch(MyLatch);
+}
+
+struct Attempt {
+  char* output;  // NULL on error
+  char* error;
+  bool timed_out;
+};
+
+// Runs one EXPLAIN in a subtransaction that is rolled back whatever
+// happens. Strings are allocated in the caller's memory context. An error
+// longjmps out of PG_TRY, so no C++ object with a destructor may live in
+// it.
+Attempt explainRolledBack(const char* sql, int timeout_ms) {
+  MemoryContext caller_context = CurrentMemoryContext;
+  ResourceOwner caller_owner = CurrentResourceOwner;
+  char* volatile output = nullptr;
+  char* volatile error = nullptr;
+  volatile bool bounded = timeout_ms > 0;
+  Attempt attempt{nullptr, nullptr, false};
+
+  if (bounded && !timeout_registered) {
+    timeout_id = RegisterTimeout(USER_TIMEOUT, onTimeout);
+    timeout_registered = true;
+  }
+
+  BeginInternalSubTransaction(nullptr);
+  MemoryContextSwitchTo(caller_context);
+  PG_TRY();
+  {
+    if (SPI_connect() != SPI_OK_CONNECT)
+      elog(ERROR, "Failed to connect to SPI");
+    if (bounded) {
+      timed_out = false;
+      enable_timeout_after(timeout_id, timeout_ms);
+    }
+    int ret = SPI_execute(sql, false, 0);
+    if (bounded) {
+      disable_timeout(timeout_id, false);
+      // Finished just as the time ran out: drop the cancel we raised.
+      if (timed_out)
+        QueryCancelPending = false;
+    }
+
+    if (ret < 0) {
+      error = MemoryContextStrdup(
+          caller_context,
+          psprintf("Failed to execute EXPLAIN query: %s",
+                   SPI_result_code_string(ret)));
+    } else if (SPI_processed == 0) {
+      error = MemoryContextStrdup(caller_context,
+                                  "No output from EXPLAIN query");
+    } else {
+      char* value = SPI_getvalue(SPI_tuptable->vals[0],
+                                 SPI_tuptable->tupdesc, 1);
+      if (value)
+        output = MemoryContextStrdup(caller_context, value);
+      else
+        error = MemoryContextStrdup(caller_context,
+                                    "Failed to get EXPLAIN output");
+    }
+    SPI_finish();
+
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(caller_context);
+    CurrentResourceOwner = caller_owner;
+  }
+  PG_CATCH();
+  {
+    if (bounded)
+      disable_timeout(timeout_id, false);
+    MemoryContextSwitchTo(caller_context);
+    ErrorData* edata = CopyErrorData();
+    FlushErrorState();
+
+    // Also ends the SPI connection made in the subtransaction.
+    RollbackAndReleaseCurrentSubTransaction();
+    MemoryContextSwitchTo(caller_context);
+    CurrentResourceOwner = caller_owner;
+
+    attempt.timed_out =
+        bounded && timed_out && edata->sqlerrcode == ERRCODE_QUERY_CANCELED;
+    error = edata->message
+                ? edata->message
+                : MemoryContextStrdup(caller_context, "EXPLAIN failed");
+  }
+  PG_END_TRY();
+
+  attempt.output = output;
+  attempt.error = error;
+  return attempt;
+}
+
+}  // namespace
+
+std::optional<ExplainMode> ExplainRunner::parseMode(const std::string& name) {
+  std::string lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (lower == "plan")
+    return ExplainMode::PLAN;
+  if (lower == "analyze")
+    return ExplainMode::ANALYZE;
+  if (lower == "bounded")
+    return ExplainMode::BOUNDED;
+  return std::nullopt;
+}
+
+std::string ExplainRunner::modeName(ExplainMode mode) {
+  switch (mode) {
+    case ExplainMode::PLAN:
+      return "plan";
+    case ExplainMode::ANALYZE:
+      return "analyze";
+    case ExplainMode::BOUNDED:
+      return "bounded";
+  }
+  return "analyze";
+}
+
+ExplainRunner::Output ExplainRunner::run(const std::string& query,
+                                         ExplainMode mode,
+                                         int timeout_ms) {
+  Output output;
+  std::string plan_sql = kPlanOptions + query;
+  std::string analyze_sql = kAnalyzeOptions + query;
+
+  Attempt attempt{nullptr, nullptr, false};
+  if (mode == ExplainMode::PLAN) {
+    attempt = explainRolledBack(plan_sql.c_str(), 0);
+  } else {
+    int bound = mode == ExplainMode::BOUNDED ? std::max(timeout_ms, 1) : 0;
+    attempt = explainRolledBack(analyze_sql.c_str(), bound);
+    output.shown = ExplainMode::ANALYZE;
+    if (attempt.timed_out) {
+      logger::Logger::info("EXPLAIN ANALYZE stopped after " +
+                           std::to_string(bound) +
+                           " ms, explaining the plan instead");
+      output.timed_out = true;
+      output.shown = ExplainMode::PLAN;
+      attempt = explainRolledBack(plan_sql.c_str(), 0);
+    }
+  }
+
+  if (!attempt.output) {
+    output.error_message = attempt.error ? attempt.error : "EXPLAIN failed";
+    return output;
+  }
+  output.explain_output = attempt.output;
+  output.success = true;
+  return output;
+}
+
+}  // namespace pg_ai
@@ -0,0 +1,146 @@
+#include "../include/fk_graph.hpp"
+
+#include <algorithm>
+#include <deque>
+
+namespace pg_ai {
+
+FkGraph::FkGraph(const std::vector<ForeignKeyInfo>& foreign_keys) {
+  for (const auto& key : foreign_keys) {
+    size_t from = intern({key.schema_name, key.table_name});
+    size_t to = intern({key.foreign_schema_name, key.foreign_table_name});
+    // Self-references never help a join between different tables.
+    if (from == to)
+      continue;
+    adjacency_[from].push_back(to);
+    adjacency_[to].push_back(from);
+  }
+  // Sorted neighbours keep search results stable across rebuilds.
+  for (auto& edges : adjacency_) {
+    std::sort(edges.begin(), edges.end(), [this](size_t a, size_t b) {
+      return names_[a] < names_[b];
+    });
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  }
+}
+
+size_t FkGraph::find(const TableName& table) const {
+  auto found = ids_.find(table);
+  return found == ids_.end() ? kNone : found->second;
+}
+
+size_t FkGraph::intern(const TableName& table) {
+  auto [it, inserted] = ids_.emplace(table, names_.size());
+  if (inserted) {
+    names_.push_back(table);
+    adjacency_.emplace_back();
+  }
+  return it->second;
+}
+
+std::vector<FkGraph::TableName> FkGraph::neighbours(
+    const TableName& table) const {
+  std::vector<TableName> result;
+  size_t id = find(table);
+  if (id == kNone)
+    return result;
+  for (size_t next : adjacency_[id]) {
+    result.push_back(names_[next]);
+  }
+  return result;
+}
+
+std::vector<size_t> FkGraph::search(size_t from,
+                                    const std::vector<bool>& targets,
+                                    size_t max_hops,
+                                    const TableFilter& allowed) const {
+  if (targets[from])
+    return {from};
+
+  std::vector<size_t> parent(names_.size(), kNone);
+  std::vector<size_t> depth(names_.size(), 0);
+  std::deque<size_t> queue = {from};
+  parent[from] = from;
+  while (!queue.empty()) {
+    size_t current = queue.front();
+    queue.pop_front();
+    if (depth[current] >= max_hops)
+      continue;
+    for (size_t next : adjacency_[current]) {
+      if (parent[next] != kNone)
+        continue;
+      parent[next] = current;
+      depth[next] = depth[current] + 1;
+      if (targets[next]) {
+        std::vector<size_t> path = {next};
+        while (path.back() != from) {
+          path.push_back(parent[path.back()]);
+        }
+        std::reverse(path.begin(), path.end());
+        return path;
+      }
+      // Endpoints are always usable; only the tables in between are filtered.
+      if (allowed && !allowed(names_[next]))
+        continue;
+      queue.push_back(next);
+    }
+  }
+  return {};
+}
+
+std::vector<FkGraph::TableName> FkGraph::shortestPath(
+    const TableName& from,
+    const TableName& to,
+    size_t max_hops,
+    const TableFilter& allowed) const {
+  std::vector<TableName> result;
+  size_t source = find(from);
+  size_t target = find(to);
+  if (source == kNone || target == kNone)
+    return result;
+
+  std::vector<bool> targets(names_.size(), false);
+  targets[target] = true;
+  for (size_t id : search(source, targets, max_hops, allowed)) {
+    result.push_back(names_[id]);
+  }
+  return result;
+}
+
+std::vector<FkGraph::TableName> FkGraph::connect(
+    const std::vector<TableName>& tables,
+    size_t max_hops,
+    const TableFilter& allowed) const {
+  std::vector<TableName> added;
+  std::vector<bool> in_tree(names_.size(), false);
+  bool tree_empty = true;
+
+  for (const auto& table : tables) {
+    size_t id = find(table);
+    if (id == kNone)
+      continue;
+    if (!tree_empty && !in_tree[id]) {
+      auto path = search(id, in_tree, max_hops, allowed);
+      for (size_t node : path) {
+        if (in_tree[node])
+          continue;
+        in_tree[node] = true;
+        if (node != id)
+          added.push_back(names_[node]);
+      }
+    }
+    in_tree[id] = true;
+    tree_empty = false;
+  }
+
+  // A table given as input may have been added as part of an earlier path.
+  added.erase(std::remove_if(added.begin(), added.end(),
+                             [&](const TableName& name) {
+                               return std::find(tables.begin(), tables.end(),
+                                                name) != tables.end();
+                             }),
+              added.end());
+  return added;
+}
+
+}  // namespace pg_ai
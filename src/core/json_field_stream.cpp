@@ -0,0 +1,150 @@
+#include "../include/json_field_stream.hpp"
+
+#include <cctype>
+#include <utility>
+
+namespace pg_ai {
+
+JsonFieldStream::JsonFieldStream(std::string field)
+    : field_(std::move(field)) {}
+
+void JsonFieldStream::appendCodePoint(unsigned code_point) {
+  std::string& out = string_is_key_ ? key_ : value_;
+  if (!string_is_key_ && !capture_)
+    return;
+  if (code_point < 0x80) {
+    out += static_cast<char>(code_point);
+  } else if (code_point < 0x800) {
+    out += static_cast<char>(0xC0 | (code_point >> 6));
+    out += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else if (code_point < 0x10000) {
+    out += static_cast<char>(0xE0 | (code_point >> 12));
+    out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (code_point >> 18));
+    out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (code_point & 0x3F));
+  }
+}
+
+void JsonFieldStream::finishString() {
+  state_ = State::OUTSIDE;
+  if (string_is_key_) {
+    expect_key_ = false;
+  } else if (capture_) {
+    capture_ = false;
+    complete_ = true;
+  }
+}
+
+void JsonFieldStream::feed(std::string_view chunk) {
+  for (char c : chunk) {
+    if (complete_)
+      return;
+
+    switch (state_) {
+      case State::IN_STRING:
+        if (c == '\\') {
+          state_ = State::IN_ESCAPE;
+        } else if (c == '"') {
+          finishString();
+        } else if (string_is_key_) {
+          key_ += c;
+        } else if (capture_) {
+          value_ += c;
+        }
+        break;
+
+      case State::IN_ESCAPE: {
+        state_ = State::IN_STRING;
+        char decoded = c;
+        switch (c) {
+          case 'n':
+            decoded = '\n';
+            break;
+          case 't':
+            decoded = '\t';
+            break;
+          case 'r':
+            decoded = '\r';
+            break;
+          case 'b':
+            decoded = '\b';
+            break;
+          case 'f':
+            decoded = '\f';
+            break;
+          case 'u':
+            state_ = State::IN_UNICODE;
+            hex_.clear();
+            continue;
+          default:
+            break;  // \" \\ \/ stand for themselves
+        }
+        appendCodePoint(static_cast<unsigned char>(decoded));
+        break;
+      }
+
+      case State::IN_UNICODE: {
+        if (!std::isxdigit(static_cast<unsigned char>(c))) {
+          state_ = State::IN_STRING;
+          break;
+        }
+        hex_ += c;
+        if (hex_.size() < 4)
+          break;
+        state_ = State::IN_STRING;
+        unsigned code_point = std::stoul(hex_, nullptr, 16);
+        if (code_point >= 0xD800 && code_point < 0xDC00) {
+          high_surrogate_ = code_point;
+        } else if (code_point >= 0xDC00 && code_point < 0xE000 &&
+                   high_surrogate_ != 0) {
+          appendCodePoint(0x10000 + ((high_surrogate_ - 0xD800) << 10) +
+                          (code_point - 0xDC00));
+          high_surrogate_ = 0;
+        } else {
+          appendCodePoint(code_point);
+        }
+        break;
+      }
+
+      case State::OUTSIDE:
+        // Text before the object, e.g. a ```json fence.
+        if (depth_ == 0 && c != '{')
+          break;
+        if (c == '"') {
+          state_ = State::IN_STRING;
+          string_is_key_ = depth_ == 1 && expect_key_;
+          capture_ = !string_is_key_ && field_next_;
+          field_next_ = false;
+          if (string_is_key_)
+            key_.clear();
+        } else if (c == '{' || c == '[') {
+          // A nested value of the field means it is not a string.
+          if (field_next_) {
+            complete_ = true;
+            return;
+          }
+          depth_++;
+          expect_key_ = c == '{' && depth_ == 1;
+        } else if (c == '}' || c == ']') {
+          if (depth_ > 0)
+            depth_--;
+        } else if (c == ',' && depth_ == 1) {
+          expect_key_ = true;
+        } else if (c == ':' && depth_ == 1) {
+          field_next_ = key_ == field_;
+          key_.clear();
+        } else if (field_next_ &&
+                   !std::isspace(static_cast<unsigned char>(c))) {
+          // null, a number or a boolean
+          complete_ = true;
+        }
+        break;
+    }
+  }
+}
+
+}  // namespace pg_ai
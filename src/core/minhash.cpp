@@ -0,0 +1,142 @@
+#include "../include/minhash.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+
+#include "../include/context_packer.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+// Words that do not change what is asked for. Unlike the schema ranking's
+// stop words this keeps "last", "top", "first", "not" and the like.
+const std::unordered_set<std::string>& fillerWords() {
+  static const std::unordered_set<std::string> words = {
+      "a",    "an",     "the",  "me",   "us",      "i",    "we",
+      "my",   "our",    "s",    "show", "list",    "give", "get",
+      "find", "display", "return", "please", "can", "could", "would",
+      "you",  "want",   "need", "query", "sql",  "all",     "of",   "for"};
+  return words;
+}
+
+uint64_t fnv1a(const std::string& text) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+uint64_t mix(uint64_t x) {
+  // splitmix64 finalizer
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+std::vector<std::string> MinHash::features(const std::string& request) {
+  std::vector<std::string> result;
+  std::string word;
+  auto flush = [&]() {
+    if (!word.empty() && !fillerWords().count(word))
+      result.push_back(ContextPacker::stem(word));
+    word.clear();
+  };
+  for (char c : request) {
+    if (std::isalnum(static_cast<unsigned char>(c))) {
+      word += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    } else {
+      flush();
+    }
+  }
+  flush();
+
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+std::string MinHash::literals(const std::string& request) {
+  std::string result;
+  for (size_t i = 0; i < request.size();) {
+    char c = request[i];
+    if (c == '\'' || c == '"') {
+      size_t end = request.find(c, i + 1);
+      if (end == std::string::npos)
+        end = request.size() - 1;
+      result += request.substr(i, end - i + 1);
+      result += '\0';
+      i = end + 1;
+    } else if (std::isdigit(static_cast<unsigned char>(c))) {
+      size_t end = i;
+      while (end < request.size() &&
+             (std::isdigit(static_cast<unsigned char>(request[end])) ||
+              request[end] == '.'))
+        end++;
+      result += request.substr(i, end - i);
+      result += '\0';
+      i = end;
+    } else if (std::isalpha(static_cast<unsigned char>(c))) {
+      // Digits inside words ("q3", "utf8") are part of the word.
+      while (i < request.size() &&
+             std::isalnum(static_cast<unsigned char>(request[i])))
+        i++;
+    } else {
+      i++;
+    }
+  }
+  return result;
+}
+
+MinHash::Signature MinHash::signature(
+    const std::vector<std::string>& features) {
+  Signature signature;
+  signature.fill(UINT32_MAX);
+  for (const auto& feature : features) {
+    uint64_t base = fnv1a(feature);
+    for (size_t i = 0; i < kSize; i++) {
+      auto value = static_cast<uint32_t>(mix(base ^ mix(i)) >> 32);
+      signature[i] = std::min(signature[i], value);
+    }
+  }
+  return signature;
+}
+
+MinHash::Bands MinHash::bands(const Signature& signature) {
+  Bands result;
+  for (size_t band = 0; band < kBands; band++) {
+    uint64_t hash = mix(band);
+    for (size_t row = 0; row < kRowsPerBand; row++)
+      hash = mix(hash ^ signature[band * kRowsPerBand + row]);
+    result[band] = hash;
+  }
+  return result;
+}
+
+double MinHash::jaccard(const std::vector<std::string>& a,
+                        const std::vector<std::string>& b) {
+  if (a.empty() && b.empty())
+    return 1.0;
+  std::vector<std::string> common;
+  std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                        std::back_inserter(common));
+  size_t united = a.size() + b.size() - common.size();
+  return static_cast<double>(common.size()) / static_cast<double>(united);
+}
+
+double MinHash::estimate(const Signature& a, const Signature& b) {
+  size_t equal = 0;
+  for (size_t i = 0; i < kSize; i++) {
+    if (a[i] == b[i])
+      equal++;
+  }
+  return static_cast<double>(equal) / kSize;
+}
+
+}  // namespace pg_ai
@@ -0,0 +1,116 @@
+#include "../include/model_router.hpp"
+
+#include <cctype>
+#include <unordered_set>
+
+#include "../include/context_packer.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+// Matched against both the word and its stem, so "totals" and "ranking"
+// count as well.
+const std::unordered_set<std::string>& aggregateTerms() {
+  static const std::unordered_set<std::string> terms = {
+      "sum",       "total",     "average", "avg",     "mean",       "median",
+      "max",       "maximum",   "min",     "minimum", "group",      "per",
+      "each",      "distinct",  "ratio",   "percent", "percentage", "share",
+      "breakdown", "aggregate", "count"};
+  return terms;
+}
+
+const std::unordered_set<std::string>& analyticTerms() {
+  static const std::unordered_set<std::string> terms = {
+      "rank",      "ranking",    "running",    "cumulative", "moving",
+      "rolling",   "previous",   "prior",      "growth",     "trend",
+      "compare",   "comparison", "compared",   "versus",     "vs",
+      "lag",       "lead",       "percentile", "partition",  "window",
+      "retention", "cohort",     "yoy",        "mom"};
+  return terms;
+}
+
+constexpr double kTableWeight = 1.0;
+constexpr double kAggregateWeight = 1.0;
+constexpr double kAnalyticWeight = 2.0;
+constexpr double kWordsPerPoint = 12.0;
+constexpr double kContextTokensPerPoint = 1500.0;
+
+ModelRouter::Stats counters;
+
+}  // namespace
+
+ModelRouter::Features ModelRouter::features(const std::string& request,
+                                            size_t tables,
+                                            size_t context_tokens) {
+  Features result;
+  result.tables = tables;
+  result.context_tokens = context_tokens;
+
+  std::unordered_set<std::string> seen;
+  std::string word;
+  auto flush = [&]() {
+    if (word.empty())
+      return;
+    result.words++;
+    std::string stemmed = ContextPacker::stem(word);
+    auto is = [&](const std::unordered_set<std::string>& terms) {
+      return terms.count(word) || terms.count(stemmed);
+    };
+    if (seen.insert(stemmed).second) {
+      if (is(analyticTerms()))
+        result.analytic_terms++;
+      else if (is(aggregateTerms()))
+        result.aggregate_terms++;
+    }
+    word.clear();
+  };
+  for (char c : request) {
+    if (std::isalnum(static_cast<unsigned char>(c))) {
+      word += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    } else {
+      flush();
+    }
+  }
+  flush();
+  return result;
+}
+
+double ModelRouter::score(const Features& features) {
+  // One table is a lookup; every further one is a join.
+  double joins = features.tables > 1 ? features.tables - 1 : 0;
+  return kTableWeight * joins +
+         kAggregateWeight * features.aggregate_terms +
+         kAnalyticWeight * features.analytic_terms +
+         features.words / kWordsPerPoint +
+         features.context_tokens / kContextTokensPerPoint;
+}
+
+ModelRouter::Decision ModelRouter::route(const Features& features,
+                                         double threshold) {
+  Decision decision;
+  decision.features = features;
+  decision.score = score(features);
+  decision.tier = decision.score < threshold ? Tier::FAST : Tier::STRONG;
+  return decision;
+}
+
+const char* ModelRouter::tierName(Tier tier) {
+  return tier == Tier::FAST ? "fast" : "strong";
+}
+
+void ModelRouter::record(Tier tier, uint64_t latency_ms) {
+  if (tier == Tier::FAST) {
+    counters.fast_calls++;
+    counters.fast_latency_ms += latency_ms;
+  } else {
+    counters.strong_calls++;
+    counters.strong_latency_ms += latency_ms;
+  }
+}
+
+ModelRouter::Stats ModelRouter::stats() {
+  return counters;
+}
+
+}  // namespace pg_ai
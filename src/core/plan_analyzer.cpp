@@ -0,0 +1,329 @@
+#include "../include/plan_analyzer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <nlohmann/json.hpp>
+
+namespace pg_ai {
+
+namespace {
+
+using json = nlohmann::json;
+
+// How far past its threshold a finding becomes critical
+constexpr double kCriticalScale = 100;
+// Sort spills of at least this many kB are critical
+constexpr double kCriticalSpillKb = 1024.0 * 1024.0;
+
+double number(const json& node, const char* key, double fallback = 0) {
+  auto found = node.find(key);
+  if (found == node.end() || !found->is_number())
+    return fallback;
+  return found->get<double>();
+}
+
+std::string text(const json& node, const char* key) {
+  auto found = node.find(key);
+  if (found == node.end() || !found->is_string())
+    return "";
+  return found->get<std::string>();
+}
+
+std::string rows(double value) {
+  return std::to_string(std::llround(value));
+}
+
+std::string percent(double share) {
+  return std::to_string(std::lround(share * 100)) + "%";
+}
+
+std::string relationOf(const json& node) {
+  std::string relation = text(node, "Relation Name");
+  std::string schema = text(node, "Schema");
+  if (!relation.empty() && !schema.empty())
+    return schema + "." + relation;
+  return relation;
+}
+
+std::string describe(const json& node) {
+  std::string relation = relationOf(node);
+  std::string type = text(node, "Node Type");
+  return relation.empty() ? type : type + " on " + relation;
+}
+
+bool analyzed(const json& node) {
+  return node.contains("Actual Rows");
+}
+
+// Rows a node produced over all of its loops, or the estimate for one loop
+double producedRows(const json& node) {
+  if (analyzed(node))
+    return number(node, "Actual Rows") * number(node, "Actual Loops", 1);
+  return number(node, "Plan Rows");
+}
+
+class Walker {
+ public:
+  Walker(const PlanAnalyzer::Options& options,
+         std::vector<PlanAnalyzer::Finding>& findings)
+      : options_(options), findings_(findings) {}
+
+  void visit(const json& node, const std::string& path) {
+    checkSeqScan(node, path);
+    checkMisestimate(node, path);
+    checkSpill(node, path);
+    checkNestedLoop(node, path);
+    checkHeapFetches(node, path);
+
+    auto children = node.find("Plans");
+    if (children == node.end() || !children->is_array())
+      return;
+    for (size_t i = 0; i < children->size(); i++) {
+      visit((*children)[i], path + ".Plans[" + std::to_string(i) + "]");
+    }
+  }
+
+ private:
+  void add(PlanAnalyzer::Severity severity,
+           const char* rule,
+           const std::string& path,
+           const json& node,
+           const std::string& message,
+           const std::string& relation) {
+    findings_.push_back({severity, rule, path, text(node, "Node Type"),
+                         relation, message});
+  }
+
+  void add(PlanAnalyzer::Severity severity,
+           const char* rule,
+           const std::string& path,
+           const json& node,
+           const std::string& message) {
+    add(severity, rule, path, node, message, relationOf(node));
+  }
+
+  void checkSeqScan(const json& node, const std::string& path) {
+    if (text(node, "Node Type") != "Seq Scan")
+      return;
+    bool filtered = node.contains("Filter");
+
+    if (!analyzed(node)) {
+      double expected = number(node, "Plan Rows");
+      if (expected >= options_.large_scan_rows) {
+        add(PlanAnalyzer::Severity::INFO, "seq_scan", path, node,
+            describe(node) + " is expected to return " + rows(expected) +
+                " rows");
+      }
+      return;
+    }
+
+    double loops = number(node, "Actual Loops", 1);
+    double returned = number(node, "Actual Rows");
+    double removed = number(node, "Rows Removed by Filter");
+    double read = (returned + removed) * loops;
+    if (read < options_.large_scan_rows)
+      return;
+
+    double discarded = removed / std::max(returned + removed, 1.0);
+    std::string message = describe(node) + " reads " + rows(read) + " rows";
+    auto severity = PlanAnalyzer::Severity::INFO;
+    if (filtered) {
+      message += " and its filter discards " + percent(discarded);
+      if (discarded >= 0.9) {
+        severity = read >= options_.large_scan_rows * kCriticalScale
+                       ? PlanAnalyzer::Severity::CRITICAL
+                       : PlanAnalyzer::Severity::WARNING;
+        message += "; an index on the filtered columns may avoid the scan";
+      }
+    }
+    if (loops > 1)
+      message += " (over " + rows(loops) + " loops)";
+    add(severity, "seq_scan", path, node, message);
+  }
+
+  void checkMisestimate(const json& node, const std::string& path) {
+    if (!analyzed(node) || number(node, "Actual Loops") <= 0)
+      return;
+    double actual = std::max(number(node, "Actual Rows"), 1.0);
+    double expected = std::max(number(node, "Plan Rows"), 1.0);
+    double factor = std::max(actual / expected, expected / actual);
+    if (factor < options_.misestimate_factor)
+      return;
+
+    auto severity = factor >= options_.misestimate_factor * 10
+                        ? PlanAnalyzer::Severity::CRITICAL
+                        : PlanAnalyzer::Severity::WARNING;
+    add(severity, "row_misestimate", path, node,
+        describe(node) + " was estimated at " +
+            rows(number(node, "Plan Rows")) + " rows per loop but returned " +
+            rows(number(node, "Actual Rows")) + " (" + rows(factor) + "x " +
+            (actual > expected ? "under" : "over") +
+            "); stale statistics or correlated conditions, try ANALYZE or "
+            "CREATE STATISTICS");
+  }
+
+  void checkSpill(const json& node, const std::string& path) {
+    std::string type = text(node, "Node Type");
+
+    if (type == "Sort" || type == "Incremental Sort") {
+      std::string method = text(node, "Sort Method");
+      if (text(node, "Sort Space Type") != "Disk" &&
+          method.find("external") == std::string::npos)
+        return;
+      double kb = number(node, "Sort Space Used");
+      add(kb >= kCriticalSpillKb ? PlanAnalyzer::Severity::CRITICAL
+                                 : PlanAnalyzer::Severity::WARNING,
+          "disk_spill", path, node,
+          type + " spills " + rows(kb) + " kB to disk (" + method +
+              "); raise work_mem or sort fewer rows");
+      return;
+    }
+
+    if (type == "Hash") {
+      double batches = number(node, "Hash Batches", 1);
+      if (batches <= 1)
+        return;
+      add(PlanAnalyzer::Severity::WARNING, "disk_spill", path, node,
+          "Hash table was split into " + rows(batches) + " batches (" +
+              rows(number(node, "Original Hash Batches", 1)) +
+              " planned) and spills to disk; raise work_mem or hash the "
+              "smaller side");
+      return;
+    }
+
+    if (type == "Aggregate") {
+      double batches = number(node, "HashAgg Batches", 1);
+      double kb = number(node, "Disk Usage");
+      if (batches <= 1 && kb <= 0)
+        return;
+      add(PlanAnalyzer::Severity::WARNING, "disk_spill", path, node,
+          "HashAggregate spills " + rows(kb) + " kB to disk in " +
+              rows(batches) + " batches; raise work_mem or "
+              "hash_mem_multiplier");
+    }
+  }
+
+  void checkNestedLoop(const json& node, const std::string& path) {
+    if (text(node, "Node Type") != "Nested Loop")
+      return;
+    auto children = node.find("Plans");
+    if (children == node.end() || !children->is_array())
+      return;
+    const json* outer = nullptr;
+    const json* inner = nullptr;
+    for (const auto& child : *children) {
+      std::string relationship = text(child, "Parent Relationship");
+      if (relationship == "Outer")
+        outer = &child;
+      else if (relationship == "Inner")
+        inner = &child;
+    }
+    if (!outer || !inner)
+      return;
+
+    double loops = 0;
+    double inner_rows = 0;
+    if (analyzed(*inner)) {
+      loops = number(*inner, "Actual Loops", 1);
+      inner_rows = producedRows(*inner);
+    } else {
+      loops = number(*outer, "Plan Rows");
+      inner_rows = loops * number(*inner, "Plan Rows");
+    }
+    if (inner_rows < options_.nested_loop_inner_rows)
+      return;
+
+    // A sequential scan repeated per outer row is the worst case.
+    bool rescans = text(*inner, "Node Type") == "Seq Scan" && loops > 1;
+    auto severity =
+        rescans || inner_rows >= options_.nested_loop_inner_rows *
+                                     kCriticalScale
+            ? PlanAnalyzer::Severity::CRITICAL
+            : PlanAnalyzer::Severity::WARNING;
+    add(severity, "nested_loop", path, node,
+        "Nested Loop runs its inner side (" + describe(*inner) + ") " +
+            rows(loops) + " times for " + rows(inner_rows) +
+            " rows in total; a hash or merge join, or an index on the join "
+            "key, may be faster",
+        relationOf(*inner));
+  }
+
+  void checkHeapFetches(const json& node, const std::string& path) {
+    if (text(node, "Node Type") != "Index Only Scan" || !analyzed(node))
+      return;
+    double fetches = number(node, "Heap Fetches");
+    double returned = producedRows(node);
+    if (fetches < options_.min_heap_fetches ||
+        fetches < options_.heap_fetch_share * returned)
+      return;
+    add(PlanAnalyzer::Severity::WARNING, "heap_fetches", path, node,
+        describe(node) + " fetched " + rows(fetches) + " of " +
+            rows(returned) +
+            " rows from the table; VACUUM it so the visibility map lets "
+            "the scan skip the heap");
+  }
+
+  const PlanAnalyzer::Options& options_;
+  std::vector<PlanAnalyzer::Finding>& findings_;
+};
+
+}  // namespace
+
+PlanAnalyzer::Analysis PlanAnalyzer::analyze(
+    const std::string& explain_json) {
+  return analyze(explain_json, Options());
+}
+
+PlanAnalyzer::Analysis PlanAnalyzer::analyze(const std::string& explain_json,
+                                             const Options& options) {
+  Analysis analysis;
+  json root = json::parse(explain_json, nullptr, false);
+  if (root.is_discarded()) {
+    analysis.error_message = "EXPLAIN output is not valid JSON";
+    return analysis;
+  }
+  // EXPLAIN (FORMAT JSON) returns [{"Plan": {...}, ...}].
+  if (root.is_array() && !root.empty())
+    root = root[0];
+  if (!root.is_object() || !root.contains("Plan") ||
+      !root["Plan"].is_object()) {
+    analysis.error_message = "Not EXPLAIN (FORMAT JSON) output";
+    return analysis;
+  }
+
+  const json& plan = root["Plan"];
+  analysis.analyzed = analyzed(plan);
+  Walker(options, analysis.findings).visit(plan, "Plan");
+  std::stable_sort(analysis.findings.begin(), analysis.findings.end(),
+                   [](const Finding& a, const Finding& b) {
+                     return a.severity > b.severity;
+                   });
+  analysis.success = true;
+  return analysis;
+}
+
+std::string PlanAnalyzer::severityName(Severity severity) {
+  switch (severity) {
+    case Severity::INFO:
+      return "info";
+    case Severity::WARNING:
+      return "warning";
+    case Severity::CRITICAL:
+      return "critical";
+  }
+  return "info";
+}
+
+std::string PlanAnalyzer::formatFindings(const Analysis& analysis) {
+  if (analysis.findings.empty())
+    return "";
+  std::string text = "Problems found by rule-based checks of this plan:\n";
+  for (const auto& finding : analysis.findings) {
+    text += "- [" + severityName(finding.severity) + "] " + finding.path +
+            ": " + finding.message + "\n";
+  }
+  return text;
+}
+
+}  // namespace pg_ai
@@ -0,0 +1,664 @@
+#include "../include/provider_call.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+}
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+
+#include "../include/config.hpp"
+#include "../include/logger.hpp"
+#include "../include/token_counter.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Longest latch wait between checks of the helper thread.
+constexpr long kPollIntervalMs = 10;
+constexpr long kBaseBackoffMs = 250;
+constexpr long kMaxBackoffMs = 8000;
+// Latencies kept for the hedge delay, and how many are needed before the
+// percentile replaces [hedging] delay_ms.
+constexpr size_t kLatencySamples = 128;
+constexpr size_t kMinLatencySamples = 20;
+
+// Shared between the backend and one helper thread. Only the helper writes
+// the response; the backend may stop waiting at any time.
+struct CallState {
+  std::mutex mutex;
+  std::deque<std::string> chunks;
+  ProviderCall::Response response;
+  std::atomic<bool> done{false};
+  std::atomic<bool> abandoned{false};
+};
+
+std::atomic<int> calls_in_flight{0};
+bool exit_hook_installed = false;
+
+// Only updated on the backend thread.
+ProviderCall::Stats counters;
+std::optional<size_t> last_prefix_hash;
+// Ring buffer of recent successful call latencies
+std::vector<long> latencies_ms;
+size_t next_latency = 0;
+
+// A detached call may still be inside the SDK when the backend exits.
+// Skipping static destructors keeps it from touching torn-down state.
+void exitWithCallsInFlight(int code, Datum arg) {
+  if (calls_in_flight.load() > 0)
+    _exit(code);
+}
+
+// Items of one batch, handed out to the worker threads in order.
+struct BatchState {
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::vector<ai::GenerateOptions> requests;
+  // Tokens each request is charged by the rate limiter
+  std::vector<uint64_t> charged;
+  std::vector<ProviderCall::Response> responses;
+  std::vector<std::optional<Clock::time_point>> started;
+  std::vector<bool> finished;
+  // Given up on by the backend; a late response is dropped.
+  std::vector<bool> timed_out;
+  size_t next = 0;
+  bool abandoned = false;
+};
+
+// Authentication and request errors will not succeed on a second try.
+bool isRetryable(const std::string& message) {
+  for (const char* permanent :
+       {"400", "401", "403", "404", "invalid_api_key", "authentication",
+        "invalid_request_error", "permission"}) {
+    if (message.find(permanent) != std::string::npos)
+      return false;
+  }
+  return true;
+}
+
+// What a call costs in its bucket's token limit: the prompt and the longest
+// answer it may get. Refunded down to the actual usage afterwards.
+uint64_t chargedTokens(const RateLimiter::Bucket& bucket,
+                       const ai::GenerateOptions& options) {
+  if (bucket.token_interval_us <= 0)
+    return 0;
+  uint64_t prompt =
+      TokenCounter::count(options.model, options.system + "\n" + options.prompt)
+          .tokens;
+  int max_tokens = std::max(options.max_tokens.value_or(0), 0);
+  return prompt + static_cast<uint64_t>(max_tokens);
+}
+
+void settleUsage(const RateLimiter::Bucket& bucket,
+                 uint64_t charged,
+                 const ProviderCall::Response& response) {
+  uint64_t used = response.prompt_tokens + response.completion_tokens;
+  if (used > 0)
+    RateLimiter::refund(bucket, charged, used);
+}
+
+long backoffMs(int attempt) {
+  static thread_local std::mt19937 random{std::random_device{}()};
+  long ceiling =
+      std::min(kMaxBackoffMs, kBaseBackoffMs << std::min(attempt, 10));
+  // Equal jitter: half fixed, half random.
+  std::uniform_int_distribution<long> jitter(0, ceiling / 2);
+  return ceiling / 2 + jitter(random);
+}
+
+uint64_t elapsedMs(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                               since)
+      .count();
+}
+
+long remainingMs(Clock::time_point deadline) {
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - Clock::now());
+  return std::max<long>(left.count(), 0);
+}
+
+std::string timeoutMessage(int timeout_ms) {
+  return "Request timed out after " + std::to_string(timeout_ms) +
+         " ms (request_timeout_ms)";
+}
+
+ProviderCall::Response generateOnce(ai::Client& client,
+                                    const ai::GenerateOptions& options) {
+  ProviderCall::Response response;
+  try {
+    auto result = client.generate_text(options);
+    response.success = static_cast<bool>(result);
+    if (result)
+      response.text = result.text;
+    else
+      response.error_message = result.error_message();
+    response.prompt_tokens = result.usage.prompt_tokens;
+    response.completion_tokens = result.usage.completion_tokens;
+  } catch (const std::exception& e) {
+    response.error_message = e.what();
+  }
+  return response;
+}
+
+// Starts `body` on a detached thread that PostgreSQL's signals never reach.
+void spawn(std::function<void()> body) {
+  if (!exit_hook_installed) {
+    on_proc_exit(exitWithCallsInFlight, (Datum)0);
+    exit_hook_installed = true;
+  }
+
+  // PostgreSQL's signal handlers must only ever run on the backend thread.
+  sigset_t all_signals, previous;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &previous);
+  calls_in_flight.fetch_add(1);
+  try {
+    std::thread([body = std::move(body)]() {
+      body();
+      calls_in_flight.fetch_sub(1);
+    }).detach();
+  } catch (...) {
+    calls_in_flight.fetch_sub(1);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    throw;
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+// The helper threads below make no PostgreSQL calls and do not log.
+
+void runAttempt(std::shared_ptr<CallState> state,
+                std::shared_ptr<ai::Client> client,
+                ai::GenerateOptions options,
+                bool stream) {
+  ProviderCall::Response response;
+  try {
+    if (stream) {
+      auto events = client->stream_text(ai::StreamOptions(options));
+      response.success = true;
+      for (const auto& event : events) {
+        if (state->abandoned.load())
+          break;
+        if (event.is_error()) {
+          response.success = false;
+          response.error_message = event.error.value_or("stream failed");
+          break;
+        }
+        if (event.is_text_delta()) {
+          std::lock_guard<std::mutex> guard(state->mutex);
+          state->chunks.push_back(event.text_delta);
+        }
+      }
+    } else {
+      response = generateOnce(*client, options);
+    }
+  } catch (const std::exception& e) {
+    response.success = false;
+    response.error_message = e.what();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    state->response = std::move(response);
+  }
+  state->done.store(true);
+}
+
+void startAttempt(const std::shared_ptr<CallState>& state,
+                  const std::shared_ptr<ai::Client>& client,
+                  const ai::GenerateOptions& options,
+                  bool stream) {
+  spawn([state, client, options, stream]() {
+    runAttempt(state, client, options, stream);
+  });
+}
+
+// Takes batch items until none are left. Retries happen here, each item
+// within its own request_timeout_ms from when it was taken.
+void runBatchWorker(std::shared_ptr<BatchState> state,
+                    std::shared_ptr<ai::Client> client,
+                    RateLimiter::Bucket bucket,
+                    int timeout_ms,
+                    int max_retries,
+                    long max_wait_ms) {
+  for (;;) {
+    size_t item;
+    Clock::time_point deadline;
+    {
+      std::lock_guard<std::mutex> guard(state->mutex);
+      if (state->abandoned || state->next >= state->requests.size())
+        return;
+      item = state->next++;
+      state->started[item] = Clock::now();
+      deadline = *state->started[item] + std::chrono::milliseconds(timeout_ms);
+    }
+
+    ProviderCall::Response response;
+    for (int attempt = 0;; attempt++) {
+      // Waits for the rate limit here, on the worker's own thread.
+      std::optional<std::string> refused;
+      auto waiting_since = Clock::now();
+      for (bool waited = false;;) {
+        int64_t wait_us = RateLimiter::tryAcquire(bucket, state->charged[item]);
+        if (wait_us == 0)
+          break;
+        long wait_ms = static_cast<long>((wait_us + 999) / 1000);
+        if (static_cast<long>(elapsedMs(waiting_since)) + wait_ms >
+                max_wait_ms ||
+            wait_ms >= remainingMs(deadline)) {
+          refused = RateLimiter::reject(bucket, wait_us);
+          break;
+        }
+        if (!waited) {
+          waited = true;
+          RateLimiter::noteWait(bucket);
+        }
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (state->wakeup.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                                   [&]() { return state->abandoned; }))
+          return;
+      }
+      if (refused) {
+        response = {.success = false, .error_message = *refused};
+        break;
+      }
+
+      response = generateOnce(*client, state->requests[item]);
+      if (!response.success &&
+          RateLimiter::isRateLimited(response.error_message))
+        RateLimiter::throttle(bucket);
+      if (response.success || attempt >= max_retries ||
+          !isRetryable(response.error_message))
+        break;
+      long delay_ms = backoffMs(attempt);
+      if (delay_ms >= remainingMs(deadline))
+        break;
+      std::unique_lock<std::mutex> lock(state->mutex);
+      if (state->wakeup.wait_for(lock, std::chrono::milliseconds(delay_ms),
+                                 [&]() { return state->abandoned; }))
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(state->mutex);
+    response.latency_ms = elapsedMs(*state->started[item]);
+    if (!state->timed_out[item])
+      state->responses[item] = std::move(response);
+    state->finished[item] = true;
+  }
+}
+
+bool interruptPending() {
+  return QueryCancelPending || ProcDiePending;
+}
+
+// Sleeps on the latch until `until` or the deadline, whichever is first.
+void sleepInterruptibly(Clock::time_point until) {
+  for (;;) {
+    if (interruptPending())
+      throw CallInterrupted();
+    long wait_ms = remainingMs(until);
+    if (wait_ms <= 0)
+      return;
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    std::min(wait_ms, kPollIntervalMs), PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+  }
+}
+
+void recordCall(const ai::GenerateOptions& options) {
+  counters.calls++;
+  size_t prefix_hash = std::hash<std::string>{}(options.system);
+  if (last_prefix_hash == prefix_hash)
+    counters.prefix_repeats++;
+  last_prefix_hash = prefix_hash;
+}
+
+void recordUsage(const ProviderCall::Response& response) {
+  counters.prompt_tokens += response.prompt_tokens;
+  counters.completion_tokens += response.completion_tokens;
+}
+
+void recordLatency(Clock::time_point started) {
+  long elapsed_ms = static_cast<long>(elapsedMs(started));
+  if (latencies_ms.size() < kLatencySamples) {
+    latencies_ms.push_back(elapsed_ms);
+  } else {
+    latencies_ms[next_latency] = elapsed_ms;
+    next_latency = (next_latency + 1) % kLatencySamples;
+  }
+}
+
+// How long a call may take before it is hedged: the configured percentile
+// of recent latencies, or delay_ms until enough calls have been seen.
+long hedgeDelayMs() {
+  const auto& cfg = config::ConfigManager::getConfig();
+  if (latencies_ms.size() < kMinLatencySamples)
+    return std::max(cfg.hedging_delay_ms, 0);
+
+  std::vector<long> sorted = latencies_ms;
+  double percentile = std::clamp(cfg.hedging_percentile, 0.0, 100.0);
+  size_t rank = static_cast<size_t>(percentile / 100.0 * (sorted.size() - 1));
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
+
+// At most max_rate of the calls of this backend are hedged.
+bool hedgeAllowed() {
+  const auto& cfg = config::ConfigManager::getConfig();
+  return static_cast<double>(counters.hedges) <
+         cfg.hedging_max_rate * static_cast<double>(counters.calls);
+}
+
+bool succeeded(CallState& state) {
+  std::lock_guard<std::mutex> guard(state.mutex);
+  return state.response.success;
+}
+
+}  // namespace
+
+ProviderCall::Stats ProviderCall::stats() {
+  return counters;
+}
+
+ProviderCall::Response ProviderCall::run(std::shared_ptr<ai::Client> client,
+                                         const RateLimiter::Bucket& bucket,
+                                         const ai::GenerateOptions& options,
+                                         const ChunkHandler& on_chunk,
+                                         const HedgeFactory& hedge) {
+  const auto& cfg = config::ConfigManager::getConfig();
+  auto call_started = Clock::now();
+  auto deadline =
+      call_started +
+      std::chrono::milliseconds(std::max(cfg.request_timeout_ms, 1));
+  int max_retries = std::max(cfg.max_retries, 0);
+  bool stream = static_cast<bool>(on_chunk);
+  recordCall(options);
+  uint64_t charged = chargedTokens(bucket, options);
+
+  Response response;
+  for (int attempt = 0;; attempt++) {
+    if (auto refused =
+            RateLimiter::acquire(bucket, charged, remainingMs(deadline))) {
+      return {.success = false,
+              .error_message = *refused,
+              .latency_ms = elapsedMs(call_started)};
+    }
+
+    auto state = std::make_shared<CallState>();
+    auto attempt_started = Clock::now();
+    startAttempt(state, client, options, stream);
+
+    // Only the first attempt is hedged; retries are slow anyway.
+    std::shared_ptr<CallState> hedge_state;
+    std::optional<Clock::time_point> hedge_at;
+    if (hedge && !stream && attempt == 0)
+      hedge_at = attempt_started + std::chrono::milliseconds(hedgeDelayMs());
+    auto abandonAll = [&]() {
+      state->abandoned.store(true);
+      if (hedge_state)
+        hedge_state->abandoned.store(true);
+    };
+
+    std::string streamed;
+    bool delivered = false;
+    auto drain = [&]() {
+      std::deque<std::string> chunks;
+      {
+        std::lock_guard<std::mutex> guard(state->mutex);
+        chunks.swap(state->chunks);
+      }
+      for (auto& chunk : chunks) {
+        streamed += chunk;
+        delivered = true;
+        if (!on_chunk(chunk))
+          return false;
+      }
+      return true;
+    };
+
+    bool timed_out = false;
+    std::shared_ptr<CallState> winner = state;
+    std::optional<Hedge> hedge_target;
+    uint64_t hedge_charged = 0;
+    for (;;) {
+      bool done = state->done.load();
+      if (stream && !drain()) {
+        state->abandoned.store(true);
+        response = {.success = true,
+                    .text = streamed,
+                    .stopped = true,
+                    .latency_ms = elapsedMs(call_started)};
+        return response;
+      }
+      if (hedge_state) {
+        // The first success wins; a failure waits for the other request.
+        bool hedge_done = hedge_state->done.load();
+        if (done && succeeded(*state))
+          break;
+        if (hedge_done && succeeded(*hedge_state)) {
+          winner = hedge_state;
+          counters.hedge_wins++;
+          break;
+        }
+        if (done && hedge_done)
+          break;
+      } else if (done) {
+        break;
+      }
+      if (interruptPending()) {
+        abandonAll();
+        throw CallInterrupted();
+      }
+      long wait_ms = remainingMs(deadline);
+      if (wait_ms <= 0) {
+        abandonAll();
+        timed_out = true;
+        break;
+      }
+      if (hedge_at && Clock::now() >= *hedge_at) {
+        hedge_at.reset();
+        if (hedgeAllowed())
+          hedge_target = hedge();
+        if (hedge_target)
+          hedge_charged =
+              chargedTokens(hedge_target->bucket, hedge_target->options);
+        // A hedge is only worth sending if it can go out right away.
+        if (hedge_target &&
+            RateLimiter::tryAcquire(hedge_target->bucket, hedge_charged) == 0) {
+          logger::Logger::debug("Provider call slower than hedge delay, "
+                                "sending a hedge request");
+          hedge_state = std::make_shared<CallState>();
+          startAttempt(hedge_state, hedge_target->client, hedge_target->options,
+                       false);
+          counters.hedges++;
+        }
+      }
+      (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                      std::min(wait_ms, kPollIntervalMs), PG_WAIT_EXTENSION);
+      ResetLatch(MyLatch);
+    }
+
+    if (timed_out) {
+      return {.success = false,
+              .error_message = timeoutMessage(cfg.request_timeout_ms)};
+    }
+
+    // The losing request cannot be stopped inside the SDK; it is left to
+    // finish detached, like a timed-out call.
+    abandonAll();
+    {
+      std::lock_guard<std::mutex> guard(winner->mutex);
+      response = winner->response;
+    }
+    response.latency_ms = elapsedMs(call_started);
+    recordUsage(response);
+    const auto& winner_bucket =
+        winner == state ? bucket : hedge_target->bucket;
+    settleUsage(winner_bucket, winner == state ? charged : hedge_charged,
+                response);
+    if (!response.success && RateLimiter::isRateLimited(response.error_message))
+      RateLimiter::throttle(winner_bucket);
+    // Measured from the first request even when the hedge won, so hedging
+    // does not pull the percentile down by much.
+    if (response.success && !stream)
+      recordLatency(attempt_started);
+    if (stream)
+      response.text = streamed;
+    if (response.success)
+      return response;
+
+    // A partly streamed response cannot be replayed without duplicates.
+    if (delivered || attempt >= max_retries ||
+        !isRetryable(response.error_message))
+      return response;
+
+    long delay_ms = backoffMs(attempt);
+    if (delay_ms >= remainingMs(deadline))
+      return response;
+    logger::Logger::warning("Provider request failed (" +
+                            response.error_message + "), retrying in " +
+                            std::to_string(delay_ms) + " ms");
+    sleepInterruptibly(Clock::now() + std::chrono::milliseconds(delay_ms));
+  }
+}
+
+std::vector<ProviderCall::Response> ProviderCall::runBatch(
+    const std::vector<std::shared_ptr<ai::Client>>& clients,
+    const RateLimiter::Bucket& bucket,
+    std::vector<ai::GenerateOptions> requests) {
+  const auto& cfg = config::ConfigManager::getConfig();
+  int timeout_ms = std::max(cfg.request_timeout_ms, 1);
+  int max_retries = std::max(cfg.max_retries, 0);
+  long max_wait_ms = cfg.rate_limit_policy == config::RateLimitPolicy::FAIL
+                         ? 0
+                         : std::max(cfg.rate_limit_max_wait_ms, 0);
+  size_t count = requests.size();
+  auto state = std::make_shared<BatchState>();
+  for (const auto& request : requests) {
+    recordCall(request);
+    state->charged.push_back(chargedTokens(bucket, request));
+  }
+
+  state->requests = std::move(requests);
+  state->responses.resize(count);
+  state->started.resize(count);
+  state->finished.resize(count, false);
+  state->timed_out.resize(count, false);
+
+  auto abandon = [&]() {
+    {
+      std::lock_guard<std::mutex> guard(state->mutex);
+      state->abandoned = true;
+    }
+    state->wakeup.notify_all();
+  };
+
+  size_t workers = std::min(clients.size(), count);
+  if (workers == 0) {
+    return std::vector<Response>(
+        count, {.success = false, .error_message = "No AI client available"});
+  }
+  for (size_t i = 0; i < workers; i++) {
+    try {
+      spawn([state, client = clients[i], bucket, timeout_ms, max_retries,
+             max_wait_ms]() {
+        runBatchWorker(state, client, bucket, timeout_ms, max_retries,
+                       max_wait_ms);
+      });
+    } catch (...) {
+      abandon();
+      throw;
+    }
+  }
+
+  for (;;) {
+    if (interruptPending()) {
+      abandon();
+      throw CallInterrupted();
+    }
+
+    size_t settled = 0;
+    size_t given_up = 0;
+    long wait_ms = kPollIntervalMs;
+    {
+      std::lock_guard<std::mutex> guard(state->mutex);
+      size_t stuck = 0;
+      for (size_t i = 0; i < count; i++) {
+        if (state->timed_out[i] && !state->finished[i])
+          stuck++;
+        if (state->finished[i] || state->timed_out[i]) {
+          settled++;
+          continue;
+        }
+        if (!state->started[i])
+          continue;
+        auto deadline =
+            *state->started[i] + std::chrono::milliseconds(timeout_ms);
+        long left = remainingMs(deadline);
+        if (left <= 0) {
+          state->timed_out[i] = true;
+          state->responses[i] = {.success = false,
+                                 .error_message = timeoutMessage(timeout_ms)};
+          settled++;
+          stuck++;
+        } else {
+          wait_ms = std::min(wait_ms, left);
+        }
+      }
+      // Every worker is inside a call that already timed out and cannot be
+      // aborted, so nothing would take the remaining items.
+      if (stuck >= workers && state->next < count) {
+        for (size_t i = state->next; i < count; i++) {
+          state->timed_out[i] = true;
+          state->responses[i] = {.success = false,
+                                 .error_message = timeoutMessage(timeout_ms)};
+          settled++;
+          given_up++;
+        }
+        state->next = count;
+      }
+    }
+    if (given_up > 0) {
+      logger::Logger::warning(
+          "All batch workers are stuck on timed-out requests, giving up on " +
+          std::to_string(given_up) + " pending requests");
+    }
+    if (settled == count)
+      break;
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    std::max(wait_ms, 1L), PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+  }
+
+  // Workers stuck on timed-out items stop once their call returns.
+  abandon();
+  std::lock_guard<std::mutex> guard(state->mutex);
+  for (size_t i = 0; i < count; i++) {
+    recordUsage(state->responses[i]);
+    settleUsage(bucket, state->charged[i], state->responses[i]);
+  }
+  return state->responses;
+}
+
+}  // namespace pg_ai
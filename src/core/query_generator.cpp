@@ -11,265 +11,837 @@ extern "C" {
 #include <algorithm>
 #include <cctype>
 #include <fstream>
+#include <map>
 #include <optional>
 #include <regex>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
-#include <ai/anthropic.h>
 #include <ai/openai.h>
 #include <nlohmann/json.hpp>
 
+#include "../include/catalog_reader.hpp"
+#include "../include/client_pool.hpp"
 #include "../include/config.hpp"
+#include "../include/context_packer.hpp"
+#include "../include/explain_runner.hpp"
+#include "../include/fk_graph.hpp"
+#include "../include/json_field_stream.hpp"
 #include "../include/logger.hpp"
+#include "../include/model_router.hpp"
+#include "../include/plan_analyzer.hpp"
 #include "../include/prompts.hpp"
+#include "../include/provider_call.hpp"
+#include "../include/rate_limiter.hpp"
+#include "../include/result_cache.hpp"
+#include "../include/schema_cache.hpp"
+#include "../include/schema_fingerprint.hpp"
+#include "../include/single_flight.hpp"
+#include "../include/spi_plan_cache.hpp"
+#include "../include/token_counter.hpp"
 #include "../include/utils.hpp"
 
 using namespace pg_ai::logger;
 
 namespace pg_ai {
 
-QueryResult QueryGenerator::generateQuery(const QueryRequest& request) {
-  try {
-    if (request.natural_language.empty()) {
-      return {.success = false,
-              .error_message = "Natural language query cannot be empty"};
+namespace {
+
+// Table listing of this backend, keyed by the schema version it was built at.
+// Like the shared cache entry it is role-neutral, so it stays valid across
+// SET ROLE; getDatabaseTables() filters every copy for the current user.
+std::optional<std::pair<uint64_t, DatabaseSchema>> last_listing;
+
+std::vector<ColumnStats> columnStatsFor(Oid relid, int mcv_count) {
+  uint64_t cache_ticket = 0;
+  auto cached = SchemaCache::lookupColumnStats(relid, cache_ticket);
+  std::vector<ColumnStats> stats;
+  if (cached) {
+    stats = std::move(*cached);
+  } else {
+    stats = CatalogReader::readColumnStats(relid, mcv_count);
+    SchemaCache::storeColumnStats(relid, stats, cache_ticket);
+  }
+  CatalogReader::restrictColumnStatsToUser(relid, stats);
+  return stats;
+}
+
+std::string formatColumnStats(const ColumnStats& stats) {
+  std::ostringstream line;
+  line << "- " << stats.column_name << ":";
+  if (stats.has_statistics) {
+    line.setf(std::ios::fixed);
+    line.precision(1);
+    line << " nulls " << stats.null_frac * 100 << "%";
+    // Negative n_distinct is a fraction of the row count.
+    if (stats.n_distinct < 0) {
+      line.precision(0);
+      line << ", distinct ~" << -stats.n_distinct * 100 << "% of rows";
+    } else if (stats.n_distinct > 0) {
+      line.precision(0);
+      line << ", distinct ~" << stats.n_distinct;
     }
+    if (!stats.most_common_values.empty()) {
+      line << ", common values:";
+      for (size_t i = 0; i < stats.most_common_values.size(); i++) {
+        line << (i ? ", " : " ") << stats.most_common_values[i];
+      }
+    }
+    if (stats.has_correlation) {
+      line.precision(2);
+      line << ", correlation " << stats.correlation;
+    }
+  }
+  if (!stats.leading_index.empty()) {
+    line << (stats.has_statistics ? "," : "") << " leads index "
+         << stats.leading_index;
+  }
+  line << "\n";
+  return line.str();
+}
 
-    const auto& cfg = config::ConfigManager::getConfig();
+std::string formatColumnStatsSection(const std::vector<ColumnStats>& stats) {
+  if (stats.empty())
+    return "";
+  // Statistics are a hint, so drop whole lines once the budget is spent.
+  const auto& cfg = config::ConfigManager::getConfig();
+  size_t budget = std::max(cfg.schema_column_stats_max_chars, 0);
+  std::string section;
+  for (const auto& column : stats) {
+    std::string line = formatColumnStats(column);
+    if (section.size() + line.size() > budget)
+      break;
+    section += line;
+  }
+  return section.empty() ? "" : "\nCOLUMN STATISTICS:\n" + section;
+}
 
-    std::string api_key = request.api_key;
-    std::string api_key_source = "parameter";
-    std::string provider_preference = request.provider;
+// Prompt text of one table. The structure part is shared through the cache
+// (the prewarm workers usually have it ready) with users who see every
+// column; statistics are filtered by the caller's privileges and appended
+// here.
+std::string tableContext(const TableDetails& details) {
+  Oid relid = details.restricted ? InvalidOid
+                                 : CatalogReader::resolveTable(
+                                       details.table_name, details.schema_name);
+  uint64_t cache_ticket = 0;
+  std::optional<std::string> cached;
+  if (OidIsValid(relid)) {
+    cached = SchemaCache::lookupText(SchemaCache::EntryKind::TABLE_TEXT, relid,
+                                     cache_ticket);
+  }
 
-    config::Provider selected_provider;
-    const config::ProviderConfig* provider_config = nullptr;
+  std::string text;
+  if (cached) {
+    text = std::move(*cached);
+  } else {
+    TableDetails structure = details;
+    structure.column_stats.clear();
+    text = QueryGenerator::formatTableDetailsForAI(structure);
+    if (OidIsValid(relid)) {
+      SchemaCache::storeText(SchemaCache::EntryKind::TABLE_TEXT, relid, text,
+                             cache_ticket);
+    }
+  }
+  return text + formatColumnStatsSection(details.column_stats);
+}
 
-    if (provider_preference == "openai") {
-      selected_provider = config::Provider::OPENAI;
-      provider_config =
-          config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
-      logger::Logger::info("Explicit OpenAI provider selection from parameter");
+FkGraph foreignKeyGraph() {
+  uint64_t cache_ticket = 0;
+  auto cached = SchemaCache::lookupForeignKeys(cache_ticket);
+  if (cached)
+    return FkGraph(*cached);
+  auto keys = CatalogReader::readForeignKeys();
+  SchemaCache::storeForeignKeys(keys, cache_ticket);
+  return FkGraph(keys);
+}
 
-      if (api_key.empty() && provider_config &&
-          !provider_config->api_key.empty()) {
-        api_key = provider_config->api_key;
-        api_key_source = "openai_config";
-        logger::Logger::info("Using OpenAI API key from configuration");
-      }
-    } else if (provider_preference == "anthropic") {
-      selected_provider = config::Provider::ANTHROPIC;
-      provider_config =
-          config::ConfigManager::getProviderConfig(config::Provider::ANTHROPIC);
-      logger::Logger::info(
-          "Explicit Anthropic provider selection from parameter");
+struct StreamedResponse {
+  std::string text;
+  // Set when the stream was cut short after the sql field
+  std::optional<std::string> sql;
+  std::string error_message;
+  uint64_t latency_ms = 0;
+};
+
+StreamedResponse streamResponse(std::shared_ptr<ai::Client> client,
+                                const RateLimiter::Bucket& bucket,
+                                const ai::GenerateOptions& options,
+                                const QueryRequest& request) {
+  StreamedResponse response;
+  JsonFieldStream sql_field("sql");
+
+  auto result = ProviderCall::run(
+      std::move(client), bucket, options, [&](const std::string& chunk) {
+        request.on_chunk({StreamChunk::Kind::TEXT, chunk});
+        if (sql_field.complete())
+          return true;
+        sql_field.feed(chunk);
+        if (!sql_field.complete())
+          return true;
+        request.on_chunk({StreamChunk::Kind::SQL, sql_field.value()});
+        return !request.stop_after_sql;
+      });
+
+  response.text = std::move(result.text);
+  response.latency_ms = result.latency_ms;
+  if (!result.success)
+    response.error_message = result.error_message;
+  if (result.stopped)
+    response.sql = sql_field.value();
+  return response;
+}
 
-      if (api_key.empty() && provider_config &&
-          !provider_config->api_key.empty()) {
-        api_key = provider_config->api_key;
-        api_key_source = "anthropic_config";
-        logger::Logger::info("Using Anthropic API key from configuration");
-      }
-    } else {
-      if (api_key.empty()) {
-        const auto* openai_config =
-            config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
-        if (openai_config && !openai_config->api_key.empty()) {
+// Listing part of the legacy prompt, shared through the cache like
+// tableContext: only with users who see every table.
+std::string schemaContext(const DatabaseSchema& schema) {
+  if (schema.restricted)
+    return QueryGenerator::formatSchemaForAI(schema);
+  uint64_t cache_ticket = 0;
+  auto cached = SchemaCache::lookupText(SchemaCache::EntryKind::SCHEMA_TEXT,
+                                        InvalidOid, cache_ticket);
+  if (cached)
+    return std::move(*cached);
+  std::string text = QueryGenerator::formatSchemaForAI(schema);
+  SchemaCache::storeText(SchemaCache::EntryKind::SCHEMA_TEXT, InvalidOid, text,
+                         cache_ticket);
+  return text;
+}
+
+// Provider, API key and model for a request. An explicit provider wins;
+// otherwise the first provider with a configured key is used.
+struct ResolvedProvider {
+  config::Provider provider = config::Provider::OPENAI;
+  std::string api_key;
+  std::string model_name;
+  // Configured endpoint; empty for the provider's public API
+  std::string base_url;
+  // Set when no usable key was found
+  std::string error_message;
+};
+
+ResolvedProvider resolveProvider(const std::string& request_api_key,
+                                 const std::string& provider_preference) {
+  ResolvedProvider resolved;
+  std::string api_key = request_api_key;
+  std::string api_key_source = "parameter";
+
+  config::Provider selected_provider;
+  const config::ProviderConfig* provider_config = nullptr;
+
+  if (provider_preference == "openai") {
+    selected_provider = config::Provider::OPENAI;
+    provider_config =
+        config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
+    logger::Logger::info("Explicit OpenAI provider selection from parameter");
+
+    if (api_key.empty() && provider_config &&
+        !provider_config->api_key.empty()) {
+      api_key = provider_config->api_key;
+      api_key_source = "openai_config";
+      logger::Logger::info("Using OpenAI API key from configuration");
+    }
+  } else if (provider_preference == "anthropic") {
+    selected_provider = config::Provider::ANTHROPIC;
+    provider_config =
+        config::ConfigManager::getProviderConfig(config::Provider::ANTHROPIC);
+    logger::Logger::info(
+        "Explicit Anthropic provider selection from parameter");
+
+    if (api_key.empty() && provider_config &&
+        !provider_config->api_key.empty()) {
+      api_key = provider_config->api_key;
+      api_key_source = "anthropic_config";
+      logger::Logger::info("Using Anthropic API key from configuration");
+    }
+  } else {
+    if (api_key.empty()) {
+      const auto* openai_config =
+          config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
+      if (openai_config && !openai_config->api_key.empty()) {
+        logger::Logger::info(
+            "Auto-selecting OpenAI provider based on configuration");
+        selected_provider = config::Provider::OPENAI;
+        provider_config = openai_config;
+        api_key = openai_config->api_key;
+        api_key_source = "openai_config";
+      } else {
+        const auto* anthropic_config =
+            config::ConfigManager::getProviderConfig(
+                config::Provider::ANTHROPIC);
+        if (anthropic_config && !anthropic_config->api_key.empty()) {
           logger::Logger::info(
-              "Auto-selecting OpenAI provider based on configuration");
-          selected_provider = config::Provider::OPENAI;
-          provider_config = openai_config;
-          api_key = openai_config->api_key;
-          api_key_source = "openai_config";
+              "Auto-selecting Anthropic provider based on configuration");
+          selected_provider = config::Provider::ANTHROPIC;
+          provider_config = anthropic_config;
+          api_key = anthropic_config->api_key;
+          api_key_source = "anthropic_config";
         } else {
-          const auto* anthropic_config =
-              config::ConfigManager::getProviderConfig(
-                  config::Provider::ANTHROPIC);
-          if (anthropic_config && !anthropic_config->api_key.empty()) {
-            logger::Logger::info(
-                "Auto-selecting Anthropic provider based on configuration");
-            selected_provider = config::Provider::ANTHROPIC;
-            provider_config = anthropic_config;
-            api_key = anthropic_config->api_key;
-            api_key_source = "anthropic_config";
-          } else {
-            logger::Logger::warning("No API key found in config");
-            return {.success = false,
-                    .error_message =
-                        "API key required. Pass as 4th parameter or set OpenAI "
-                        "or Anthropic API key in ~/.pg_ai.config."};
-          }
+          logger::Logger::warning("No API key found in config");
+          resolved.error_message =
+              "API key required. Pass it as the api_key argument or set "
+              "an OpenAI or Anthropic API key in ~/.pg_ai.config.";
+          return resolved;
         }
-      } else {
-        selected_provider = config::Provider::OPENAI;
-        provider_config =
-            config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
-        logger::Logger::info(
-            "Auto-selecting OpenAI provider (API key provided, no provider "
-            "specified)");
       }
+    } else {
+      selected_provider = config::Provider::OPENAI;
+      provider_config =
+          config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
+      logger::Logger::info(
+          "Auto-selecting OpenAI provider (API key provided, no provider "
+          "specified)");
     }
+  }
 
-    if (api_key.empty()) {
-      std::string provider_name =
-          config::ConfigManager::providerToString(selected_provider);
-      return {.success = false,
-              .error_message = "No API key available for " + provider_name +
-                               " provider. Please provide API key as parameter "
-                               "or configure it in ~/.pg_ai.config."};
-    }
+  if (api_key.empty()) {
+    std::string provider_name =
+        config::ConfigManager::providerToString(selected_provider);
+    resolved.error_message = "No API key available for " + provider_name +
+                             " provider. Please provide API key as parameter "
+                             "or configure it in ~/.pg_ai.config.";
+    return resolved;
+  }
 
-    std::string system_prompt = prompts::SYSTEM_PROMPT;
+  resolved.provider = selected_provider;
+  resolved.api_key = api_key;
+  if (provider_config)
+    resolved.base_url = provider_config->base_url;
+  if (provider_config && !provider_config->default_model.name.empty()) {
+    resolved.model_name = provider_config->default_model.name;
+  } else {
+    resolved.model_name = selected_provider == config::Provider::ANTHROPIC
+                              ? "claude-3-5-sonnet-20241022"
+                              : "gpt-4o";
+  }
+  return resolved;
+}
 
-    std::string prompt = buildPrompt(request);
+// The system part (instructions, then the schema context) comes first and
+// only changes with the schema, so consecutive requests share a long prefix
+// that providers with prompt caching (OpenAI does so automatically) serve
+// from cache. The request itself goes last, in the user part.
+struct Prompt {
+  std::string system;
+  std::string user;
+  // What went into the schema context, for model routing
+  size_t tables = 0;
+  size_t context_tokens = 0;
+};
+
+ai::GenerateOptions generateOptions(const std::string& model_name,
+                                    const Prompt& prompt) {
+  ai::GenerateOptions options(model_name, prompt.system, prompt.user);
+
+  auto prompt_tokens =
+      TokenCounter::count(model_name, prompt.system + "\n" + prompt.user);
+  logger::Logger::info("Prompt for " + model_name + ": " +
+                       (prompt_tokens.exact ? "" : "~") +
+                       std::to_string(prompt_tokens.tokens) + " tokens");
+
+  const config::ModelConfig* model_config =
+      config::ConfigManager::getModelConfig(model_name);
+  if (model_config) {
+    int max_tokens =
+        TokenCounter::answerLimit(*model_config, prompt_tokens.tokens);
+    options.max_tokens = max_tokens;
+    options.temperature = model_config->temperature;
+    logger::Logger::info(
+        "Using model: " + model_name +
+        " with max_tokens=" + std::to_string(max_tokens) +
+        ", temperature=" + std::to_string(model_config->temperature));
+  } else {
+    logger::Logger::info("Using model: " + model_name +
+                         " with default settings");
+  }
+  return options;
+}
 
-    config::Provider provider = selected_provider;
+std::shared_ptr<ai::Client> acquireClient(const ResolvedProvider& resolved) {
+  try {
+    auto client = ClientPool::acquire(resolved.provider, resolved.api_key,
+                                      resolved.base_url);
+    logger::Logger::info(
+        "Using " + config::ConfigManager::providerToString(resolved.provider) +
+        " provider with model: " + resolved.model_name +
+        (resolved.base_url.empty() ? "" : " at " + resolved.base_url));
+    return client;
+  } catch (const std::exception& e) {
+    logger::Logger::error(
+        "Failed to create " +
+        config::ConfigManager::providerToString(resolved.provider) +
+        " client: " + std::string(e.what()));
+    throw std::runtime_error("Failed to create AI client: " +
+                             std::string(e.what()));
+  }
+}
 
-    ai::Client client;
-    std::string model_name;
+// Everything that determines a provider's answer, for SingleFlight. The
+// API key is part of it (hashed, the key is shared with other backends), so
+// a call is only shared between sessions that would pay for it the same way.
+std::string flightKey(const ResolvedProvider& resolved,
+                      const ai::GenerateOptions& options) {
+  return nlohmann::json{
+      {"provider", config::ConfigManager::providerToString(resolved.provider)},
+      {"key_hash", std::hash<std::string>{}(resolved.api_key)},
+      {"base_url", resolved.base_url},
+      {"model", options.model},
+      {"system", options.system},
+      {"prompt", options.prompt},
+      {"max_tokens", options.max_tokens.value_or(0)},
+      {"temperature", options.temperature.value_or(0.0)}}
+      .dump();
+}
 
-    try {
-      if (provider == config::Provider::OPENAI) {
-        logger::Logger::info("Creating OpenAI client");
-        client = ai::openai::create_client(api_key);
-        model_name =
-            (provider_config && !provider_config->default_model.name.empty())
-                ? provider_config->default_model.name
-                : "gpt-4o";
-      } else if (provider == config::Provider::ANTHROPIC) {
-        logger::Logger::info("Creating Anthropic client");
-        client = ai::anthropic::create_client(api_key);
-        model_name =
-            (provider_config && !provider_config->default_model.name.empty())
-                ? provider_config->default_model.name
-                : "claude-3-5-sonnet-20241022";
-      } else {
-        logger::Logger::warning("Unknown provider, defaulting to OpenAI");
-        client = ai::openai::create_client(api_key);
-        model_name = "gpt-4o";
-      }
+RateLimiter::Bucket rateBucket(const ResolvedProvider& resolved) {
+  return RateLimiter::bucketFor(resolved.provider, resolved.api_key,
+                                resolved.base_url);
+}
+
+// Where a slow call is sent again: the other provider, when it has a
+// configured key. The client and options are only built if the hedge fires.
+ProviderCall::HedgeFactory hedgeFor(const ResolvedProvider& primary,
+                                    const Prompt& prompt) {
+  if (!config::ConfigManager::getConfig().hedging_enabled)
+    return {};
+
+  config::Provider other = primary.provider == config::Provider::OPENAI
+                               ? config::Provider::ANTHROPIC
+                               : config::Provider::OPENAI;
+  const auto* other_config = config::ConfigManager::getProviderConfig(other);
+  if (!other_config || other_config->api_key.empty()) {
+    logger::Logger::debug("Hedging skipped: no " +
+                          config::ConfigManager::providerToString(other) +
+                          " API key configured");
+    return {};
+  }
 
-      logger::Logger::info("Using " +
-                           config::ConfigManager::providerToString(provider) +
-                           " provider with model: " + model_name);
+  // Only called while the provider call runs, so the prompt outlives it.
+  return [other, &prompt]() -> std::optional<ProviderCall::Hedge> {
+    try {
+      ResolvedProvider target =
+          resolveProvider("", config::ConfigManager::providerToString(other));
+      return ProviderCall::Hedge{
+          .client = acquireClient(target),
+          .options = generateOptions(target.model_name, prompt),
+          .bucket = rateBucket(target)};
     } catch (const std::exception& e) {
-      logger::Logger::error("Failed to create " +
-                            config::ConfigManager::providerToString(provider) +
-                            " client: " + std::string(e.what()));
-      throw std::runtime_error("Failed to create AI client: " +
-                               std::string(e.what()));
+      logger::Logger::warning("Hedging disabled for this call: " +
+                              std::string(e.what()));
+      return std::nullopt;
     }
+  };
+}
 
-    ai::GenerateOptions options(model_name, system_prompt, prompt);
+// Switches a simple request to the provider's fast model when [routing] is
+// enabled. Returns the tier, so the call's latency can be recorded.
+std::optional<ModelRouter::Tier> routeModel(ResolvedProvider& resolved,
+                                            const std::string& natural_language,
+                                            const Prompt& prompt) {
+  const auto& cfg = config::ConfigManager::getConfig();
+  if (!cfg.routing_enabled)
+    return std::nullopt;
+
+  auto decision = ModelRouter::route(
+      ModelRouter::features(natural_language, prompt.tables,
+                            prompt.context_tokens),
+      cfg.routing_threshold);
+  if (decision.tier == ModelRouter::Tier::FAST) {
+    const auto* provider_config =
+        config::ConfigManager::getProviderConfig(resolved.provider);
+    std::string fast_model =
+        provider_config && !provider_config->fast_model.empty()
+            ? provider_config->fast_model
+        : resolved.provider == config::Provider::ANTHROPIC
+            ? "claude-3-5-haiku-20241022"
+            : "gpt-3.5-turbo";
+
+    // A prompt packed for the strong model may not fit the fast one
+    auto limit = TokenCounter::promptLimit(fast_model);
+    if (limit && TokenCounter::count(fast_model,
+                                     prompt.system + "\n" + prompt.user)
+                         .tokens > *limit)
+      decision.tier = ModelRouter::Tier::STRONG;
+    else
+      resolved.model_name = fast_model;
+  }
 
-    const config::ModelConfig* model_config =
-        config::ConfigManager::getModelConfig(model_name);
-    if (model_config) {
-      options.max_tokens = model_config->max_tokens;
-      options.temperature = model_config->temperature;
-      logger::Logger::info(
-          "Using model: " + model_name +
-          " with max_tokens=" + std::to_string(model_config->max_tokens) +
-          ", temperature=" + std::to_string(model_config->temperature));
-    } else {
-      logger::Logger::info("Using model: " + model_name +
-                           " with default settings");
-    }
+  const auto& features = decision.features;
+  logger::Logger::info(
+      "Routed to " + std::string(ModelRouter::tierName(decision.tier)) +
+      " model " + resolved.model_name + " (score " +
+      std::to_string(decision.score) + ": " + std::to_string(features.tables) +
+      " tables, " + std::to_string(features.aggregate_terms) +
+      " aggregate and " + std::to_string(features.analytic_terms) +
+      " analytic terms, " + std::to_string(features.words) + " words, ~" +
+      std::to_string(features.context_tokens) + " context tokens)");
+  return decision.tier;
+}
 
-    auto result = client.generate_text(options);
+// Catalog data shared by the prompts of one call (or one whole batch):
+// listing and foreign keys are read once, table details once per table.
+class SchemaSnapshot {
+ public:
+  const DatabaseSchema& schema() {
+    if (!schema_)
+      schema_ = QueryGenerator::getDatabaseTables();
+    return *schema_;
+  }
 
-    if (!result) {
-      return {.success = false,
-              .error_message = "AI API error: " + result.error_message()};
-    }
+  const FkGraph& graph() {
+    if (!graph_)
+      graph_ = foreignKeyGraph();
+    return *graph_;
+  }
 
-    if (result.text.empty()) {
-      return {.success = false,
-              .error_message = "Empty response from AI service"};
+  std::vector<TableDetails> details(
+      const std::vector<std::pair<std::string, std::string>>& tables) {
+    std::vector<std::pair<std::string, std::string>> missing;
+    for (const auto& table : tables) {
+      if (!details_.count(table))
+        missing.push_back(table);
     }
+    if (!missing.empty()) {
+      auto fetched = QueryGenerator::getTablesDetails(missing);
+      for (size_t i = 0; i < missing.size(); i++)
+        details_.emplace(missing[i], std::move(fetched[i]));
+    }
+
+    std::vector<TableDetails> result;
+    result.reserve(tables.size());
+    for (const auto& table : tables)
+      result.push_back(details_.at(table));
+    return result;
+  }
+
+ private:
+  std::optional<DatabaseSchema> schema_;
+  std::optional<FkGraph> graph_;
+  std::map<std::pair<std::string, std::string>, TableDetails> details_;
+};
+
+Prompt buildPromptFrom(const std::string& natural_language,
+                       SchemaSnapshot& snapshot,
+                       const std::string& model_name) {
+  const auto& cfg = config::ConfigManager::getConfig();
+
+  Prompt prompt;
+  prompt.user = "Generate a PostgreSQL query for this request:\n\nRequest: " +
+                natural_language + "\n";
+
+  // Tokens the schema context may take, if the model's window is known
+  std::optional<size_t> context_limit;
+  if (auto limit = TokenCounter::promptLimit(model_name)) {
+    size_t fixed =
+        TokenCounter::count(model_name, std::string(prompts::SYSTEM_PROMPT) +
+                                            "\n\nSchema info:\n" +
+                                            prompt.user)
+            .tokens;
+    context_limit = *limit > fixed ? *limit - fixed : 0;
+  }
 
-    nlohmann::json j = extractSQLFromResponse(result.text);
-    std::string sql = j.value("sql", "");
-    std::string explanation = j.value("explanation", "");
+  std::string schema_context;
+  try {
+    const auto& schema = snapshot.schema();
+
+    // The packer's budget is an estimate; when the counted context still
+    // does not fit, shrink the budget in proportion and pack again.
+    auto pack = [&](size_t budget) {
+      ContextPacker::Options options;
+      options.max_detailed_tables =
+          std::max(cfg.schema_context_max_detailed_tables, 0);
+      ContextPacker::PackedContext packed;
+      for (int attempt = 0; attempt < 4 && budget > 0; attempt++) {
+        options.token_budget = budget;
+        packed = ContextPacker::pack(
+            natural_language, schema,
+            [&](const auto& tables) { return snapshot.details(tables); },
+            tableContext, options, &snapshot.graph());
+        size_t tokens = TokenCounter::count(model_name, packed.text).tokens;
+        if (!context_limit || tokens <= *context_limit)
+          break;
+        logger::Logger::warning(
+            "Schema context of " + std::to_string(tokens) +
+            " tokens does not fit " + model_name + "; packing it again");
+        budget = budget * *context_limit * 9 / (tokens * 10);
+      }
+      logger::Logger::debug(
+          "Schema context: " + std::to_string(packed.detailed_tables) +
+          " detailed, " + std::to_string(packed.listed_tables) + " listed, " +
+          std::to_string(packed.omitted_tables) + " omitted, ~" +
+          std::to_string(packed.estimated_tokens) + " tokens");
+      schema_context = packed.text;
+      prompt.tables = packed.detailed_tables;
+    };
+
+    if (schema.success && cfg.schema_context_token_budget > 0) {
+      size_t budget = cfg.schema_context_token_budget;
+      if (context_limit)
+        budget = std::min(budget, *context_limit);
+      pack(budget);
+    } else if (schema.success) {
+      schema_context = schemaContext(schema);
+
+      std::vector<std::pair<std::string, std::string>> mentioned_tables;
+      for (const auto& table : schema.tables) {
+        if (mentioned_tables.size() >= 3)
+          break;
+        if (natural_language.find(table.table_name) != std::string::npos) {
+          mentioned_tables.emplace_back(table.schema_name, table.table_name);
+        }
+      }
+
+      for (const auto& table_details : snapshot.details(mentioned_tables)) {
+        if (table_details.success) {
+          schema_context += "\n" + tableContext(table_details);
+          prompt.tables++;
+        }
+      }
 
-    if (sql.empty()) {
-      return {
-          .success = true, .explanation = explanation, .generated_query = ""};
+      // The full listing of a large database can overflow the window
+      if (context_limit &&
+          TokenCounter::count(model_name, schema_context).tokens >
+              *context_limit) {
+        prompt.tables = 0;
+        pack(*context_limit);
+      }
     }
+  } catch (...) {
+  }
+
+  prompt.context_tokens =
+      TokenCounter::count(model_name, schema_context).tokens;
+  prompt.system = prompts::SYSTEM_PROMPT;
+  if (!schema_context.empty())
+    prompt.system += "\n\nSchema info:\n" + schema_context;
+  return prompt;
+}
+
+}  // namespace
 
-    std::string upper_sql = sql;
-    std::transform(upper_sql.begin(), upper_sql.end(), upper_sql.begin(),
-                   ::toupper);
-    if (upper_sql.find("INFORMATION_SCHEMA") != std::string::npos ||
-        upper_sql.find("PG_CATALOG") != std::string::npos) {
+QueryResult QueryGenerator::generateQuery(const QueryRequest& request) {
+  try {
+    if (request.natural_language.empty()) {
       return {.success = false,
-              .error_message =
-                  "Generated query accesses system tables. Please query user "
-                  "tables only."};
+              .error_message = "Natural language query cannot be empty"};
     }
 
-    std::vector<std::string> warnings_vec;
-    try {
-      if (j.contains("warnings")) {
-        if (j["warnings"].is_array()) {
-          warnings_vec = j["warnings"].get<std::vector<std::string>>();
-        } else if (j["warnings"].is_string()) {
-          warnings_vec.push_back(j["warnings"].get<std::string>());
-        }
+    auto resolved = resolveProvider(request.api_key, request.provider);
+    if (!resolved.error_message.empty())
+      return {.success = false, .error_message = resolved.error_message};
+
+    // Bypassing the cache still refreshes it.
+    std::optional<ResultCache::Key> cache_key;
+    if (!request.on_chunk) {
+      cache_key = ResultCache::makeKey(
+          request.natural_language,
+          config::ConfigManager::providerToString(resolved.provider),
+          resolved.model_name);
+    }
+    if (cache_key && request.use_cache) {
+      if (auto cached = ResultCache::lookup(*cache_key)) {
+        logger::Logger::debug("Answered from the result cache");
+        return std::move(*cached);
       }
-    } catch (...) {
     }
 
-    return {
-        .generated_query = sql,
-        .explanation = explanation,
-        .warnings = warnings_vec,
-        .row_limit_applied = j.value("row_limit_applied", false),
-        .suggested_visualization = j.value("suggested_visualization", "table"),
-        .success = true,
-        .error_message = ""};
+    SchemaSnapshot snapshot;
+    auto prompt = buildPromptFrom(request.natural_language, snapshot,
+                                  resolved.model_name);
+    auto tier = routeModel(resolved, request.natural_language, prompt);
+    auto client = acquireClient(resolved);
+    auto options = generateOptions(resolved.model_name, prompt);
+
+    std::string response_text;
+    std::optional<std::string> early_sql;
+    uint64_t latency_ms = 0;
+    SingleFlight::Leader leader;
+    if (request.on_chunk) {
+      auto streamed =
+          streamResponse(client, rateBucket(resolved), options, request);
+      if (!streamed.error_message.empty()) {
+        return {.success = false,
+                .error_message = "AI API error: " + streamed.error_message};
+      }
+      response_text = std::move(streamed.text);
+      early_sql = std::move(streamed.sql);
+      latency_ms = streamed.latency_ms;
+    } else {
+      // Sessions sending the same prompt at the same time share one call.
+      auto flight = SingleFlight::join(flightKey(resolved, options));
+      if (flight.result) {
+        logger::Logger::debug("Answered by the identical request of another "
+                              "session");
+        return std::move(*flight.result);
+      }
+      leader = std::move(flight.leader);
+
+      auto result = ProviderCall::run(client, rateBucket(resolved), options, {},
+                                      hedgeFor(resolved, prompt));
+      if (!result.success) {
+        QueryResult failure{
+            .success = false,
+            .error_message = "AI API error: " + result.error_message};
+        leader.finish(failure);
+        return failure;
+      }
+      response_text = std::move(result.text);
+      latency_ms = result.latency_ms;
+    }
+    if (tier)
+      ModelRouter::record(*tier, latency_ms);
+
+    auto result = parseResponse(response_text, early_sql);
+    if (cache_key)
+      ResultCache::store(*cache_key, result);
+    leader.finish(result);
+    return result;
   } catch (const std::exception& e) {
     return {.success = false,
             .error_message = std::string("Exception: ") + e.what()};
   }
 }
 
-std::string QueryGenerator::buildPrompt(const QueryRequest& request) {
-  std::ostringstream prompt;
-  const auto& cfg = config::ConfigManager::getConfig();
-
-  prompt << "Generate a PostgreSQL query for this request:\n\n";
-  prompt << "Request: " << request.natural_language << "\n";
-
-  std::string schema_context;
+std::vector<QueryResult> QueryGenerator::generateQueries(
+    const BatchQueryRequest& request) {
+  std::vector<QueryResult> results(request.natural_language.size());
   try {
-    auto schema = getDatabaseTables();
-    if (schema.success) {
-      schema_context = formatSchemaForAI(schema);
-
-      std::vector<std::string> mentioned_tables;
-      for (const auto& table : schema.tables) {
-        if (request.natural_language.find(table.table_name) !=
-            std::string::npos) {
-          mentioned_tables.push_back(table.table_name);
+    auto resolved = resolveProvider(request.api_key, request.provider);
+
+    // Prompts are built up front, on this thread; only the provider calls
+    // run concurrently.
+    SchemaSnapshot snapshot;
+    std::vector<size_t> pending;
+    std::vector<std::optional<ResultCache::Key>> cache_keys;
+    std::vector<ai::GenerateOptions> calls;
+    std::vector<std::optional<ModelRouter::Tier>> tiers;
+    for (size_t i = 0; i < request.natural_language.size(); i++) {
+      const auto& natural_language = request.natural_language[i];
+      if (natural_language.empty()) {
+        results[i] = {
+            .success = false,
+            .error_message = "Natural language query cannot be empty"};
+      } else if (!resolved.error_message.empty()) {
+        results[i] = {.success = false,
+                      .error_message = resolved.error_message};
+      } else {
+        auto cache_key = ResultCache::makeKey(
+            natural_language,
+            config::ConfigManager::providerToString(resolved.provider),
+            resolved.model_name);
+        if (cache_key && request.use_cache) {
+          if (auto cached = ResultCache::lookup(*cache_key)) {
+            results[i] = std::move(*cached);
+            continue;
+          }
         }
+        pending.push_back(i);
+        cache_keys.push_back(std::move(cache_key));
+        auto prompt =
+            buildPromptFrom(natural_language, snapshot, resolved.model_name);
+        ResolvedProvider routed = resolved;
+        tiers.push_back(routeModel(routed, natural_language, prompt));
+        calls.push_back(generateOptions(routed.model_name, prompt));
       }
+    }
+    if (calls.empty())
+      return results;
 
-      for (size_t i = 0; i < mentioned_tables.size() && i < 3; ++i) {
-        auto table_details = getTableDetails(mentioned_tables[i]);
-        if (table_details.success) {
-          schema_context += "\n" + formatTableDetailsForAI(table_details);
+    const auto& cfg = config::ConfigManager::getConfig();
+    size_t concurrency = std::clamp(cfg.batch_concurrency, 1, 16);
+    concurrency = std::min(concurrency, calls.size());
+    std::vector<std::shared_ptr<ai::Client>> clients;
+    for (size_t i = 0; i < concurrency; i++)
+      clients.push_back(acquireClient(resolved));
+    logger::Logger::info("Generating " + std::to_string(calls.size()) +
+                         " queries, " + std::to_string(concurrency) +
+                         " at a time");
+
+    auto responses = ProviderCall::runBatch(clients, rateBucket(resolved),
+                                            std::move(calls));
+    for (size_t k = 0; k < pending.size(); k++) {
+      auto& result = results[pending[k]];
+      try {
+        if (!responses[k].success) {
+          result = {
+              .success = false,
+              .error_message = "AI API error: " + responses[k].error_message};
+        } else {
+          if (tiers[k])
+            ModelRouter::record(*tiers[k], responses[k].latency_ms);
+          result = parseResponse(responses[k].text);
+          if (cache_keys[k])
+            ResultCache::store(*cache_keys[k], result);
         }
+      } catch (const std::exception& e) {
+        result = {.success = false,
+                  .error_message = std::string("Exception: ") + e.what()};
       }
     }
-  } catch (...) {
+  } catch (const CallInterrupted&) {
+    throw;
+  } catch (const std::exception& e) {
+    for (auto& result : results) {
+      if (!result.success && result.error_message.empty()) {
+        result = {.success = false,
+                  .error_message = std::string("Exception: ") + e.what()};
+      }
+    }
+  }
+  return results;
+}
+
+QueryResult QueryGenerator::parseResponse(
+    const std::string& response_text,
+    const std::optional<std::string>& early_sql) {
+  if (response_text.empty()) {
+    return {.success = false,
+            .error_message = "Empty response from AI service"};
+  }
+
+  // The rest of the response was dropped, so only the query is known.
+  nlohmann::json j = early_sql ? nlohmann::json{{"sql", *early_sql}}
+                               : extractSQLFromResponse(response_text);
+  std::string sql = j.value("sql", "");
+  std::string explanation = j.value("explanation", "");
+
+  if (sql.empty()) {
+    return {
+        .success = true, .explanation = explanation, .generated_query = ""};
+  }
+
+  std::string upper_sql = sql;
+  std::transform(upper_sql.begin(), upper_sql.end(), upper_sql.begin(),
+                 ::toupper);
+  if (upper_sql.find("INFORMATION_SCHEMA") != std::string::npos ||
+      upper_sql.find("PG_CATALOG") != std::string::npos) {
+    return {.success = false,
+            .error_message =
+                "Generated query accesses system tables. Please query user "
+                "tables only."};
   }
 
-  if (!schema_context.empty()) {
-    prompt << "Schema info:\n" << schema_context << "\n";
+  std::vector<std::string> warnings_vec;
+  try {
+    if (j.contains("warnings")) {
+      if (j["warnings"].is_array()) {
+        warnings_vec = j["warnings"].get<std::vector<std::string>>();
+      } else if (j["warnings"].is_string()) {
+        warnings_vec.push_back(j["warnings"].get<std::string>());
+      }
+    }
+  } catch (...) {
   }
 
-  return prompt.str();
+  return {
+      .generated_query = sql,
+      .explanation = explanation,
+      .warnings = warnings_vec,
+      .row_limit_applied = j.value("row_limit_applied", false),
+      .suggested_visualization = j.value("suggested_visualization", "table"),
+      .success = true,
+      .error_message = ""};
 }
 
 nlohmann::json QueryGenerator::extractSQLFromResponse(const std::string& text) {
@@ -294,30 +866,61 @@ nlohmann::json QueryGenerator::extractSQLFromResponse(const std::string& text) {
 }
 
 DatabaseSchema QueryGenerator::getDatabaseTables() {
+  DatabaseSchema result = getAllDatabaseTables();
+  if (result.success)
+    result.restricted = CatalogReader::restrictTablesToUser(result.tables) > 0;
+  return result;
+}
+
+DatabaseSchema QueryGenerator::getAllDatabaseTables() {
   DatabaseSchema result;
   result.success = false;
 
+  uint64_t cache_ticket = 0;
+  if (SchemaCache::lookupTables(result, cache_ticket)) {
+    return result;
+  }
+
+  // Without the shared cache, reuse this backend's last listing until the
+  // schema fingerprint moves. Grants do not move it, but the listing is not
+  // filtered yet.
+  auto schema_version = SchemaFingerprint::version();
+  if (schema_version && last_listing &&
+      last_listing->first == *schema_version) {
+    SchemaCache::storeTables(last_listing->second, cache_ticket);
+    return last_listing->second;
+  }
+
   try {
     if (SPI_connect() != SPI_OK_CONNECT) {
       result.error_message = "Failed to connect to SPI";
       return result;
     }
 
+    // The base tables information_schema.tables would list, but without its
+    // privilege filter: the listing is shared between roles.
     const char* query = R"(
             SELECT
-                t.table_name,
-                t.table_schema,
-                t.table_type,
+                c.relname,
+                n.nspname,
+                'BASE TABLE'::text,
                 COALESCE(pg_stat.n_tup_ins + pg_stat.n_tup_upd + pg_stat.n_tup_del, 0) as estimated_rows
-            FROM information_schema.tables t
-            LEFT JOIN pg_stat_user_tables pg_stat ON t.table_name = pg_stat.relname
-                AND t.table_schema = pg_stat.schemaname
-            WHERE t.table_schema NOT IN ('information_schema', 'pg_catalog')
-                AND t.table_type = 'BASE TABLE'
-            ORDER BY t.table_schema, t.table_name
+            FROM pg_catalog.pg_class c
+            JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace
+            LEFT JOIN pg_catalog.pg_stat_user_tables pg_stat ON pg_stat.relid = c.oid
+            WHERE c.relkind IN ('r', 'p')
+                AND c.relpersistence <> 't'
+                AND n.nspname NOT IN ('information_schema', 'pg_catalog')
+                AND NOT EXISTS (
+                    SELECT 1 FROM pg_catalog.pg_depend d
+                    WHERE d.classid = 'pg_catalog.pg_class'::pg_catalog.regclass
+                        AND d.objid = c.oid
+                        AND d.deptype = 'e'
+                )
+            ORDER BY n.nspname, c.relname
         )";
 
-    int ret = SPI_execute(query, true, 0);
+    int ret = SpiPlanCache::execute(query, true, 0);
 
     if (ret != SPI_OK_SELECT) {
       result.error_message = "Failed to execute query";
@@ -364,6 +967,10 @@ DatabaseSchema QueryGenerator::getDatabaseTables() {
     result.success = true;
     SPI_finish();
 
+    SchemaCache::storeTables(result, cache_ticket);
+    if (schema_version)
+      last_listing.emplace(*schema_version, result);
+
   } catch (const std::exception& e) {
     result.error_message = std::string("Exception: ") + e.what();
     SPI_finish();
@@ -380,159 +987,102 @@ TableDetails QueryGenerator::getTableDetails(const std::string& table_name,
   result.schema_name = schema_name;
 
   try {
-    if (SPI_connect() != SPI_OK_CONNECT) {
-      result.error_message = "Failed to connect to SPI";
+    Oid relid = CatalogReader::resolveTable(table_name, schema_name);
+    if (!OidIsValid(relid)) {
+      result.error_message =
+          "Table " + schema_name + "." + table_name + " does not exist";
       return result;
     }
 
-    std::string column_query = R"(
-            SELECT
-                c.column_name,
-                c.data_type,
-                c.is_nullable,
-                c.column_default,
-                CASE WHEN pk.column_name IS NOT NULL THEN true ELSE false END as is_primary_key,
-                CASE WHEN fk.column_name IS NOT NULL THEN true ELSE false END as is_foreign_key,
-                fk.foreign_table_name,
-                fk.foreign_column_name
-            FROM information_schema.columns c
-            LEFT JOIN (
-                SELECT kcu.column_name, kcu.table_name, kcu.table_schema
-                FROM information_schema.table_constraints tc
-                JOIN information_schema.key_column_usage kcu
-                    ON tc.constraint_name = kcu.constraint_name
-                    AND tc.table_schema = kcu.table_schema
-                WHERE tc.constraint_type = 'PRIMARY KEY'
-            ) pk ON c.column_name = pk.column_name
-                AND c.table_name = pk.table_name
-                AND c.table_schema = pk.table_schema
-            LEFT JOIN (
-                SELECT
-                    kcu.column_name,
-                    kcu.table_name,
-                    kcu.table_schema,
-                    ccu.table_name AS foreign_table_name,
-                    ccu.column_name AS foreign_column_name
-                FROM information_schema.table_constraints tc
-                JOIN information_schema.key_column_usage kcu
-                    ON tc.constraint_name = kcu.constraint_name
-                    AND tc.table_schema = kcu.table_schema
-                JOIN information_schema.constraint_column_usage ccu
-                    ON ccu.constraint_name = tc.constraint_name
-                    AND ccu.table_schema = tc.table_schema
-                WHERE tc.constraint_type = 'FOREIGN KEY'
-            ) fk ON c.column_name = fk.column_name
-                AND c.table_name = fk.table_name
-                AND c.table_schema = fk.table_schema
-            WHERE c.table_name = ')" +
-                               table_name + R"('
-                AND c.table_schema = ')" +
-                               schema_name + R"('
-            ORDER BY c.ordinal_position
-        )";
-
-    int ret = SPI_execute(column_query.c_str(), true, 0);
-
-    if (ret != SPI_OK_SELECT) {
-      result.error_message = "Failed to execute column query";
-      SPI_finish();
-      return result;
+    // The cache holds the full structure; what the user may see is cut
+    // from every copy handed out.
+    uint64_t cache_ticket = 0;
+    if (!SchemaCache::lookupTableDetails(relid, result, cache_ticket)) {
+      result = CatalogReader::readTableStructure(relid);
+      SchemaCache::storeTableDetails(relid, result, cache_ticket);
     }
+    if (result.success)
+      CatalogReader::restrictTableDetailsToUser(relid, result);
 
-    SPITupleTable* tuptable = SPI_tuptable;
-    TupleDesc tupdesc = tuptable->tupdesc;
-
-    for (uint64 i = 0; i < SPI_processed; i++) {
-      HeapTuple tuple = tuptable->vals[i];
-      ColumnInfo column_info;
-
-      char* column_name = SPI_getvalue(tuple, tupdesc, 1);
-      char* data_type = SPI_getvalue(tuple, tupdesc, 2);
-      char* is_nullable = SPI_getvalue(tuple, tupdesc, 3);
-      char* column_default = SPI_getvalue(tuple, tupdesc, 4);
-      char* is_primary_key = SPI_getvalue(tuple, tupdesc, 5);
-      char* is_foreign_key = SPI_getvalue(tuple, tupdesc, 6);
-      char* foreign_table = SPI_getvalue(tuple, tupdesc, 7);
-      char* foreign_column = SPI_getvalue(tuple, tupdesc, 8);
-
-      if (column_name)
-        column_info.column_name = std::string(column_name);
-      if (data_type)
-        column_info.data_type = std::string(data_type);
-      if (is_nullable)
-        column_info.is_nullable = (std::string(is_nullable) == "YES");
-      if (column_default)
-        column_info.column_default = std::string(column_default);
-      if (is_primary_key)
-        column_info.is_primary_key = (std::string(is_primary_key) == "t");
-      if (is_foreign_key)
-        column_info.is_foreign_key = (std::string(is_foreign_key) == "t");
-      if (foreign_table)
-        column_info.foreign_table = std::string(foreign_table);
-      if (foreign_column)
-        column_info.foreign_column = std::string(foreign_column);
-
-      result.columns.push_back(column_info);
-
-      if (column_name)
-        pfree(column_name);
-      if (data_type)
-        pfree(data_type);
-      if (is_nullable)
-        pfree(is_nullable);
-      if (column_default)
-        pfree(column_default);
-      if (is_primary_key)
-        pfree(is_primary_key);
-      if (is_foreign_key)
-        pfree(is_foreign_key);
-      if (foreign_table)
-        pfree(foreign_table);
-      if (foreign_column)
-        pfree(foreign_column);
-    }
-
-    std::string index_query = R"(
-            SELECT indexname, indexdef
-            FROM pg_indexes
-            WHERE tablename = ')" +
-                              table_name + R"('
-                AND schemaname = ')" +
-                              schema_name + R"('
-            ORDER BY indexname
-        )";
+  } catch (const std::exception& e) {
+    result.success = false;
+    result.error_message = std::string("Exception: ") + e.what();
+  }
 
-    ret = SPI_execute(index_query.c_str(), true, 0);
+  return result;
+}
 
-    if (ret == SPI_OK_SELECT) {
-      tuptable = SPI_tuptable;
-      tupdesc = tuptable->tupdesc;
+std::vector<TableDetails> QueryGenerator::getTablesDetails(
+    const std::vector<std::pair<std::string, std::string>>& tables) {
+  std::vector<TableDetails> results(tables.size());
 
-      for (uint64 i = 0; i < SPI_processed; i++) {
-        HeapTuple tuple = tuptable->vals[i];
-        char* indexname = SPI_getvalue(tuple, tupdesc, 1);
-        char* indexdef = SPI_getvalue(tuple, tupdesc, 2);
+  try {
+    // Resolve every name first so the cache is probed once for all tables.
+    std::vector<Oid> relids;
+    std::vector<size_t> positions;
+    for (size_t i = 0; i < tables.size(); i++) {
+      const auto& [schema_name, table_name] = tables[i];
+      results[i].success = false;
+      results[i].schema_name = schema_name;
+      results[i].table_name = table_name;
+
+      Oid relid = CatalogReader::resolveTable(table_name, schema_name);
+      if (!OidIsValid(relid)) {
+        results[i].error_message =
+            "Table " + schema_name + "." + table_name + " does not exist";
+        continue;
+      }
+      relids.push_back(relid);
+      positions.push_back(i);
+    }
 
-        if (indexdef) {
-          result.indexes.push_back(std::string(indexdef));
-        }
+    std::vector<uint64_t> cache_tickets;
+    auto cached = SchemaCache::lookupTableDetails(relids, cache_tickets);
 
-        if (indexname)
-          pfree(indexname);
-        if (indexdef)
-          pfree(indexdef);
+    // A table may be requested more than once; read it only once.
+    std::unordered_map<Oid, size_t> built;
+    for (size_t k = 0; k < relids.size(); k++) {
+      size_t i = positions[k];
+      if (cached[k]) {
+        results[i] = std::move(*cached[k]);
+        continue;
+      }
+      auto seen = built.find(relids[k]);
+      if (seen != built.end()) {
+        results[i] = results[seen->second];
+        continue;
       }
+      results[i] = CatalogReader::readTableStructure(relids[k]);
+      SchemaCache::storeTableDetails(relids[k], results[i], cache_tickets[k]);
+      built[relids[k]] = i;
     }
 
-    result.success = true;
-    SPI_finish();
+    // The cache keeps the full structure, so filter only once every copy
+    // was made and stored.
+    for (size_t k = 0; k < relids.size(); k++) {
+      auto& details = results[positions[k]];
+      if (details.success)
+        CatalogReader::restrictTableDetailsToUser(relids[k], details);
+    }
 
+    const auto& cfg = config::ConfigManager::getConfig();
+    if (cfg.schema_column_stats) {
+      for (size_t k = 0; k < relids.size(); k++) {
+        auto& details = results[positions[k]];
+        if (details.success && details.column_stats.empty()) {
+          details.column_stats =
+              columnStatsFor(relids[k], cfg.schema_column_stats_mcv_count);
+        }
+      }
+    }
   } catch (const std::exception& e) {
-    result.error_message = std::string("Exception: ") + e.what();
-    SPI_finish();
+    for (auto& details : results) {
+      if (!details.success && details.error_message.empty())
+        details.error_message = std::string("Exception: ") + e.what();
+    }
   }
 
-  return result;
+  return results;
 }
 
 std::string QueryGenerator::formatSchemaForAI(const DatabaseSchema& schema) {
@@ -587,6 +1137,8 @@ std::string QueryGenerator::formatTableDetailsForAI(
     }
   }
 
+  result << formatColumnStatsSection(details.column_stats);
+
   return result.str();
 }
 
@@ -601,158 +1153,95 @@ ExplainResult QueryGenerator::explainQuery(const ExplainRequest& request) {
 
     result.query = request.query_text;
 
-    if (SPI_connect() != SPI_OK_CONNECT) {
-      result.error_message = "Failed to connect to SPI";
+    auto mode = ExplainRunner::parseMode(request.mode);
+    if (!mode) {
+      result.error_message = "Unknown explain mode '" + request.mode +
+                             "' (expected plan, analyze or bounded)";
       return result;
     }
 
-    std::string explain_query =
-        "EXPLAIN (ANALYZE, VERBOSE, COSTS, SETTINGS, BUFFERS, FORMAT JSON) " +
-        request.query_text;
-
-    int ret = SPI_execute(explain_query.c_str(), false, 0);
-
-    if (ret < 0) {
-      result.error_message = "Failed to execute EXPLAIN query: " +
-                             std::string(SPI_result_code_string(ret));
-      SPI_finish();
+    const auto& cfg = config::ConfigManager::getConfig();
+    auto explained =
+        ExplainRunner::run(request.query_text, *mode, cfg.explain_timeout_ms);
+    if (!explained.success) {
+      result.error_message = explained.error_message;
       return result;
     }
-
-    if (ret != SPI_OK_SELECT && ret != SPI_OK_UTILITY) {
-      result.error_message =
-          "Failed to execute EXPLAIN query. SPI result code: " +
-          std::to_string(ret) + " (" +
-          std::string(SPI_result_code_string(ret)) + "). " +
-          "This may indicate the query failed or EXPLAIN ANALYZE is not "
-          "supported in this context.";
-      SPI_finish();
-      return result;
+    result.explain_output = std::move(explained.explain_output);
+    result.mode = ExplainRunner::modeName(*mode);
+    if (explained.timed_out) {
+      result.mode += " (plan only, ANALYZE stopped after " +
+                     std::to_string(cfg.explain_timeout_ms) + " ms)";
     }
 
-    if (SPI_processed == 0) {
-      result.error_message = "No output from EXPLAIN query";
-      SPI_finish();
+    auto resolved = resolveProvider(request.api_key, request.provider);
+    if (!resolved.error_message.empty()) {
+      result.error_message = resolved.error_message;
       return result;
     }
 
-    SPITupleTable* tuptable = SPI_tuptable;
-    TupleDesc tupdesc = tuptable->tupdesc;
-    HeapTuple tuple = tuptable->vals[0];
-
-    char* explain_output = SPI_getvalue(tuple, tupdesc, 1);
-    if (!explain_output) {
-      result.error_message = "Failed to get EXPLAIN output";
-      SPI_finish();
-      return result;
+    Prompt prompt{
+        .system = prompts::EXPLAIN_SYSTEM_PROMPT,
+        .user = explained.shown == ExplainMode::ANALYZE
+                     ? "Please analyze this PostgreSQL EXPLAIN ANALYZE "
+                       "output:\n\n"
+                     : "Please analyze this PostgreSQL EXPLAIN output. The "
+                       "query was not run, so the plan has estimates but no "
+                       "actual times or row counts:\n\n"};
+    prompt.user += "Query:\n" + request.query_text + "\n\n";
+    // Known problems go before the plan, which may be truncated below.
+    if (cfg.explain_include_findings) {
+      auto findings = PlanAnalyzer::formatFindings(
+          PlanAnalyzer::analyze(result.explain_output));
+      if (!findings.empty())
+        prompt.user += findings + "Focus on these first.\n\n";
     }
-
-    result.explain_output = std::string(explain_output);
-    SPI_finish();
-
-    const auto& cfg = config::ConfigManager::getConfig();
-    std::string api_key = request.api_key;
-    std::string provider_preference = request.provider;
-
-    config::Provider selected_provider;
-    const config::ProviderConfig* provider_config = nullptr;
-
-    if (provider_preference == "openai") {
-      selected_provider = config::Provider::OPENAI;
-      provider_config =
-          config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
-      if (api_key.empty() && provider_config &&
-          !provider_config->api_key.empty()) {
-        api_key = provider_config->api_key;
-      }
-    } else if (provider_preference == "anthropic") {
-      selected_provider = config::Provider::ANTHROPIC;
-      provider_config =
-          config::ConfigManager::getProviderConfig(config::Provider::ANTHROPIC);
-      if (api_key.empty() && provider_config &&
-          !provider_config->api_key.empty()) {
-        api_key = provider_config->api_key;
-      }
-    } else {
-      if (api_key.empty()) {
-        const auto* openai_config =
-            config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
-        if (openai_config && !openai_config->api_key.empty()) {
-          selected_provider = config::Provider::OPENAI;
-          provider_config = openai_config;
-          api_key = openai_config->api_key;
-        } else {
-          const auto* anthropic_config =
-              config::ConfigManager::getProviderConfig(
-                  config::Provider::ANTHROPIC);
-          if (anthropic_config && !anthropic_config->api_key.empty()) {
-            selected_provider = config::Provider::ANTHROPIC;
-            provider_config = anthropic_config;
-            api_key = anthropic_config->api_key;
-          } else {
-            result.error_message =
-                "API key required. Pass as parameter or configure "
-                "~/.pg_ai.config";
-            return result;
-          }
+    prompt.user += "EXPLAIN Output:\n";
+
+    // Plans of large queries can exceed the window; keep the longest prefix
+    // of the output that fits.
+    std::string plan = result.explain_output;
+    if (auto limit = TokenCounter::promptLimit(resolved.model_name)) {
+      const std::string note = "\n[... plan truncated to fit the model]";
+      auto fits = [&](size_t length) {
+        std::string text = prompt.system + "\n" + prompt.user +
+                           plan.substr(0, length) +
+                           (length < plan.size() ? note : "");
+        return TokenCounter::count(resolved.model_name, text).tokens <= *limit;
+      };
+      if (!fits(plan.size())) {
+        size_t low = 0, high = plan.size();
+        while (low < high) {
+          size_t mid = low + (high - low + 1) / 2;
+          if (fits(mid))
+            low = mid;
+          else
+            high = mid - 1;
         }
-      } else {
-        selected_provider = config::Provider::OPENAI;
-        provider_config =
-            config::ConfigManager::getProviderConfig(config::Provider::OPENAI);
+        logger::Logger::warning("EXPLAIN output truncated from " +
+                                std::to_string(plan.size()) + " to " +
+                                std::to_string(low) + " bytes to fit " +
+                                resolved.model_name);
+        plan = plan.substr(0, low) + note;
       }
     }
+    prompt.user += plan;
 
-    if (api_key.empty()) {
-      result.error_message = "No API key available for provider";
-      return result;
-    }
-
-    std::string system_prompt = prompts::EXPLAIN_SYSTEM_PROMPT;
-
-    std::string prompt =
-        "Please analyze this PostgreSQL EXPLAIN ANALYZE output:\n\nQuery:\n" +
-        request.query_text + "\n\nEXPLAIN Output:\n" + result.explain_output;
-
-    ai::Client client;
-    std::string model_name;
-
+    std::shared_ptr<ai::Client> client;
     try {
-      if (selected_provider == config::Provider::OPENAI) {
-        client = ai::openai::create_client(api_key);
-        model_name =
-            (provider_config && !provider_config->default_model.name.empty())
-                ? provider_config->default_model.name
-                : "gpt-4o";
-      } else if (selected_provider == config::Provider::ANTHROPIC) {
-        client = ai::anthropic::create_client(api_key);
-        model_name =
-            (provider_config && !provider_config->default_model.name.empty())
-                ? provider_config->default_model.name
-                : "claude-3-5-sonnet-20241022";
-      } else {
-        client = ai::openai::create_client(api_key);
-        model_name = "gpt-4o";
-      }
+      client = acquireClient(resolved);
     } catch (const std::exception& e) {
-      result.error_message =
-          "Failed to create AI client: " + std::string(e.what());
+      result.error_message = e.what();
       return result;
     }
+    auto options = generateOptions(resolved.model_name, prompt);
 
-    ai::GenerateOptions options(model_name, system_prompt, prompt);
-
-    const config::ModelConfig* model_config =
-        config::ConfigManager::getModelConfig(model_name);
-    if (model_config) {
-      options.max_tokens = model_config->max_tokens;
-      options.temperature = model_config->temperature;
-    }
-
-    auto ai_result = client.generate_text(options);
+    auto ai_result =
+        ProviderCall::run(client, rateBucket(resolved), options, {},
+                          hedgeFor(resolved, prompt));
 
-    if (!ai_result) {
-      result.error_message = "AI API error: " + ai_result.error_message();
+    if (!ai_result.success) {
+      result.error_message = "AI API error: " + ai_result.error_message;
       return result;
     }
 
@@ -0,0 +1,484 @@
+#include "../include/rate_limiter.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <common/hashfn.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <port/atomics.h>
+#include <storage/condition_variable.h>
+#include <storage/latch.h>
+#include <storage/lwlock.h>
+#include <storage/shmem.h>
+#include <utils/memutils.h>
+}
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "../include/logger.hpp"
+#include "../include/provider_call.hpp"
+#include "../include/shmem.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+constexpr int kSlots = 32;
+// Shared by every key that finds no free slot, after the keyed slots
+constexpr int kOverflowSlot = kSlots;
+// A slot without admissions for this long, and not in debt, can be given to
+// another key. Well above request_timeout_ms, so that calls still running
+// rarely settle on a reused slot.
+constexpr uint64 kIdleUs = 10 * 60 * 1000000ULL;
+constexpr size_t kNameLength = 96;
+// Longest single sleep; waiters are also woken by refunds. Interrupts are
+// checked between sleeps.
+constexpr long kMaxSleepMs = 100;
+
+// Times are microseconds of the monotonic clock, which all processes share.
+struct Slot {
+  pg_atomic_uint64 key;  // 0: free; written last when a slot is claimed
+  char name[kNameLength];
+  pg_atomic_uint64 request_tat;
+  pg_atomic_uint64 token_tat;
+  pg_atomic_uint64 blocked_until;
+  // Last admission, or when the slot was claimed
+  pg_atomic_uint64 last_used;
+  // Limits of the backend that last resolved the bucket, for monitoring
+  pg_atomic_uint64 requests_per_minute;
+  pg_atomic_uint64 tokens_per_minute;
+  pg_atomic_uint64 admitted;
+  pg_atomic_uint64 waited;
+  pg_atomic_uint64 rejected;
+  pg_atomic_uint64 throttled;
+  ConditionVariable changed;
+};
+
+Slot* shared_slots = nullptr;
+// Buckets of this backend when the library was not preloaded
+Slot* local_slots = nullptr;
+bool full_warning_logged = false;
+
+void initSlots(Slot* slots) {
+  for (int i = 0; i <= kOverflowSlot; i++) {
+    Slot& slot = slots[i];
+    pg_atomic_init_u64(&slot.key, 0);
+    slot.name[0] = '\0';
+    pg_atomic_init_u64(&slot.request_tat, 0);
+    pg_atomic_init_u64(&slot.token_tat, 0);
+    pg_atomic_init_u64(&slot.blocked_until, 0);
+    pg_atomic_init_u64(&slot.last_used, 0);
+    pg_atomic_init_u64(&slot.requests_per_minute, 0);
+    pg_atomic_init_u64(&slot.tokens_per_minute, 0);
+    pg_atomic_init_u64(&slot.admitted, 0);
+    pg_atomic_init_u64(&slot.waited, 0);
+    pg_atomic_init_u64(&slot.rejected, 0);
+    pg_atomic_init_u64(&slot.throttled, 0);
+    ConditionVariableInit(&slot.changed);
+  }
+  snprintf(slots[kOverflowSlot].name, kNameLength,
+           "overflow (keys without a bucket)");
+}
+
+// Only called on the backend thread; helper threads get a slot index from
+// a bucket resolved before they started.
+Slot* slots() {
+  if (shared_slots)
+    return shared_slots;
+  if (!local_slots) {
+    local_slots = static_cast<Slot*>(
+        MemoryContextAlloc(TopMemoryContext, sizeof(Slot) * (kSlots + 1)));
+    initSlots(local_slots);
+  }
+  return local_slots;
+}
+
+Slot& slotOf(const RateLimiter::Bucket& bucket) {
+  return (shared_slots ? shared_slots : local_slots)[bucket.slot];
+}
+
+uint64 nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int findSlot(Slot* all, uint64 key) {
+  for (int i = 0; i < kSlots; i++) {
+    if (pg_atomic_read_u64(&all[i].key) == key)
+      return i;
+  }
+  return -1;
+}
+
+// The least recently used slot that has been idle for kIdleUs and owes
+// nothing, so that starting it over loses no limit.
+int idleSlot(Slot* all, uint64 now) {
+  int index = -1;
+  uint64 oldest = 0;
+  for (int i = 0; i < kSlots; i++) {
+    Slot& slot = all[i];
+    uint64 last_used = pg_atomic_read_u64(&slot.last_used);
+    if (last_used + kIdleUs > now ||
+        pg_atomic_read_u64(&slot.request_tat) > now ||
+        pg_atomic_read_u64(&slot.token_tat) > now ||
+        pg_atomic_read_u64(&slot.blocked_until) > now)
+      continue;
+    if (index < 0 || last_used < oldest) {
+      index = i;
+      oldest = last_used;
+    }
+  }
+  return index;
+}
+
+// Called under the RATE_LIMITER lock when the slots are shared.
+int claimSlot(Slot* all, uint64 key, const std::string& name) {
+  int index = findSlot(all, key);
+  if (index >= 0)
+    return index;
+  uint64 now = nowUs();
+  index = findSlot(all, 0);
+  if (index < 0)
+    index = idleSlot(all, now);
+  if (index < 0)
+    return -1;
+
+  Slot& slot = all[index];
+  if (pg_atomic_read_u64(&slot.key) != 0) {
+    logger::Logger::debug("Reusing the idle rate limit bucket of " +
+                          std::string(slot.name));
+    pg_atomic_write_u64(&slot.key, 0);
+    pg_write_barrier();
+    pg_atomic_write_u64(&slot.request_tat, 0);
+    pg_atomic_write_u64(&slot.token_tat, 0);
+    pg_atomic_write_u64(&slot.blocked_until, 0);
+    pg_atomic_write_u64(&slot.admitted, 0);
+    pg_atomic_write_u64(&slot.waited, 0);
+    pg_atomic_write_u64(&slot.rejected, 0);
+    pg_atomic_write_u64(&slot.throttled, 0);
+  }
+  pg_atomic_write_u64(&slot.last_used, now);
+  snprintf(slot.name, kNameLength, "%s", name.c_str());
+  pg_write_barrier();
+  pg_atomic_write_u64(&slot.key, key);
+  return index;
+}
+
+// Names a key by a short hash so that the key itself is never shown.
+std::string bucketName(config::Provider provider,
+                       const std::string& api_key,
+                       const std::string& base_url) {
+  std::string name = config::ConfigManager::providerToString(provider);
+  if (!base_url.empty())
+    name += " " + base_url;
+  if (api_key.empty())
+    return name + " (no key)";
+  char hash[16];
+  snprintf(hash, sizeof(hash), "%06llx",
+           static_cast<unsigned long long>(
+               hash_bytes_extended(
+                   reinterpret_cast<const unsigned char*>(api_key.data()),
+                   api_key.size(), 0) &
+               0xffffff));
+  return name + " key " + hash;
+}
+
+std::optional<double> available(uint64 tat,
+                                uint64 now,
+                                int64_t tolerance_us,
+                                uint64 per_minute) {
+  if (per_minute == 0)
+    return std::nullopt;
+  double interval_us = 60e6 / static_cast<double>(per_minute);
+  double ahead_us = tat > now ? static_cast<double>(tat - now) : 0.0;
+  return (static_cast<double>(tolerance_us) - ahead_us) / interval_us;
+}
+
+}  // namespace
+
+Size RateLimiter::shmemSize() {
+  return mul_size(kSlots + 1, sizeof(Slot));
+}
+
+void RateLimiter::shmemInit() {
+  bool found = false;
+  shared_slots = static_cast<Slot*>(
+      ShmemInitStruct("pg_ai_query rate limits", shmemSize(), &found));
+  if (!found)
+    initSlots(shared_slots);
+}
+
+RateLimiter::Bucket RateLimiter::bucketFor(config::Provider provider,
+                                           const std::string& api_key,
+                                           const std::string& base_url) {
+  const auto& cfg = config::ConfigManager::getConfig();
+  const auto* provider_config =
+      config::ConfigManager::getProviderConfig(provider);
+  int requests_per_minute =
+      provider_config ? std::max(provider_config->requests_per_minute, 0) : 0;
+  int tokens_per_minute =
+      provider_config ? std::max(provider_config->tokens_per_minute, 0) : 0;
+
+  std::string identity = config::ConfigManager::providerToString(provider) +
+                         "\n" + base_url + "\n" + api_key;
+  uint64 key = hash_bytes_extended(
+      reinterpret_cast<const unsigned char*>(identity.data()), identity.size(),
+      0);
+  if (key == 0)
+    key = 1;
+
+  Slot* all = slots();
+  int index = findSlot(all, key);
+  if (index < 0) {
+    std::string name = bucketName(provider, api_key, base_url);
+    if (shared_slots) {
+      LWLockAcquire(shmem::lock(shmem::LockId::RATE_LIMITER), LW_EXCLUSIVE);
+      index = claimSlot(all, key, name);
+      LWLockRelease(shmem::lock(shmem::LockId::RATE_LIMITER));
+    } else {
+      index = claimSlot(all, key, name);
+    }
+  }
+  // Every slot is busy: such keys share one bucket rather than going
+  // unlimited.
+  if (index < 0) {
+    if (!full_warning_logged) {
+      logger::Logger::warning("All " + std::to_string(kSlots) +
+                              " rate limit buckets are in use; calls with "
+                              "other keys share the overflow bucket");
+      full_warning_logged = true;
+    }
+    index = kOverflowSlot;
+    pg_atomic_write_u64(&all[index].key, 1);
+  }
+
+  Slot& slot = all[index];
+  pg_atomic_write_u64(&slot.requests_per_minute, requests_per_minute);
+  pg_atomic_write_u64(&slot.tokens_per_minute, tokens_per_minute);
+
+  Bucket bucket;
+  bucket.slot = index;
+  if (requests_per_minute > 0)
+    bucket.request_interval_us = 60e6 / requests_per_minute;
+  if (tokens_per_minute > 0)
+    bucket.token_interval_us = 60e6 / tokens_per_minute;
+  bucket.tolerance_us =
+      static_cast<int64_t>(std::max(cfg.rate_limit_burst_seconds, 0.0) * 1e6);
+  bucket.throttle_us =
+      static_cast<int64_t>(std::max(cfg.rate_limit_throttle_ms, 0)) * 1000;
+  return bucket;
+}
+
+int64_t RateLimiter::tryAcquire(const Bucket& bucket, uint64_t tokens) {
+  if (bucket.slot < 0)
+    return 0;
+  Slot& slot = slotOf(bucket);
+  uint64 now = nowUs();
+
+  // Waiters leave a block spread over half its length, so they do not all
+  // call the provider again at once.
+  uint64 blocked_until = pg_atomic_read_u64(&slot.blocked_until);
+  if (blocked_until > now) {
+    static thread_local std::mt19937_64 random{std::random_device{}()};
+    std::uniform_int_distribution<int64_t> jitter(0, bucket.throttle_us / 2);
+    return static_cast<int64_t>(blocked_until - now) + jitter(random);
+  }
+
+  auto aheadUs = [&](uint64 tat) {
+    return static_cast<int64_t>(tat) - static_cast<int64_t>(now) -
+           bucket.tolerance_us;
+  };
+  for (;;) {
+    uint64 request_tat = pg_atomic_read_u64(&slot.request_tat);
+    int64_t wait_us = 0;
+    if (bucket.request_interval_us > 0)
+      wait_us = std::max(wait_us, aheadUs(request_tat));
+    if (bucket.token_interval_us > 0)
+      wait_us =
+          std::max(wait_us, aheadUs(pg_atomic_read_u64(&slot.token_tat)));
+    if (wait_us > 0)
+      return wait_us;
+
+    if (bucket.request_interval_us > 0) {
+      uint64 next = std::max(request_tat, now) +
+                    static_cast<uint64>(bucket.request_interval_us);
+      if (!pg_atomic_compare_exchange_u64(&slot.request_tat, &request_tat,
+                                          next))
+        continue;
+    }
+    break;
+  }
+
+  // The request is admitted; its tokens are charged even if that takes the
+  // bucket further into debt than another caller just did.
+  if (bucket.token_interval_us > 0 && tokens > 0) {
+    uint64 cost = static_cast<uint64>(bucket.token_interval_us *
+                                      static_cast<double>(tokens));
+    uint64 token_tat = pg_atomic_read_u64(&slot.token_tat);
+    while (!pg_atomic_compare_exchange_u64(&slot.token_tat, &token_tat,
+                                           std::max(token_tat, now) + cost)) {
+    }
+  }
+  pg_atomic_write_u64(&slot.last_used, now);
+  pg_atomic_fetch_add_u64(&slot.admitted, 1);
+  return 0;
+}
+
+std::optional<std::string> RateLimiter::acquire(const Bucket& bucket,
+                                                uint64_t tokens,
+                                                long max_wait_ms) {
+  if (bucket.slot < 0)
+    return std::nullopt;
+  const auto& cfg = config::ConfigManager::getConfig();
+  long limit_ms = cfg.rate_limit_policy == config::RateLimitPolicy::FAIL
+                      ? 0
+                      : std::min<long>(max_wait_ms,
+                                       std::max(cfg.rate_limit_max_wait_ms, 0));
+  Slot& slot = slotOf(bucket);
+  uint64 started = nowUs();
+  bool waiting = false;
+
+  // Registered before checking, so a refund in between is not missed.
+  ConditionVariablePrepareToSleep(&slot.changed);
+  for (;;) {
+    int64_t wait_us = tryAcquire(bucket, tokens);
+    if (wait_us == 0) {
+      ConditionVariableCancelSleep();
+      return std::nullopt;
+    }
+
+    int64_t waited_us = static_cast<int64_t>(nowUs() - started);
+    if (waited_us + wait_us > static_cast<int64_t>(limit_ms) * 1000) {
+      ConditionVariableCancelSleep();
+      return reject(bucket, wait_us);
+    }
+    if (!waiting) {
+      waiting = true;
+      noteWait(bucket);
+      logger::Logger::debug("Waiting up to " +
+                            std::to_string((wait_us + 999) / 1000) +
+                            " ms for the rate limit of " + slot.name);
+    }
+
+    if (QueryCancelPending || ProcDiePending) {
+      ConditionVariableCancelSleep();
+      throw CallInterrupted();
+    }
+    long timeout_ms = std::clamp<long>((wait_us + 999) / 1000, 1, kMaxSleepMs);
+#if PG_VERSION_NUM >= 140000
+    // Held so that an interrupt cannot raise an error through C++ frames;
+    // it is turned into CallInterrupted above.
+    HOLD_INTERRUPTS();
+    (void)ConditionVariableTimedSleep(&slot.changed, timeout_ms,
+                                      PG_WAIT_EXTENSION);
+    RESUME_INTERRUPTS();
+#else
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    timeout_ms, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+#endif
+  }
+}
+
+std::string RateLimiter::reject(const Bucket& bucket, int64_t wait_us) {
+  Slot& slot = slotOf(bucket);
+  pg_atomic_fetch_add_u64(&slot.rejected, 1);
+  return "Rate limit of " + std::string(slot.name) +
+         " reached; next call possible in " +
+         std::to_string((wait_us + 999) / 1000) + " ms";
+}
+
+void RateLimiter::noteWait(const Bucket& bucket) {
+  pg_atomic_fetch_add_u64(&slotOf(bucket).waited, 1);
+}
+
+void RateLimiter::refund(const Bucket& bucket,
+                         uint64_t charged,
+                         uint64_t used) {
+  if (bucket.slot < 0 || bucket.token_interval_us <= 0 || used >= charged)
+    return;
+  Slot& slot = slotOf(bucket);
+  uint64 credit = static_cast<uint64>(bucket.token_interval_us *
+                                      static_cast<double>(charged - used));
+  uint64 now = nowUs();
+  uint64 token_tat = pg_atomic_read_u64(&slot.token_tat);
+  while (token_tat > now) {
+    uint64 next = token_tat - now > credit ? token_tat - credit : now;
+    if (pg_atomic_compare_exchange_u64(&slot.token_tat, &token_tat, next))
+      break;
+  }
+  ConditionVariableBroadcast(&slot.changed);
+}
+
+void RateLimiter::throttle(const Bucket& bucket) {
+  if (bucket.slot < 0 || bucket.throttle_us <= 0)
+    return;
+  Slot& slot = slotOf(bucket);
+  uint64 until = nowUs() + static_cast<uint64>(bucket.throttle_us);
+  uint64 blocked_until = pg_atomic_read_u64(&slot.blocked_until);
+  while (blocked_until < until &&
+         !pg_atomic_compare_exchange_u64(&slot.blocked_until, &blocked_until,
+                                         until)) {
+  }
+  pg_atomic_fetch_add_u64(&slot.throttled, 1);
+}
+
+bool RateLimiter::isRateLimited(const std::string& message) {
+  std::string lower = message;
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  for (const char* marker :
+       {"429", "rate limit", "rate_limit", "too many requests"}) {
+    if (lower.find(marker) != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+std::vector<RateLimiter::BucketState> RateLimiter::buckets() {
+  const auto& cfg = config::ConfigManager::getConfig();
+  auto tolerance_us =
+      static_cast<int64_t>(std::max(cfg.rate_limit_burst_seconds, 0.0) * 1e6);
+  Slot* all = slots();
+  uint64 now = nowUs();
+
+  std::vector<BucketState> result;
+  for (int i = 0; i <= kOverflowSlot; i++) {
+    Slot& slot = all[i];
+    if (pg_atomic_read_u64(&slot.key) == 0)
+      continue;
+    pg_read_barrier();
+
+    BucketState state;
+    state.name = slot.name;
+    uint64 requests_per_minute =
+        pg_atomic_read_u64(&slot.requests_per_minute);
+    uint64 tokens_per_minute = pg_atomic_read_u64(&slot.tokens_per_minute);
+    state.requests_per_minute = static_cast<int64_t>(requests_per_minute);
+    state.tokens_per_minute = static_cast<int64_t>(tokens_per_minute);
+    state.requests_available =
+        available(pg_atomic_read_u64(&slot.request_tat), now, tolerance_us,
+                  requests_per_minute);
+    state.tokens_available =
+        available(pg_atomic_read_u64(&slot.token_tat), now, tolerance_us,
+                  tokens_per_minute);
+    uint64 blocked_until = pg_atomic_read_u64(&slot.blocked_until);
+    state.blocked_ms = blocked_until > now
+                           ? static_cast<int64_t>(blocked_until - now) / 1000
+                           : 0;
+    state.admitted = pg_atomic_read_u64(&slot.admitted);
+    state.waited = pg_atomic_read_u64(&slot.waited);
+    state.rejected = pg_atomic_read_u64(&slot.rejected);
+    state.throttled = pg_atomic_read_u64(&slot.throttled);
+    result.push_back(std::move(state));
+  }
+  return result;
+}
+
+}  // namespace pg_ai
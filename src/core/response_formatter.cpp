@@ -43,6 +43,11 @@ std::string ResponseFormatter::createJSONResponse(
     response["row_limit_applied"] = true;
   }
 
+  if (result.similar_cache_hit) {
+    response["similar_cache_hit"] = true;
+    response["cached_request"] = result.cached_request;
+  }
+
   return response.dump(2);  // Pretty print with 2-space indentation
 }
 
@@ -76,6 +81,11 @@ std::string ResponseFormatter::createPlainTextResponse(
               "for safety";
   }
 
+  if (result.similar_cache_hit) {
+    output << "\n\n-- Note: Reused the cached query of a similar request: "
+           << result.cached_request;
+  }
+
   return output.str();
 }
 
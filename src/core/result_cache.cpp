@@ -0,0 +1,531 @@
+#include "../include/result_cache.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <common/hashfn.h>
+#include <lib/ilist.h>
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/shmem.h>
+#include <utils/hsearch.h>
+#include <utils/timestamp.h>
+}
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <nlohmann/json.hpp>
+
+#include "../include/logger.hpp"
+#include "../include/minhash.hpp"
+#include "../include/prompts.hpp"
+#include "../include/schema_fingerprint.hpp"
+#include "../include/shmem.hpp"
+
+namespace pg_ai {
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(QueryResult,
+                                   generated_query,
+                                   explanation,
+                                   warnings,
+                                   row_limit_applied,
+                                   suggested_visualization)
+
+namespace {
+
+// Two independent 64-bit hashes of the full key; the key itself is stored
+// with the payload and compared on lookup.
+struct ResultKey {
+  uint64 hash_a;
+  uint64 hash_b;
+};
+
+struct ResultEntry {
+  ResultKey key;  // hash key, must be first
+  dlist_node lru_node;
+  dsa_pointer payload;
+  Size payload_size;
+  TimestampTz stored_at;
+  uint64 scope;
+  uint64 bands[MinHash::kBands];
+};
+
+// One LSH bucket: requests of one scope whose signatures agree on a band.
+// Only the latest result per bucket is kept.
+struct BandKey {
+  uint64 scope;
+  uint64 band_hash;
+  uint32 band;
+};
+
+struct BandEntry {
+  BandKey key;  // hash key, must be first
+  ResultKey result;
+};
+
+struct SharedState {
+  dlist_head lru;  // most recently used first
+  long entries;
+  Size bytes;
+  pg_atomic_uint64 hits;
+  pg_atomic_uint64 similar_hits;
+  pg_atomic_uint64 misses;
+  pg_atomic_uint64 evictions;
+};
+
+bool cache_enabled = false;
+bool similar_enabled = false;
+long max_entries = 0;
+Size max_bytes = 0;
+HTAB* cache_index = nullptr;
+HTAB* band_index = nullptr;
+SharedState* shared = nullptr;
+
+uint64 hashText(const std::string& text) {
+  return hash_bytes_extended(
+      reinterpret_cast<const unsigned char*>(text.data()), text.size(), 0);
+}
+
+BandKey makeBandKey(uint64 scope, uint32 band, uint64 band_hash) {
+  BandKey key;
+  std::memset(&key, 0, sizeof(key));
+  key.scope = scope;
+  key.band = band;
+  key.band_hash = band_hash;
+  return key;
+}
+
+ResultKey hashKey(const std::string& key) {
+  ResultKey result;
+  std::memset(&result, 0, sizeof(result));
+  result.hash_a = hash_bytes_extended(
+      reinterpret_cast<const unsigned char*>(key.data()), key.size(), 0);
+  result.hash_b = hash_bytes_extended(
+      reinterpret_cast<const unsigned char*>(key.data()), key.size(),
+      UINT64CONST(0x9e3779b97f4a7c15));
+  return result;
+}
+
+struct Payload {
+  QueryResult result;
+  std::string request;
+  std::vector<std::string> features;
+};
+
+// Payload layout: key length, key, CBOR of the result, request and its
+// features.
+std::string encode(const ResultCache::Key& key, const QueryResult& result) {
+  nlohmann::json body = {{"result", result},
+                         {"request", key.request},
+                         {"features", key.features}};
+  std::vector<uint8_t> cbor = nlohmann::json::to_cbor(body);
+  uint32 key_size = static_cast<uint32>(key.text.size());
+  std::string blob(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+  blob += key.text;
+  blob.append(cbor.begin(), cbor.end());
+  return blob;
+}
+
+// With a key, only an entry stored under exactly that key is accepted.
+std::optional<Payload> decode(const std::string& blob,
+                              const std::string* key = nullptr) {
+  uint32 key_size;
+  if (blob.size() < sizeof(key_size))
+    return std::nullopt;
+  std::memcpy(&key_size, blob.data(), sizeof(key_size));
+  if (blob.size() < sizeof(key_size) + key_size ||
+      (key && blob.compare(sizeof(key_size), key_size, *key) != 0))
+    return std::nullopt;
+
+  auto cbor = blob.begin() + sizeof(key_size) + key_size;
+  auto body = nlohmann::json::from_cbor(cbor, blob.end());
+  Payload payload{.result = body.at("result").get<QueryResult>(),
+                  .request = body.at("request").get<std::string>(),
+                  .features =
+                      body.at("features").get<std::vector<std::string>>()};
+  payload.result.success = true;
+  return payload;
+}
+
+// Caller holds the cache lock exclusively.
+void indexBands(ResultEntry* entry) {
+  if (!band_index)
+    return;
+  for (uint32 band = 0; band < MinHash::kBands; band++) {
+    BandKey key = makeBandKey(entry->scope, band, entry->bands[band]);
+    auto* bucket = static_cast<BandEntry*>(
+        hash_search(band_index, &key, HASH_ENTER_NULL, nullptr));
+    // A full index only makes similar requests less likely to be found.
+    if (bucket)
+      bucket->result = entry->key;
+  }
+}
+
+// Caller holds the cache lock exclusively.
+void unindexBands(const ResultEntry* entry) {
+  if (!band_index)
+    return;
+  for (uint32 band = 0; band < MinHash::kBands; band++) {
+    BandKey key = makeBandKey(entry->scope, band, entry->bands[band]);
+    auto* bucket = static_cast<BandEntry*>(
+        hash_search(band_index, &key, HASH_FIND, nullptr));
+    if (bucket &&
+        std::memcmp(&bucket->result, &entry->key, sizeof(ResultKey)) == 0)
+      hash_search(band_index, &key, HASH_REMOVE, nullptr);
+  }
+}
+
+// Caller holds the cache lock exclusively.
+void removeEntry(ResultEntry* entry, dsa_area* area) {
+  unindexBands(entry);
+  dlist_delete(&entry->lru_node);
+  if (DsaPointerIsValid(entry->payload))
+    dsa_free(area, entry->payload);
+  shared->entries--;
+  shared->bytes -= entry->payload_size;
+  hash_search(cache_index, &entry->key, HASH_REMOVE, nullptr);
+}
+
+// Caller holds the cache lock exclusively.
+bool evictOldest(dsa_area* area) {
+  if (dlist_is_empty(&shared->lru))
+    return false;
+  auto* oldest =
+      dlist_tail_element(ResultEntry, lru_node, &shared->lru);
+  removeEntry(oldest, area);
+  pg_atomic_fetch_add_u64(&shared->evictions, 1);
+  return true;
+}
+
+bool expired(const ResultEntry* entry, TimestampTz now) {
+  int ttl = config::ConfigManager::getConfig().result_cache_ttl_seconds;
+  return ttl > 0 && now - entry->stored_at > int64(ttl) * USECS_PER_SEC;
+}
+
+// Payloads of the latest results sharing a band with the request. Caller
+// holds the cache lock.
+std::vector<std::string> similarCandidates(const ResultCache::Key& key,
+                                           dsa_area* area,
+                                           TimestampTz now) {
+  std::vector<std::string> blobs;
+  std::vector<ResultKey> seen;
+  auto bands = MinHash::bands(MinHash::signature(key.features));
+  for (uint32 band = 0; band < MinHash::kBands; band++) {
+    BandKey band_key = makeBandKey(key.scope, band, bands[band]);
+    auto* bucket = static_cast<BandEntry*>(
+        hash_search(band_index, &band_key, HASH_FIND, nullptr));
+    if (!bucket)
+      continue;
+    bool duplicate = std::any_of(seen.begin(), seen.end(), [&](const auto& k) {
+      return std::memcmp(&k, &bucket->result, sizeof(ResultKey)) == 0;
+    });
+    if (duplicate)
+      continue;
+    seen.push_back(bucket->result);
+
+    auto* entry = static_cast<ResultEntry*>(
+        hash_search(cache_index, &bucket->result, HASH_FIND, nullptr));
+    if (!entry || entry->scope != key.scope || expired(entry, now))
+      continue;
+    blobs.emplace_back(
+        static_cast<const char*>(dsa_get_address(area, entry->payload)),
+        entry->payload_size);
+  }
+  return blobs;
+}
+
+}  // namespace
+
+void ResultCache::configure(const config::Configuration& cfg) {
+  cache_enabled = cfg.result_cache_enabled;
+  similar_enabled = cache_enabled && cfg.result_cache_similar_enabled;
+  max_entries =
+      cfg.result_cache_max_entries > 0 ? cfg.result_cache_max_entries : 1024;
+  max_bytes =
+      static_cast<Size>(std::max(cfg.result_cache_size_mb, 1)) * 1024 * 1024;
+}
+
+Size ResultCache::shmemSize() {
+  if (!cache_enabled)
+    return 0;
+  Size size = add_size(hash_estimate_size(max_entries, sizeof(ResultEntry)),
+                       MAXALIGN(sizeof(SharedState)));
+  if (similar_enabled) {
+    size = add_size(size, hash_estimate_size(max_entries * MinHash::kBands,
+                                             sizeof(BandEntry)));
+  }
+  return size;
+}
+
+Size ResultCache::areaSize() {
+  return cache_enabled ? max_bytes : 0;
+}
+
+void ResultCache::shmemInit() {
+  if (!cache_enabled)
+    return;
+
+  HASHCTL info;
+  std::memset(&info, 0, sizeof(info));
+  info.keysize = sizeof(ResultKey);
+  info.entrysize = sizeof(ResultEntry);
+  cache_index = ShmemInitHash("pg_ai_query result cache", max_entries,
+                              max_entries, &info, HASH_ELEM | HASH_BLOBS);
+
+  if (similar_enabled) {
+    std::memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(BandKey);
+    info.entrysize = sizeof(BandEntry);
+    long buckets = max_entries * static_cast<long>(MinHash::kBands);
+    band_index = ShmemInitHash("pg_ai_query result cache bands", buckets,
+                               buckets, &info, HASH_ELEM | HASH_BLOBS);
+  }
+
+  bool found = false;
+  shared = static_cast<SharedState*>(ShmemInitStruct(
+      "pg_ai_query result cache state", sizeof(SharedState), &found));
+  if (!found) {
+    dlist_init(&shared->lru);
+    shared->entries = 0;
+    shared->bytes = 0;
+    pg_atomic_init_u64(&shared->hits, 0);
+    pg_atomic_init_u64(&shared->similar_hits, 0);
+    pg_atomic_init_u64(&shared->misses, 0);
+    pg_atomic_init_u64(&shared->evictions, 0);
+  }
+}
+
+std::string ResultCache::normalize(const std::string& request) {
+  std::string normalized;
+  normalized.reserve(request.size());
+  char quote = 0;
+  bool pending_space = false;
+  for (char c : request) {
+    if (quote) {
+      normalized += c;
+      if (c == quote)
+        quote = 0;
+      continue;
+    }
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      pending_space = !normalized.empty();
+      continue;
+    }
+    if (pending_space) {
+      normalized += ' ';
+      pending_space = false;
+    }
+    if (c == '\'' || c == '"')
+      quote = c;
+    normalized +=
+        static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  return normalized;
+}
+
+std::optional<ResultCache::Key> ResultCache::makeKey(
+    const std::string& request,
+    const std::string& provider,
+    const std::string& model) {
+  if (!cache_index)
+    return std::nullopt;
+  // Without the DDL triggers a schema change could not be noticed.
+  auto schema_version = SchemaFingerprint::version();
+  if (!schema_version)
+    return std::nullopt;
+
+  const auto& cfg = config::ConfigManager::getConfig();
+  nlohmann::json scope = {
+      {"database", MyDatabaseId},
+      {"role", GetUserId()},
+      {"schema", *schema_version},
+      {"provider", provider},
+      {"model", model},
+      {"prompt", prompts::PROMPT_VERSION},
+      {"context",
+       {cfg.schema_context_token_budget, cfg.schema_context_max_detailed_tables,
+        cfg.schema_column_stats, cfg.schema_column_stats_mcv_count}},
+      {"routing", {cfg.routing_enabled, cfg.routing_threshold}}};
+
+  Key key;
+  key.request = request;
+  key.features = MinHash::features(request);
+  key.scope = hashText(scope.dump() + '\0' + MinHash::literals(request));
+  scope["request"] = normalize(request);
+  key.text = scope.dump();
+  return key;
+}
+
+std::optional<QueryResult> ResultCache::lookup(const Key& key) {
+  if (!cache_index)
+    return std::nullopt;
+  dsa_area* area = shmem::area();
+  if (!area)
+    return std::nullopt;
+
+  const auto& cfg = config::ConfigManager::getConfig();
+  bool try_similar = band_index && cfg.result_cache_similarity_threshold > 0 &&
+                     cfg.result_cache_similarity_threshold <= 1;
+  ResultKey hash_key = hashKey(key.text);
+  TimestampTz now = GetCurrentTimestamp();
+  std::optional<std::string> blob;
+  std::vector<std::string> candidates;
+  LWLock* lock = shmem::lock(shmem::LockId::RESULT_CACHE);
+
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  auto* entry = static_cast<ResultEntry*>(
+      hash_search(cache_index, &hash_key, HASH_FIND, nullptr));
+  if (entry && expired(entry, now)) {
+    removeEntry(entry, area);
+    entry = nullptr;
+  }
+  if (entry) {
+    dlist_move_head(&shared->lru, &entry->lru_node);
+    blob.emplace(
+        static_cast<const char*>(dsa_get_address(area, entry->payload)),
+        entry->payload_size);
+  } else if (try_similar) {
+    candidates = similarCandidates(key, area, now);
+  }
+  LWLockRelease(lock);
+
+  std::optional<QueryResult> result;
+  try {
+    if (blob) {
+      if (auto payload = decode(*blob, &key.text))
+        result = std::move(payload->result);
+    }
+
+    // The best candidate at or above the threshold, compared exactly.
+    double best = cfg.result_cache_similarity_threshold;
+    for (const auto& candidate : candidates) {
+      auto payload = decode(candidate);
+      if (!payload)
+        continue;
+      double similarity = MinHash::jaccard(key.features, payload->features);
+      if (similarity >= best) {
+        best = similarity;
+        result = std::move(payload->result);
+        result->similar_cache_hit = true;
+        result->cached_request = payload->request;
+      }
+    }
+  } catch (const std::exception& e) {
+    logger::Logger::warning("Discarding unreadable result cache entry: " +
+                            std::string(e.what()));
+  }
+
+  if (result && result->similar_cache_hit) {
+    logger::Logger::debug("Reusing the cached result of a similar request: " +
+                          result->cached_request);
+    pg_atomic_fetch_add_u64(&shared->similar_hits, 1);
+  }
+  pg_atomic_fetch_add_u64(result ? &shared->hits : &shared->misses, 1);
+  return result;
+}
+
+void ResultCache::store(const Key& key, const QueryResult& result) {
+  // A reused result stays filed under the request it was generated for.
+  if (!cache_index || !result.success || result.similar_cache_hit)
+    return;
+  dsa_area* area = shmem::area();
+  if (!area)
+    return;
+
+  std::string blob = encode(key, result);
+  if (blob.size() > max_bytes)
+    return;
+  ResultKey hash_key = hashKey(key.text);
+  auto bands = MinHash::bands(MinHash::signature(key.features));
+  LWLock* lock = shmem::lock(shmem::LockId::RESULT_CACHE);
+
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  auto* existing = static_cast<ResultEntry*>(
+      hash_search(cache_index, &hash_key, HASH_FIND, nullptr));
+  if (existing)
+    removeEntry(existing, area);
+  while (shared->entries >= max_entries ||
+         shared->bytes + blob.size() > max_bytes) {
+    if (!evictOldest(area))
+      break;
+  }
+
+  // The area is shared with the schema cache, so it may fill up first.
+  // Results are only evicted until they have freed as much as this one
+  // needs; if that is not enough, the space is held by the schema cache and
+  // evicting more would only empty the result cache.
+  dsa_pointer payload =
+      dsa_allocate_extended(area, blob.size(), DSA_ALLOC_NO_OOM);
+  Size bytes_before = shared->bytes;
+  while (!DsaPointerIsValid(payload) &&
+         bytes_before - shared->bytes < blob.size() && evictOldest(area))
+    payload = dsa_allocate_extended(area, blob.size(), DSA_ALLOC_NO_OOM);
+  if (!DsaPointerIsValid(payload)) {
+    LWLockRelease(lock);
+    logger::Logger::warning("Result cache is full, result not cached");
+    return;
+  }
+  std::memcpy(dsa_get_address(area, payload), blob.data(), blob.size());
+
+  bool found = false;
+  auto* entry = static_cast<ResultEntry*>(
+      hash_search(cache_index, &hash_key, HASH_ENTER_NULL, &found));
+  if (!entry) {
+    dsa_free(area, payload);
+    LWLockRelease(lock);
+    return;
+  }
+  entry->payload = payload;
+  entry->payload_size = blob.size();
+  entry->stored_at = GetCurrentTimestamp();
+  entry->scope = key.scope;
+  std::copy(bands.begin(), bands.end(), entry->bands);
+  dlist_push_head(&shared->lru, &entry->lru_node);
+  indexBands(entry);
+  shared->entries++;
+  shared->bytes += blob.size();
+  LWLockRelease(lock);
+}
+
+uint64_t ResultCache::reset() {
+  if (!cache_index)
+    return 0;
+  dsa_area* area = shmem::area();
+  if (!area)
+    return 0;
+
+  LWLock* lock = shmem::lock(shmem::LockId::RESULT_CACHE);
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  uint64_t removed = 0;
+  while (!dlist_is_empty(&shared->lru)) {
+    removeEntry(dlist_head_element(ResultEntry, lru_node, &shared->lru), area);
+    removed++;
+  }
+  pg_atomic_write_u64(&shared->hits, 0);
+  pg_atomic_write_u64(&shared->similar_hits, 0);
+  pg_atomic_write_u64(&shared->misses, 0);
+  pg_atomic_write_u64(&shared->evictions, 0);
+  LWLockRelease(lock);
+  return removed;
+}
+
+ResultCache::Stats ResultCache::stats() {
+  Stats result;
+  if (!shared)
+    return result;
+
+  LWLock* lock = shmem::lock(shmem::LockId::RESULT_CACHE);
+  LWLockAcquire(lock, LW_SHARED);
+  result.entries = shared->entries;
+  result.bytes = shared->bytes;
+  LWLockRelease(lock);
+  result.hits = pg_atomic_read_u64(&shared->hits);
+  result.similar_hits = pg_atomic_read_u64(&shared->similar_hits);
+  result.misses = pg_atomic_read_u64(&shared->misses);
+  result.evictions = pg_atomic_read_u64(&shared->evictions);
+  return result;
+}
+
+}  // namespace pg_ai
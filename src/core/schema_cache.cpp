@@ -0,0 +1,523 @@
+#include "../include/schema_cache.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <miscadmin.h>
+#include <port/atomics.h>
+#include <storage/shmem.h>
+#include <utils/hsearch.h>
+#include <utils/inval.h>
+#include <utils/syscache.h>
+}
+
+#include <cstring>
+#include <optional>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "../include/logger.hpp"
+#include "../include/shmem.hpp"
+
+namespace pg_ai {
+
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(TableInfo,
+                                   table_name,
+                                   schema_name,
+                                   table_type,
+                                   estimated_rows)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ColumnInfo,
+                                   column_name,
+                                   data_type,
+                                   is_nullable,
+                                   column_default,
+                                   is_primary_key,
+                                   is_foreign_key,
+                                   foreign_table,
+                                   foreign_column)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ColumnStats,
+                                   column_name,
+                                   has_statistics,
+                                   null_frac,
+                                   n_distinct,
+                                   most_common_values,
+                                   has_correlation,
+                                   correlation,
+                                   leading_index)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(ForeignKeyInfo,
+                                   schema_name,
+                                   table_name,
+                                   foreign_schema_name,
+                                   foreign_table_name)
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(TableDetails,
+                                   table_name,
+                                   schema_name,
+                                   columns,
+                                   indexes)
+
+namespace {
+
+struct CacheKey {
+  Oid dbid;
+  Oid relid;
+  uint32 kind;
+};
+
+struct CacheEntry {
+  CacheKey key;  // hash key, must be first
+  uint64 version;
+  uint64 generation;
+  bool valid;
+  dsa_pointer payload;
+  Size payload_size;
+};
+
+// pg_statistic invalidations carry only a catcache hash value, which cannot be
+// mapped back to a relation. They bump a per-database generation instead, and
+// column statistics entries built under an older generation are rebuilt.
+constexpr int kGenerationSlots = 64;
+
+bool cache_enabled = false;
+long max_entries = 0;
+HTAB* cache_index = nullptr;
+pg_atomic_uint64* generations = nullptr;
+
+pg_atomic_uint64* generationSlot() {
+  return &generations[MyDatabaseId % kGenerationSlots];
+}
+
+uint64 currentGeneration(SchemaCache::EntryKind kind) {
+  if (kind != SchemaCache::EntryKind::COLUMN_STATS)
+    return 0;
+  return pg_atomic_read_u64(generationSlot());
+}
+
+CacheKey makeKey(SchemaCache::EntryKind kind, Oid relid) {
+  CacheKey key;
+  std::memset(&key, 0, sizeof(key));
+  key.dbid = MyDatabaseId;
+  key.relid = relid;
+  key.kind = static_cast<uint32>(kind);
+  return key;
+}
+
+std::string encode(const nlohmann::json& j) {
+  std::vector<uint8_t> bytes = nlohmann::json::to_cbor(j);
+  return std::string(bytes.begin(), bytes.end());
+}
+
+nlohmann::json decode(const std::string& blob) {
+  return nlohmann::json::from_cbor(blob.begin(), blob.end());
+}
+
+// Drop stale entries and release their payloads. Caller holds the cache lock
+// exclusively.
+void sweepInvalidEntries(dsa_area* area) {
+  HASH_SEQ_STATUS status;
+  hash_seq_init(&status, cache_index);
+  CacheEntry* entry;
+  while ((entry = static_cast<CacheEntry*>(hash_seq_search(&status)))) {
+    auto& generation = generations[entry->key.dbid % kGenerationSlots];
+    bool stale_generation =
+        entry->key.kind ==
+            static_cast<uint32>(SchemaCache::EntryKind::COLUMN_STATS) &&
+        entry->generation != pg_atomic_read_u64(&generation);
+    if (entry->valid && !stale_generation)
+      continue;
+    if (DsaPointerIsValid(entry->payload))
+      dsa_free(area, entry->payload);
+    hash_search(cache_index, &entry->key, HASH_REMOVE, nullptr);
+  }
+}
+
+CacheEntry* enterEntry(const CacheKey& key, dsa_area* area) {
+  bool found = false;
+  auto* entry = static_cast<CacheEntry*>(
+      hash_search(cache_index, &key, HASH_ENTER_NULL, &found));
+  if (!entry) {
+    sweepInvalidEntries(area);
+    entry = static_cast<CacheEntry*>(
+        hash_search(cache_index, &key, HASH_ENTER_NULL, &found));
+    if (!entry)
+      return nullptr;
+  }
+  if (!found) {
+    entry->version = 0;
+    entry->generation = 0;
+    entry->valid = false;
+    entry->payload = InvalidDsaPointer;
+    entry->payload_size = 0;
+  }
+  return entry;
+}
+
+void relcacheCallback(Datum arg, Oid relid) {
+  if (OidIsValid(relid)) {
+    SchemaCache::invalidate(SchemaCache::EntryKind::TABLE_DETAILS, relid);
+    SchemaCache::invalidate(SchemaCache::EntryKind::TABLE_TEXT, relid);
+  } else {
+    SchemaCache::invalidateDatabase();
+  }
+}
+
+void relationListCallback(Datum arg, int cacheid, uint32 hashvalue) {
+  SchemaCache::invalidate(SchemaCache::EntryKind::TABLE_LIST, InvalidOid);
+  SchemaCache::invalidate(SchemaCache::EntryKind::SCHEMA_TEXT, InvalidOid);
+  SchemaCache::invalidate(SchemaCache::EntryKind::FOREIGN_KEYS, InvalidOid);
+}
+
+void constraintCallback(Datum arg, int cacheid, uint32 hashvalue) {
+  SchemaCache::invalidate(SchemaCache::EntryKind::FOREIGN_KEYS, InvalidOid);
+}
+
+void statisticCallback(Datum arg, int cacheid, uint32 hashvalue) {
+  if (generations)
+    pg_atomic_fetch_add_u64(generationSlot(), 1);
+}
+
+}  // namespace
+
+void SchemaCache::configure(const config::Configuration& cfg) {
+  cache_enabled = cfg.schema_cache_enabled;
+  max_entries = cfg.schema_cache_max_entries > 0
+                    ? cfg.schema_cache_max_entries
+                    : 1024;
+}
+
+Size SchemaCache::shmemSize() {
+  if (!cache_enabled)
+    return 0;
+  return add_size(hash_estimate_size(max_entries, sizeof(CacheEntry)),
+                  mul_size(kGenerationSlots, sizeof(pg_atomic_uint64)));
+}
+
+void SchemaCache::shmemInit() {
+  if (!cache_enabled)
+    return;
+
+  HASHCTL info;
+  std::memset(&info, 0, sizeof(info));
+  info.keysize = sizeof(CacheKey);
+  info.entrysize = sizeof(CacheEntry);
+  cache_index = ShmemInitHash("pg_ai_query schema cache", max_entries,
+                              max_entries, &info, HASH_ELEM | HASH_BLOBS);
+
+  bool found = false;
+  generations = static_cast<pg_atomic_uint64*>(
+      ShmemInitStruct("pg_ai_query schema cache generations",
+                      mul_size(kGenerationSlots, sizeof(pg_atomic_uint64)),
+                      &found));
+  if (!found) {
+    for (int i = 0; i < kGenerationSlots; i++)
+      pg_atomic_init_u64(&generations[i], 0);
+  }
+}
+
+void SchemaCache::registerInvalidationCallbacks() {
+  CacheRegisterRelcacheCallback(relcacheCallback, (Datum)0);
+  // Any pg_class or pg_namespace change may add, drop or rename a table.
+  CacheRegisterSyscacheCallback(RELNAMENSP, relationListCallback, (Datum)0);
+  CacheRegisterSyscacheCallback(NAMESPACEOID, relationListCallback, (Datum)0);
+  CacheRegisterSyscacheCallback(CONSTROID, constraintCallback, (Datum)0);
+  CacheRegisterSyscacheCallback(STATRELATTINH, statisticCallback, (Datum)0);
+}
+
+bool SchemaCache::lookup(EntryKind kind,
+                         Oid relid,
+                         std::string& blob,
+                         uint64_t& ticket) {
+  std::vector<std::optional<std::string>> blobs;
+  std::vector<uint64_t> tickets;
+  lookupMany(kind, {relid}, &blobs, tickets);
+  ticket = tickets[0];
+  if (!blobs[0])
+    return false;
+  blob = std::move(*blobs[0]);
+  return true;
+}
+
+void SchemaCache::lookupMany(EntryKind kind,
+                             const std::vector<Oid>& relids,
+                             std::vector<std::optional<std::string>>* blobs,
+                             std::vector<uint64_t>& tickets) {
+  if (blobs)
+    blobs->assign(relids.size(), std::nullopt);
+  tickets.assign(relids.size(), 0);
+  if (!cache_index || relids.empty())
+    return;
+  dsa_area* area = shmem::area();
+  if (!area)
+    return;
+
+  LWLock* lock = shmem::lock(shmem::LockId::SCHEMA_CACHE);
+  uint64 generation = currentGeneration(kind);
+  std::vector<size_t> absent;
+
+  LWLockAcquire(lock, LW_SHARED);
+  for (size_t i = 0; i < relids.size(); i++) {
+    CacheKey key = makeKey(kind, relids[i]);
+    auto* entry = static_cast<CacheEntry*>(
+        hash_search(cache_index, &key, HASH_FIND, nullptr));
+    if (entry && entry->generation != generation) {
+      absent.push_back(i);
+    } else if (entry && entry->valid) {
+      if (blobs) {
+        (*blobs)[i].emplace(
+            static_cast<const char*>(dsa_get_address(area, entry->payload)),
+            entry->payload_size);
+      }
+    } else if (entry) {
+      tickets[i] = entry->version + 1;
+    } else {
+      absent.push_back(i);
+    }
+  }
+  LWLockRelease(lock);
+
+  if (absent.empty())
+    return;
+
+  // Create placeholders so invalidations arriving while the caller builds
+  // the entries bump their versions and void the tickets.
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  for (size_t i : absent) {
+    CacheEntry* entry = enterEntry(makeKey(kind, relids[i]), area);
+    if (!entry)
+      continue;
+    if (entry->generation != generation) {
+      entry->version++;
+      entry->valid = false;
+      entry->generation = generation;
+    }
+    tickets[i] = entry->version + 1;
+  }
+  LWLockRelease(lock);
+}
+
+void SchemaCache::store(EntryKind kind,
+                        Oid relid,
+                        const std::string& blob,
+                        uint64_t ticket) {
+  if (ticket == 0 || !cache_index || blob.empty())
+    return;
+  dsa_area* area = shmem::area();
+  if (!area)
+    return;
+
+  LWLock* lock = shmem::lock(shmem::LockId::SCHEMA_CACHE);
+
+  dsa_pointer payload =
+      dsa_allocate_extended(area, blob.size(), DSA_ALLOC_NO_OOM);
+  if (!DsaPointerIsValid(payload)) {
+    LWLockAcquire(lock, LW_EXCLUSIVE);
+    sweepInvalidEntries(area);
+    LWLockRelease(lock);
+    payload = dsa_allocate_extended(area, blob.size(), DSA_ALLOC_NO_OOM);
+    if (!DsaPointerIsValid(payload)) {
+      logger::Logger::warning("Schema cache is full, entry not cached");
+      return;
+    }
+  }
+  std::memcpy(dsa_get_address(area, payload), blob.data(), blob.size());
+
+  CacheKey key = makeKey(kind, relid);
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  auto* entry = static_cast<CacheEntry*>(
+      hash_search(cache_index, &key, HASH_FIND, nullptr));
+  if (!entry || entry->version + 1 != ticket ||
+      entry->generation != currentGeneration(kind)) {
+    LWLockRelease(lock);
+    dsa_free(area, payload);
+    return;
+  }
+  if (DsaPointerIsValid(entry->payload))
+    dsa_free(area, entry->payload);
+  entry->payload = payload;
+  entry->payload_size = blob.size();
+  entry->valid = true;
+  LWLockRelease(lock);
+}
+
+void SchemaCache::invalidate(EntryKind kind, Oid relid) {
+  if (!cache_index)
+    return;
+
+  CacheKey key = makeKey(kind, relid);
+  LWLock* lock = shmem::lock(shmem::LockId::SCHEMA_CACHE);
+
+  // Most relcache invalidations concern relations we never cached.
+  LWLockAcquire(lock, LW_SHARED);
+  bool present = hash_search(cache_index, &key, HASH_FIND, nullptr) != nullptr;
+  LWLockRelease(lock);
+  if (!present)
+    return;
+
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  auto* entry = static_cast<CacheEntry*>(
+      hash_search(cache_index, &key, HASH_FIND, nullptr));
+  if (entry) {
+    entry->version++;
+    entry->valid = false;
+  }
+  LWLockRelease(lock);
+}
+
+void SchemaCache::invalidateDatabase() {
+  if (!cache_index)
+    return;
+
+  LWLock* lock = shmem::lock(shmem::LockId::SCHEMA_CACHE);
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  HASH_SEQ_STATUS status;
+  hash_seq_init(&status, cache_index);
+  CacheEntry* entry;
+  while ((entry = static_cast<CacheEntry*>(hash_seq_search(&status)))) {
+    if (entry->key.dbid == MyDatabaseId) {
+      entry->version++;
+      entry->valid = false;
+    }
+  }
+  LWLockRelease(lock);
+}
+
+bool SchemaCache::lookupTables(DatabaseSchema& schema, uint64_t& ticket) {
+  std::string blob;
+  if (!lookup(EntryKind::TABLE_LIST, InvalidOid, blob, ticket))
+    return false;
+
+  try {
+    schema.tables = decode(blob).get<std::vector<TableInfo>>();
+    schema.success = true;
+    return true;
+  } catch (const std::exception& e) {
+    logger::Logger::warning("Discarding unreadable schema cache entry: " +
+                            std::string(e.what()));
+    return false;
+  }
+}
+
+void SchemaCache::storeTables(const DatabaseSchema& schema, uint64_t ticket) {
+  if (ticket == 0 || !schema.success)
+    return;
+  store(EntryKind::TABLE_LIST, InvalidOid, encode(schema.tables), ticket);
+}
+
+std::vector<std::optional<TableDetails>> SchemaCache::lookupTableDetails(
+    const std::vector<Oid>& relids,
+    std::vector<uint64_t>& tickets) {
+  std::vector<std::optional<std::string>> blobs;
+  lookupMany(EntryKind::TABLE_DETAILS, relids, &blobs, tickets);
+
+  std::vector<std::optional<TableDetails>> details(relids.size());
+  for (size_t i = 0; i < blobs.size(); i++) {
+    if (!blobs[i])
+      continue;
+    try {
+      details[i] = decode(*blobs[i]).get<TableDetails>();
+      details[i]->success = true;
+    } catch (const std::exception& e) {
+      logger::Logger::warning("Discarding unreadable schema cache entry: " +
+                              std::string(e.what()));
+    }
+  }
+  return details;
+}
+
+bool SchemaCache::lookupTableDetails(Oid relid,
+                                     TableDetails& details,
+                                     uint64_t& ticket) {
+  std::string blob;
+  if (!lookup(EntryKind::TABLE_DETAILS, relid, blob, ticket))
+    return false;
+
+  try {
+    details = decode(blob).get<TableDetails>();
+    details.success = true;
+    return true;
+  } catch (const std::exception& e) {
+    logger::Logger::warning("Discarding unreadable schema cache entry: " +
+                            std::string(e.what()));
+    return false;
+  }
+}
+
+void SchemaCache::storeTableDetails(Oid relid,
+                                    const TableDetails& details,
+                                    uint64_t ticket) {
+  if (ticket == 0 || !details.success)
+    return;
+  store(EntryKind::TABLE_DETAILS, relid, encode(details), ticket);
+}
+
+std::optional<std::vector<ColumnStats>> SchemaCache::lookupColumnStats(
+    Oid relid,
+    uint64_t& ticket) {
+  std::string blob;
+  if (!lookup(EntryKind::COLUMN_STATS, relid, blob, ticket))
+    return std::nullopt;
+
+  try {
+    return decode(blob).get<std::vector<ColumnStats>>();
+  } catch (const std::exception& e) {
+    logger::Logger::warning("Discarding unreadable schema cache entry: " +
+                            std::string(e.what()));
+    return std::nullopt;
+  }
+}
+
+void SchemaCache::storeColumnStats(Oid relid,
+                                   const std::vector<ColumnStats>& stats,
+                                   uint64_t ticket) {
+  if (ticket == 0)
+    return;
+  store(EntryKind::COLUMN_STATS, relid, encode(stats), ticket);
+}
+
+std::optional<std::vector<ForeignKeyInfo>> SchemaCache::lookupForeignKeys(
+    uint64_t& ticket) {
+  std::string blob;
+  if (!lookup(EntryKind::FOREIGN_KEYS, InvalidOid, blob, ticket))
+    return std::nullopt;
+
+  try {
+    return decode(blob).get<std::vector<ForeignKeyInfo>>();
+  } catch (const std::exception& e) {
+    logger::Logger::warning("Discarding unreadable schema cache entry: " +
+                            std::string(e.what()));
+    return std::nullopt;
+  }
+}
+
+void SchemaCache::storeForeignKeys(const std::vector<ForeignKeyInfo>& keys,
+                                   uint64_t ticket) {
+  if (ticket == 0)
+    return;
+  store(EntryKind::FOREIGN_KEYS, InvalidOid, encode(keys), ticket);
+}
+
+std::optional<std::string> SchemaCache::lookupText(EntryKind kind,
+                                                   Oid relid,
+                                                   uint64_t& ticket) {
+  std::string text;
+  if (!lookup(kind, relid, text, ticket))
+    return std::nullopt;
+  return text;
+}
+
+void SchemaCache::storeText(EntryKind kind,
+                            Oid relid,
+                            const std::string& text,
+                            uint64_t ticket) {
+  store(kind, relid, text, ticket);
+}
+
+std::vector<uint64_t> SchemaCache::reserveMissing(
+    EntryKind kind,
+    const std::vector<Oid>& relids) {
+  std::vector<uint64_t> tickets;
+  lookupMany(kind, relids, nullptr, tickets);
+  return tickets;
+}
+
+}  // namespace pg_ai
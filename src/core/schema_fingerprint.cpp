@@ -0,0 +1,387 @@
+#include "../include/schema_fingerprint.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <access/htup_details.h>
+#include <access/relation.h>
+#include <access/xact.h>
+#include <catalog/catalog.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_class.h>
+#include <catalog/pg_type.h>
+#include <common/hashfn.h>
+#include <executor/spi.h>
+#include <utils/builtins.h>
+#include <utils/inval.h>
+#include <utils/lsyscache.h>
+#include <utils/rel.h>
+#include <utils/relcache.h>
+#include <utils/syscache.h>
+}
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../include/logger.hpp"
+#include "../include/spi_plan_cache.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+struct FingerprintTable {
+  std::string name;
+  Oid relid;
+};
+
+// This backend's last computed version and the OID of the table it was read
+// from. DDL transactions that change fingerprints send a relcache
+// invalidation of that table at commit, which drops it.
+std::optional<std::pair<Oid, uint64_t>> cached_version;
+// Relcache invalidations seen by this backend
+uint64_t invalidations = 0;
+bool callback_registered = false;
+
+void relcacheCallback(Datum arg, Oid relid) {
+  invalidations++;
+  if (cached_version && (!OidIsValid(relid) || relid == cached_version->first))
+    cached_version.reset();
+}
+
+bool isTracked(char relkind, char persistence, Oid namespace_oid) {
+  switch (relkind) {
+    case RELKIND_RELATION:
+    case RELKIND_PARTITIONED_TABLE:
+    case RELKIND_VIEW:
+    case RELKIND_MATVIEW:
+    case RELKIND_FOREIGN_TABLE:
+    case RELKIND_INDEX:
+    case RELKIND_PARTITIONED_INDEX:
+      break;
+    default:
+      return false;
+  }
+  if (persistence == RELPERSISTENCE_TEMP || IsCatalogNamespace(namespace_oid) ||
+      IsToastNamespace(namespace_oid))
+    return false;
+
+  char* name = get_namespace_name(namespace_oid);
+  bool tracked = name && strcmp(name, "information_schema") != 0;
+  if (name)
+    pfree(name);
+  return tracked;
+}
+
+// Length-prefixed so that adjacent fields cannot run into each other.
+void appendField(std::string& buffer, const std::string& value) {
+  buffer += std::to_string(value.size());
+  buffer += ':';
+  buffer += value;
+}
+
+void appendField(std::string& buffer, int64 value) {
+  appendField(buffer, std::to_string(value));
+}
+
+void appendRelation(std::string& buffer, Relation rel) {
+  appendField(buffer, RelationGetRelationName(rel));
+  char* schema_name = get_namespace_name(RelationGetNamespace(rel));
+  appendField(buffer, schema_name ? schema_name : "");
+  if (schema_name)
+    pfree(schema_name);
+  appendField(buffer, rel->rd_rel->relkind);
+
+  char relkind = rel->rd_rel->relkind;
+  if (relkind == RELKIND_INDEX || relkind == RELKIND_PARTITIONED_INDEX) {
+    text* def = DatumGetTextPP(
+        DirectFunctionCall1(pg_get_indexdef, ObjectIdGetDatum(rel->rd_id)));
+    char* def_str = text_to_cstring(def);
+    appendField(buffer, def_str);
+    pfree(def_str);
+    return;
+  }
+
+  TupleDesc desc = RelationGetDescr(rel);
+  for (int i = 0; i < desc->natts; i++) {
+    Form_pg_attribute att = TupleDescAttr(desc, i);
+    if (att->attisdropped)
+      continue;
+    appendField(buffer, NameStr(att->attname));
+    appendField(buffer, att->atttypid);
+    appendField(buffer, att->atttypmod);
+    appendField(buffer, att->attnotnull);
+    appendField(buffer, att->attidentity);
+    appendField(buffer, att->attgenerated);
+  }
+
+  TupleConstr* constr = desc->constr;
+  if (constr) {
+    for (int i = 0; i < constr->num_defval; i++) {
+      appendField(buffer, constr->defval[i].adnum);
+      appendField(buffer, constr->defval[i].adbin);
+    }
+    for (int i = 0; i < constr->num_check; i++) {
+      appendField(buffer, constr->check[i].ccname);
+      appendField(buffer, constr->check[i].ccbin);
+    }
+  }
+
+  // Referenced tables are identified by OID so renaming one changes only its
+  // own fingerprint.
+  ListCell* lc;
+  foreach (lc, RelationGetFKeyList(rel)) {
+    auto* fk = static_cast<ForeignKeyCacheInfo*>(lfirst(lc));
+    appendField(buffer, fk->confrelid);
+    for (int i = 0; i < fk->nkeys; i++) {
+      appendField(buffer, fk->conkey[i]);
+      appendField(buffer, fk->confkey[i]);
+    }
+  }
+}
+
+// Must be called while connected to SPI.
+std::optional<FingerprintTable> findFingerprintTable() {
+  // The extension is relocatable, so its schema is looked up on every use.
+  // Nothing is returned while the extension is being dropped.
+  const char* query = R"(
+      SELECT pg_catalog.format('%I.pg_ai_schema_fingerprints', n.nspname),
+             pg_catalog.to_regclass(
+               pg_catalog.format('%I.pg_ai_schema_fingerprints', n.nspname))
+               ::pg_catalog.oid
+      FROM pg_catalog.pg_extension e
+      JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace
+      WHERE e.extname = 'pg_ai_query'
+        AND pg_catalog.to_regclass(pg_catalog.format(
+              '%I.pg_ai_schema_fingerprints', n.nspname)) IS NOT NULL
+  )";
+  if (SpiPlanCache::execute(query, true, 1) != SPI_OK_SELECT ||
+      SPI_processed == 0)
+    return std::nullopt;
+
+  char* name = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+  bool isnull;
+  Datum relid = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 2,
+                              &isnull);
+  FingerprintTable table{name, isnull ? InvalidOid : DatumGetObjectId(relid)};
+  pfree(name);
+  return table;
+}
+
+// XOR of every stored fingerprint. Must be called while connected to SPI.
+std::optional<uint64_t> sumFingerprints(const FingerprintTable& table) {
+  std::string query = "SELECT fingerprint FROM " + table.name;
+  // Not read-only, so a READ COMMITTED statement gets a fresh snapshot.
+  if (SpiPlanCache::execute(query, false, 0) != SPI_OK_SELECT)
+    return std::nullopt;
+  uint64_t version = 0;
+  for (uint64 i = 0; i < SPI_processed; i++) {
+    bool isnull;
+    Datum value = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc,
+                                1, &isnull);
+    if (!isnull)
+      version ^= static_cast<uint64_t>(DatumGetInt64(value));
+  }
+  return version;
+}
+
+std::vector<Oid> queryOids(const char* query) {
+  std::vector<Oid> oids;
+  if (SpiPlanCache::execute(query, true, 0) != SPI_OK_SELECT)
+    return oids;
+  for (uint64 i = 0; i < SPI_processed; i++) {
+    bool isnull;
+    Datum value = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc,
+                                1, &isnull);
+    if (!isnull)
+      oids.push_back(DatumGetObjectId(value));
+  }
+  return oids;
+}
+
+// The version is derived from the fingerprint rows, so a change only has to
+// be announced: backends drop their computed version when the invalidation
+// arrives at commit. Unlike a shared counter row, this takes no lock that
+// would serialize concurrent DDL transactions.
+void announceChange(const FingerprintTable& table, uint64_t delta) {
+  if (delta == 0)
+    return;
+  cached_version.reset();
+  if (OidIsValid(table.relid))
+    CacheInvalidateRelcacheByRelid(table.relid);
+}
+
+// Replaces the stored fingerprint of each relation, removing those that are
+// gone or untracked, and returns the XOR of all changes.
+uint64_t replaceFingerprints(const FingerprintTable& table,
+                             const std::vector<Oid>& relids,
+                             bool recompute) {
+  std::string remove = "DELETE FROM " + table.name +
+                       " WHERE relid = $1 RETURNING fingerprint";
+  std::string insert =
+      "INSERT INTO " + table.name + " (relid, fingerprint) "
+      "VALUES ($1, $2)";
+  uint64_t delta = 0;
+  for (Oid relid : relids) {
+    uint64_t fingerprint = recompute ? SchemaFingerprint::relation(relid) : 0;
+
+    if (SpiPlanCache::execute(remove, {OIDOID}, {ObjectIdGetDatum(relid)},
+                              false, 0) == SPI_OK_DELETE_RETURNING &&
+        SPI_processed > 0) {
+      bool isnull;
+      Datum old = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+                                1, &isnull);
+      if (!isnull)
+        delta ^= static_cast<uint64_t>(DatumGetInt64(old));
+    }
+
+    if (fingerprint != 0) {
+      SpiPlanCache::execute(
+          insert, {OIDOID, INT8OID},
+          {ObjectIdGetDatum(relid),
+           Int64GetDatum(static_cast<int64>(fingerprint))},
+          false, 0);
+      delta ^= fingerprint;
+    }
+  }
+  return delta;
+}
+
+}  // namespace
+
+uint64_t SchemaFingerprint::relation(Oid relid) {
+  HeapTuple tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+  if (!HeapTupleIsValid(tuple))
+    return 0;
+  auto* form = reinterpret_cast<Form_pg_class>(GETSTRUCT(tuple));
+  bool tracked =
+      isTracked(form->relkind, form->relpersistence, form->relnamespace);
+  ReleaseSysCache(tuple);
+  if (!tracked)
+    return 0;
+
+  Relation rel = try_relation_open(relid, AccessShareLock);
+  if (!rel)
+    return 0;
+  std::string buffer;
+  appendRelation(buffer, rel);
+  relation_close(rel, AccessShareLock);
+
+  uint64_t hash = hash_bytes_extended(
+      reinterpret_cast<const unsigned char*>(buffer.data()),
+      static_cast<int>(buffer.size()), 0);
+  // 0 is reserved for "not tracked".
+  return hash == 0 ? 1 : hash;
+}
+
+std::optional<uint64_t> SchemaFingerprint::version() {
+  if (!callback_registered) {
+    CacheRegisterRelcacheCallback(relcacheCallback, (Datum)0);
+    callback_registered = true;
+  }
+  if (SPI_connect() != SPI_OK_CONNECT)
+    return std::nullopt;
+
+  std::optional<uint64_t> result;
+  auto table = findFingerprintTable();
+  if (table && cached_version && cached_version->first == table->relid) {
+    result = cached_version->second;
+  } else if (table) {
+    uint64_t seen = invalidations;
+    result = sumFingerprints(*table);
+    // A statement snapshot taken after the last invalidation sees every
+    // change announced so far; a transaction snapshot may be older.
+    if (result && seen == invalidations && OidIsValid(table->relid) &&
+        !IsolationUsesXactSnapshot())
+      cached_version.emplace(table->relid, *result);
+  }
+
+  SPI_finish();
+  return result;
+}
+
+uint64_t SchemaFingerprint::refresh() {
+  if (SPI_connect() != SPI_OK_CONNECT)
+    throw std::runtime_error("Failed to connect to SPI");
+
+  auto table = findFingerprintTable();
+  if (!table) {
+    SPI_finish();
+    throw std::runtime_error("pg_ai_query schema fingerprint table not found");
+  }
+
+  std::string clear = "DELETE FROM " + table->name;
+  SpiPlanCache::execute(clear, false, 0);
+
+  auto relids = queryOids(R"(
+      SELECT c.oid FROM pg_catalog.pg_class c
+      WHERE c.relkind IN ('r', 'p', 'v', 'm', 'f', 'i', 'I')
+        AND c.relpersistence <> 't'
+  )");
+  uint64_t version = replaceFingerprints(*table, relids, true);
+  // Backends may hold versions computed from the rows just replaced, even
+  // when the new version happens to be the same.
+  announceChange(*table, 1);
+
+  SPI_finish();
+  logger::Logger::info("Schema fingerprints rebuilt for " +
+                       std::to_string(relids.size()) + " relations");
+  return version;
+}
+
+void SchemaFingerprint::applyDdlCommands() {
+  if (SPI_connect() != SPI_OK_CONNECT)
+    throw std::runtime_error("Failed to connect to SPI");
+
+  auto table = findFingerprintTable();
+  if (!table) {
+    SPI_finish();
+    return;
+  }
+
+  // A schema rename changes the name of every relation in it.
+  if (!queryOids(R"(
+        SELECT objid FROM pg_catalog.pg_event_trigger_ddl_commands()
+        WHERE command_tag = 'ALTER SCHEMA'
+      )").empty()) {
+    SPI_finish();
+    refresh();
+    return;
+  }
+
+  // Constraints added by ALTER TABLE may create indexes that are not reported
+  // as commands of their own, so the indexes of touched tables are included.
+  auto relids = queryOids(R"(
+      WITH touched AS (
+        SELECT objid FROM pg_catalog.pg_event_trigger_ddl_commands()
+        WHERE classid = 'pg_catalog.pg_class'::pg_catalog.regclass
+      )
+      SELECT objid FROM touched
+      UNION
+      SELECT i.indexrelid FROM pg_catalog.pg_index i
+      JOIN touched t ON i.indrelid = t.objid
+  )");
+  announceChange(*table, replaceFingerprints(*table, relids, true));
+  SPI_finish();
+}
+
+void SchemaFingerprint::applyDroppedObjects() {
+  if (SPI_connect() != SPI_OK_CONNECT)
+    throw std::runtime_error("Failed to connect to SPI");
+
+  auto table = findFingerprintTable();
+  if (table) {
+    auto relids = queryOids(R"(
+        SELECT objid FROM pg_catalog.pg_event_trigger_dropped_objects()
+        WHERE classid = 'pg_catalog.pg_class'::pg_catalog.regclass
+          AND objsubid = 0
+    )");
+    announceChange(*table, replaceFingerprints(*table, relids, false));
+  }
+  SPI_finish();
+}
+
+}  // namespace pg_ai
@@ -0,0 +1,220 @@
+#include "../include/schema_prewarm.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <access/xact.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <postmaster/bgworker.h>
+#include <postmaster/interrupt.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <tcop/tcopprot.h>
+#include <utils/guc.h>
+#include <utils/snapmgr.h>
+}
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../include/catalog_reader.hpp"
+#include "../include/config.hpp"
+#include "../include/logger.hpp"
+#include "../include/query_generator.hpp"
+#include "../include/schema_cache.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+using EntryKind = SchemaCache::EntryKind;
+
+// Relation locks are held until commit, so large catalogs are warmed in
+// several transactions.
+constexpr size_t kTablesPerTransaction = 100;
+
+void beginTransaction() {
+  SetCurrentStatementStartTimestamp();
+  StartTransactionCommand();
+  PushActiveSnapshot(GetTransactionSnapshot());
+}
+
+void commitTransaction() {
+  PopActiveSnapshot();
+  CommitTransactionCommand();
+}
+
+size_t warmTables(const std::vector<Oid>& relids,
+                  const config::Configuration& cfg) {
+  size_t rebuilt = 0;
+  auto detail_tickets =
+      SchemaCache::reserveMissing(EntryKind::TABLE_DETAILS, relids);
+  auto text_tickets =
+      SchemaCache::reserveMissing(EntryKind::TABLE_TEXT, relids);
+
+  for (size_t i = 0; i < relids.size(); i++) {
+    if (detail_tickets[i] == 0 && text_tickets[i] == 0)
+      continue;
+    auto details = CatalogReader::readTableStructure(relids[i]);
+    if (!details.success)
+      continue;
+    SchemaCache::storeTableDetails(relids[i], details, detail_tickets[i]);
+    SchemaCache::storeText(EntryKind::TABLE_TEXT, relids[i],
+                           QueryGenerator::formatTableDetailsForAI(details),
+                           text_tickets[i]);
+    rebuilt++;
+  }
+
+  if (cfg.schema_column_stats) {
+    auto stats_tickets =
+        SchemaCache::reserveMissing(EntryKind::COLUMN_STATS, relids);
+    for (size_t i = 0; i < relids.size(); i++) {
+      if (stats_tickets[i] == 0)
+        continue;
+      SchemaCache::storeColumnStats(
+          relids[i],
+          CatalogReader::readColumnStats(relids[i],
+                                         cfg.schema_column_stats_mcv_count),
+          stats_tickets[i]);
+      rebuilt++;
+    }
+  }
+  return rebuilt;
+}
+
+}  // namespace
+
+void SchemaPrewarm::registerWorkers() {
+  if (!process_shared_preload_libraries_in_progress)
+    return;
+
+  const auto& cfg = config::ConfigManager::getConfig();
+  std::vector<std::string> databases =
+      cfg.schema_cache_enabled ? cfg.schema_prewarm_databases
+                               : std::vector<std::string>();
+  // Backends must read the config file themselves on first use.
+  config::ConfigManager::reset();
+
+  for (const auto& database : databases) {
+    BackgroundWorker worker;
+    std::memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags =
+        BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = 60;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_ai_query");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN,
+             "pg_ai_schema_prewarm_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "pg_ai_query schema prewarm for %s",
+             database.c_str());
+    snprintf(worker.bgw_type, BGW_MAXLEN, "pg_ai_query schema prewarm");
+    strlcpy(worker.bgw_extra, database.c_str(), BGW_EXTRALEN);
+    RegisterBackgroundWorker(&worker);
+  }
+}
+
+size_t SchemaPrewarm::warmDatabase() {
+  const auto& cfg = config::ConfigManager::getConfig();
+  size_t rebuilt = 0;
+
+  // The table list comes from the cache when it is still valid, so this is
+  // cheap when nothing changed. Everything stored here is role-neutral: the
+  // worker runs as the bootstrap superuser, and readers filter on use.
+  std::vector<Oid> relids;
+  beginTransaction();
+  auto schema = QueryGenerator::getAllDatabaseTables();
+  if (schema.success) {
+    for (const auto& table : schema.tables) {
+      Oid relid =
+          CatalogReader::resolveTable(table.table_name, table.schema_name);
+      if (OidIsValid(relid))
+        relids.push_back(relid);
+    }
+
+    uint64_t ticket =
+        SchemaCache::reserveMissing(EntryKind::SCHEMA_TEXT, {InvalidOid})[0];
+    if (ticket != 0) {
+      SchemaCache::storeText(EntryKind::SCHEMA_TEXT, InvalidOid,
+                             QueryGenerator::formatSchemaForAI(schema), ticket);
+      rebuilt++;
+    }
+
+    ticket =
+        SchemaCache::reserveMissing(EntryKind::FOREIGN_KEYS, {InvalidOid})[0];
+    if (ticket != 0) {
+      SchemaCache::storeForeignKeys(CatalogReader::readForeignKeys(), ticket);
+      rebuilt++;
+    }
+  }
+  commitTransaction();
+
+  for (size_t start = 0; start < relids.size();
+       start += kTablesPerTransaction) {
+    CHECK_FOR_INTERRUPTS();
+    size_t end = std::min(start + kTablesPerTransaction, relids.size());
+    std::vector<Oid> batch(relids.begin() + start, relids.begin() + end);
+
+    beginTransaction();
+    rebuilt += warmTables(batch, cfg);
+    commitTransaction();
+  }
+  return rebuilt;
+}
+
+}  // namespace pg_ai
+
+extern "C" {
+
+/**
+ * Entry point of a schema prewarm worker. bgw_extra holds the database name.
+ */
+void pg_ai_schema_prewarm_main(Datum main_arg) {
+  char database[BGW_EXTRALEN];
+  strlcpy(database, MyBgworkerEntry->bgw_extra, BGW_EXTRALEN);
+
+  pqsignal(SIGHUP, SignalHandlerForConfigReload);
+  pqsignal(SIGTERM, die);
+  BackgroundWorkerUnblockSignals();
+  BackgroundWorkerInitializeConnection(database, nullptr, 0);
+
+  pg_ai::logger::Logger::info(
+      std::string("Schema prewarm worker started for ") + database);
+
+  for (;;) {
+    CHECK_FOR_INTERRUPTS();
+
+    // The config file is re-read on SIGHUP (pg_ctl reload).
+    if (ConfigReloadPending) {
+      ConfigReloadPending = false;
+      ProcessConfigFile(PGC_SIGHUP);
+      pg_ai::config::ConfigManager::reset();
+    }
+
+    pgstat_report_activity(STATE_RUNNING, "warming schema cache");
+    size_t rebuilt = 0;
+    try {
+      rebuilt = pg_ai::SchemaPrewarm::warmDatabase();
+    } catch (const std::exception& e) {
+      if (IsTransactionState())
+        AbortCurrentTransaction();
+      pg_ai::logger::Logger::warning(
+          std::string("Schema prewarm failed: ") + e.what());
+    }
+    pgstat_report_activity(STATE_IDLE, nullptr);
+    if (rebuilt > 0) {
+      pg_ai::logger::Logger::debug("Schema prewarm rebuilt " +
+                                   std::to_string(rebuilt) + " entries");
+    }
+
+    int interval = std::max(
+        pg_ai::config::ConfigManager::getConfig().schema_prewarm_interval_ms,
+        100);
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    interval, PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+  }
+}
+}
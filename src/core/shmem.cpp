@@ -0,0 +1,158 @@
+#include "../include/shmem.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <miscadmin.h>
+#include <storage/ipc.h>
+#include <storage/shmem.h>
+#include <utils/memutils.h>
+}
+
+#include <algorithm>
+
+#include "../include/config.hpp"
+#include "../include/logger.hpp"
+#include "../include/rate_limiter.hpp"
+#include "../include/result_cache.hpp"
+#include "../include/schema_cache.hpp"
+#include "../include/single_flight.hpp"
+
+namespace pg_ai::shmem {
+
+namespace {
+
+constexpr const char* kSegmentName = "pg_ai_query";
+constexpr const char* kLockTrancheName = "pg_ai_query";
+constexpr const char* kDsaTrancheName = "pg_ai_query_dsa";
+
+struct SharedHeader {
+  int dsa_tranche_id;
+  Size dsa_size;
+};
+
+#if PG_VERSION_NUM >= 150000
+shmem_request_hook_type prev_shmem_request_hook = nullptr;
+#endif
+shmem_startup_hook_type prev_shmem_startup_hook = nullptr;
+
+// Sizes are computed once in the postmaster and inherited by every backend.
+Size dsa_size = 0;
+SharedHeader* header = nullptr;
+LWLockPadded* locks = nullptr;
+dsa_area* local_area = nullptr;
+
+char* dsaPlace() {
+  return reinterpret_cast<char*>(header) + MAXALIGN(sizeof(SharedHeader));
+}
+
+Size segmentSize() {
+  return add_size(MAXALIGN(sizeof(SharedHeader)), dsa_size);
+}
+
+void computeSizes() {
+  const auto& cfg = config::ConfigManager::getConfig();
+  Size mb = cfg.schema_cache_enabled
+                ? static_cast<Size>(std::max(cfg.schema_cache_size_mb, 1))
+                : 0;
+  SchemaCache::configure(cfg);
+  ResultCache::configure(cfg);
+  dsa_size = std::max(mb * 1024 * 1024 + ResultCache::areaSize(),
+                      dsa_minimum_size());
+  // Backends must read the config file themselves on first use.
+  config::ConfigManager::reset();
+}
+
+void requestShmem() {
+#if PG_VERSION_NUM >= 150000
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+#endif
+  computeSizes();
+  RequestAddinShmemSpace(add_size(
+      add_size(segmentSize(), add_size(RateLimiter::shmemSize(),
+                                       SingleFlight::shmemSize())),
+      add_size(SchemaCache::shmemSize(), ResultCache::shmemSize())));
+  RequestNamedLWLockTranche(kLockTrancheName,
+                            static_cast<int>(LockId::COUNT));
+}
+
+void startupShmem() {
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  bool found = false;
+  header = static_cast<SharedHeader*>(
+      ShmemInitStruct(kSegmentName, segmentSize(), &found));
+  if (!found) {
+    header->dsa_tranche_id = LWLockNewTrancheId();
+    header->dsa_size = dsa_size;
+
+    dsa_area* area =
+        dsa_create_in_place(dsaPlace(), dsa_size, header->dsa_tranche_id,
+                            nullptr);
+    dsa_pin(area);
+    // Keep everything inside the preallocated segment.
+    dsa_set_size_limit(area, dsa_size);
+    dsa_detach(area);
+  }
+  LWLockRegisterTranche(header->dsa_tranche_id, kDsaTrancheName);
+
+  SchemaCache::shmemInit();
+  ResultCache::shmemInit();
+  RateLimiter::shmemInit();
+  SingleFlight::shmemInit();
+
+  LWLockRelease(AddinShmemInitLock);
+}
+
+void releaseArea(int code, Datum arg) {
+  if (local_area) {
+    dsa_detach(local_area);
+    local_area = nullptr;
+  }
+}
+
+}  // namespace
+
+void install() {
+  if (!process_shared_preload_libraries_in_progress)
+    return;
+
+#if PG_VERSION_NUM >= 150000
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = requestShmem;
+#else
+  requestShmem();
+#endif
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = startupShmem;
+}
+
+bool isAvailable() {
+  return header != nullptr;
+}
+
+LWLock* lock(LockId id) {
+  if (!locks)
+    locks = GetNamedLWLockTranche(kLockTrancheName);
+  return &locks[static_cast<int>(id)].lock;
+}
+
+dsa_area* area() {
+  if (!header)
+    return nullptr;
+
+  if (!local_area) {
+    MemoryContext old_context = MemoryContextSwitchTo(TopMemoryContext);
+    local_area = dsa_attach_in_place(dsaPlace(), nullptr);
+    dsa_pin_mapping(local_area);
+    MemoryContextSwitchTo(old_context);
+    on_shmem_exit(releaseArea, (Datum)0);
+  }
+  return local_area;
+}
+
+}  // namespace pg_ai::shmem
@@ -0,0 +1,393 @@
+#include "../include/single_flight.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <access/xact.h>
+#include <common/hashfn.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <storage/condition_variable.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <storage/lwlock.h>
+#include <storage/procarray.h>
+#include <storage/shmem.h>
+#include <utils/dsa.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include <nlohmann/json.hpp>
+
+#include "../include/config.hpp"
+#include "../include/logger.hpp"
+#include "../include/provider_call.hpp"
+#include "../include/shmem.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kFlights = 64;
+// Added to the longest a leader's call may take before followers give up
+constexpr long kLeaderSlackMs = 5000;
+// Longest single sleep, so that a leader that died is noticed
+constexpr long kMaxSleepMs = 1000;
+
+enum class FlightState : uint32 { FREE = 0, RUNNING, DONE, ABANDONED };
+
+// One call in flight. A slot is freed by its last reader: the leader when
+// nobody follows, else the last follower to take the result.
+struct Flight {
+  uint64 hash_a;
+  uint64 hash_b;
+  FlightState state;
+  int leader_pid;
+  // Changes whenever the flight gets a new leader
+  uint32 generation;
+  int followers;
+  dsa_pointer result;
+  Size result_size;
+  ConditionVariable done;
+};
+
+Flight* flights = nullptr;
+SingleFlight::Stats counters;
+
+// The flight this backend leads. A leader unwound by a PostgreSQL error
+// never runs its destructor, so an abort releases the flight instead.
+int led_slot = -1;
+uint32 led_generation = 0;
+bool callbacks_registered = false;
+
+LWLock* flightLock() {
+  return shmem::lock(shmem::LockId::SINGLE_FLIGHT);
+}
+
+// QueryResult is stored with every field, errors included.
+std::string encode(const QueryResult& result) {
+  nlohmann::json body = {
+      {"generated_query", result.generated_query},
+      {"explanation", result.explanation},
+      {"warnings", result.warnings},
+      {"row_limit_applied", result.row_limit_applied},
+      {"suggested_visualization", result.suggested_visualization},
+      {"success", result.success},
+      {"error_message", result.error_message}};
+  std::vector<uint8_t> cbor = nlohmann::json::to_cbor(body);
+  return std::string(cbor.begin(), cbor.end());
+}
+
+QueryResult decode(const std::string& blob) {
+  auto body = nlohmann::json::from_cbor(blob);
+  QueryResult result;
+  result.generated_query = body.at("generated_query").get<std::string>();
+  result.explanation = body.at("explanation").get<std::string>();
+  result.warnings = body.at("warnings").get<std::vector<std::string>>();
+  result.row_limit_applied = body.at("row_limit_applied").get<bool>();
+  result.suggested_visualization =
+      body.at("suggested_visualization").get<std::string>();
+  result.success = body.at("success").get<bool>();
+  result.error_message = body.at("error_message").get<std::string>();
+  return result;
+}
+
+// Caller holds the lock exclusively.
+void freeFlight(Flight& flight, dsa_area* area) {
+  if (DsaPointerIsValid(flight.result))
+    dsa_free(area, flight.result);
+  flight.result = InvalidDsaPointer;
+  flight.result_size = 0;
+  flight.state = FlightState::FREE;
+  flight.followers = 0;
+  flight.leader_pid = 0;
+  flight.hash_a = 0;
+  flight.hash_b = 0;
+}
+
+// Caller holds the lock.
+int findFlight(uint64 hash_a, uint64 hash_b) {
+  for (int i = 0; i < kFlights; i++) {
+    const Flight& flight = flights[i];
+    if (flight.state != FlightState::FREE && flight.hash_a == hash_a &&
+        flight.hash_b == hash_b)
+      return i;
+  }
+  return -1;
+}
+
+// Caller holds the lock.
+int findFreeFlight() {
+  for (int i = 0; i < kFlights; i++) {
+    if (flights[i].state == FlightState::FREE)
+      return i;
+  }
+  return -1;
+}
+
+// Gives up leading without a result: a follower takes the call over, or
+// the flight is freed when nobody waits.
+void abandon(int slot, uint32 generation) {
+  if (led_slot == slot && led_generation == generation)
+    led_slot = -1;
+  Flight& flight = flights[slot];
+  LWLockAcquire(flightLock(), LW_EXCLUSIVE);
+  bool mine = flight.state == FlightState::RUNNING &&
+              flight.generation == generation &&
+              flight.leader_pid == MyProcPid;
+  if (mine) {
+    if (flight.followers == 0)
+      freeFlight(flight, shmem::area());
+    else
+      flight.state = FlightState::ABANDONED;
+  }
+  LWLockRelease(flightLock());
+  if (mine)
+    ConditionVariableBroadcast(&flight.done);
+}
+
+void releaseLedFlight() {
+  if (led_slot >= 0)
+    abandon(led_slot, led_generation);
+}
+
+void onXactEvent(XactEvent event, void* arg) {
+  if (event == XACT_EVENT_ABORT || event == XACT_EVENT_PARALLEL_ABORT)
+    releaseLedFlight();
+}
+
+void onSubXactEvent(SubXactEvent event,
+                    SubTransactionId subid,
+                    SubTransactionId parent_subid,
+                    void* arg) {
+  if (event == SUBXACT_EVENT_ABORT_SUB)
+    releaseLedFlight();
+}
+
+void onExit(int code, Datum arg) {
+  releaseLedFlight();
+}
+
+void registerCallbacks() {
+  if (callbacks_registered)
+    return;
+  RegisterXactCallback(onXactEvent, nullptr);
+  RegisterSubXactCallback(onSubXactEvent, nullptr);
+  on_shmem_exit(onExit, (Datum)0);
+  callbacks_registered = true;
+}
+
+long remainingMs(Clock::time_point deadline) {
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - Clock::now());
+  return std::max<long>(left.count(), 0);
+}
+
+}  // namespace
+
+SingleFlight::Leader::Leader(Leader&& other) noexcept
+    : slot_(other.slot_), generation_(other.generation_) {
+  other.slot_ = -1;
+}
+
+SingleFlight::Leader& SingleFlight::Leader::operator=(Leader&& other) noexcept {
+  if (this != &other) {
+    if (slot_ >= 0)
+      abandon(slot_, generation_);
+    slot_ = other.slot_;
+    generation_ = other.generation_;
+    other.slot_ = -1;
+  }
+  return *this;
+}
+
+SingleFlight::Leader::~Leader() {
+  if (slot_ >= 0)
+    abandon(slot_, generation_);
+}
+
+void SingleFlight::Leader::finish(const QueryResult& result) {
+  if (slot_ < 0)
+    return;
+  int slot = slot_;
+  slot_ = -1;
+  if (led_slot == slot && led_generation == generation_)
+    led_slot = -1;
+
+  std::string blob = encode(result);
+  dsa_area* area = shmem::area();
+  Flight& flight = flights[slot];
+
+  LWLockAcquire(flightLock(), LW_EXCLUSIVE);
+  if (flight.state != FlightState::RUNNING ||
+      flight.generation != generation_ || flight.leader_pid != MyProcPid) {
+    LWLockRelease(flightLock());
+    return;
+  }
+  if (flight.followers == 0) {
+    freeFlight(flight, area);
+    LWLockRelease(flightLock());
+    return;
+  }
+  // The area is shared with the caches; without room, a follower makes the
+  // call again.
+  dsa_pointer payload =
+      dsa_allocate_extended(area, blob.size(), DSA_ALLOC_NO_OOM);
+  if (DsaPointerIsValid(payload)) {
+    std::memcpy(dsa_get_address(area, payload), blob.data(), blob.size());
+    flight.result = payload;
+    flight.result_size = blob.size();
+    flight.state = FlightState::DONE;
+  } else {
+    flight.state = FlightState::ABANDONED;
+  }
+  LWLockRelease(flightLock());
+  ConditionVariableBroadcast(&flight.done);
+}
+
+Size SingleFlight::shmemSize() {
+  return mul_size(kFlights, sizeof(Flight));
+}
+
+void SingleFlight::shmemInit() {
+  bool found = false;
+  flights = static_cast<Flight*>(
+      ShmemInitStruct("pg_ai_query single flight", shmemSize(), &found));
+  if (!found) {
+    for (int i = 0; i < kFlights; i++) {
+      Flight& flight = flights[i];
+      flight.state = FlightState::FREE;
+      flight.generation = 0;
+      flight.result = InvalidDsaPointer;
+      freeFlight(flight, nullptr);
+      ConditionVariableInit(&flight.done);
+    }
+  }
+}
+
+SingleFlight::Outcome SingleFlight::join(const std::string& call) {
+  Outcome outcome;
+  const auto& cfg = config::ConfigManager::getConfig();
+  if (!flights || !cfg.single_flight_enabled)
+    return outcome;
+  dsa_area* area = shmem::area();
+  if (!area)
+    return outcome;
+  registerCallbacks();
+
+  std::string key = std::to_string(MyDatabaseId) + "\n" +
+                    std::to_string(GetUserId()) + "\n" + call;
+  const auto* bytes = reinterpret_cast<const unsigned char*>(key.data());
+  uint64 hash_a = hash_bytes_extended(bytes, key.size(), 0);
+  uint64 hash_b = hash_bytes_extended(bytes, key.size(),
+                                      UINT64CONST(0x9e3779b97f4a7c15));
+
+  // A leader's call ends within request_timeout_ms once the rate limiter
+  // admitted it.
+  auto deadline =
+      Clock::now() +
+      std::chrono::milliseconds(std::max(cfg.request_timeout_ms, 1) +
+                                std::max(cfg.rate_limit_max_wait_ms, 0) +
+                                kLeaderSlackMs);
+
+  auto lead = [&](int slot, Flight& flight) {
+    flight.state = FlightState::RUNNING;
+    flight.leader_pid = MyProcPid;
+    flight.generation++;
+    outcome.leader.slot_ = slot;
+    outcome.leader.generation_ = flight.generation;
+    led_slot = slot;
+    led_generation = flight.generation;
+  };
+
+  int slot = -1;
+  for (;;) {
+    // Registered before checking, so a result stored in between wakes us.
+    if (slot >= 0)
+      ConditionVariablePrepareToSleep(&flights[slot].done);
+    LWLockAcquire(flightLock(), LW_EXCLUSIVE);
+
+    if (slot < 0) {
+      slot = findFlight(hash_a, hash_b);
+      if (slot < 0) {
+        slot = findFreeFlight();
+        if (slot >= 0) {
+          Flight& flight = flights[slot];
+          flight.hash_a = hash_a;
+          flight.hash_b = hash_b;
+          flight.followers = 0;
+          lead(slot, flight);
+          counters.led++;
+        }
+        // A full table only means this call is not shared.
+        LWLockRelease(flightLock());
+        return outcome;
+      }
+      flights[slot].followers++;
+      LWLockRelease(flightLock());
+      logger::Logger::debug(
+          "Waiting for the identical request of backend " +
+          std::to_string(flights[slot].leader_pid));
+      continue;
+    }
+
+    Flight& flight = flights[slot];
+    if (flight.state == FlightState::DONE) {
+      std::string blob(
+          static_cast<const char*>(dsa_get_address(area, flight.result)),
+          flight.result_size);
+      if (--flight.followers == 0)
+        freeFlight(flight, area);
+      LWLockRelease(flightLock());
+      ConditionVariableCancelSleep();
+      outcome.result = decode(blob);
+      counters.followed++;
+      return outcome;
+    }
+
+    bool leader_gone =
+        flight.state == FlightState::ABANDONED ||
+        (flight.leader_pid != MyProcPid &&
+         BackendPidGetProc(flight.leader_pid) == nullptr);
+    if (leader_gone) {
+      flight.followers--;
+      lead(slot, flight);
+      LWLockRelease(flightLock());
+      ConditionVariableCancelSleep();
+      counters.takeovers++;
+      logger::Logger::info(
+          "Leader of an identical request went away, making the call");
+      return outcome;
+    }
+
+    bool interrupted = QueryCancelPending || ProcDiePending;
+    long wait_ms = remainingMs(deadline);
+    if (interrupted || wait_ms <= 0) {
+      flight.followers--;
+      LWLockRelease(flightLock());
+      ConditionVariableCancelSleep();
+      if (interrupted)
+        throw CallInterrupted();
+      counters.timeouts++;
+      logger::Logger::warning(
+          "Gave up waiting for an identical request, making the call");
+      return outcome;
+    }
+    LWLockRelease(flightLock());
+
+    (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                    std::min(wait_ms, kMaxSleepMs), PG_WAIT_EXTENSION);
+    ResetLatch(MyLatch);
+  }
+}
+
+SingleFlight::Stats SingleFlight::stats() {
+  return counters;
+}
+
+}  // namespace pg_ai
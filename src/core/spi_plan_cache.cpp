@@ -0,0 +1,51 @@
+#include "../include/spi_plan_cache.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+
+namespace pg_ai {
+
+namespace {
+
+std::unordered_map<std::string, SPIPlanPtr> plans;
+
+}  // namespace
+
+SPIPlanPtr SpiPlanCache::get(const std::string& query,
+                             const std::vector<Oid>& arg_types) {
+  auto it = plans.find(query);
+  if (it != plans.end())
+    return it->second;
+
+  SPIPlanPtr plan =
+      SPI_prepare(query.c_str(), static_cast<int>(arg_types.size()),
+                  const_cast<Oid*>(arg_types.data()));
+  if (!plan) {
+    throw std::runtime_error(std::string("Failed to prepare query: ") +
+                             SPI_result_code_string(SPI_result));
+  }
+  // Moves the plan out of the SPI procedure context.
+  if (SPI_keepplan(plan) != 0)
+    throw std::runtime_error("Failed to keep prepared query");
+
+  plans.emplace(query, plan);
+  return plan;
+}
+
+int SpiPlanCache::execute(const std::string& query,
+                          const std::vector<Oid>& arg_types,
+                          const std::vector<Datum>& values,
+                          bool read_only,
+                          long count) {
+  SPIPlanPtr plan = get(query, arg_types);
+  return SPI_execute_plan(plan, const_cast<Datum*>(values.data()), nullptr,
+                          read_only, count);
+}
+
+int SpiPlanCache::execute(const std::string& query,
+                          bool read_only,
+                          long count) {
+  return execute(query, {}, {}, read_only, count);
+}
+
+}  // namespace pg_ai
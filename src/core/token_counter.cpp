@@ -0,0 +1,93 @@
+#include "../include/token_counter.hpp"
+
+extern "C" {
+#include <postgres.h>
+
+#include <miscadmin.h>
+}
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
+#include "../include/bpe_tokenizer.hpp"
+#include "../include/context_packer.hpp"
+#include "../include/logger.hpp"
+
+namespace pg_ai {
+
+namespace {
+
+// Loaded vocabularies of this backend, by name; vocabularies that failed to
+// load are not tried again.
+std::map<std::string, std::unique_ptr<BpeTokenizer>> tokenizers;
+std::set<std::string> unavailable;
+
+std::string vocabularyDir() {
+  const auto& cfg = config::ConfigManager::getConfig();
+  if (!cfg.tokenizer_vocab_dir.empty())
+    return cfg.tokenizer_vocab_dir;
+  char share_path[MAXPGPATH];
+  get_share_path(my_exec_path, share_path);
+  return std::string(share_path) + "/extension/pg_ai_query/tokenizers";
+}
+
+const BpeTokenizer* tokenizerFor(const std::string& model) {
+  const char* vocabulary = BpeTokenizer::vocabularyFor(model);
+  if (!vocabulary || unavailable.count(vocabulary))
+    return nullptr;
+  auto it = tokenizers.find(vocabulary);
+  if (it != tokenizers.end())
+    return it->second.get();
+
+  std::string path = vocabularyDir() + "/" + vocabulary + ".tiktoken";
+  try {
+    auto tokenizer =
+        BpeTokenizer::load(path, BpeTokenizer::patternFor(vocabulary));
+    logger::Logger::info("Loaded tokenizer vocabulary " + path + " (" +
+                         std::to_string(tokenizer->vocabularySize()) +
+                         " tokens)");
+    return tokenizers.emplace(vocabulary, std::move(tokenizer))
+        .first->second.get();
+  } catch (const std::exception& e) {
+    logger::Logger::warning(std::string(e.what()) +
+                            "; estimating token counts instead");
+    unavailable.insert(vocabulary);
+    return nullptr;
+  }
+}
+
+}  // namespace
+
+TokenCounter::Count TokenCounter::count(const std::string& model,
+                                        std::string_view text) {
+  if (const BpeTokenizer* tokenizer = tokenizerFor(model))
+    return {.tokens = tokenizer->count(text), .exact = true};
+  return {.tokens = ContextPacker::estimateTokens(std::string(text)),
+          .exact = false};
+}
+
+std::optional<size_t> TokenCounter::promptLimit(const std::string& model) {
+  const config::ModelConfig* model_config =
+      config::ConfigManager::getModelConfig(model);
+  if (!model_config || model_config->context_window <= 0)
+    return std::nullopt;
+  size_t window = static_cast<size_t>(model_config->context_window);
+  size_t max_tokens =
+      static_cast<size_t>(std::max(model_config->max_tokens, 0));
+  size_t reserved = std::min(max_tokens, window / 2);
+  return window - reserved;
+}
+
+int TokenCounter::answerLimit(const config::ModelConfig& model,
+                              size_t prompt_tokens) {
+  if (model.context_window <= 0)
+    return model.max_tokens;
+  size_t window = static_cast<size_t>(model.context_window);
+  size_t left = window > prompt_tokens ? window - prompt_tokens : 1;
+  size_t max_tokens = static_cast<size_t>(std::max(model.max_tokens, 1));
+  return static_cast<int>(std::clamp<size_t>(left, 1, max_tokens));
+}
+
+}  // namespace pg_ai
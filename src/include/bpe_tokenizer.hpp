@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace pg_ai {
+
+/**
+ * @brief Byte-pair encoding tokenizer reading tiktoken vocabulary files
+ *
+ * A vocabulary file has one "<base64 token> <rank>" line per token
+ * (cl100k_base.tiktoken, o200k_base.tiktoken). It is mapped once and decoded
+ * into a single buffer that the rank index points into.
+ *
+ * Text is first split the way the encoding's regular expression splits it,
+ * then each piece is merged lowest rank first. Letters are told apart from
+ * other characters by ASCII class, and every non-ASCII byte counts as a
+ * lowercase letter, so counts are exact for ASCII text (identifiers, SQL,
+ * EXPLAIN output) and close for the rest.
+ */
+class BpeTokenizer {
+ public:
+  enum class Pattern {
+    CL100K,  // GPT-4, GPT-3.5
+    O200K,   // GPT-4o and later
+  };
+
+  /**
+   * @brief Load a vocabulary file
+   * @throws std::runtime_error if the file cannot be read or parsed
+   */
+  static std::unique_ptr<BpeTokenizer> load(const std::string& path,
+                                            Pattern pattern);
+
+  /**
+   * @brief Vocabulary name ("cl100k_base", "o200k_base") for a model, or
+   *        nullptr if the model's tokenizer is not known
+   */
+  static const char* vocabularyFor(const std::string& model);
+
+  static Pattern patternFor(const std::string& vocabulary);
+
+  /**
+   * @brief Pieces the encoding's pre-tokenizer would produce
+   */
+  static std::vector<std::string_view> split(std::string_view text,
+                                             Pattern pattern);
+
+  std::vector<uint32_t> encode(std::string_view text) const;
+
+  size_t count(std::string_view text) const;
+
+  size_t vocabularySize() const { return ranks_.size(); }
+
+ private:
+  BpeTokenizer() = default;
+
+  // Appends the ranks of one piece's tokens; returns how many there are.
+  size_t mergePiece(std::string_view piece, std::vector<uint32_t>* out) const;
+
+  Pattern pattern_ = Pattern::CL100K;
+  std::string bytes_;
+  std::unordered_map<std::string_view, uint32_t> ranks_;
+};
+
+}  // namespace pg_ai
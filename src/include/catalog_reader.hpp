@@ -0,0 +1,126 @@
+#pragma once
+
+extern "C" {
+#include <postgres.h>
+}
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "query_generator.hpp"
+
+namespace pg_ai {
+
+struct IndexDetails {
+  std::string index_name;
+  bool is_unique;
+  bool is_primary;
+  std::string definition;
+};
+
+/**
+ * @brief Reads schema metadata straight from the system caches
+ *
+ * Avoids information_schema and SPI text round-trips: columns, defaults,
+ * keys and indexes come from the relcache and syscache entries PostgreSQL
+ * already keeps warm. Must be called inside a transaction.
+ */
+class CatalogReader {
+ public:
+  /**
+   * @brief Resolve a schema-qualified table name to its OID
+   * @return Relation OID, or InvalidOid if it does not exist
+   */
+  static Oid resolveTable(const std::string& table_name,
+                          const std::string& schema_name);
+
+  /**
+   * @brief Build TableDetails for a relation, as the current user may see it
+   *
+   * Columns the user has no privilege on are left out; a relation the user
+   * cannot see is reported as missing.
+   * @param relid OID of a table, view, materialized view or foreign table
+   * @return Details; success is false if the relation cannot be read
+   */
+  static TableDetails readTableDetails(Oid relid);
+
+  /**
+   * @brief Build TableDetails for a relation, whatever the current user may see
+   *
+   * For the schema cache, which is shared between roles; filter the result
+   * with restrictTableDetailsToUser() before showing it to a user.
+   */
+  static TableDetails readTableStructure(Oid relid);
+
+  /**
+   * @brief Visit every user relation the current user can see
+   *
+   * Scans pg_class directly, skipping system schemas, other sessions'
+   * temporary tables and the extension's own tables. Row estimates come from
+   * pg_class.reltuples. Relations are visited in physical order.
+   */
+  static void forEachTable(const std::function<void(const TableInfo&)>& visit);
+
+  /**
+   * @brief Read every foreign key between user tables of the database
+   *
+   * Scans pg_constraint directly. Keys cloned onto partitions are skipped,
+   * since the partitioned parent already carries them. Not filtered by the
+   * current user's privileges.
+   */
+  static std::vector<ForeignKeyInfo> readForeignKeys();
+
+  /**
+   * @brief Read the indexes of a relation, ordered by name
+   *
+   * Empty if the current user cannot see the relation.
+   */
+  static std::vector<IndexDetails> readIndexes(Oid relid);
+
+  /**
+   * @brief Build a per-column statistics digest from pg_statistic
+   * @param relid Relation OID
+   * @param mcv_count Maximum number of most common values kept per column
+   * @return One entry per column that has statistics or leads an index
+   */
+  static std::vector<ColumnStats> readColumnStats(Oid relid, int mcv_count);
+
+  /**
+   * @brief Whether the current user can see a relation
+   *
+   * Same test information_schema.tables applies: any privilege on the table
+   * or one of its columns, or membership in the owning role.
+   */
+  static bool canSeeTable(Oid relid);
+
+  /**
+   * @brief Drop tables the current user may not see from a listing
+   *
+   * Listings are cached across users, so this runs on every use.
+   * @return Number of tables dropped
+   */
+  static size_t restrictTablesToUser(std::vector<TableInfo>& tables);
+
+  /**
+   * @brief Drop columns the current user may not see from table details
+   *
+   * Mirrors information_schema.columns: a column is shown with any privilege
+   * on the table or on that column. Details are cached across users, so this
+   * runs on every use.
+   * @return false, with details marked as failed, if the table is not visible
+   */
+  static bool restrictTableDetailsToUser(Oid relid, TableDetails& details);
+
+  /**
+   * @brief Drop statistics the current user may not read
+   *
+   * Mirrors the pg_stats view: only columns the user can SELECT are kept,
+   * and nothing is kept when row-level security applies to the user.
+   * Digests are cached across users, so this runs on every use.
+   */
+  static void restrictColumnStatsToUser(Oid relid,
+                                        std::vector<ColumnStats>& stats);
+};
+
+}  // namespace pg_ai
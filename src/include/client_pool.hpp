@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <ai/openai.h>
+
+#include "config.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief AI clients kept for the lifetime of the backend
+ *
+ * Clients are keyed by (provider, API key hash, base URL) and reused across
+ * calls, so a session issuing several requests pays for client setup, and
+ * whatever connection state the client's HTTP layer keeps, only once. The
+ * least recently used client is dropped when the pool is full.
+ *
+ * Clients are handed out as leases: a client still held by a call (e.g. one
+ * abandoned after a timeout that keeps running on its own thread) is never
+ * given to a second caller, and stays alive after eviction until released.
+ */
+class ClientPool {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    // Clients created, i.e. requests that could not reuse a connection
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+  };
+
+  /**
+   * @brief Lease an idle client, creating one if none is free
+   * @param base_url Provider endpoint; empty for the SDK default
+   */
+  static std::shared_ptr<ai::Client> acquire(config::Provider provider,
+                                             const std::string& api_key,
+                                             const std::string& base_url = "");
+
+  static Stats stats();
+
+  /**
+   * @brief Drop every pooled client
+   */
+  static void clear();
+};
+
+}  // namespace pg_ai
@@ -8,13 +8,18 @@ namespace pg_ai::config {
 
 enum class Provider { OPENAI, ANTHROPIC, UNKNOWN };
 
+// What a backend does when a provider's rate limit is reached
+enum class RateLimitPolicy { WAIT, FAIL };
+
 struct ModelConfig {
   std::string name;
   std::string description;
   int max_tokens;
   double temperature;
+  // Prompt and answer tokens the model accepts; 0 when unknown
+  int context_window;
 
-  ModelConfig() : max_tokens(4096), temperature(0.7) {}
+  ModelConfig() : max_tokens(4096), temperature(0.7), context_window(0) {}
 };
 
 struct ProviderConfig {
@@ -22,9 +27,21 @@ struct ProviderConfig {
   std::string api_key;
   std::vector<ModelConfig> available_models;
   ModelConfig default_model;
+  // Model for simple requests when [routing] is enabled; empty uses the
+  // provider's built-in choice
+  std::string fast_model;
+  // Endpoint of an OpenAI- or Anthropic-compatible server (e.g. local
+  // inference); empty for the public API
+  std::string base_url;
+  // Limits shared by all backends using the same key; 0 for none
+  int requests_per_minute;
+  int tokens_per_minute;
 
   // Default constructor
-  ProviderConfig() : provider(Provider::UNKNOWN) {}
+  ProviderConfig()
+      : provider(Provider::UNKNOWN),
+        requests_per_minute(0),
+        tokens_per_minute(0) {}
 };
 
 struct Configuration {
@@ -36,6 +53,8 @@ struct Configuration {
   bool enable_logging;
   int request_timeout_ms;
   int max_retries;
+  // Provider calls in flight at once for generate_queries
+  int batch_concurrency;
 
   // Query generation settings
   bool enforce_limit;
@@ -47,6 +66,67 @@ struct Configuration {
   bool show_suggested_visualization;
   bool use_formatted_response;
 
+  // Schema cache settings (shared memory, requires shared_preload_libraries)
+  bool schema_cache_enabled;
+  int schema_cache_size_mb;
+  int schema_cache_max_entries;
+
+  // Column statistics digest added to table details in prompts
+  bool schema_column_stats;
+  int schema_column_stats_max_chars;
+  int schema_column_stats_mcv_count;
+
+  // Schema context packing; a zero budget lists every table
+  int schema_context_token_budget;
+  int schema_context_max_detailed_tables;
+
+  // Background workers keeping the schema cache warm (postmaster only)
+  std::vector<std::string> schema_prewarm_databases;
+  int schema_prewarm_interval_ms;
+
+  // Shared cache of generated queries (requires shared_preload_libraries)
+  bool result_cache_enabled;
+  int result_cache_size_mb;
+  int result_cache_max_entries;
+  int result_cache_ttl_seconds;
+  // Reuse results of differently worded requests (MinHash/LSH)
+  bool result_cache_similar_enabled;
+  double result_cache_similarity_threshold;
+
+  // Second request to another provider when the first one is slow
+  bool hedging_enabled;
+  double hedging_percentile;
+  // Hedge delay until enough latencies have been seen
+  int hedging_delay_ms;
+  // Largest share of calls that may be hedged
+  double hedging_max_rate;
+
+  // Route simple requests to each provider's fast_model
+  bool routing_enabled;
+  // Complexity score from which the default model is used
+  double routing_threshold;
+
+  // Directory with the tiktoken vocabulary files; empty for the extension's
+  // share directory
+  std::string tokenizer_vocab_dir;
+
+  // Waiting for the providers' requests_per_minute/tokens_per_minute
+  RateLimitPolicy rate_limit_policy;
+  int rate_limit_max_wait_ms;
+  // Work a bucket admits at once after being idle
+  double rate_limit_burst_seconds;
+  // How long a 429 answer blocks the key for every backend
+  int rate_limit_throttle_ms;
+
+  // Share one provider call between backends sending the same request at
+  // the same time (requires shared_preload_libraries)
+  bool single_flight_enabled;
+
+  // Time EXPLAIN ANALYZE may take in explain_query()'s bounded mode
+  int explain_timeout_ms;
+  // List PlanAnalyzer's findings in explain_query()'s prompt
+  bool explain_include_findings;
+
   // Default constructor with sensible defaults
   Configuration();
 };
@@ -96,6 +176,14 @@ class ConfigManager {
    */
   static Provider stringToProvider(const std::string& provider_str);
 
+  /**
+   * @brief Forget the loaded configuration so the next access reloads it
+   *
+   * Used after reading settings in the postmaster so that every backend
+   * still picks up the current config file on first use.
+   */
+  static void reset();
+
  private:
   static Configuration config_;
   static bool config_loaded_;
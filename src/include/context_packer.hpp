@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "fk_graph.hpp"
+#include "query_generator.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Builds the schema part of a prompt within a token budget
+ *
+ * Tables are scored against the request by name tokens (with plurals and
+ * simple suffixes stemmed), matching column names, foreign-key proximity to
+ * other matches and, as a tie-breaker, row counts. The budget is then filled
+ * greedily: full details for the best matches, names only for the next tier,
+ * and nothing for the rest. The chosen tables are written in name order, not
+ * score order, so the text only depends on which tables were chosen.
+ *
+ * With a foreign-key graph, the tables on the shortest join paths between
+ * the matched tables are described as well, and no others.
+ */
+class ContextPacker {
+ public:
+  struct Options {
+    // Estimated tokens available for the schema context
+    size_t token_budget = 2000;
+    // Tables that may be described with full details
+    size_t max_detailed_tables = 5;
+  };
+
+  struct ScoredTable {
+    size_t index;  // position in DatabaseSchema::tables
+    double score;
+  };
+
+  struct PackedContext {
+    std::string text;
+    size_t detailed_tables = 0;
+    size_t listed_tables = 0;
+    size_t omitted_tables = 0;
+    size_t estimated_tokens = 0;
+  };
+
+  // Fetches details for (schema, table) pairs, one result per pair in order
+  using DetailsFetcher = std::function<std::vector<TableDetails>(
+      const std::vector<std::pair<std::string, std::string>>&)>;
+  using DetailsFormatter = std::function<std::string(const TableDetails&)>;
+
+  /**
+   * @brief Pack the schema context for a request
+   * @param request Natural language request
+   * @param schema Every table of the database
+   * @param fetch Called at most twice, for candidate tables only
+   * @param format Renders one table's details
+   * @param graph Foreign keys of the database; without it only keys of
+   *              fetched tables are known
+   */
+  static PackedContext pack(const std::string& request,
+                            const DatabaseSchema& schema,
+                            const DetailsFetcher& fetch,
+                            const DetailsFormatter& format,
+                            const Options& options,
+                            const FkGraph* graph = nullptr);
+
+  /**
+   * @brief Score tables by name against the request, best first
+   */
+  static std::vector<ScoredTable> rankTables(const std::string& request,
+                                             const DatabaseSchema& schema);
+
+  /**
+   * @brief Split into lowercase, stemmed words, dropping stop words
+   */
+  static std::vector<std::string> tokenize(const std::string& text);
+
+  /**
+   * @brief Reduce a lowercase word to a crude stem ("categories" -> "category")
+   */
+  static std::string stem(const std::string& word);
+
+  /**
+   * @brief Rough token count of a prompt fragment (about 4 chars per token)
+   */
+  static size_t estimateTokens(const std::string& text);
+};
+
+}  // namespace pg_ai
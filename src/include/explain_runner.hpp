@@ -0,0 +1,49 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+namespace pg_ai {
+
+enum class ExplainMode {
+  PLAN,     // EXPLAIN without ANALYZE; the statement is not run
+  ANALYZE,  // EXPLAIN ANALYZE, rolled back afterwards
+  BOUNDED   // ANALYZE under [explain] timeout_ms, else the plan
+};
+
+/**
+ * @brief Runs EXPLAIN for explain_query()
+ *
+ * Every EXPLAIN runs in a subtransaction that is always rolled back, so
+ * ANALYZE of a data-modifying statement leaves no changes behind (apart
+ * from effects outside the transaction, such as sequence increments), and
+ * an error in the statement is returned instead of aborting the caller's
+ * transaction. In BOUNDED mode ANALYZE is cancelled after the given time
+ * and the plan is returned instead.
+ */
+class ExplainRunner {
+ public:
+  struct Output {
+    bool success = false;
+    std::string explain_output;  // FORMAT JSON
+    // What explain_output shows: PLAN or ANALYZE
+    ExplainMode shown = ExplainMode::PLAN;
+    // BOUNDED only: ANALYZE ran out of time
+    bool timed_out = false;
+    std::string error_message;
+  };
+
+  /**
+   * @brief Parse "plan", "analyze" or "bounded" (case-insensitive)
+   */
+  static std::optional<ExplainMode> parseMode(const std::string& name);
+
+  static std::string modeName(ExplainMode mode);
+
+  /**
+   * @param timeout_ms Time ANALYZE may take in BOUNDED mode
+   */
+  static Output run(const std::string& query, ExplainMode mode, int timeout_ms);
+};
+
+}  // namespace pg_ai
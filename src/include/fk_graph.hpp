@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "query_generator.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Undirected join graph over the database's foreign keys
+ *
+ * Nodes are (schema, table) pairs and an edge joins two tables when either
+ * references the other. Used to find the tables needed to join the ones a
+ * request mentions, so only those are described in detail.
+ */
+class FkGraph {
+ public:
+  using TableName = std::pair<std::string, std::string>;  // (schema, table)
+  using TableFilter = std::function<bool(const TableName&)>;
+
+  FkGraph() = default;
+  explicit FkGraph(const std::vector<ForeignKeyInfo>& foreign_keys);
+
+  bool empty() const { return names_.empty(); }
+
+  /**
+   * @brief Tables joined to a table by a foreign key in either direction
+   */
+  std::vector<TableName> neighbours(const TableName& table) const;
+
+  /**
+   * @brief Shortest join path between two tables, endpoints included
+   * @param max_hops Longest path considered, in foreign keys
+   * @param allowed Tables the path may pass through (all when empty)
+   * @return Empty when the tables are not connected within max_hops
+   */
+  std::vector<TableName> shortestPath(const TableName& from,
+                                      const TableName& to,
+                                      size_t max_hops,
+                                      const TableFilter& allowed = {}) const;
+
+  /**
+   * @brief Tables needed to join the given tables to each other
+   *
+   * Each table is joined to the nearest table already connected, which
+   * approximates the smallest join tree. Tables that cannot be reached
+   * within max_hops are left unconnected.
+   * @return Intermediate tables only, in the order they were added
+   */
+  std::vector<TableName> connect(const std::vector<TableName>& tables,
+                                 size_t max_hops,
+                                 const TableFilter& allowed = {}) const;
+
+ private:
+  static constexpr size_t kNone = static_cast<size_t>(-1);
+
+  size_t find(const TableName& table) const;
+  size_t intern(const TableName& table);
+  // Breadth-first search from `from` to the nearest node in `targets`.
+  std::vector<size_t> search(size_t from,
+                             const std::vector<bool>& targets,
+                             size_t max_hops,
+                             const TableFilter& allowed) const;
+
+  std::map<TableName, size_t> ids_;
+  std::vector<TableName> names_;
+  std::vector<std::vector<size_t>> adjacency_;
+};
+
+}  // namespace pg_ai
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace pg_ai {
+
+/**
+ * @brief Extracts one top-level string field from JSON arriving in pieces
+ *
+ * Fed the raw model output chunk by chunk, it tracks just enough JSON
+ * structure (nesting, strings, escapes) to notice when the value of the
+ * wanted field of the outermost object has been fully received, without
+ * waiting for the rest of the document. Text around the object, such as a
+ * ```json fence, is ignored.
+ */
+class JsonFieldStream {
+ public:
+  explicit JsonFieldStream(std::string field);
+
+  /**
+   * @brief Consume the next piece of the document
+   */
+  void feed(std::string_view chunk);
+
+  /**
+   * @brief Whether the field's value has been fully received
+   *
+   * Also true when the field is present but not a string (e.g. null); the
+   * value is then empty.
+   */
+  bool complete() const { return complete_; }
+
+  /**
+   * @brief Unescaped value; partial until complete()
+   */
+  const std::string& value() const { return value_; }
+
+ private:
+  enum class State {
+    OUTSIDE,        // between tokens
+    IN_STRING,      // inside a key or a value that is not the field
+    IN_ESCAPE,      // after a backslash
+    IN_UNICODE,     // reading the four hex digits of \u
+  };
+
+  void finishString();
+  void appendCodePoint(unsigned code_point);
+
+  std::string field_;
+  State state_ = State::OUTSIDE;
+  int depth_ = 0;
+  // At depth 1, the next string is a key.
+  bool expect_key_ = false;
+  bool string_is_key_ = false;
+  bool capture_ = false;
+  // The last key read matched the field and its value comes next.
+  bool field_next_ = false;
+  bool complete_ = false;
+  std::string key_;
+  std::string value_;
+  std::string hex_;
+  unsigned high_surrogate_ = 0;
+};
+
+}  // namespace pg_ai
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pg_ai {
+
+/**
+ * @brief Similarity of differently worded requests
+ *
+ * A request is reduced to the set of its stemmed words, minus filler such as
+ * "show me the", so "orders last week" and "last week's orders" have the
+ * same features. MinHash signatures estimate the Jaccard similarity of two
+ * feature sets, and their bands (locality-sensitive hashing) make similar
+ * requests collide in a hash index. Hashes are seeded with constants, so
+ * signatures agree across processes.
+ */
+class MinHash {
+ public:
+  static constexpr size_t kBands = 16;
+  static constexpr size_t kRowsPerBand = 4;
+  static constexpr size_t kSize = kBands * kRowsPerBand;
+
+  using Signature = std::array<uint32_t, kSize>;
+  using Bands = std::array<uint64_t, kBands>;
+
+  /**
+   * @brief Sorted, distinct features of a request
+   */
+  static std::vector<std::string> features(const std::string& request);
+
+  /**
+   * @brief Numbers and quoted strings of a request, in order
+   *
+   * Requests that differ here ("top 5" vs "top 10") must never share a
+   * result, however similar the rest.
+   */
+  static std::string literals(const std::string& request);
+
+  static Signature signature(const std::vector<std::string>& features);
+
+  /**
+   * @brief One hash per band; similar signatures share at least one
+   */
+  static Bands bands(const Signature& signature);
+
+  /**
+   * @brief Exact Jaccard similarity of two sorted feature sets
+   */
+  static double jaccard(const std::vector<std::string>& a,
+                        const std::vector<std::string>& b);
+
+  /**
+   * @brief Fraction of equal signature positions, estimating jaccard()
+   */
+  static double estimate(const Signature& a, const Signature& b);
+};
+
+}  // namespace pg_ai
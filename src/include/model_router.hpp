@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pg_ai {
+
+/**
+ * @brief Picks a fast or a strong model by how complex a request looks
+ *
+ * The score grows with the tables the schema context had to describe, with
+ * aggregate words ("total", "average", "per") and, twice as much, with
+ * analytic words that usually need window functions or several passes
+ * ("rank", "running", "growth"), with request length and with the size of
+ * the schema context. Requests scoring below the threshold go to the fast
+ * model. Scoring is local and takes microseconds.
+ */
+class ModelRouter {
+ public:
+  enum class Tier { FAST, STRONG };
+
+  struct Features {
+    size_t tables = 0;
+    size_t aggregate_terms = 0;
+    size_t analytic_terms = 0;
+    size_t words = 0;
+    size_t context_tokens = 0;
+  };
+
+  struct Decision {
+    Tier tier = Tier::STRONG;
+    double score = 0;
+    Features features;
+  };
+
+  // Counters of the current backend, for tuning the threshold
+  struct Stats {
+    uint64_t fast_calls = 0;
+    uint64_t strong_calls = 0;
+    // Summed provider latency of the calls of each tier
+    uint64_t fast_latency_ms = 0;
+    uint64_t strong_latency_ms = 0;
+  };
+
+  /**
+   * @brief Features of a request
+   * @param tables Tables described in detail in the schema context
+   * @param context_tokens Estimated size of the schema context
+   */
+  static Features features(const std::string& request,
+                           size_t tables,
+                           size_t context_tokens);
+
+  static double score(const Features& features);
+
+  static Decision route(const Features& features, double threshold);
+
+  static const char* tierName(Tier tier);
+
+  /**
+   * @brief Count a routed call and how long the provider took
+   */
+  static void record(Tier tier, uint64_t latency_ms);
+
+  static Stats stats();
+};
+
+}  // namespace pg_ai
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace pg_ai {
+
+/**
+ * @brief Rule-based checks of an EXPLAIN (FORMAT JSON) plan
+ *
+ * Walks every node of the plan, InitPlans and SubPlans included, and
+ * reports the problems most explain_query() calls are about: large
+ * sequential scans, row misestimates, sorts and hashes spilling to disk,
+ * nested loops with large inner sides, and index-only scans that visit the
+ * heap. Rules that need actual row counts only run on EXPLAIN ANALYZE
+ * output. Needs no provider; the findings are returned by analyze_plan()
+ * and, with [explain] include_findings, listed in explain_query()'s prompt.
+ */
+class PlanAnalyzer {
+ public:
+  enum class Severity { INFO, WARNING, CRITICAL };
+
+  struct Finding {
+    Severity severity = Severity::INFO;
+    std::string rule;  // e.g. "seq_scan", "row_misestimate"
+    // Position in the JSON tree, e.g. "Plan.Plans[0].Plans[1]"
+    std::string path;
+    std::string node_type;
+    std::string relation;  // schema.table, empty for nodes without one
+    std::string message;
+  };
+
+  struct Options {
+    // Rows a sequential scan reads before it is reported
+    double large_scan_rows = 100000;
+    // Actual/estimated row ratio (either way) reported as a misestimate
+    double misestimate_factor = 100;
+    // Rows the inner side of a nested loop produces over all loops
+    double nested_loop_inner_rows = 100000;
+    // Heap fetches of an index-only scan, as a share of its rows
+    double heap_fetch_share = 0.1;
+    double min_heap_fetches = 1000;
+  };
+
+  struct Analysis {
+    bool success = false;
+    bool analyzed = false;  // actual row counts were available
+    // Most severe first, then in plan order
+    std::vector<Finding> findings;
+    std::string error_message;
+  };
+
+  static Analysis analyze(const std::string& explain_json);
+  static Analysis analyze(const std::string& explain_json,
+                          const Options& options);
+
+  static std::string severityName(Severity severity);
+
+  /**
+   * @brief Findings as a list for an LLM prompt; empty when there are none
+   */
+  static std::string formatFindings(const Analysis& analysis);
+};
+
+}  // namespace pg_ai
@@ -5,4 +5,7 @@
 namespace pg_ai::prompts {
 extern const std::string SYSTEM_PROMPT;
 extern const std::string EXPLAIN_SYSTEM_PROMPT;
+// Bump when the prompts or their layout change; cached results of older
+// versions are then no longer used.
+extern const int PROMPT_VERSION;
 }  // namespace pg_ai::prompts
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ai/openai.h>
+
+#include "rate_limiter.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Thrown when a query cancel or backend termination is pending
+ *
+ * The SQL-callable wrappers let CHECK_FOR_INTERRUPTS() raise the actual
+ * PostgreSQL error once the C++ frames have unwound.
+ */
+class CallInterrupted : public std::runtime_error {
+ public:
+  CallInterrupted() : std::runtime_error("Request interrupted") {}
+};
+
+/**
+ * @brief Runs provider requests without blocking interrupts
+ *
+ * The request runs on a helper thread while the backend waits on its latch,
+ * so pg_cancel_backend, statement_timeout and postmaster death are noticed
+ * within a few milliseconds. The whole call, retries included, is bounded by
+ * [general] request_timeout_ms; failed attempts are retried up to
+ * max_retries times with jittered exponential backoff. A call given up on
+ * keeps running detached until the provider answers, holding its own
+ * reference to the client; only the backend moves on.
+ *
+ * With a hedge, a non-streamed call that has not been answered within the
+ * [hedging] percentile of recent call latencies is sent a second time, to
+ * the hedge's client and model. The hedge is only built at that point. The
+ * first successful answer wins and the other request is abandoned.
+ *
+ * Every attempt, retries and hedges included, is first admitted by the
+ * provider's RateLimiter bucket. A hedge that would have to wait is not
+ * sent, and a 429 answer blocks the bucket for all backends.
+ */
+class ProviderCall {
+ public:
+  struct Response {
+    bool success = false;
+    std::string text;
+    std::string error_message;
+    // The chunk handler asked to stop before the response was complete
+    bool stopped = false;
+    // Token usage as reported by the provider (not known for streams)
+    uint64_t prompt_tokens = 0;
+    uint64_t completion_tokens = 0;
+    // From the start of the call to the answer, retries included
+    uint64_t latency_ms = 0;
+  };
+
+  // Counters of the current backend
+  struct Stats {
+    uint64_t calls = 0;
+    uint64_t prompt_tokens = 0;
+    uint64_t completion_tokens = 0;
+    // Calls whose system prompt (instructions and schema context) was the
+    // same as the previous call's, i.e. candidates for provider-side prompt
+    // caching
+    uint64_t prefix_repeats = 0;
+    // Hedge requests sent, and how many of them answered first
+    uint64_t hedges = 0;
+    uint64_t hedge_wins = 0;
+  };
+
+  // Called on the backend thread for each streamed chunk; return false to
+  // stop reading.
+  using ChunkHandler = std::function<bool(const std::string&)>;
+
+  // Where a slow call is sent a second time
+  struct Hedge {
+    std::shared_ptr<ai::Client> client;
+    ai::GenerateOptions options;
+    RateLimiter::Bucket bucket;
+  };
+
+  // Builds the hedge once the hedge delay has passed; nullopt to not hedge.
+  using HedgeFactory = std::function<std::optional<Hedge>()>;
+
+  /**
+   * @brief Generate text, streaming it when a chunk handler is given
+   * @param bucket Rate limit bucket of the client's provider and key
+   * @param hedge Builds the second destination for a slow first attempt;
+   *              streamed calls are never hedged
+   * @throws CallInterrupted if a cancel or termination request arrives
+   */
+  static Response run(std::shared_ptr<ai::Client> client,
+                      const RateLimiter::Bucket& bucket,
+                      const ai::GenerateOptions& options,
+                      const ChunkHandler& on_chunk = {},
+                      const HedgeFactory& hedge = {});
+
+  /**
+   * @brief Generate text for many requests, several at a time
+   *
+   * One worker thread per client takes requests in order until none are
+   * left, so at most clients.size() calls are in flight. Each request gets
+   * its own request_timeout_ms and retries; a failure only affects its own
+   * response. Workers wait for the rate limit on their own threads. Once
+   * every worker is stuck in a call that already timed out, the requests
+   * not yet taken time out too.
+   * @return One response per request, in request order
+   * @throws CallInterrupted if a cancel or termination request arrives
+   */
+  static std::vector<Response> runBatch(
+      const std::vector<std::shared_ptr<ai::Client>>& clients,
+      const RateLimiter::Bucket& bucket,
+      std::vector<ai::GenerateOptions> requests);
+
+  static Stats stats();
+};
+
+}  // namespace pg_ai
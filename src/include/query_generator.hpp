@@ -1,15 +1,46 @@
 #pragma once
 
+#include <functional>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 
 namespace pg_ai {
 
+// A piece of a streamed response
+struct StreamChunk {
+  enum class Kind {
+    TEXT,  // raw model output, in arrival order
+    SQL    // the complete sql field, as soon as it has arrived
+  };
+  Kind kind;
+  std::string content;
+};
+
+using StreamCallback = std::function<void(const StreamChunk&)>;
+
 struct QueryRequest {
   std::string natural_language;
   std::string api_key;
   std::string provider;
+  // When set, the response is streamed and each piece passed here
+  StreamCallback on_chunk;
+  // Stop reading the stream once the sql field is complete
+  bool stop_after_sql = false;
+  // Answer from the shared result cache; fresh results are stored either
+  // way (streamed requests bypass it)
+  bool use_cache = true;
+};
+
+// Several requests translated with one schema discovery
+struct BatchQueryRequest {
+  std::vector<std::string> natural_language;
+  std::string api_key;
+  std::string provider;
+  bool use_cache = true;
 };
 
 struct QueryResult {
@@ -20,6 +51,10 @@ struct QueryResult {
   std::string suggested_visualization;
   bool success;
   std::string error_message;
+  // Reused from the result cache, generated for a differently worded
+  // request (cached_request)
+  bool similar_cache_hit = false;
+  std::string cached_request;
 };
 
 struct TableInfo {
@@ -40,30 +75,61 @@ struct ColumnInfo {
   std::string foreign_column;
 };
 
+struct ColumnStats {
+  std::string column_name;
+  bool has_statistics;
+  double null_frac;
+  // Positive: estimated distinct values; negative: -(distinct / rows)
+  double n_distinct;
+  std::vector<std::string> most_common_values;
+  bool has_correlation;
+  double correlation;
+  // Name of an index whose first key column is this column, if any
+  std::string leading_index;
+};
+
 struct TableDetails {
   std::string table_name;
   std::string schema_name;
   std::vector<ColumnInfo> columns;
   std::vector<std::string> indexes;
+  std::vector<ColumnStats> column_stats;
   bool success;
   std::string error_message;
+  // Set when columns the current user cannot see were left out
+  bool restricted = false;
+};
+
+// One foreign key, from the referencing table to the referenced one
+struct ForeignKeyInfo {
+  std::string schema_name;
+  std::string table_name;
+  std::string foreign_schema_name;
+  std::string foreign_table_name;
 };
 
 struct DatabaseSchema {
   std::vector<TableInfo> tables;
   bool success;
   std::string error_message;
+  // Set when tables the current user cannot see were left out
+  bool restricted = false;
 };
 
 struct ExplainRequest {
   std::string query_text;
   std::string api_key;
   std::string provider;
+  // plan, analyze or bounded (see ExplainRunner)
+  std::string mode = "analyze";
 };
 
 struct ExplainResult {
   std::string query;
   std::string explain_output;
+  // How explain_output was produced, e.g. "plan" or "bounded (plan only,
+  // ANALYZE stopped after 5000 ms)"
+  std::string mode;
   std::string ai_explanation;
   bool success;
   std::string error_message;
@@ -72,17 +138,46 @@ struct ExplainResult {
 class QueryGenerator {
  public:
   static QueryResult generateQuery(const QueryRequest& request);
+  /**
+   * @brief Translate many requests, calling the provider concurrently
+   *
+   * The schema is read once for the whole batch and every prompt is built
+   * on the calling thread; at most [general] batch_concurrency provider
+   * calls are in flight. A failed item does not affect the others.
+   * @return One result per request, in request order
+   */
+  static std::vector<QueryResult> generateQueries(
+      const BatchQueryRequest& request);
+  /**
+   * @brief List the tables of the database the current user can see
+   */
   static DatabaseSchema getDatabaseTables();
+  /**
+   * @brief List every user table, whatever the current user may see
+   *
+   * This is the listing shared through the schema cache; filter it with
+   * CatalogReader::restrictTablesToUser() before showing it to a user.
+   */
+  static DatabaseSchema getAllDatabaseTables();
   static TableDetails getTableDetails(
       const std::string& table_name,
       const std::string& schema_name = "public");
+  /**
+   * @brief Fetch details for several tables in one catalog pass
+   * @param tables (schema, table) pairs
+   * @return One entry per requested table, in request order
+   */
+  static std::vector<TableDetails> getTablesDetails(
+      const std::vector<std::pair<std::string, std::string>>& tables);
   static ExplainResult explainQuery(const ExplainRequest& request);
 
   static std::string formatSchemaForAI(const DatabaseSchema& schema);
   static std::string formatTableDetailsForAI(const TableDetails& details);
 
  private:
-  static std::string buildPrompt(const QueryRequest& request);
+  static QueryResult parseResponse(
+      const std::string& response_text,
+      const std::optional<std::string>& early_sql = std::nullopt);
   static nlohmann::json extractSQLFromResponse(const std::string& response);
 };
 
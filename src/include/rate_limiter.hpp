@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <postgres.h>
+}
+
+#include "config.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Provider rate limits shared by all backends
+ *
+ * Each provider, endpoint and API key gets a bucket in shared memory with a
+ * request and a token limit ([openai]/[anthropic] requests_per_minute and
+ * tokens_per_minute). A limit is kept as a GCRA theoretical arrival time:
+ * the time at which everything admitted so far would have been spent at the
+ * configured rate. A call is admitted while that time is at most
+ * [rate_limit] burst_seconds ahead of now, and then moves it on by its cost:
+ * one request, and its prompt plus max_tokens tokens. Both are updated with
+ * compare-and-swap, so admission takes no lock. Tokens a call did not use
+ * are given back once the provider reports its usage.
+ *
+ * A backend that is not admitted sleeps on the bucket's condition variable
+ * until its turn comes or tokens are given back, for at most max_wait_ms,
+ * or fails at once with policy = fail. Because every waiter is admitted at
+ * the configured rate, a burst of sessions is spread out instead of hitting
+ * the provider together.
+ *
+ * A 429 answer blocks the bucket for [rate_limit] throttle_ms in every
+ * backend; waiters then resume with some jitter.
+ *
+ * There are 32 buckets. One that has admitted nothing for ten minutes and
+ * owes nothing is given to the next new key; while none is free, new keys
+ * share one overflow bucket instead of going unlimited.
+ *
+ * Without shared_preload_libraries each backend has its own buckets.
+ */
+class RateLimiter {
+ public:
+  // The bucket of one provider and key, resolved on the backend thread.
+  // tryAcquire() and throttle() may then be called from helper threads.
+  struct Bucket {
+    int slot = -1;  // -1: not limited
+    double request_interval_us = 0;  // 0: no request limit
+    double token_interval_us = 0;    // 0: no token limit
+    int64_t tolerance_us = 0;
+    int64_t throttle_us = 0;
+  };
+
+  // A bucket as shown by pg_ai_rate_limits()
+  struct BucketState {
+    std::string name;
+    int64_t requests_per_minute = 0;
+    int64_t tokens_per_minute = 0;
+    // What could be admitted right now; negative while in debt
+    std::optional<double> requests_available;
+    std::optional<double> tokens_available;
+    int64_t blocked_ms = 0;
+    uint64_t admitted = 0;
+    uint64_t waited = 0;
+    uint64_t rejected = 0;
+    uint64_t throttled = 0;
+  };
+
+  /**
+   * @brief Shared memory needed for the buckets
+   */
+  static Size shmemSize();
+
+  /**
+   * @brief Create or attach the buckets (shmem startup hook)
+   */
+  static void shmemInit();
+
+  /**
+   * @brief Find or create the bucket of a provider, endpoint and key
+   *
+   * A bucket without limits is still created, so that 429 answers block
+   * the other backends. Falls back to the shared overflow bucket when every
+   * bucket is in use.
+   */
+  static Bucket bucketFor(config::Provider provider,
+                          const std::string& api_key,
+                          const std::string& base_url);
+
+  /**
+   * @brief Admit a call if the bucket allows it (any thread)
+   * @return 0 when admitted, else microseconds until it may be
+   */
+  static int64_t tryAcquire(const Bucket& bucket, uint64_t tokens);
+
+  /**
+   * @brief Admit a call, waiting according to [rate_limit] policy
+   * @param max_wait_ms Longest wait, also capped by max_wait_ms
+   * @return Empty when admitted, else why the call was refused
+   * @throws CallInterrupted if a cancel or termination request arrives
+   */
+  static std::optional<std::string> acquire(const Bucket& bucket,
+                                            uint64_t tokens,
+                                            long max_wait_ms);
+
+  /**
+   * @brief Count a call that was not admitted in time (any thread)
+   * @return Error message for the call
+   */
+  static std::string reject(const Bucket& bucket, int64_t wait_us);
+
+  /**
+   * @brief Count a call that had to wait (any thread)
+   */
+  static void noteWait(const Bucket& bucket);
+
+  /**
+   * @brief Give back tokens a call was charged but did not use
+   */
+  static void refund(const Bucket& bucket, uint64_t charged, uint64_t used);
+
+  /**
+   * @brief Block the bucket after a 429 answer (any thread)
+   */
+  static void throttle(const Bucket& bucket);
+
+  /**
+   * @brief Whether a provider error is a rate limit answer
+   */
+  static bool isRateLimited(const std::string& message);
+
+  static std::vector<BucketState> buckets();
+};
+
+}  // namespace pg_ai
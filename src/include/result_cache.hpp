@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <postgres.h>
+}
+
+#include "config.hpp"
+#include "query_generator.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Generated queries shared by all backends, keyed by exact request
+ *
+ * An entry is keyed by the normalized request text, the database, the
+ * current role, the schema version (SchemaFingerprint), provider, model,
+ * prompt version and the settings that shape the prompt, so a schema change
+ * or a different model never returns an old answer. Parsed results are
+ * stored serialized in the extension's dynamic shared area and evicted least
+ * recently used once [result_cache] size_mb or max_entries is reached, or
+ * when older than ttl_seconds.
+ *
+ * With [result_cache] similar_enabled, a request missing the exact key may
+ * reuse the result of a differently worded one: results are also indexed by
+ * the MinHash bands of their request, and a candidate sharing a band is used
+ * when the Jaccard similarity of the two requests reaches
+ * similarity_threshold and everything else in the key, including numbers and
+ * quoted strings of the request, is identical.
+ *
+ * Requires shared_preload_libraries; otherwise every lookup misses.
+ */
+class ResultCache {
+ public:
+  struct Key {
+    // Exact key, stored with the entry
+    std::string text;
+    // Hash of everything in the key but the request's wording
+    uint64_t scope = 0;
+    std::string request;
+    std::vector<std::string> features;
+  };
+
+  struct Stats {
+    uint64_t hits = 0;
+    // Hits on a differently worded request, also counted in hits
+    uint64_t similar_hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+  };
+
+  /**
+   * @brief Capture sizing settings (postmaster only, before shmemSize())
+   */
+  static void configure(const config::Configuration& cfg);
+
+  /**
+   * @brief Shared memory needed for the index and LRU list
+   */
+  static Size shmemSize();
+
+  /**
+   * @brief Bytes the cache may use in the shared area
+   */
+  static Size areaSize();
+
+  /**
+   * @brief Create or attach the index (shmem startup hook)
+   */
+  static void shmemInit();
+
+  /**
+   * @brief Build the cache key of a request
+   * @return Empty when the request must not be cached (no schema version)
+   */
+  static std::optional<Key> makeKey(const std::string& request,
+                                    const std::string& provider,
+                                    const std::string& model);
+
+  /**
+   * @brief Collapse whitespace and case outside quotes
+   *
+   * "Count  Orders by 'Open' status " -> "count orders by 'Open' status"
+   */
+  static std::string normalize(const std::string& request);
+
+  /**
+   * @brief Find the result of this request, or of a similar one
+   *
+   * A result found through similarity has similar_cache_hit set and
+   * cached_request naming the request it was generated for.
+   */
+  static std::optional<QueryResult> lookup(const Key& key);
+  static void store(const Key& key, const QueryResult& result);
+
+  /**
+   * @brief Drop every entry and zero the counters
+   * @return Number of entries removed
+   */
+  static uint64_t reset();
+
+  static Stats stats();
+};
+
+}  // namespace pg_ai
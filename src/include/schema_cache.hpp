@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <postgres.h>
+}
+
+#include "config.hpp"
+#include "query_generator.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Schema catalog cache shared by all backends of the cluster
+ *
+ * Table lists, table details and foreign keys are stored serialized (CBOR),
+ * and prompt text as is, in the extension's dynamic shared area, indexed by
+ * (database, relation, kind).
+ * Entries are invalidated per relation from relcache/syscache callbacks, so
+ * only relations that actually changed are rebuilt; column statistics
+ * digests are rebuilt whenever pg_statistic changes. Requires the library to
+ * be listed in shared_preload_libraries; otherwise every lookup misses.
+ *
+ * Lookups hand out a ticket on a miss. A later store with that ticket is
+ * dropped if the entry was invalidated while the caller was building it.
+ *
+ * Entries are shared by all roles, so they hold the full, unfiltered
+ * structure; callers filter every hit for the current user (see the
+ * CatalogReader::restrict*ToUser functions). Prompt text is only used by
+ * users who see every table (SCHEMA_TEXT) or every column (TABLE_TEXT).
+ */
+class SchemaCache {
+ public:
+  enum class EntryKind : uint32_t {
+    TABLE_LIST = 1,
+    TABLE_DETAILS = 2,
+    COLUMN_STATS = 3,
+    // Prompt text as formatTableDetailsForAI/formatSchemaForAI render it
+    TABLE_TEXT = 4,
+    SCHEMA_TEXT = 5,
+    FOREIGN_KEYS = 6
+  };
+
+  /**
+   * @brief Capture sizing settings (postmaster only, before shmemSize())
+   */
+  static void configure(const config::Configuration& cfg);
+
+  /**
+   * @brief Shared memory needed for the cache index
+   */
+  static Size shmemSize();
+
+  /**
+   * @brief Create or attach the cache index (shmem startup hook)
+   */
+  static void shmemInit();
+
+  /**
+   * @brief Register relcache/syscache invalidation callbacks
+   */
+  static void registerInvalidationCallbacks();
+
+  /**
+   * @brief Look up the table list of the current database
+   * @param schema Filled on a hit
+   * @param ticket Set on a miss; pass to storeTables()
+   * @return true on a cache hit
+   */
+  static bool lookupTables(DatabaseSchema& schema, uint64_t& ticket);
+  static void storeTables(const DatabaseSchema& schema, uint64_t ticket);
+
+  /**
+   * @brief Look up the details of one relation of the current database
+   * @param relid Relation OID
+   * @param details Filled on a hit
+   * @param ticket Set on a miss; pass to storeTableDetails()
+   * @return true on a cache hit
+   */
+  static bool lookupTableDetails(Oid relid,
+                                 TableDetails& details,
+                                 uint64_t& ticket);
+
+  /**
+   * @brief Look up the details of several relations under one lock
+   * @param relids Relation OIDs
+   * @param tickets Set per relation; non-zero where a store is allowed
+   * @return Details per relation, empty where the cache missed
+   */
+  static std::vector<std::optional<TableDetails>> lookupTableDetails(
+      const std::vector<Oid>& relids,
+      std::vector<uint64_t>& tickets);
+
+  static void storeTableDetails(Oid relid,
+                                const TableDetails& details,
+                                uint64_t ticket);
+
+  /**
+   * @brief Look up the statistics digest of one relation
+   *
+   * Digests stay valid until pg_statistic changes in the current database.
+   */
+  static std::optional<std::vector<ColumnStats>> lookupColumnStats(
+      Oid relid,
+      uint64_t& ticket);
+  static void storeColumnStats(Oid relid,
+                               const std::vector<ColumnStats>& stats,
+                               uint64_t ticket);
+
+  /**
+   * @brief Look up every foreign key of the current database
+   *
+   * Invalidated whenever a constraint, table or schema changes.
+   */
+  static std::optional<std::vector<ForeignKeyInfo>> lookupForeignKeys(
+      uint64_t& ticket);
+  static void storeForeignKeys(const std::vector<ForeignKeyInfo>& keys,
+                               uint64_t ticket);
+
+  /**
+   * @brief Look up preformatted prompt text (TABLE_TEXT or SCHEMA_TEXT)
+   * @param relid Relation OID, InvalidOid for SCHEMA_TEXT
+   */
+  static std::optional<std::string> lookupText(EntryKind kind,
+                                               Oid relid,
+                                               uint64_t& ticket);
+  static void storeText(EntryKind kind,
+                        Oid relid,
+                        const std::string& text,
+                        uint64_t ticket);
+
+  /**
+   * @brief Get tickets for the entries that need to be (re)built
+   *
+   * Like a lookup, but payloads of valid entries are not copied.
+   * @return Ticket per relation; 0 where the entry is valid
+   */
+  static std::vector<uint64_t> reserveMissing(EntryKind kind,
+                                              const std::vector<Oid>& relids);
+
+  /**
+   * @brief Mark an entry of the current database stale
+   */
+  static void invalidate(EntryKind kind, Oid relid);
+
+  /**
+   * @brief Mark every entry of the current database stale
+   */
+  static void invalidateDatabase();
+
+ private:
+  static bool lookup(EntryKind kind,
+                     Oid relid,
+                     std::string& blob,
+                     uint64_t& ticket);
+  static void lookupMany(EntryKind kind,
+                         const std::vector<Oid>& relids,
+                         std::vector<std::optional<std::string>>* blobs,
+                         std::vector<uint64_t>& tickets);
+  static void store(EntryKind kind,
+                    Oid relid,
+                    const std::string& blob,
+                    uint64_t ticket);
+};
+
+}  // namespace pg_ai
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+extern "C" {
+#include <postgres.h>
+}
+
+namespace pg_ai {
+
+/**
+ * @brief Content hash of the database schema, maintained by DDL triggers
+ *
+ * Every user table, view, materialized view, foreign table and index has a
+ * fingerprint over its name, columns (types, nullability, defaults),
+ * constraints or index definition. The database version is the XOR of all of
+ * them, so it is updated in O(changed relations) and returns to an earlier
+ * value when a change is reverted. Fingerprints live in the extension's
+ * pg_ai_schema_fingerprints table and are updated by the ddl_command_end and
+ * sql_drop event triggers installed with the extension.
+ */
+class SchemaFingerprint {
+ public:
+  /**
+   * @brief Fingerprint of one relation
+   * @return 0 if the relation does not exist or is not tracked
+   */
+  static uint64_t relation(Oid relid);
+
+  /**
+   * @brief Current database version, the XOR of the stored fingerprints
+   *
+   * Computed once per backend and kept until a DDL transaction that changes
+   * fingerprints commits.
+   * @return Empty if the extension's fingerprint table is missing
+   */
+  static std::optional<uint64_t> version();
+
+  /**
+   * @brief Recompute every fingerprint from the catalogs
+   * @return The new database version
+   */
+  static uint64_t refresh();
+
+  /**
+   * @brief Re-fingerprint relations touched by the current DDL command
+   *
+   * Must run inside a ddl_command_end event trigger.
+   */
+  static void applyDdlCommands();
+
+  /**
+   * @brief Remove relations dropped by the current DDL command
+   *
+   * Must run inside a sql_drop event trigger.
+   */
+  static void applyDroppedObjects();
+};
+
+}  // namespace pg_ai
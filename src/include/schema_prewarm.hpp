@@ -0,0 +1,40 @@
+#pragma once
+
+extern "C" {
+#include <postgres.h>
+}
+
+namespace pg_ai {
+
+/**
+ * @brief Background workers that keep the shared schema cache warm
+ *
+ * One worker per database listed in [schema] prewarm_databases. Each worker
+ * periodically rebuilds whatever the catalog invalidation callbacks have
+ * marked stale: the table list, foreign keys, table details, the prompt text
+ * formatSchemaForAI/formatTableDetailsForAI produce and, when enabled,
+ * column statistics digests. Request backends then only do lookups.
+ */
+class SchemaPrewarm {
+ public:
+  /**
+   * @brief Register the workers (from _PG_init, while preloading)
+   */
+  static void registerWorkers();
+
+  /**
+   * @brief Rebuild every stale cache entry of the current database
+   *
+   * Runs its own transactions, committing every few tables so that relation
+   * locks do not pile up on large catalogs. Must be called outside a
+   * transaction.
+   * @return Number of entries rebuilt
+   */
+  static size_t warmDatabase();
+};
+
+}  // namespace pg_ai
+
+extern "C" {
+PGDLLEXPORT void pg_ai_schema_prewarm_main(Datum main_arg);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+extern "C" {
+#include <postgres.h>
+
+#include <storage/lwlock.h>
+#include <utils/dsa.h>
+}
+
+namespace pg_ai::shmem {
+
+/**
+ * @brief Named LWLocks owned by the extension, one per shared structure
+ */
+enum class LockId : int {
+  SCHEMA_CACHE = 0,
+  RESULT_CACHE,
+  RATE_LIMITER,
+  SINGLE_FLIGHT,
+  COUNT
+};
+
+/**
+ * @brief Install the shared memory request/startup hooks
+ *
+ * Must be called from _PG_init while shared_preload_libraries is being
+ * processed. When the library is loaded any other way the shared
+ * structures are simply unavailable and callers fall back to uncached paths.
+ */
+void install();
+
+/**
+ * @brief Whether the shared memory segment was set up by the postmaster
+ */
+bool isAvailable();
+
+/**
+ * @brief Get one of the extension's LWLocks
+ */
+LWLock* lock(LockId id);
+
+/**
+ * @brief Get the shared dynamic area, attaching to it on first use
+ * @return Area pointer, or nullptr when shared memory is unavailable
+ */
+dsa_area* area();
+
+}  // namespace pg_ai::shmem
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+extern "C" {
+#include <postgres.h>
+}
+
+#include "query_generator.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Coalesces identical provider calls made at the same time
+ *
+ * A call is identified by its exact prompt, provider, endpoint and model,
+ * together with the database and role. The first backend to join a call
+ * leads it; backends joining while it runs sleep on the flight's condition
+ * variable and get the leader's QueryResult, passed serialized through the
+ * shared area, instead of calling the provider themselves.
+ *
+ * If the leader goes away without a result (cancelled, failed with an
+ * error, or exited), the first follower to notice takes the call over.
+ * Followers give up after request_timeout_ms plus the rate limit's
+ * max_wait_ms and a few seconds, and then make the call on their own.
+ *
+ * Requires shared_preload_libraries and [single_flight] enabled; otherwise
+ * every backend leads its own calls.
+ */
+class SingleFlight {
+ public:
+  // A call this backend leads. Followers are released by finish(), or told
+  // to take over when the leader is destroyed without a result.
+  class Leader {
+   public:
+    Leader() = default;
+    Leader(Leader&& other) noexcept;
+    Leader& operator=(Leader&& other) noexcept;
+    Leader(const Leader&) = delete;
+    Leader& operator=(const Leader&) = delete;
+    ~Leader();
+
+    /**
+     * @brief Hand the result, successful or not, to the followers
+     */
+    void finish(const QueryResult& result);
+
+   private:
+    friend class SingleFlight;
+    int slot_ = -1;
+    uint32_t generation_ = 0;
+  };
+
+  struct Outcome {
+    // Result of another backend's call; empty when this backend must make
+    // the call itself
+    std::optional<QueryResult> result;
+    Leader leader;
+  };
+
+  // Counters of the current backend
+  struct Stats {
+    // Calls led while other backends were allowed to join
+    uint64_t led = 0;
+    // Results received from another backend's call
+    uint64_t followed = 0;
+    // Calls taken over from a leader that went away
+    uint64_t takeovers = 0;
+    // Waits given up on
+    uint64_t timeouts = 0;
+  };
+
+  /**
+   * @brief Shared memory needed for the in-flight table
+   */
+  static Size shmemSize();
+
+  /**
+   * @brief Create or attach the in-flight table (shmem startup hook)
+   */
+  static void shmemInit();
+
+  /**
+   * @brief Lead a call or wait for the identical call already running
+   * @param call Everything that determines the provider's answer
+   * @throws CallInterrupted if a cancel or termination request arrives
+   */
+  static Outcome join(const std::string& call);
+
+  static Stats stats();
+};
+
+}  // namespace pg_ai
@@ -0,0 +1,49 @@
+#pragma once
+
+extern "C" {
+#include <postgres.h>
+
+#include <executor/spi.h>
+}
+
+#include <string>
+#include <vector>
+
+namespace pg_ai {
+
+/**
+ * @brief Backend-lifetime cache of prepared SPI plans
+ *
+ * Catalog queries are prepared once with SPI_prepare and kept with
+ * SPI_keepplan, so later calls skip parsing and planning. Values are always
+ * bound as typed parameters, never spliced into the query text. Kept plans
+ * are revalidated by PostgreSQL's plan cache when the objects they use
+ * change. Must be called while connected to SPI.
+ */
+class SpiPlanCache {
+ public:
+  /**
+   * @brief Get the plan for a query, preparing it on first use
+   * @param query Query text, also the cache key
+   * @param arg_types Types of $1..$n
+   */
+  static SPIPlanPtr get(const std::string& query,
+                        const std::vector<Oid>& arg_types = {});
+
+  /**
+   * @brief Execute a cached plan with non-null parameters
+   * @return SPI_execute_plan result code
+   */
+  static int execute(const std::string& query,
+                     const std::vector<Oid>& arg_types,
+                     const std::vector<Datum>& values,
+                     bool read_only,
+                     long count);
+
+  /**
+   * @brief Execute a cached plan that takes no parameters
+   */
+  static int execute(const std::string& query, bool read_only, long count);
+};
+
+}  // namespace pg_ai
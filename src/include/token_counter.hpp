@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "config.hpp"
+
+namespace pg_ai {
+
+/**
+ * @brief Prompt token counts for the configured models
+ *
+ * OpenAI models are counted with their BPE vocabulary (cl100k_base or
+ * o200k_base), read from [tokenizer] vocab_dir the first time a backend
+ * needs it. Other models, or a missing vocabulary file, fall back to an
+ * estimate of about four characters per token.
+ */
+class TokenCounter {
+ public:
+  struct Count {
+    size_t tokens = 0;
+    // Counted with the model's vocabulary rather than estimated
+    bool exact = false;
+  };
+
+  static Count count(const std::string& model, std::string_view text);
+
+  /**
+   * @brief Tokens a prompt may take in the model's context window
+   *
+   * The window minus max_tokens kept for the answer, but never more than
+   * half the window. nullopt if the window is not known.
+   */
+  static std::optional<size_t> promptLimit(const std::string& model);
+
+  /**
+   * @brief max_tokens to request so that prompt and answer fit the window
+   */
+  static int answerLimit(const config::ModelConfig& model,
+                         size_t prompt_tokens);
+};
+
+}  // namespace pg_ai
@@ -3,35 +3,165 @@ extern "C" {
 
 #include <access/htup_details.h>
 #include <catalog/pg_type.h>
+#include <commands/event_trigger.h>
 #include <fmgr.h>
 #include <funcapi.h>
 #include <miscadmin.h>
+#include <utils/array.h>
 #include <utils/builtins.h>
 #include <utils/elog.h>
 #include <utils/memutils.h>
+#include <utils/tuplestore.h>
 }
 
 #include <nlohmann/json.hpp>
 
+#include "include/catalog_reader.hpp"
+#include "include/client_pool.hpp"
 #include "include/config.hpp"
+#include "include/explain_runner.hpp"
+#include "include/model_router.hpp"
+#include "include/plan_analyzer.hpp"
+#include "include/provider_call.hpp"
+#include "include/rate_limiter.hpp"
 #include "include/query_generator.hpp"
 #include "include/response_formatter.hpp"
+#include "include/result_cache.hpp"
+#include "include/schema_cache.hpp"
+#include "include/schema_fingerprint.hpp"
+#include "include/schema_prewarm.hpp"
+#include "include/shmem.hpp"
+#include "include/single_flight.hpp"
+#include "include/token_counter.hpp"
+
+namespace {
+
+nlohmann::json tableDetailsToJson(const pg_ai::TableDetails& details) {
+  nlohmann::json json_result;
+  json_result["table_name"] = details.table_name;
+  json_result["schema_name"] = details.schema_name;
+
+  nlohmann::json columns = nlohmann::json::array();
+  for (const auto& column : details.columns) {
+    nlohmann::json column_json;
+    column_json["column_name"] = column.column_name;
+    column_json["data_type"] = column.data_type;
+    column_json["is_nullable"] = column.is_nullable;
+    column_json["column_default"] = column.column_default;
+    column_json["is_primary_key"] = column.is_primary_key;
+    column_json["is_foreign_key"] = column.is_foreign_key;
+    if (!column.foreign_table.empty()) {
+      column_json["foreign_table"] = column.foreign_table;
+      column_json["foreign_column"] = column.foreign_column;
+    }
+    columns.push_back(column_json);
+  }
+  json_result["columns"] = columns;
+
+  json_result["indexes"] = details.indexes;
+  return json_result;
+}
+
+// Prepares a set-returning function to return its rows in a tuplestore, which
+// spills to disk beyond work_mem.
+ReturnSetInfo* beginMaterializedResult(FunctionCallInfo fcinfo) {
+#if PG_VERSION_NUM >= 150000
+  InitMaterializedSRF(fcinfo, 0);
+  return reinterpret_cast<ReturnSetInfo*>(fcinfo->resultinfo);
+#else
+  auto* rsinfo = reinterpret_cast<ReturnSetInfo*>(fcinfo->resultinfo);
+  if (!rsinfo || !IsA(rsinfo, ReturnSetInfo) ||
+      !(rsinfo->allowedModes & SFRM_Materialize)) {
+    ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                    errmsg("set-valued function called in context that "
+                           "cannot accept a set")));
+  }
+
+  TupleDesc tupdesc;
+  if (get_call_result_type(fcinfo, nullptr, &tupdesc) != TYPEFUNC_COMPOSITE)
+    elog(ERROR, "return type must be a row type");
+
+  MemoryContext old_context =
+      MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+  rsinfo->returnMode = SFRM_Materialize;
+  rsinfo->setResult = tuplestore_begin_heap(true, false, work_mem);
+  rsinfo->setDesc = CreateTupleDescCopy(tupdesc);
+  MemoryContextSwitchTo(old_context);
+  return rsinfo;
+#endif
+}
+
+Datum textOrNull(const std::string& value, bool& isnull) {
+  isnull = value.empty();
+  return isnull ? (Datum)0 : CStringGetTextDatum(value.c_str());
+}
+
+Oid resolveTableOrError(FunctionCallInfo fcinfo) {
+  std::string table_name = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  std::string schema_name =
+      PG_ARGISNULL(1) ? "public" : text_to_cstring(PG_GETARG_TEXT_PP(1));
+  Oid relid = pg_ai::CatalogReader::resolveTable(table_name, schema_name);
+  if (!OidIsValid(relid)) {
+    ereport(ERROR, (errcode(ERRCODE_UNDEFINED_TABLE),
+                    errmsg("Table %s.%s does not exist", schema_name.c_str(),
+                           table_name.c_str())));
+  }
+  return relid;
+}
+
+}  // namespace
 
 extern "C" {
 PG_MODULE_MAGIC;
 
+void _PG_init(void);
+
 PG_FUNCTION_INFO_V1(generate_query);
+PG_FUNCTION_INFO_V1(generate_query_stream);
+PG_FUNCTION_INFO_V1(generate_queries);
 PG_FUNCTION_INFO_V1(get_database_tables);
 PG_FUNCTION_INFO_V1(get_table_details);
+PG_FUNCTION_INFO_V1(get_tables_details);
+PG_FUNCTION_INFO_V1(list_tables);
+PG_FUNCTION_INFO_V1(list_table_columns);
+PG_FUNCTION_INFO_V1(list_table_indexes);
 PG_FUNCTION_INFO_V1(explain_query);
+PG_FUNCTION_INFO_V1(analyze_plan);
+PG_FUNCTION_INFO_V1(pg_ai_schema_version);
+PG_FUNCTION_INFO_V1(pg_ai_schema_refresh);
+PG_FUNCTION_INFO_V1(pg_ai_relation_fingerprint);
+PG_FUNCTION_INFO_V1(pg_ai_schema_ddl_command_end);
+PG_FUNCTION_INFO_V1(pg_ai_schema_sql_drop);
+PG_FUNCTION_INFO_V1(pg_ai_backend_stats);
+PG_FUNCTION_INFO_V1(pg_ai_cache_stats);
+PG_FUNCTION_INFO_V1(pg_ai_cache_reset);
+PG_FUNCTION_INFO_V1(pg_ai_estimate_tokens);
+PG_FUNCTION_INFO_V1(pg_ai_rate_limits);
+
+/**
+ * _PG_init()
+ *
+ * When loaded through shared_preload_libraries, reserves the shared schema
+ * cache, registers the catalog invalidation callbacks that keep it fresh and
+ * starts the configured schema prewarm workers.
+ */
+void _PG_init(void) {
+  if (!process_shared_preload_libraries_in_progress)
+    return;
+
+  pg_ai::shmem::install();
+  pg_ai::SchemaCache::registerInvalidationCallbacks();
+  pg_ai::SchemaPrewarm::registerWorkers();
+}
 
 /**
  * generate_query(natural_language_query text, api_key text DEFAULT NULL,
- * provider text DEFAULT 'auto')
+ * provider text DEFAULT 'auto', use_cache boolean DEFAULT true)
  *
  * Generates a SQL query from natural language input with automatic schema
  * discovery Provider options: 'openai', 'anthropic', 'auto' (auto-select based
- * on config)
+ * on config). Repeated requests are answered from the shared result cache
+ * unless use_cache is false.
  */
 Datum generate_query(PG_FUNCTION_ARGS) {
   try {
@@ -46,8 +176,13 @@ Datum generate_query(PG_FUNCTION_ARGS) {
 
     pg_ai::QueryRequest request{
         .natural_language = nl_query, .api_key = api_key, .provider = provider};
+    request.use_cache = PG_NARGS() > 3 && !PG_ARGISNULL(3) ? PG_GETARG_BOOL(3)
+                                                           : true;
 
     auto result = pg_ai::QueryGenerator::generateQuery(request);
+    // A cancel or timeout that cut the provider call short is raised here,
+    // outside the C++ frames.
+    CHECK_FOR_INTERRUPTS();
 
     if (!result.success) {
       ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
@@ -73,6 +208,137 @@ Datum generate_query(PG_FUNCTION_ARGS) {
   }
 }
 
+/**
+ * generate_query_stream(natural_language_query text, api_key text DEFAULT
+ * NULL, provider text DEFAULT 'auto', stop_after_sql boolean DEFAULT false)
+ *
+ * Streams the model response and returns its pieces as (seq, kind, content)
+ * rows: 'text' chunks in arrival order, 'sql' once the query is complete
+ * (also raised as a NOTICE right away) and a final 'result' row with the
+ * formatted response generate_query would return.
+ */
+Datum generate_query_stream(PG_FUNCTION_ARGS) {
+  std::string nl_query = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  std::string api_key =
+      PG_ARGISNULL(1) ? "" : text_to_cstring(PG_GETARG_TEXT_PP(1));
+  std::string provider =
+      PG_ARGISNULL(2) ? "auto" : text_to_cstring(PG_GETARG_TEXT_PP(2));
+  bool stop_after_sql = PG_ARGISNULL(3) ? false : PG_GETARG_BOOL(3);
+
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+  int32 seq = 0;
+  auto emit = [&](const char* kind, const std::string& content) {
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+    values[0] = Int32GetDatum(++seq);
+    values[1] = CStringGetTextDatum(kind);
+    values[2] = CStringGetTextDatum(content.c_str());
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  };
+
+  try {
+    pg_ai::QueryRequest request{.natural_language = nl_query,
+                                .api_key = api_key,
+                                .provider = provider,
+                                .stop_after_sql = stop_after_sql};
+    request.on_chunk = [&](const pg_ai::StreamChunk& chunk) {
+      if (chunk.kind == pg_ai::StreamChunk::Kind::SQL) {
+        // Notices reach the client immediately, before the result set.
+        ereport(NOTICE, (errmsg("%s", chunk.content.c_str())));
+        emit("sql", chunk.content);
+      } else {
+        emit("text", chunk.content);
+      }
+    };
+
+    auto result = pg_ai::QueryGenerator::generateQuery(request);
+    CHECK_FOR_INTERRUPTS();
+    if (!result.success) {
+      ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
+                      errmsg("Query generation failed: %s",
+                             result.error_message.c_str())));
+    }
+
+    const auto& config = pg_ai::config::ConfigManager::getConfig();
+    emit("result", result.generated_query.empty()
+                       ? result.explanation
+                       : pg_ai::ResponseFormatter::formatResponse(result,
+                                                                  config));
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  return (Datum)0;
+}
+
+/**
+ * generate_queries(natural_language_queries text[], api_key text DEFAULT
+ * NULL, provider text DEFAULT 'auto', use_cache boolean DEFAULT true)
+ *
+ * Translates every element of the array, with one schema discovery for the
+ * whole batch and up to [general] batch_concurrency provider calls at once.
+ * Returns one (idx, natural_language_query, generated_query, error) row per
+ * element in input order; a failed element sets error instead of aborting
+ * the batch.
+ */
+Datum generate_queries(PG_FUNCTION_ARGS) {
+  ArrayType* queries_arg = PG_GETARG_ARRAYTYPE_P(0);
+  std::string api_key =
+      PG_ARGISNULL(1) ? "" : text_to_cstring(PG_GETARG_TEXT_PP(1));
+  std::string provider =
+      PG_ARGISNULL(2) ? "auto" : text_to_cstring(PG_GETARG_TEXT_PP(2));
+  bool use_cache = PG_ARGISNULL(3) ? true : PG_GETARG_BOOL(3);
+
+  Datum* elems;
+  bool* nulls;
+  int nelems;
+  deconstruct_array(queries_arg, TEXTOID, -1, false, TYPALIGN_INT, &elems,
+                    &nulls, &nelems);
+
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  try {
+    pg_ai::BatchQueryRequest request{
+        .api_key = api_key, .provider = provider, .use_cache = use_cache};
+    for (int i = 0; i < nelems; i++) {
+      request.natural_language.push_back(
+          nulls[i] ? "" : TextDatumGetCString(elems[i]));
+    }
+
+    auto results = pg_ai::QueryGenerator::generateQueries(request);
+    CHECK_FOR_INTERRUPTS();
+
+    const auto& config = pg_ai::config::ConfigManager::getConfig();
+    for (int i = 0; i < nelems; i++) {
+      const auto& result = results[i];
+      Datum values[4];
+      bool value_nulls[4] = {false, nulls[i], false, false};
+      values[0] = Int32GetDatum(i + 1);
+      values[1] = nulls[i] ? (Datum)0 : elems[i];
+      if (result.success) {
+        values[2] = CStringGetTextDatum(
+            result.generated_query.empty()
+                ? ""
+                : pg_ai::ResponseFormatter::formatResponse(result, config)
+                      .c_str());
+        value_nulls[3] = true;
+      } else {
+        value_nulls[2] = true;
+        values[3] = CStringGetTextDatum(result.error_message.c_str());
+      }
+      tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values,
+                           value_nulls);
+    }
+  } catch (const std::exception& e) {
+    CHECK_FOR_INTERRUPTS();
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  return (Datum)0;
+}
+
 /**
  * get_database_tables()
  *
@@ -133,28 +399,61 @@ Datum get_table_details(PG_FUNCTION_ARGS) {
                              result.error_message.c_str())));
     }
 
-    nlohmann::json json_result;
-    json_result["table_name"] = result.table_name;
-    json_result["schema_name"] = result.schema_name;
-
-    nlohmann::json columns = nlohmann::json::array();
-    for (const auto& column : result.columns) {
-      nlohmann::json column_json;
-      column_json["column_name"] = column.column_name;
-      column_json["data_type"] = column.data_type;
-      column_json["is_nullable"] = column.is_nullable;
-      column_json["column_default"] = column.column_default;
-      column_json["is_primary_key"] = column.is_primary_key;
-      column_json["is_foreign_key"] = column.is_foreign_key;
-      if (!column.foreign_table.empty()) {
-        column_json["foreign_table"] = column.foreign_table;
-        column_json["foreign_column"] = column.foreign_column;
+    nlohmann::json json_result = tableDetailsToJson(result);
+
+    std::string json_string = json_result.dump(2);
+    PG_RETURN_TEXT_P(cstring_to_text(json_string.c_str()));
+
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+    PG_RETURN_NULL();
+  }
+}
+
+/**
+ * get_tables_details(table_names text[])
+ *
+ * Returns a JSON array with the details of several tables, fetched in one
+ * catalog pass. Names may be schema-qualified ('sales.orders'); unqualified
+ * names are looked up in 'public'. Tables that cannot be read are reported
+ * with an "error" field instead of failing the whole call.
+ */
+Datum get_tables_details(PG_FUNCTION_ARGS) {
+  try {
+    ArrayType* names_arg = PG_GETARG_ARRAYTYPE_P(0);
+
+    Datum* elems;
+    bool* nulls;
+    int nelems;
+    deconstruct_array(names_arg, TEXTOID, -1, false, TYPALIGN_INT, &elems,
+                      &nulls, &nelems);
+
+    std::vector<std::pair<std::string, std::string>> tables;
+    for (int i = 0; i < nelems; i++) {
+      if (nulls[i])
+        continue;
+      std::string name = TextDatumGetCString(elems[i]);
+      size_t dot = name.find('.');
+      if (dot == std::string::npos) {
+        tables.emplace_back("public", name);
+      } else {
+        tables.emplace_back(name.substr(0, dot), name.substr(dot + 1));
       }
-      columns.push_back(column_json);
     }
-    json_result["columns"] = columns;
 
-    json_result["indexes"] = result.indexes;
+    auto results = pg_ai::QueryGenerator::getTablesDetails(tables);
+
+    nlohmann::json json_result = nlohmann::json::array();
+    for (const auto& details : results) {
+      if (details.success) {
+        json_result.push_back(tableDetailsToJson(details));
+      } else {
+        json_result.push_back({{"table_name", details.table_name},
+                               {"schema_name", details.schema_name},
+                               {"error", details.error_message}});
+      }
+    }
 
     std::string json_string = json_result.dump(2);
     PG_RETURN_TEXT_P(cstring_to_text(json_string.c_str()));
@@ -166,28 +465,137 @@ Datum get_table_details(PG_FUNCTION_ARGS) {
   }
 }
 
+/**
+ * list_tables()
+ *
+ * Returns one row per user table, view, materialized view and foreign table,
+ * emitted straight from a pg_class scan without building JSON.
+ */
+Datum list_tables(PG_FUNCTION_ARGS) {
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  // Each row is built in a scratch context so memory does not grow with the
+  // catalog; the tuplestore keeps its own copy.
+  MemoryContext row_context = AllocSetContextCreate(
+      CurrentMemoryContext, "list_tables row", ALLOCSET_SMALL_SIZES);
+
+  try {
+    pg_ai::CatalogReader::forEachTable([&](const pg_ai::TableInfo& table) {
+      MemoryContext old_context = MemoryContextSwitchTo(row_context);
+      Datum values[4];
+      bool nulls[4] = {false, false, false, false};
+      values[0] = CStringGetTextDatum(table.schema_name.c_str());
+      values[1] = CStringGetTextDatum(table.table_name.c_str());
+      values[2] = CStringGetTextDatum(table.table_type.c_str());
+      values[3] = Int64GetDatum(table.estimated_rows);
+      tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+      MemoryContextSwitchTo(old_context);
+      MemoryContextReset(row_context);
+    });
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  MemoryContextDelete(row_context);
+  return (Datum)0;
+}
+
+/**
+ * list_table_columns(table_name text, schema_name text DEFAULT 'public')
+ *
+ * Returns one row per column of a table, in column order.
+ */
+Datum list_table_columns(PG_FUNCTION_ARGS) {
+  Oid relid = resolveTableOrError(fcinfo);
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  try {
+    auto details = pg_ai::CatalogReader::readTableDetails(relid);
+    if (!details.success) {
+      ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
+                      errmsg("Failed to get table details: %s",
+                             details.error_message.c_str())));
+    }
+
+    int32 position = 0;
+    for (const auto& column : details.columns) {
+      Datum values[9];
+      bool nulls[9] = {false};
+      values[0] = Int32GetDatum(++position);
+      values[1] = CStringGetTextDatum(column.column_name.c_str());
+      values[2] = CStringGetTextDatum(column.data_type.c_str());
+      values[3] = BoolGetDatum(column.is_nullable);
+      values[4] = textOrNull(column.column_default, nulls[4]);
+      values[5] = BoolGetDatum(column.is_primary_key);
+      values[6] = BoolGetDatum(column.is_foreign_key);
+      values[7] = textOrNull(column.foreign_table, nulls[7]);
+      values[8] = textOrNull(column.foreign_column, nulls[8]);
+      tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  return (Datum)0;
+}
+
+/**
+ * list_table_indexes(table_name text, schema_name text DEFAULT 'public')
+ *
+ * Returns one row per index of a table, ordered by index name.
+ */
+Datum list_table_indexes(PG_FUNCTION_ARGS) {
+  Oid relid = resolveTableOrError(fcinfo);
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  try {
+    for (const auto& index : pg_ai::CatalogReader::readIndexes(relid)) {
+      Datum values[4];
+      bool nulls[4] = {false, false, false, false};
+      values[0] = CStringGetTextDatum(index.index_name.c_str());
+      values[1] = BoolGetDatum(index.is_unique);
+      values[2] = BoolGetDatum(index.is_primary);
+      values[3] = CStringGetTextDatum(index.definition.c_str());
+      tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  return (Datum)0;
+}
+
 /**
  * explain_query(query_text text, api_key text DEFAULT NULL,
- * provider text DEFAULT 'auto')
+ * provider text DEFAULT 'auto', mode text DEFAULT 'analyze')
  *
- * Runs EXPLAIN ANALYZE on a query and returns an AI-generated explanation
- * of the execution plan, performance insights, and optimization suggestions.
+ * Runs EXPLAIN on a query and returns an AI-generated explanation of the
+ * execution plan, performance insights, and optimization suggestions,
+ * preceded by the explain mode used. ANALYZE is always rolled back.
  */
 Datum explain_query(PG_FUNCTION_ARGS) {
   try {
     text* query_text_arg = PG_GETARG_TEXT_PP(0);
     text* api_key_arg = PG_ARGISNULL(1) ? nullptr : PG_GETARG_TEXT_PP(1);
     text* provider_arg = PG_ARGISNULL(2) ? nullptr : PG_GETARG_TEXT_PP(2);
+    text* mode_arg = PG_ARGISNULL(3) ? nullptr : PG_GETARG_TEXT_PP(3);
 
     std::string query_text = text_to_cstring(query_text_arg);
     std::string api_key = api_key_arg ? text_to_cstring(api_key_arg) : "";
     std::string provider =
         provider_arg ? text_to_cstring(provider_arg) : "auto";
+    std::string mode = mode_arg ? text_to_cstring(mode_arg) : "analyze";
 
-    pg_ai::ExplainRequest request{
-        .query_text = query_text, .api_key = api_key, .provider = provider};
+    pg_ai::ExplainRequest request{.query_text = query_text,
+                                  .api_key = api_key,
+                                  .provider = provider,
+                                  .mode = mode};
 
     auto result = pg_ai::QueryGenerator::explainQuery(request);
+    CHECK_FOR_INTERRUPTS();
 
     if (!result.success) {
       ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
@@ -195,11 +603,307 @@ Datum explain_query(PG_FUNCTION_ARGS) {
                              result.error_message.c_str())));
     }
 
-    PG_RETURN_TEXT_P(cstring_to_text(result.ai_explanation.c_str()));
+    std::string output =
+        "Explain mode: " + result.mode + "\n\n" + result.ai_explanation;
+    PG_RETURN_TEXT_P(cstring_to_text(output.c_str()));
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+    PG_RETURN_NULL();
+  }
+}
+
+/**
+ * analyze_plan(query_text text, mode text DEFAULT 'analyze')
+ *
+ * Runs EXPLAIN on a query and returns the problems found by the rule-based
+ * plan analyzer, one row per finding, without calling an AI provider.
+ */
+Datum analyze_plan(PG_FUNCTION_ARGS) {
+  if (PG_ARGISNULL(0)) {
+    ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                    errmsg("query_text cannot be NULL")));
+  }
+  std::string query_text = text_to_cstring(PG_GETARG_TEXT_PP(0));
+  std::string mode_name =
+      PG_ARGISNULL(1) ? "analyze" : text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+  auto mode = pg_ai::ExplainRunner::parseMode(mode_name);
+  if (!mode) {
+    ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("unknown explain mode \"%s\"", mode_name.c_str()),
+                    errhint("Use plan, analyze or bounded.")));
+  }
+
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  try {
+    const auto& cfg = pg_ai::config::ConfigManager::getConfig();
+    auto explained =
+        pg_ai::ExplainRunner::run(query_text, *mode, cfg.explain_timeout_ms);
+    CHECK_FOR_INTERRUPTS();
+    if (!explained.success) {
+      ereport(ERROR, (errcode(ERRCODE_EXTERNAL_ROUTINE_EXCEPTION),
+                      errmsg("Plan analysis failed: %s",
+                             explained.error_message.c_str())));
+    }
+    if (explained.timed_out) {
+      ereport(NOTICE, (errmsg("EXPLAIN ANALYZE stopped after %d ms, only "
+                              "the plan was analyzed",
+                              cfg.explain_timeout_ms)));
+    }
+
+    auto analysis = pg_ai::PlanAnalyzer::analyze(explained.explain_output);
+    if (!analysis.success) {
+      ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                      errmsg("Plan analysis failed: %s",
+                             analysis.error_message.c_str())));
+    }
+
+    for (const auto& finding : analysis.findings) {
+      Datum values[6];
+      bool nulls[6] = {false};
+      values[0] = CStringGetTextDatum(
+          pg_ai::PlanAnalyzer::severityName(finding.severity).c_str());
+      values[1] = CStringGetTextDatum(finding.rule.c_str());
+      values[2] = CStringGetTextDatum(finding.path.c_str());
+      values[3] = CStringGetTextDatum(finding.node_type.c_str());
+      nulls[4] = finding.relation.empty();
+      values[4] = CStringGetTextDatum(finding.relation.c_str());
+      values[5] = CStringGetTextDatum(finding.message.c_str());
+      tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  return (Datum)0;
+}
+/**
+ * pg_ai_schema_version()
+ *
+ * Returns the current schema fingerprint of the database. It changes whenever
+ * a table, view or index definition changes and can be used as a cache key.
+ */
+Datum pg_ai_schema_version(PG_FUNCTION_ARGS) {
+  try {
+    auto version = pg_ai::SchemaFingerprint::version();
+    if (!version) {
+      ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                      errmsg("Schema fingerprint state is not available")));
+    }
+    PG_RETURN_INT64(static_cast<int64>(*version));
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+    PG_RETURN_NULL();
+  }
+}
+
+/**
+ * pg_ai_schema_refresh()
+ *
+ * Recomputes every relation fingerprint, e.g. after a restore, and returns
+ * the new schema version.
+ */
+Datum pg_ai_schema_refresh(PG_FUNCTION_ARGS) {
+  try {
+    PG_RETURN_INT64(
+        static_cast<int64>(pg_ai::SchemaFingerprint::refresh()));
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+    PG_RETURN_NULL();
+  }
+}
+
+/**
+ * pg_ai_relation_fingerprint(relation regclass)
+ *
+ * Returns the fingerprint of one relation, or NULL if it is not tracked.
+ */
+Datum pg_ai_relation_fingerprint(PG_FUNCTION_ARGS) {
+  uint64_t fingerprint =
+      pg_ai::SchemaFingerprint::relation(PG_GETARG_OID(0));
+  if (fingerprint == 0)
+    PG_RETURN_NULL();
+  PG_RETURN_INT64(static_cast<int64>(fingerprint));
+}
+
+/**
+ * pg_ai_schema_ddl_command_end()
+ *
+ * ddl_command_end event trigger keeping relation fingerprints current.
+ */
+Datum pg_ai_schema_ddl_command_end(PG_FUNCTION_ARGS) {
+  if (!CALLED_AS_EVENT_TRIGGER(fcinfo)) {
+    ereport(ERROR, (errcode(ERRCODE_E_R_I_E_EVENT_TRIGGER_PROTOCOL_VIOLATED),
+                    errmsg("not fired by event trigger manager")));
+  }
+  try {
+    pg_ai::SchemaFingerprint::applyDdlCommands();
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+  PG_RETURN_NULL();
+}
+
+/**
+ * pg_ai_schema_sql_drop()
+ *
+ * sql_drop event trigger removing fingerprints of dropped relations.
+ */
+Datum pg_ai_schema_sql_drop(PG_FUNCTION_ARGS) {
+  if (!CALLED_AS_EVENT_TRIGGER(fcinfo)) {
+    ereport(ERROR, (errcode(ERRCODE_E_R_I_E_EVENT_TRIGGER_PROTOCOL_VIOLATED),
+                    errmsg("not fired by event trigger manager")));
+  }
+  try {
+    pg_ai::SchemaFingerprint::applyDroppedObjects();
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+  PG_RETURN_NULL();
+}
+
+/**
+ * pg_ai_backend_stats()
+ *
+ * Returns counters of the current backend as (stat, value) rows.
+ */
+Datum pg_ai_backend_stats(PG_FUNCTION_ARGS) {
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  auto pool = pg_ai::ClientPool::stats();
+  auto calls = pg_ai::ProviderCall::stats();
+  auto routing = pg_ai::ModelRouter::stats();
+  auto flight = pg_ai::SingleFlight::stats();
+  const std::pair<const char*, uint64_t> stats[] = {
+      {"client_pool_hits", pool.hits},
+      {"client_pool_misses", pool.misses},
+      {"client_pool_evictions", pool.evictions},
+      {"client_pool_size", pool.size},
+      {"provider_calls", calls.calls},
+      {"prompt_tokens", calls.prompt_tokens},
+      {"completion_tokens", calls.completion_tokens},
+      {"prompt_prefix_repeats", calls.prefix_repeats},
+      {"hedges", calls.hedges},
+      {"hedge_wins", calls.hedge_wins},
+      {"routed_fast", routing.fast_calls},
+      {"routed_fast_ms", routing.fast_latency_ms},
+      {"routed_strong", routing.strong_calls},
+      {"routed_strong_ms", routing.strong_latency_ms},
+      {"single_flight_led", flight.led},
+      {"single_flight_followed", flight.followed},
+      {"single_flight_takeovers", flight.takeovers},
+      {"single_flight_timeouts", flight.timeouts},
+  };
+  for (const auto& [name, value] : stats) {
+    Datum values[2];
+    bool nulls[2] = {false, false};
+    values[0] = CStringGetTextDatum(name);
+    values[1] = Int64GetDatum(static_cast<int64>(value));
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+/**
+ * pg_ai_cache_stats()
+ *
+ * Returns the counters of the shared result cache as (stat, value) rows.
+ */
+Datum pg_ai_cache_stats(PG_FUNCTION_ARGS) {
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  auto cache = pg_ai::ResultCache::stats();
+  const std::pair<const char*, uint64_t> stats[] = {
+      {"hits", cache.hits},           {"similar_hits", cache.similar_hits},
+      {"misses", cache.misses},       {"evictions", cache.evictions},
+      {"entries", cache.entries},     {"bytes", cache.bytes},
+  };
+  for (const auto& [name, value] : stats) {
+    Datum values[2];
+    bool nulls[2] = {false, false};
+    values[0] = CStringGetTextDatum(name);
+    values[1] = Int64GetDatum(static_cast<int64>(value));
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+
+  return (Datum)0;
+}
+
+/**
+ * pg_ai_cache_reset()
+ *
+ * Empties the shared result cache and zeroes its counters. Returns the
+ * number of entries removed.
+ */
+Datum pg_ai_cache_reset(PG_FUNCTION_ARGS) {
+  PG_RETURN_INT64(static_cast<int64>(pg_ai::ResultCache::reset()));
+}
+
+/**
+ * pg_ai_estimate_tokens(text text, model text DEFAULT NULL)
+ *
+ * Counts the tokens of a text for a model (the default model when NULL),
+ * the way prompts are budgeted before they are sent.
+ */
+Datum pg_ai_estimate_tokens(PG_FUNCTION_ARGS) {
+  if (PG_ARGISNULL(0))
+    PG_RETURN_NULL();
+  try {
+    std::string text = text_to_cstring(PG_GETARG_TEXT_PP(0));
+    std::string model =
+        PG_ARGISNULL(1)
+            ? pg_ai::config::ConfigManager::getConfig()
+                  .default_provider.default_model.name
+            : text_to_cstring(PG_GETARG_TEXT_PP(1));
+    auto count = pg_ai::TokenCounter::count(model, text);
+    PG_RETURN_INT32(static_cast<int32>(count.tokens));
   } catch (const std::exception& e) {
     ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
                     errmsg("Internal error: %s", e.what())));
     PG_RETURN_NULL();
   }
 }
-}
\ No newline at end of file
+
+/**
+ * pg_ai_rate_limits()
+ *
+ * Returns one row per provider rate limit bucket: its limits, what it could
+ * admit right now and how many calls waited, were refused or throttled.
+ */
+Datum pg_ai_rate_limits(PG_FUNCTION_ARGS) {
+  ReturnSetInfo* rsinfo = beginMaterializedResult(fcinfo);
+
+  try {
+    for (const auto& bucket : pg_ai::RateLimiter::buckets()) {
+      Datum values[10];
+      bool nulls[10] = {false};
+      values[0] = CStringGetTextDatum(bucket.name.c_str());
+      values[1] = Int64GetDatum(bucket.requests_per_minute);
+      values[2] = Int64GetDatum(bucket.tokens_per_minute);
+      nulls[3] = !bucket.requests_available;
+      values[3] = Float8GetDatum(bucket.requests_available.value_or(0));
+      nulls[4] = !bucket.tokens_available;
+      values[4] = Float8GetDatum(bucket.tokens_available.value_or(0));
+      values[5] = Int64GetDatum(bucket.blocked_ms);
+      values[6] = Int64GetDatum(static_cast<int64>(bucket.admitted));
+      values[7] = Int64GetDatum(static_cast<int64>(bucket.waited));
+      values[8] = Int64GetDatum(static_cast<int64>(bucket.rejected));
+      values[9] = Int64GetDatum(static_cast<int64>(bucket.throttled));
+      tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+    }
+  } catch (const std::exception& e) {
+    ereport(ERROR, (errcode(ERRCODE_INTERNAL_ERROR),
+                    errmsg("Internal error: %s", e.what())));
+  }
+
+  return (Datum)0;
+}
+}
@@ -87,6 +87,8 @@ All responses must be valid JSON with these fields:
 - suggested_visualization: string
 )";
 
+const int PROMPT_VERSION = 2;
+
 const std::string EXPLAIN_SYSTEM_PROMPT =
     R"(You are a PostgreSQL query performance expert.
 Analyze the provided EXPLAIN ANALYZE output and provide a clear, easy-to-understand explanation.
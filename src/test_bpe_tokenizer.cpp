@@ -0,0 +1,159 @@
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "include/bpe_tokenizer.hpp"
+
+using namespace pg_ai;
+
+namespace {
+
+std::string base64(const std::string& bytes) {
+  static const char* alphabet =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i = 0;
+  for (; i + 2 < bytes.size(); i += 3) {
+    uint32_t v = (uint8_t)bytes[i] << 16 | (uint8_t)bytes[i + 1] << 8 |
+                 (uint8_t)bytes[i + 2];
+    for (int shift = 18; shift >= 0; shift -= 6)
+      out += alphabet[(v >> shift) & 63];
+  }
+  if (i + 1 == bytes.size()) {
+    uint32_t v = (uint8_t)bytes[i] << 16;
+    out += alphabet[(v >> 18) & 63];
+    out += alphabet[(v >> 12) & 63];
+    out += "==";
+  } else if (i + 2 == bytes.size()) {
+    uint32_t v = (uint8_t)bytes[i] << 16 | (uint8_t)bytes[i + 1] << 8;
+    out += alphabet[(v >> 18) & 63];
+    out += alphabet[(v >> 12) & 63];
+    out += alphabet[(v >> 6) & 63];
+    out += '=';
+  }
+  return out;
+}
+
+// Every byte, then a few merges: "se" 256, "le" 257, "sele" 258,
+// "ct" 259, " s" 260.
+const char* kVocabPath = "test_bpe_tokenizer.tiktoken";
+
+void writeVocabulary() {
+  std::ofstream file(kVocabPath);
+  for (int i = 0; i < 256; i++)
+    file << base64(std::string(1, static_cast<char>(i))) << " " << i << "\n";
+  const std::vector<std::string> merges = {"se", "le", "sele", "ct", " s"};
+  for (size_t i = 0; i < merges.size(); i++)
+    file << base64(merges[i]) << " " << 256 + i << "\n";
+}
+
+std::vector<std::string> pieces(const std::string& text,
+                                BpeTokenizer::Pattern pattern) {
+  std::vector<std::string> result;
+  for (auto piece : BpeTokenizer::split(text, pattern))
+    result.emplace_back(piece);
+  return result;
+}
+
+}  // namespace
+
+void test_split() {
+  std::cout << "Testing pre-tokenizer..." << std::endl;
+  using P = BpeTokenizer::Pattern;
+
+  assert((pieces("SELECT id FROM users;", P::CL100K) ==
+          std::vector<std::string>{"SELECT", " id", " FROM", " users", ";"}));
+  assert((pieces("12345", P::CL100K) == std::vector<std::string>{"123", "45"}));
+  // Contractions are separate pieces for cl100k, part of the word for o200k
+  assert((pieces("I'm", P::CL100K) == std::vector<std::string>{"I", "'m"}));
+  assert((pieces("I'm", P::O200K) == std::vector<std::string>{"I'm"}));
+  // One space is left to start the next word
+  assert((pieces("a   b", P::CL100K) ==
+          std::vector<std::string>{"a", "  ", " b"}));
+  assert((pieces("x\n  y", P::CL100K) ==
+          std::vector<std::string>{"x", "\n", " ", " y"}));
+  assert((pieces(" (a)", P::CL100K) ==
+          std::vector<std::string>{" (", "a", ")"}));
+  // o200k splits camel case
+  assert((pieces("orderItems", P::O200K) ==
+          std::vector<std::string>{"order", "Items"}));
+  assert((pieces("orderItems", P::CL100K) ==
+          std::vector<std::string>{"orderItems"}));
+  std::cout << "Pre-tokenizer works." << std::endl;
+}
+
+void test_encode() {
+  std::cout << "Testing encoding..." << std::endl;
+
+  writeVocabulary();
+  auto tokenizer =
+      BpeTokenizer::load(kVocabPath, BpeTokenizer::Pattern::CL100K);
+  std::remove(kVocabPath);
+  assert(tokenizer->vocabularySize() == 261);
+
+  // Lowest rank first: "se" and "le" merge, then "sele"
+  assert((tokenizer->encode("select") == std::vector<uint32_t>{258, 259}));
+  // "se" outranks " s", which then can no longer form
+  assert((tokenizer->encode("x select") ==
+          std::vector<uint32_t>{'x', ' ', 258, 259}));
+  assert(tokenizer->count("x select") == 4);
+  assert(tokenizer->count("") == 0);
+  // Every byte is a token, so any text can be encoded
+  assert(tokenizer->count("\xc3\xa9t\xc3\xa9") == 5);
+  std::cout << "Encoding works." << std::endl;
+}
+
+void test_bad_files() {
+  std::cout << "Testing bad vocabulary files..." << std::endl;
+
+  bool threw = false;
+  try {
+    BpeTokenizer::load("no_such_vocabulary.tiktoken",
+                       BpeTokenizer::Pattern::CL100K);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  assert(threw);
+
+  {
+    std::ofstream file(kVocabPath);
+    file << "not a vocabulary\n";
+  }
+  threw = false;
+  try {
+    BpeTokenizer::load(kVocabPath, BpeTokenizer::Pattern::CL100K);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  std::remove(kVocabPath);
+  assert(threw);
+  std::cout << "Bad files rejected." << std::endl;
+}
+
+void test_model_families() {
+  std::cout << "Testing model families..." << std::endl;
+
+  assert(std::string(BpeTokenizer::vocabularyFor("gpt-4o")) == "o200k_base");
+  assert(std::string(BpeTokenizer::vocabularyFor("gpt-4o-mini")) ==
+         "o200k_base");
+  assert(std::string(BpeTokenizer::vocabularyFor("gpt-4")) == "cl100k_base");
+  assert(std::string(BpeTokenizer::vocabularyFor("gpt-3.5-turbo")) ==
+         "cl100k_base");
+  assert(BpeTokenizer::vocabularyFor("claude-3-5-sonnet-20241022") == nullptr);
+  assert(BpeTokenizer::patternFor("o200k_base") ==
+         BpeTokenizer::Pattern::O200K);
+  std::cout << "Model families work." << std::endl;
+}
+
+int main() {
+  test_split();
+  test_encode();
+  test_bad_files();
+  test_model_families();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
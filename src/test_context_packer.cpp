@@ -0,0 +1,258 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "include/context_packer.hpp"
+
+using namespace pg_ai;
+
+namespace {
+
+DatabaseSchema makeSchema() {
+  DatabaseSchema schema;
+  schema.success = true;
+  schema.tables = {
+      {"audit_log", "public", "BASE TABLE", 900000},
+      {"customers", "public", "BASE TABLE", 5000},
+      {"order_items", "public", "BASE TABLE", 80000},
+      {"orders", "public", "BASE TABLE", 20000},
+      {"product_categories", "public", "BASE TABLE", 40},
+      {"products", "public", "BASE TABLE", 1200},
+      {"sessions", "public", "BASE TABLE", 300000},
+  };
+  return schema;
+}
+
+ColumnInfo column(const std::string& name,
+                  const std::string& foreign_table = "") {
+  ColumnInfo info{};
+  info.column_name = name;
+  info.data_type = "integer";
+  info.is_nullable = true;
+  info.is_foreign_key = !foreign_table.empty();
+  info.foreign_table = foreign_table;
+  info.foreign_column = "id";
+  return info;
+}
+
+TableDetails makeDetails(const std::string& schema_name,
+                         const std::string& table_name) {
+  TableDetails details{};
+  details.success = true;
+  details.schema_name = schema_name;
+  details.table_name = table_name;
+  details.columns.push_back(column("id"));
+  if (table_name == "orders") {
+    details.columns.push_back(column("customer_id", "customers"));
+    details.columns.push_back(column("total_amount"));
+  } else if (table_name == "order_items") {
+    details.columns.push_back(column("order_id", "orders"));
+    details.columns.push_back(column("product_id", "products"));
+  } else if (table_name == "customers") {
+    details.columns.push_back(column("email"));
+  }
+  return details;
+}
+
+ContextPacker::DetailsFetcher fetcher(int& calls, size_t& fetched) {
+  return [&calls, &fetched](const auto& names) {
+    calls++;
+    fetched += names.size();
+    std::vector<TableDetails> result;
+    for (const auto& [schema_name, table_name] : names) {
+      result.push_back(makeDetails(schema_name, table_name));
+    }
+    return result;
+  };
+}
+
+std::string format(const TableDetails& details) {
+  std::string text = "=== TABLE: " + details.schema_name + "." +
+                     details.table_name + " ===\n";
+  for (const auto& col : details.columns) {
+    text += "- " + col.column_name + "\n";
+  }
+  return text;
+}
+
+bool contains(const std::string& text, const std::string& part) {
+  return text.find(part) != std::string::npos;
+}
+
+}  // namespace
+
+void test_stem() {
+  std::cout << "Testing stemming..." << std::endl;
+
+  assert(ContextPacker::stem("orders") == "order");
+  assert(ContextPacker::stem("categories") == "category");
+  assert(ContextPacker::stem("addresses") == "address");
+  assert(ContextPacker::stem("boxes") == "box");
+  assert(ContextPacker::stem("status") == "status");
+  assert(ContextPacker::stem("id") == "id");
+
+  auto tokens =
+      ContextPacker::tokenize("Show me the Top 5 Customers by orders");
+  assert((tokens == std::vector<std::string>{"5", "customer", "order"}));
+  std::cout << "Stemming works." << std::endl;
+}
+
+void test_rank_tables() {
+  std::cout << "Testing table ranking..." << std::endl;
+
+  auto schema = makeSchema();
+  auto ranked =
+      ContextPacker::rankTables("total of order items per product", schema);
+  assert(schema.tables[ranked[0].index].table_name == "order_items");
+  assert(ranked[0].score > ranked[1].score);
+
+  // Zero scores keep the larger tables first.
+  auto unmatched = ContextPacker::rankTables("xyzzy", schema);
+  assert(unmatched[0].score == 0);
+  assert(schema.tables[unmatched[0].index].table_name == "audit_log");
+  std::cout << "Ranking works." << std::endl;
+}
+
+void test_pack_details_and_foreign_keys() {
+  std::cout << "Testing packing with details..." << std::endl;
+
+  auto schema = makeSchema();
+  int calls = 0;
+  size_t fetched = 0;
+  ContextPacker::Options options;
+  options.token_budget = 2000;
+  options.max_detailed_tables = 3;
+
+  auto packed = ContextPacker::pack("Revenue per order item", schema,
+                                    fetcher(calls, fetched), format, options);
+
+  assert(calls >= 1 && calls <= 2);
+  assert(fetched <= 3 * options.max_detailed_tables);
+  assert(packed.detailed_tables == 3);
+  assert(contains(packed.text, "=== TABLE: public.order_items ==="));
+  assert(contains(packed.text, "=== TABLE: public.orders ==="));
+  // products matches no word of the request, but order_items references it.
+  assert(contains(packed.text, "=== TABLE: public.products ==="));
+  assert(!contains(packed.text, "=== TABLE: public.sessions ==="));
+  assert(packed.text.find("public.order_items (") <
+         packed.text.find("public.products ("));
+  assert(packed.listed_tables == schema.tables.size());
+  assert(packed.omitted_tables == 0);
+  assert(contains(packed.text, "If user asks for tables not listed above"));
+  std::cout << "Packing with details works." << std::endl;
+}
+
+void test_pack_join_paths() {
+  std::cout << "Testing join path expansion..." << std::endl;
+
+  auto schema = makeSchema();
+  FkGraph graph({
+      {"public", "orders", "public", "customers"},
+      {"public", "order_items", "public", "orders"},
+      {"public", "order_items", "public", "products"},
+      {"public", "products", "public", "product_categories"},
+  });
+  int calls = 0;
+  size_t fetched = 0;
+  ContextPacker::Options options;
+  options.max_detailed_tables = 2;
+
+  auto packed =
+      ContextPacker::pack("customers who bought expensive products", schema,
+                          fetcher(calls, fetched), format, options, &graph);
+
+  // Neither orders nor order_items is mentioned, but both are needed to join
+  // customers to products.
+  assert(packed.detailed_tables == 4);
+  assert(contains(packed.text, "=== TABLE: public.customers ==="));
+  assert(contains(packed.text, "=== TABLE: public.products ==="));
+  assert(contains(packed.text, "=== TABLE: public.orders ==="));
+  assert(contains(packed.text, "=== TABLE: public.order_items ==="));
+  // Neighbours off the join path are only listed.
+  assert(!contains(packed.text, "=== TABLE: public.product_categories ==="));
+  assert(contains(packed.text, "public.product_categories ("));
+  std::cout << "Join path expansion works." << std::endl;
+}
+
+void test_pack_is_canonical() {
+  std::cout << "Testing canonical packing..." << std::endl;
+
+  auto schema = makeSchema();
+  int calls = 0;
+  size_t fetched = 0;
+  ContextPacker::Options options;
+  options.max_detailed_tables = 3;
+
+  // Differently ranked, same tables chosen: the text must be identical so
+  // that providers can reuse the cached prompt prefix.
+  auto first = ContextPacker::pack("Revenue per order item", schema,
+                                   fetcher(calls, fetched), format, options);
+  auto second = ContextPacker::pack("order item revenue", schema,
+                                    fetcher(calls, fetched), format, options);
+  assert(first.text == second.text);
+
+  // Listed in name order regardless of relevance.
+  assert(first.text.find("public.customers (") <
+         first.text.find("public.order_items ("));
+  assert(first.text.find("=== TABLE: public.order_items ===") <
+         first.text.find("=== TABLE: public.orders ==="));
+  std::cout << "Canonical packing works." << std::endl;
+}
+
+void test_pack_respects_budget() {
+  std::cout << "Testing token budget..." << std::endl;
+
+  DatabaseSchema schema;
+  schema.success = true;
+  for (int i = 0; i < 500; i++) {
+    schema.tables.push_back({"table_" + std::to_string(i), "public",
+                             "BASE TABLE", static_cast<int64_t>(i)});
+  }
+  schema.tables.push_back({"invoices", "billing", "BASE TABLE", 10});
+
+  int calls = 0;
+  size_t fetched = 0;
+  ContextPacker::Options options;
+  options.token_budget = 400;
+  options.max_detailed_tables = 3;
+
+  auto packed = ContextPacker::pack("unpaid invoices", schema,
+                                    fetcher(calls, fetched), format, options);
+
+  assert(packed.estimated_tokens <= options.token_budget);
+  assert(packed.detailed_tables == 1);
+  assert(contains(packed.text, "=== TABLE: billing.invoices ==="));
+  assert(packed.omitted_tables > 0);
+  assert(packed.listed_tables + packed.omitted_tables == schema.tables.size());
+  assert(contains(packed.text, "more tables not shown"));
+  // Only the matching table is worth fetching.
+  assert(fetched == 1);
+  std::cout << "Token budget respected." << std::endl;
+}
+
+void test_pack_without_tables() {
+  std::cout << "Testing empty schema..." << std::endl;
+
+  DatabaseSchema schema;
+  schema.success = true;
+  int calls = 0;
+  size_t fetched = 0;
+  auto packed = ContextPacker::pack("anything", schema, fetcher(calls, fetched),
+                                    format, ContextPacker::Options());
+  assert(calls == 0);
+  assert(contains(packed.text, "No user tables found"));
+  std::cout << "Empty schema handled." << std::endl;
+}
+
+int main() {
+  test_stem();
+  test_rank_tables();
+  test_pack_details_and_foreign_keys();
+  test_pack_join_paths();
+  test_pack_is_canonical();
+  test_pack_respects_budget();
+  test_pack_without_tables();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include "include/fk_graph.hpp"
+
+using namespace pg_ai;
+
+namespace {
+
+using Name = FkGraph::TableName;
+
+ForeignKeyInfo key(const std::string& from, const std::string& to) {
+  return {"public", from, "public", to};
+}
+
+Name table(const std::string& name) {
+  return {"public", name};
+}
+
+// customers <- orders <- order_items -> products -> product_categories
+//                 ^
+//            shipments -> carriers
+FkGraph makeGraph() {
+  return FkGraph({
+      key("orders", "customers"),
+      key("order_items", "orders"),
+      key("order_items", "products"),
+      key("products", "product_categories"),
+      key("shipments", "orders"),
+      key("shipments", "carriers"),
+      key("employees", "employees"),
+  });
+}
+
+}  // namespace
+
+void test_neighbours() {
+  std::cout << "Testing neighbours..." << std::endl;
+
+  auto graph = makeGraph();
+  auto orders = graph.neighbours(table("orders"));
+  assert((orders == std::vector<Name>{table("customers"), table("order_items"),
+                                      table("shipments")}));
+  // Self-references are not joins.
+  assert(graph.neighbours(table("employees")).empty());
+  assert(graph.neighbours(table("missing")).empty());
+  std::cout << "Neighbours work." << std::endl;
+}
+
+void test_shortest_path() {
+  std::cout << "Testing shortest paths..." << std::endl;
+
+  auto graph = makeGraph();
+  auto path = graph.shortestPath(table("customers"), table("products"), 3);
+  assert((path == std::vector<Name>{table("customers"), table("orders"),
+                                    table("order_items"), table("products")}));
+
+  // Too long for the hop limit.
+  assert(graph.shortestPath(table("customers"), table("products"), 2).empty());
+  assert(graph.shortestPath(table("customers"), table("employees"), 5).empty());
+
+  // Intermediate tables must pass the filter.
+  auto no_orders = [](const Name& name) { return name.second != "orders"; };
+  assert(graph.shortestPath(table("customers"), table("products"), 5, no_orders)
+             .empty());
+  std::cout << "Shortest paths work." << std::endl;
+}
+
+void test_connect() {
+  std::cout << "Testing join trees..." << std::endl;
+
+  auto graph = makeGraph();
+  auto added = graph.connect({table("customers"), table("products")}, 3);
+  assert((added == std::vector<Name>{table("order_items"), table("orders")}));
+
+  // carriers joins the tree at orders, which is already part of it.
+  added = graph.connect(
+      {table("customers"), table("products"), table("carriers")}, 3);
+  assert((added == std::vector<Name>{table("order_items"), table("orders"),
+                                     table("shipments")}));
+
+  // Input tables are never reported as intermediate.
+  added = graph.connect({table("customers"), table("order_items"),
+                         table("orders")},
+                        3);
+  assert(added.empty());
+
+  // Unreachable tables stay unconnected.
+  added = graph.connect({table("customers"), table("employees")}, 3);
+  assert(added.empty());
+  std::cout << "Join trees work." << std::endl;
+}
+
+int main() {
+  test_neighbours();
+  test_shortest_path();
+  test_connect();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "include/json_field_stream.hpp"
+
+using namespace pg_ai;
+
+namespace {
+
+// Feeds the document in pieces of `step` characters and returns the number
+// of characters consumed when the field completed.
+size_t feedInSteps(JsonFieldStream& stream,
+                   const std::string& document,
+                   size_t step) {
+  for (size_t pos = 0; pos < document.size(); pos += step) {
+    stream.feed(std::string_view(document).substr(pos, step));
+    if (stream.complete())
+      return std::min(pos + step, document.size());
+  }
+  return document.size();
+}
+
+}  // namespace
+
+void test_field_completes_early() {
+  std::cout << "Testing early completion..." << std::endl;
+
+  std::string document =
+      "```json\n{\"sql\": \"SELECT id FROM users LIMIT 10\", "
+      "\"explanation\": \"A long explanation that keeps streaming...\"}\n```";
+  for (size_t step : {1, 3, 7, 1000}) {
+    JsonFieldStream stream("sql");
+    size_t consumed = feedInSteps(stream, document, step);
+    assert(stream.complete());
+    assert(stream.value() == "SELECT id FROM users LIMIT 10");
+    if (step == 1)
+      assert(consumed < document.find("explanation"));
+  }
+  std::cout << "Early completion works." << std::endl;
+}
+
+void test_escapes() {
+  std::cout << "Testing escapes..." << std::endl;
+
+  JsonFieldStream stream("sql");
+  feedInSteps(stream,
+              R"({"sql": "SELECT \"name\", 'a\\b'\nFROM t WHERE x = 'é😀'"})",
+              2);
+  assert(stream.complete());
+  assert(stream.value() ==
+         "SELECT \"name\", 'a\\b'\n"
+         "FROM t WHERE x = '\xc3\xa9\xf0\x9f\x98\x80'");
+
+  JsonFieldStream unicode("sql");
+  feedInSteps(unicode, R"({"sql": "SELECT '\u00e9\ud83d\ude00'"})", 3);
+  assert(unicode.value() == "SELECT '\xc3\xa9\xf0\x9f\x98\x80'");
+  std::cout << "Escapes work." << std::endl;
+}
+
+void test_nested_and_later_fields() {
+  std::cout << "Testing field position..." << std::endl;
+
+  // A nested "sql" key is not the top-level field.
+  JsonFieldStream stream("sql");
+  stream.feed(R"({"meta": {"sql": "nested"}, "warnings": ["sql"], )");
+  assert(!stream.complete());
+  stream.feed(R"("sql": "SELECT 1"})");
+  assert(stream.complete());
+  assert(stream.value() == "SELECT 1");
+
+  // Value strings that look like keys do not confuse it.
+  JsonFieldStream after_value("sql");
+  after_value.feed(R"({"explanation": "sql", "sql": "SELECT 2"})");
+  assert(after_value.value() == "SELECT 2");
+  std::cout << "Field position handled." << std::endl;
+}
+
+void test_non_string_value() {
+  std::cout << "Testing non-string values..." << std::endl;
+
+  JsonFieldStream null_value("sql");
+  null_value.feed(R"({"sql": null, "explanation": "Cannot answer"})");
+  assert(null_value.complete());
+  assert(null_value.value().empty());
+
+  JsonFieldStream missing("sql");
+  missing.feed(R"({"explanation": "no query"})");
+  assert(!missing.complete());
+  std::cout << "Non-string values handled." << std::endl;
+}
+
+int main() {
+  test_field_completes_early();
+  test_escapes();
+  test_nested_and_later_fields();
+  test_non_string_value();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,180 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "include/client_pool.hpp"
+#include "include/config.hpp"
+#include "include/logger.hpp"
+
+using namespace pg_ai;
+using namespace pg_ai::config;
+
+// Minimal OpenAI-compatible server on 127.0.0.1: answers one chat
+// completion request and keeps what it received.
+class MockServer {
+ public:
+  MockServer() {
+    listener_ = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listener_ >= 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    assert(bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ==
+           0);
+    assert(listen(listener_, 1) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listener_, reinterpret_cast<sockaddr*>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::thread([this]() { serveOne(); });
+  }
+
+  ~MockServer() {
+    if (thread_.joinable())
+      thread_.join();
+    close(listener_);
+  }
+
+  std::string url() const {
+    return "http://127.0.0.1:" + std::to_string(port_);
+  }
+
+  // The raw request; complete once the server thread has answered.
+  const std::string& request() {
+    if (thread_.joinable())
+      thread_.join();
+    return request_;
+  }
+
+ private:
+  void serveOne() {
+    int conn = accept(listener_, nullptr, nullptr);
+    if (conn < 0)
+      return;
+
+    char buffer[4096];
+    size_t body_start = std::string::npos;
+    size_t content_length = 0;
+    while (body_start == std::string::npos ||
+           request_.size() < body_start + content_length) {
+      ssize_t n = read(conn, buffer, sizeof(buffer));
+      if (n <= 0)
+        break;
+      request_.append(buffer, n);
+      if (body_start == std::string::npos) {
+        size_t end = request_.find("\r\n\r\n");
+        if (end == std::string::npos)
+          continue;
+        body_start = end + 4;
+        std::string headers = request_.substr(0, end);
+        for (auto& c : headers)
+          c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        size_t pos = headers.find("content-length:");
+        if (pos != std::string::npos)
+          content_length = std::stoul(headers.substr(pos + 15));
+      }
+    }
+
+    std::string body = R"({
+      "id": "chatcmpl-local",
+      "object": "chat.completion",
+      "created": 0,
+      "model": "local-sql",
+      "choices": [{
+        "index": 0,
+        "message": {"role": "assistant", "content": "{\"sql\": \"SELECT 1\"}"},
+        "finish_reason": "stop"
+      }],
+      "usage": {"prompt_tokens": 12, "completion_tokens": 5, "total_tokens": 17}
+    })";
+    std::string response =
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+        "Content-Length: " +
+        std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    (void)write(conn, response.data(), response.size());
+    close(conn);
+  }
+
+  int listener_ = -1;
+  int port_ = 0;
+  std::thread thread_;
+  std::string request_;
+};
+
+void test_endpoint_config() {
+  std::cout << "Testing endpoint configuration..." << std::endl;
+
+  std::string path = "test_local_endpoint.config";
+  {
+    std::ofstream config(path);
+    config << "[openai]\n"
+           << "api_key = local-key\n"
+           << "base_url = http://127.0.0.1:8000/\n"
+           << "models = local-sql, gpt-4o\n"
+           << "default_model = local-sql\n"
+           << "[anthropic]\n"
+           << "api_key = anthropic-key\n"
+           << "default_model = claude-3-5-haiku-20241022\n";
+  }
+  assert(ConfigManager::loadConfig(path));
+  std::remove(path.c_str());
+
+  const auto* openai = ConfigManager::getProviderConfig(Provider::OPENAI);
+  assert(openai);
+  assert(openai->base_url == "http://127.0.0.1:8000");
+  assert(openai->available_models.size() == 2);
+  assert(openai->default_model.name == "local-sql");
+  // Known models keep their settings
+  assert(openai->available_models[1].max_tokens == 16384);
+  assert(ConfigManager::getModelConfig("local-sql"));
+
+  const auto* anthropic = ConfigManager::getProviderConfig(Provider::ANTHROPIC);
+  assert(anthropic);
+  assert(anthropic->base_url.empty());
+  assert(anthropic->default_model.name == "claude-3-5-haiku-20241022");
+  std::cout << "Endpoint configuration works." << std::endl;
+}
+
+void test_local_endpoint() {
+  std::cout << "Testing requests to a local endpoint..." << std::endl;
+
+  MockServer server;
+  auto client =
+      ClientPool::acquire(Provider::OPENAI, "local-key", server.url());
+  ai::GenerateOptions options("local-sql", "You write SQL.", "count users");
+  auto result = client->generate_text(options);
+  assert(result);
+  assert(result.text == "{\"sql\": \"SELECT 1\"}");
+
+  const std::string& request = server.request();
+  assert(request.find("POST /v1/chat/completions") == 0);
+  assert(request.find("Bearer local-key") != std::string::npos);
+  assert(request.find("local-sql") != std::string::npos);
+  assert(request.find("count users") != std::string::npos);
+
+  // Clients for other endpoints are kept apart
+  auto stats = ClientPool::stats();
+  ClientPool::acquire(Provider::OPENAI, "local-key", server.url());
+  assert(ClientPool::stats().hits == stats.hits + 1);
+  ClientPool::acquire(Provider::OPENAI, "local-key");
+  assert(ClientPool::stats().misses == stats.misses + 1);
+  std::cout << "Local endpoint works." << std::endl;
+}
+
+int main() {
+  logger::Logger::setLoggingEnabled(false);
+
+  test_endpoint_config();
+  test_local_endpoint();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "include/minhash.hpp"
+
+using namespace pg_ai;
+
+void test_features() {
+  std::cout << "Testing features..." << std::endl;
+
+  // Word order, possessives, plurals and filler do not matter.
+  assert(MinHash::features("orders last week") ==
+         MinHash::features("Show me last week's orders"));
+  assert((MinHash::features("Top customers by revenue") ==
+          std::vector<std::string>{"by", "customer", "revenue", "top"}));
+
+  // Words that change the meaning are kept.
+  assert(MinHash::features("orders not shipped") !=
+         MinHash::features("orders shipped"));
+  assert(MinHash::features("first orders") != MinHash::features("orders"));
+  std::cout << "Features work." << std::endl;
+}
+
+void test_literals() {
+  std::cout << "Testing literals..." << std::endl;
+
+  assert(MinHash::literals("top 5 customers") ==
+         MinHash::literals("the 5 best customers"));
+  assert(MinHash::literals("top 5 customers") !=
+         MinHash::literals("top 10 customers"));
+  assert(MinHash::literals("orders from 'ACME'") !=
+         MinHash::literals("orders from 'Globex'"));
+  assert(MinHash::literals("sales in q3 by utf8 name").empty());
+  assert(MinHash::literals("price above 9.99") !=
+         MinHash::literals("price above 9.5"));
+  std::cout << "Literals work." << std::endl;
+}
+
+void test_similarity() {
+  std::cout << "Testing similarity..." << std::endl;
+
+  auto a = MinHash::features("orders placed last week by region");
+  auto b = MinHash::features("last week's orders by region");
+  auto c = MinHash::features("monthly revenue per product category");
+
+  assert(MinHash::jaccard(a, a) == 1.0);
+  assert(MinHash::jaccard(a, c) == 0.0);
+  // {by, last, order, place, region, week} vs {by, last, order, region, week}
+  assert(MinHash::jaccard(a, b) == 5.0 / 6.0);
+
+  auto sig_a = MinHash::signature(a);
+  auto sig_b = MinHash::signature(b);
+  auto sig_c = MinHash::signature(c);
+  assert(MinHash::estimate(sig_a, sig_a) == 1.0);
+  assert(MinHash::estimate(sig_a, sig_b) > 0.6);
+  assert(MinHash::estimate(sig_a, sig_c) < 0.2);
+
+  // Signatures are deterministic, so they can be shared between processes.
+  assert(MinHash::signature(a) == sig_a);
+  std::cout << "Similarity works." << std::endl;
+}
+
+void test_bands() {
+  std::cout << "Testing bands..." << std::endl;
+
+  auto shares_band = [](const std::string& x, const std::string& y) {
+    auto bands_x = MinHash::bands(MinHash::signature(MinHash::features(x)));
+    auto bands_y = MinHash::bands(MinHash::signature(MinHash::features(y)));
+    for (size_t i = 0; i < MinHash::kBands; i++) {
+      if (bands_x[i] == bands_y[i])
+        return true;
+    }
+    return false;
+  };
+
+  assert(shares_band("orders last week", "last week's orders"));
+  assert(shares_band("orders placed last week by region",
+                     "last week's orders by region"));
+  assert(!shares_band("orders last week", "monthly revenue per category"));
+  std::cout << "Bands work." << std::endl;
+}
+
+int main() {
+  test_features();
+  test_literals();
+  test_similarity();
+  test_bands();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
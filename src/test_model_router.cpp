@@ -0,0 +1,77 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "include/model_router.hpp"
+
+using namespace pg_ai;
+
+void test_features() {
+  std::cout << "Testing features..." << std::endl;
+
+  auto features = ModelRouter::features(
+      "Running totals of revenue per month, ranked by growth", 2, 400);
+  assert(features.tables == 2);
+  assert(features.context_tokens == 400);
+  assert(features.words == 9);
+  // running, ranked, growth
+  assert(features.analytic_terms == 3);
+  // totals, per
+  assert(features.aggregate_terms == 2);
+
+  // Repeated terms count once.
+  auto repeated = ModelRouter::features("total and total and totals", 1, 0);
+  assert(repeated.aggregate_terms == 1);
+  assert(repeated.words == 5);
+  std::cout << "Features work." << std::endl;
+}
+
+void test_routing() {
+  std::cout << "Testing routing..." << std::endl;
+
+  auto lookup = ModelRouter::route(
+      ModelRouter::features("show the user with id 5", 1, 300), 2.0);
+  assert(lookup.tier == ModelRouter::Tier::FAST);
+  assert(lookup.score < 1.0);
+
+  auto analytic = ModelRouter::route(
+      ModelRouter::features("monthly revenue growth per category with a "
+                            "running total and rank",
+                            3, 1200),
+      2.0);
+  assert(analytic.tier == ModelRouter::Tier::STRONG);
+
+  // Joins alone make a request complex.
+  auto joins = ModelRouter::route(
+      ModelRouter::features("customers and their orders and products", 4, 900),
+      2.0);
+  assert(joins.tier == ModelRouter::Tier::STRONG);
+
+  // The threshold moves the boundary.
+  auto simple = ModelRouter::features("average order value", 1, 300);
+  assert(ModelRouter::route(simple, 2.0).tier == ModelRouter::Tier::FAST);
+  assert(ModelRouter::route(simple, 1.0).tier == ModelRouter::Tier::STRONG);
+  std::cout << "Routing works." << std::endl;
+}
+
+void test_stats() {
+  std::cout << "Testing stats..." << std::endl;
+
+  ModelRouter::record(ModelRouter::Tier::FAST, 400);
+  ModelRouter::record(ModelRouter::Tier::FAST, 600);
+  ModelRouter::record(ModelRouter::Tier::STRONG, 2500);
+  auto stats = ModelRouter::stats();
+  assert(stats.fast_calls == 2);
+  assert(stats.fast_latency_ms == 1000);
+  assert(stats.strong_calls == 1);
+  assert(stats.strong_latency_ms == 2500);
+  std::cout << "Stats work." << std::endl;
+}
+
+int main() {
+  test_features();
+  test_routing();
+  test_stats();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
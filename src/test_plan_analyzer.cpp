@@ -0,0 +1,219 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "include/plan_analyzer.hpp"
+
+using namespace pg_ai;
+
+namespace {
+
+bool contains(const std::string& text, const std::string& part) {
+  return text.find(part) != std::string::npos;
+}
+
+const PlanAnalyzer::Finding* findRule(const PlanAnalyzer::Analysis& analysis,
+                                      const std::string& rule) {
+  for (const auto& finding : analysis.findings) {
+    if (finding.rule == rule)
+      return &finding;
+  }
+  return nullptr;
+}
+
+void test_invalid_input() {
+  std::cout << "Testing invalid input..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze("not json");
+  assert(!analysis.success);
+  assert(!analysis.error_message.empty());
+
+  analysis = PlanAnalyzer::analyze(R"json([{"Query": 1}])json");
+  assert(!analysis.success);
+  std::cout << "Invalid input rejected." << std::endl;
+}
+
+void test_seq_scan() {
+  std::cout << "Testing sequential scans..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Seq Scan", "Relation Name": "orders",
+      "Schema": "public", "Plan Rows": 10, "Actual Rows": 12,
+      "Actual Loops": 1, "Filter": "(status = 'late')",
+      "Rows Removed by Filter": 499988}}])json");
+  assert(analysis.success);
+  assert(analysis.analyzed);
+  auto scan = findRule(analysis, "seq_scan");
+  assert(scan);
+  assert(scan->severity == PlanAnalyzer::Severity::WARNING);
+  assert(scan->path == "Plan");
+  assert(scan->relation == "public.orders");
+  assert(contains(scan->message, "reads 500000 rows"));
+
+  // Reading the whole table without a filter is worth knowing, no more.
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Seq Scan", "Relation Name": "events",
+      "Plan Rows": 200000, "Actual Rows": 200000, "Actual Loops": 1}}])json");
+  scan = findRule(analysis, "seq_scan");
+  assert(scan && scan->severity == PlanAnalyzer::Severity::INFO);
+
+  // Small tables are fine.
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Seq Scan", "Relation Name": "countries",
+      "Plan Rows": 1, "Actual Rows": 1, "Actual Loops": 1,
+      "Filter": "(code = 'NL')", "Rows Removed by Filter": 199}}])json");
+  assert(analysis.findings.empty());
+  std::cout << "Sequential scans checked." << std::endl;
+}
+
+void test_misestimate() {
+  std::cout << "Testing row misestimates..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Scan", "Relation Name": "orders",
+      "Plan Rows": 5, "Actual Rows": 800, "Actual Loops": 1}}])json");
+  auto finding = findRule(analysis, "row_misestimate");
+  assert(finding);
+  assert(finding->severity == PlanAnalyzer::Severity::WARNING);
+  assert(contains(finding->message, "160x under"));
+
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Scan", "Relation Name": "orders",
+      "Plan Rows": 50000, "Actual Rows": 2, "Actual Loops": 1}}])json");
+  finding = findRule(analysis, "row_misestimate");
+  assert(finding && finding->severity == PlanAnalyzer::Severity::CRITICAL);
+  assert(contains(finding->message, "over"));
+
+  // Nodes that never ran and plans without ANALYZE have nothing to compare.
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Scan", "Relation Name": "orders",
+      "Plan Rows": 50000, "Actual Rows": 0, "Actual Loops": 0}}])json");
+  assert(!findRule(analysis, "row_misestimate"));
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Scan", "Relation Name": "orders",
+      "Plan Rows": 50000}}])json");
+  assert(analysis.success && !analysis.analyzed);
+  assert(analysis.findings.empty());
+  std::cout << "Row misestimates checked." << std::endl;
+}
+
+void test_disk_spill() {
+  std::cout << "Testing disk spills..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Sort", "Plan Rows": 90000, "Actual Rows": 90000,
+      "Actual Loops": 1, "Sort Method": "external merge",
+      "Sort Space Used": 20480, "Sort Space Type": "Disk",
+      "Plans": [{"Node Type": "Hash Join", "Parent Relationship": "Outer",
+                 "Plan Rows": 90000, "Actual Rows": 90000,
+                 "Actual Loops": 1,
+                 "Plans": [{"Node Type": "Index Scan",
+                            "Parent Relationship": "Outer",
+                            "Relation Name": "a", "Plan Rows": 90000,
+                            "Actual Rows": 90000, "Actual Loops": 1},
+                           {"Node Type": "Hash",
+                            "Parent Relationship": "Inner",
+                            "Plan Rows": 90000, "Actual Rows": 90000,
+                            "Actual Loops": 1, "Hash Batches": 8,
+                            "Original Hash Batches": 1}]}]}}])json");
+  size_t spills = 0;
+  for (const auto& finding : analysis.findings) {
+    if (finding.rule != "disk_spill")
+      continue;
+    spills++;
+    assert(finding.path == "Plan" ||
+           finding.path == "Plan.Plans[0].Plans[1]");
+  }
+  assert(spills == 2);
+
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Sort", "Plan Rows": 100, "Actual Rows": 100,
+      "Actual Loops": 1, "Sort Method": "quicksort",
+      "Sort Space Used": 30, "Sort Space Type": "Memory"}}])json");
+  assert(analysis.findings.empty());
+  std::cout << "Disk spills checked." << std::endl;
+}
+
+void test_nested_loop() {
+  std::cout << "Testing nested loops..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Nested Loop", "Plan Rows": 10, "Actual Rows": 10,
+      "Actual Loops": 1,
+      "Plans": [{"Node Type": "Index Scan", "Parent Relationship": "Outer",
+                 "Relation Name": "customers", "Plan Rows": 2000,
+                 "Actual Rows": 2000, "Actual Loops": 1},
+                {"Node Type": "Seq Scan", "Parent Relationship": "Inner",
+                 "Relation Name": "orders", "Plan Rows": 100,
+                 "Actual Rows": 100, "Actual Loops": 2000}]}}])json");
+  auto loop = findRule(analysis, "nested_loop");
+  assert(loop);
+  assert(loop->severity == PlanAnalyzer::Severity::CRITICAL);
+  assert(loop->path == "Plan");
+  assert(loop->relation == "orders");
+  assert(contains(loop->message, "2000 times"));
+  // The inner scan itself reads 200000 rows over its loops.
+  assert(findRule(analysis, "seq_scan"));
+  // Most severe first.
+  assert(analysis.findings.front().rule == "nested_loop");
+
+  // Estimated plans are checked against the planner's numbers.
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Nested Loop", "Plan Rows": 10,
+      "Plans": [{"Node Type": "Index Scan", "Parent Relationship": "Outer",
+                 "Relation Name": "customers", "Plan Rows": 5},
+                {"Node Type": "Index Scan", "Parent Relationship": "Inner",
+                 "Relation Name": "orders", "Plan Rows": 2}]}}])json");
+  assert(!findRule(analysis, "nested_loop"));
+  std::cout << "Nested loops checked." << std::endl;
+}
+
+void test_heap_fetches() {
+  std::cout << "Testing index-only scan heap fetches..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Only Scan", "Relation Name": "orders",
+      "Plan Rows": 40000, "Actual Rows": 40000, "Actual Loops": 1,
+      "Heap Fetches": 39000}}])json");
+  auto finding = findRule(analysis, "heap_fetches");
+  assert(finding && finding->severity == PlanAnalyzer::Severity::WARNING);
+  assert(contains(finding->message, "VACUUM"));
+
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Only Scan", "Relation Name": "orders",
+      "Plan Rows": 40000, "Actual Rows": 40000, "Actual Loops": 1,
+      "Heap Fetches": 12}}])json");
+  assert(!findRule(analysis, "heap_fetches"));
+  std::cout << "Heap fetches checked." << std::endl;
+}
+
+void test_format_findings() {
+  std::cout << "Testing prompt formatting..." << std::endl;
+
+  auto analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Index Scan", "Relation Name": "orders",
+      "Plan Rows": 5, "Actual Rows": 800, "Actual Loops": 1}}])json");
+  auto text = PlanAnalyzer::formatFindings(analysis);
+  assert(contains(text, "- [warning] Plan: Index Scan on orders"));
+
+  analysis = PlanAnalyzer::analyze(R"json([{"Plan": {
+      "Node Type": "Result", "Plan Rows": 1, "Actual Rows": 1,
+      "Actual Loops": 1}}])json");
+  assert(analysis.findings.empty());
+  assert(PlanAnalyzer::formatFindings(analysis).empty());
+  std::cout << "Prompt formatting checked." << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  test_invalid_input();
+  test_seq_scan();
+  test_misestimate();
+  test_disk_spill();
+  test_nested_loop();
+  test_heap_fetches();
+  test_format_findings();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
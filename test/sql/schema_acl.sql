@@ -0,0 +1,45 @@
+-- Schema metadata is cached once for all roles; every role must still see
+-- only the tables and columns it has privileges on, whichever role filled
+-- the cache first.
+CREATE EXTENSION IF NOT EXISTS pg_ai_query;
+CREATE ROLE regress_ai_full;
+CREATE ROLE regress_ai_limited;
+CREATE TABLE acl_open (id integer PRIMARY KEY, name text);
+CREATE TABLE acl_secret (id integer PRIMARY KEY, token text);
+CREATE TABLE acl_partial (id integer PRIMARY KEY, visible text, hidden text);
+GRANT SELECT ON acl_open, acl_secret, acl_partial TO regress_ai_full;
+GRANT SELECT ON acl_open TO regress_ai_limited;
+GRANT SELECT (id, visible) ON acl_partial TO regress_ai_limited;
+-- Fills the cache with everything
+SET ROLE regress_ai_full;
+SELECT t->>'table_name' AS table_name
+FROM jsonb_array_elements(get_database_tables()::jsonb) t
+WHERE t->>'table_name' LIKE 'acl\_%'
+ORDER BY 1;
+SELECT c->>'column_name' AS column_name
+FROM jsonb_array_elements(get_table_details('acl_partial')::jsonb -> 'columns') c;
+SELECT jsonb_array_length(get_table_details('acl_secret')::jsonb -> 'columns') AS columns;
+RESET ROLE;
+-- Served from the shared cache (or, without it, from this backend's last
+-- listing), filtered for this role
+SET ROLE regress_ai_limited;
+SELECT t->>'table_name' AS table_name
+FROM jsonb_array_elements(get_database_tables()::jsonb) t
+WHERE t->>'table_name' LIKE 'acl\_%'
+ORDER BY 1;
+SELECT c->>'column_name' AS column_name
+FROM jsonb_array_elements(get_table_details('acl_partial')::jsonb -> 'columns') c;
+SELECT get_table_details('acl_secret');
+SELECT d->>'table_name' AS table_name,
+       COALESCE(jsonb_array_length(d -> 'columns'), 0) AS columns,
+       d ? 'error' AS failed
+FROM jsonb_array_elements(
+       get_tables_details(ARRAY['acl_open', 'acl_secret', 'acl_partial'])::jsonb) d;
+-- Read straight from the catalogs, without the cache
+SELECT column_name FROM list_table_columns('acl_partial');
+SELECT column_name FROM list_table_columns('acl_secret');
+SELECT count(*) AS indexes FROM list_table_indexes('acl_secret');
+RESET ROLE;
+DROP TABLE acl_open, acl_secret, acl_partial;
+DROP ROLE regress_ai_full;
+DROP ROLE regress_ai_limited;